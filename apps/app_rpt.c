@@ -283,7 +283,6 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fnmatch.h>
-#include <curl/curl.h>
 #include <termios.h>
 
 #include "asterisk/utils.h"
@@ -326,13 +325,26 @@
 #include "app_rpt/rpt_call.h"
 #include "app_rpt/rpt_capabilities.h"
 #include "app_rpt/rpt_vox.h"
+#include "app_rpt/rpt_delayline.h"
 #include "app_rpt/rpt_serial.h" /* use serial_rxflush, serial_rxready */
 #include "app_rpt/rpt_uchameleon.h"
 #include "app_rpt/rpt_channel.h"
 #include "app_rpt/rpt_config.h"
+#include "app_rpt/rpt_dns.h"
 #include "app_rpt/rpt_telemetry.h"
 #include "app_rpt/rpt_link.h"
+#include "app_rpt/rpt_link_pool.h"
 #include "app_rpt/rpt_functions.h"
+#include "app_rpt/rpt_functrie.h"
+#include "app_rpt/rpt_events.h"
+#include "app_rpt/rpt_nodelog.h"
+#include "app_rpt/rpt_tonecache.h"
+#include "app_rpt/rpt_soundcache.h"
+#include "app_rpt/rpt_statpost.h"
+#include "app_rpt/rpt_perf.h"
+#include "app_rpt/rpt_trace.h"
+#include "app_rpt/rpt_goertzel.h"
+#include "app_rpt/rpt_dspworker.h"
 #include "app_rpt/rpt_auth.h"
 #include "app_rpt/rpt_manager.h"
 #include "app_rpt/rpt_translate.h"
@@ -412,9 +424,6 @@ AST_MUTEX_DEFINE_STATIC(rpt_master_lock);
 struct rpt rpt_vars[MAXRPTS];
 static int nrpts = 0;
 
-AST_MUTEX_DEFINE_STATIC(nodeloglock);
-static struct nodelog nodelog;
-
 static int shutting_down = 0;
 
 /* general settings */
@@ -459,52 +468,6 @@ time_t rpt_starttime(void)
 }
 
 #ifndef NATIVE_DSP
-static inline void goertzel_sample(goertzel_state_t *s, short sample)
-{
-	int v1;
-
-	v1 = s->v2;
-	s->v2 = s->v3;
-
-	s->v3 = (s->fac * s->v2) >> 15;
-	s->v3 = s->v3 - v1 + (sample >> s->chunky);
-	if (abs(s->v3) > 32768) {
-		s->chunky++;
-		s->v3 = s->v3 >> 1;
-		s->v2 = s->v2 >> 1;
-		v1 = v1 >> 1;
-	}
-}
-
-static inline void goertzel_update(goertzel_state_t *s, short *samps, int count)
-{
-	int i;
-
-	for (i = 0; i < count; i++) {
-		goertzel_sample(s, samps[i]);
-	}
-}
-
-static inline float goertzel_result(goertzel_state_t *s)
-{
-	goertzel_result_t r;
-	r.value = (s->v3 * s->v3) + (s->v2 * s->v2);
-	r.value -= ((s->v2 * s->v3) >> 15) * s->fac;
-	r.power = s->chunky * 2;
-	return (float) r.value * (float) (1 << r.power);
-}
-
-static inline void goertzel_init(goertzel_state_t *s, float freq, int samples)
-{
-	s->v2 = s->v3 = s->chunky = 0.0;
-	s->fac = (int) (32768.0 * 2.0 * cos(2.0 * M_PI * freq / TONE_SAMPLE_RATE));
-}
-
-static inline void goertzel_reset(goertzel_state_t *s)
-{
-	s->v2 = s->v3 = s->chunky = 0.0;
-}
-
 /*
  * Code used to detect tones
  */
@@ -547,12 +510,12 @@ static void tone_detect_init(tone_detect_state_t *s, int freq, int duration, int
 	   and thus no tone will be detected in them */
 	s->hits_required = (duration_samples - (s->block_size - 1)) / s->block_size;
 
-	goertzel_init(&s->tone, freq, s->block_size);
+	rpt_goertzel_init(&s->bank, &freq, 1, TONE_SAMPLE_RATE);
+	rpt_goertzel_reset(&s->tone);
 
 	s->samples_pending = s->block_size;
 	s->hit_count = 0;
 	s->last_hit = 0;
-	s->energy = 0.0;
 
 	/* We want tone energy to be amp decibels above the rest of the signal (the noise).
 	   According to Parseval's theorem the energy computed in time domain equals to energy
@@ -572,12 +535,10 @@ static void tone_detect_init(tone_detect_state_t *s, int freq, int duration, int
 
 static int tone_detect(tone_detect_state_t *s, int16_t *amp, int samples)
 {
-	float tone_energy;
-	int i;
+	float tone_energy, energy;
 	int hit = 0;
 	int limit;
 	int res = 0;
-	int16_t *ptr;
 	int start, end;
 
 	for (start = 0; start < samples; start = end) {
@@ -588,12 +549,7 @@ static int tone_detect(tone_detect_state_t *s, int16_t *amp, int samples)
 		}
 		end = start + limit;
 
-		for (i = limit, ptr = amp; i > 0; i--, ptr++) {
-			/* signed 32 bit int should be enough to suqare any possible signed 16 bit value */
-			s->energy += (int32_t) *ptr * (int32_t) *ptr;
-
-			goertzel_sample(&s->tone, *ptr);
-		}
+		rpt_goertzel_update(&s->bank, &s->tone, amp, limit);
 
 		s->samples_pending -= limit;
 
@@ -602,15 +558,15 @@ static int tone_detect(tone_detect_state_t *s, int16_t *amp, int samples)
 			break;
 		}
 
-		tone_energy = goertzel_result(&s->tone);
+		rpt_goertzel_result(&s->bank, &s->tone, &tone_energy);
 
 		/* Scale to make comparable */
 		tone_energy *= 2.0;
-		s->energy *= s->block_size;
+		energy = s->tone.energy * s->block_size;
 
 		hit = 0;
-		ast_debug(10, "tone %d, Ew=%.2E, Et=%.2E, s/n=%10.2f\n", s->freq, tone_energy, s->energy, tone_energy / (s->energy - tone_energy));
-		if (tone_energy > s->energy * s->threshold) {
+		ast_debug(10, "tone %d, Ew=%.2E, Et=%.2E, s/n=%10.2f\n", s->freq, tone_energy, energy, tone_energy / (energy - tone_energy));
+		if (tone_energy > energy * s->threshold) {
 			ast_debug(10, "Hit! count=%d\n", s->hit_count);
 			hit = 1;
 		}
@@ -636,11 +592,9 @@ static int tone_detect(tone_detect_state_t *s, int16_t *amp, int samples)
 		s->last_hit = hit;
 
 		/* Reinitialise the detector for the next block */
-		/* Reset for the next block */
-		goertzel_reset(&s->tone);
+		rpt_goertzel_reset(&s->tone);
 
 		/* Advance to the next block */
-		s->energy = 0.0;
 		s->samples_pending = s->block_size;
 
 		amp += limit;
@@ -718,30 +672,22 @@ static char *donode_make_datestr(char *buf, size_t bufsize, time_t *timep, const
 /*! \brief node logging function */
 void donodelog(struct rpt *myrpt, char *str)
 {
-	struct nodelog *nodep;
 	char datestr[100];
+	time_t timestamp;
 
 	if (!myrpt->p.archivedir) {
 		return;
 	}
 
-	nodep = ast_malloc(sizeof(struct nodelog));
-	if (!nodep) {
-		return;
-	}
-	ast_copy_string(nodep->archivedir, myrpt->p.archivedir, sizeof(nodep->archivedir));
-	donode_make_datestr(datestr, sizeof(datestr), &nodep->timestamp, myrpt->p.archivedatefmt);
-	snprintf(nodep->str, sizeof(nodep->str), "%s %s,%s\n", myrpt->name, datestr, str);
-	ast_mutex_lock(&nodeloglock);
-	insque((struct qelem *) nodep, (struct qelem *) nodelog.prev);
-	ast_mutex_unlock(&nodeloglock);
+	donode_make_datestr(datestr, sizeof(datestr), &timestamp, myrpt->p.archivedatefmt);
+	rpt_nodelog_queue(myrpt, timestamp, datestr, str);
 }
 
 void __attribute__((format(gnu_printf, 5, 6))) __donodelog_fmt(struct rpt *myrpt, const char *file, int lineno, const char *func,
 	const char *fmt, ...)
 {
 	va_list ap;
-	char *buf;
+	char buf[MAXNODESTR * 2];
 	int len;
 
 	if (!myrpt->p.archivedir) {
@@ -749,222 +695,12 @@ void __attribute__((format(gnu_printf, 5, 6))) __donodelog_fmt(struct rpt *myrpt
 	}
 
 	va_start(ap, fmt);
-	len = ast_vasprintf(&buf, fmt, ap);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
 	va_end(ap);
 
 	if (len > 0) {
 		donodelog(myrpt, buf);
-		ast_free(buf);
-	}
-}
-
-/*! \brief Routine to process events for rpt_master threads */
-void rpt_event_process(struct rpt *myrpt, struct ast_channel *chan)
-{
-	char *myval, *argv[5], *cmpvar, *var, *var1, *cmd, c;
-	char buf[1000], valbuf[500], action;
-	int i, argc, varp, var1p, thisAction;
-	struct ast_variable *v;
-	struct ast_var_t *newvariable;
-
-	if (!myrpt->ready) {
-		return;
-	}
-
-	for (v = ast_variable_browse(myrpt->cfg, myrpt->p.events); v; v = v->next) {
-		/* make a local copy of the value of this entry */
-		myval = ast_strdupa(v->value);
-		/* separate out specification into pipe-delimited fields */
-		argc = ast_app_separate_args(myval, '|', argv, sizeof(argv) / sizeof(argv[0]));
-		if (argc < 1) {
-			continue;
-		}
-		if (argc != 3) {
-			ast_log(LOG_ERROR, "event exec item malformed: %s\n", v->value);
-			continue;
-		}
-		action = toupper(*argv[0]);
-		if (!strchr("VGFCS", action)) {
-			ast_log(LOG_ERROR, "Unrecognized event action (%c) in exec item malformed: %s\n", action, v->value);
-			continue;
-		}
-		/* start indicating no command to do */
-		cmd = NULL;
-
-		c = toupper(*argv[1]);
-		if (c == 'E') { /* if to merely evaluate the statement */
-			if (!strncasecmp(v->name, "RPT", 3)) {
-				ast_log(LOG_ERROR, "%s is not a valid name for an event variable!!!!\n", v->name);
-				continue;
-			}
-			if (!strncasecmp(v->name, "XX_", 3)) {
-				ast_log(LOG_ERROR, "%s is not a valid name for an event variable!!!!\n", v->name);
-				continue;
-			}
-			/* see if this var exists yet */
-			myval = (char *) pbx_builtin_getvar_helper(chan, v->name);
-			/* if not, set it to zero, in case of the value being self-referenced */
-			if (!myval) {
-				pbx_builtin_setvar_helper(chan, v->name, "0");
-			}
-			snprintf(valbuf, sizeof(valbuf), "$[ %s ]", argv[2]);
-			buf[0] = 0;
-			pbx_substitute_variables_helper(chan, valbuf, buf, sizeof(buf) - 1);
-			if (pbx_checkcondition(buf)) {
-				cmd = "TRUE";
-			}
-		} else {
-			var = (char *) pbx_builtin_getvar_helper(chan, argv[2]);
-			if (!var) {
-				ast_log(LOG_ERROR, "Event variable %s not found\n", argv[2]);
-				continue;
-			}
-			/* set to 1 if var is true */
-			varp = ((pbx_checkcondition(var) > 0));
-			for (i = 0; (!cmd) && (c = *(argv[1] + i)); i++) {
-				if (ast_asprintf(&cmpvar, "XX_%s", argv[2]) < 0) {
-					return;
-				}
-				var1 = (char *) pbx_builtin_getvar_helper(chan, cmpvar);
-				var1p = !varp; /* start with it being opposite */
-				if (var1) {
-					/* set to 1 if var is true */
-					var1p = ((pbx_checkcondition(var1) > 0));
-				}
-				ast_free(cmpvar);
-				c = toupper(c);
-				if (!strchr("TFNI", c)) {
-					ast_log(LOG_ERROR, "Unrecognized event type (%c) in exec item malformed: %s\n", c, v->value);
-					continue;
-				}
-				switch (c) {
-				case 'N': /* if no change */
-					if (var1 && (varp == var1p)) {
-						cmd = (char *) v->name;
-					}
-					break;
-				case 'I': /* if didn't exist (initial state) */
-					if (!var1) {
-						cmd = (char *) v->name;
-					}
-					break;
-				case 'F': /* transition to false */
-					if (var1 && (var1p == 1) && (varp == 0)) {
-						cmd = (char *) v->name;
-					}
-					break;
-				case 'T': /* transition to true */
-					if ((var1p == 0) && (varp == 1)) {
-						cmd = (char *) v->name;
-					}
-					break;
-				}
-			}
-		}
-		if (action == 'V') { /* set a variable */
-			pbx_builtin_setvar_helper(chan, v->name, cmd ? "1" : "0");
-			continue;
-		} else if (action == 'G') { /* set a global variable */
-			pbx_builtin_setvar_helper(NULL, v->name, cmd ? "1" : "0");
-			continue;
-		}
-		/* if not command to execute, go to next one */
-		if (!cmd) {
-			continue;
-		}
-		if (action == 'F') { /* execute a function */
-			ast_verb(3, "Event on node %s doing macro %s for condition %s\n", myrpt->name, cmd, v->value);
-			macro_append(myrpt, cmd);
-		} else if (action == 'C') { /* execute a command */
-			/* make a local copy of the value of this entry */
-			myval = ast_strdupa(cmd);
-			/* separate out specification into comma-delimited fields */
-			argc = ast_app_separate_args(myval, ',', argv, sizeof(argv) / sizeof(argv[0]));
-			if (argc < 1) {
-				ast_log(LOG_ERROR, "event exec rpt command item malformed: %s\n", cmd);
-				continue;
-			}
-			/* Look up the action */
-			thisAction = rpt_function_lookup(argv[0]);
-			if (thisAction < 0) {
-				ast_log(LOG_ERROR, "Unknown action name %s.\n", argv[0]);
-				continue;
-			}
-			ast_verb(3, "Event on node %s doing rpt command %s for condition %s\n", myrpt->name, cmd, v->value);
-			rpt_mutex_lock(&myrpt->lock);
-			if (myrpt->cmdAction.state == CMD_STATE_IDLE) {
-				myrpt->cmdAction.state = CMD_STATE_BUSY;
-				myrpt->cmdAction.functionNumber = thisAction;
-				myrpt->cmdAction.param[0] = 0;
-				if (argc > 1) {
-					ast_copy_string(myrpt->cmdAction.param, argv[1], sizeof(myrpt->cmdAction.param));
-				}
-				myrpt->cmdAction.digits[0] = 0;
-				if (argc > 2) {
-					ast_copy_string(myrpt->cmdAction.digits, argv[2], sizeof(myrpt->cmdAction.digits));
-					snprintf(myrpt->cmdAction.param, sizeof(myrpt->cmdAction.param), "%s,%s", argv[1], argv[2]);
-				}
-				myrpt->cmdAction.command_source = SOURCE_RPT;
-				myrpt->cmdAction.state = CMD_STATE_READY;
-			} else {
-				ast_log(LOG_WARNING, "Could not execute event %s for %s: Command buffer in use\n", cmd, argv[1]);
-			}
-			rpt_mutex_unlock(&myrpt->lock);
-		} else if (action == 'S') { /* execute a shell command */
-			char *cmdbuf;
-			int argc;
-			char *argv[32];
-
-			ast_verb(3, "Event on node %s doing shell command %s for condition %s\n", myrpt->name, cmd, v->value);
-			cmdbuf = ast_strdupa(cmd);
-			argc = ast_app_separate_args(cmdbuf, ' ', argv, ARRAY_LEN(argv) - 1);
-			argv[argc] = NULL;
-			if (argc > 0) {
-				ast_safe_execvp(1, argv[0], argv);
-			}
-		}
-	}
-	for (v = ast_variable_browse(myrpt->cfg, myrpt->p.events); v; v = v->next) {
-		/* make a local copy of the value of this entry */
-		myval = ast_strdupa(v->value);
-		/* separate out specification into pipe-delimited fields */
-		argc = ast_app_separate_args(myval, '|', argv, sizeof(argv) / sizeof(argv[0]));
-		if (argc != 3) {
-			continue;
-		}
-		action = toupper(*argv[0]);
-		if (!strchr("VGFCS", action)) {
-			continue;
-		}
-		c = *argv[1];
-		if (c == 'E') {
-			continue;
-		}
-		var = (char *) pbx_builtin_getvar_helper(chan, argv[2]);
-		if (!var) {
-			continue;
-		}
-		/* set to 1 if var is true */
-		varp = pbx_checkcondition(var) > 0;
-		if (ast_asprintf(&cmpvar, "XX_%s", argv[2]) < 0) {
-			return;
-		}
-		var1 = (char *) pbx_builtin_getvar_helper(chan, cmpvar);
-		pbx_builtin_setvar_helper(chan, cmpvar, var);
-		ast_free(cmpvar);
 	}
-	if (option_verbose < 5) {
-		return;
-	}
-	i = 0;
-	ast_debug(2, "Node Variable dump for node %s:\n", myrpt->name);
-	ast_channel_lock(chan);
-	AST_LIST_TRAVERSE(ast_channel_varshead(chan), newvariable, entries) {
-		i++;
-		ast_debug(2, "   %s=%s\n", ast_var_name(newvariable), ast_var_value(newvariable));
-	}
-	ast_channel_unlock(chan);
-	ast_debug(2, "    -- %d variables\n", i);
 }
 
 static void dodispgm(struct rpt *myrpt, char *them)
@@ -997,182 +733,6 @@ static void doconpgm(struct rpt *myrpt, char *them)
 	ast_safe_execvp(1, argv[0], argv);
 }
 
-/*! \brief Store the output of libcurl (the OK is sent to stdout) */
-static size_t writefunction(char *contents, size_t size, size_t nmemb, void *userdata)
-{
-	struct ast_str **buffer = userdata;
-
-	return ast_str_append(buffer, 0, "%.*s", (int) (size * nmemb), contents);
-}
-
-/* Function to check if HTTP status code is in 2xx range */
-static rpt_bool is_http_success(int code)
-{
-	return (code >= 200 && code <= 299);
-}
-
-static const char *http_status_text(long code)
-{
-	switch (code) {
-	case 100:
-		return "Continue";
-	case 101:
-		return "Switching Protocols";
-	case 200:
-		return "OK";
-	case 201:
-		return "Created";
-	case 204:
-		return "No Content";
-	case 206:
-		return "Partial Content";
-	case 301:
-		return "Moved Permanently";
-	case 302:
-		return "Found";
-	case 304:
-		return "Not Modified";
-	case 307:
-		return "Temporary Redirect";
-	case 308:
-		return "Permanent Redirect";
-	case 400:
-		return "Bad Request";
-	case 401:
-		return "Unauthorized";
-	case 403:
-		return "Forbidden";
-	case 404:
-		return "Not Found";
-	case 405:
-		return "Method Not Allowed";
-	case 408:
-		return "Request Timeout";
-	case 429:
-		return "Too Many Requests";
-	case 500:
-		return "Internal Server Error";
-	case 501:
-		return "Not Implemented";
-	case 502:
-		return "Bad Gateway";
-	case 503:
-		return "Service Unavailable";
-	case 504:
-		return "Gateway Timeout";
-	default:
-		return "Unknown Status";
-	}
-}
-
-static void *perform_statpost(void *data)
-{
-	int failed = 0;
-	long rescode = 0;
-	CURL *curl = curl_easy_init();
-	CURLcode res;
-	char error_buffer[CURL_ERROR_SIZE];
-	struct ast_str *response_msg;
-	struct statpost *sp = (struct statpost *) data;
-	struct rpt *myrpt = sp->myrpt;
-	char *url = ast_str_buffer(sp->stats_url);
-
-	if (!curl) {
-		ast_free(sp->stats_url);
-		ast_free(sp);
-		return NULL;
-	}
-
-	response_msg = ast_str_create(RPT_AST_STR_INIT_SIZE);
-	if (!response_msg) {
-		ast_free(sp->stats_url);
-		ast_free(sp);
-		curl_easy_cleanup(curl);
-		return NULL;
-	}
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writefunction);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_msg);
-	/*
-	 *	The option setting below is the default, so there's no need to set it.
-	 *
-	 *	curl_easy_setopt(curl, CURLOPT_IPRESOLVE, (long)CURL_IPRESOLVE_WHATEVER);
-	 */
-	curl_easy_setopt(curl, CURLOPT_URL, url);
-	curl_easy_setopt(curl, CURLOPT_USERAGENT, AST_CURL_USER_AGENT);
-	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, error_buffer);
-
-	res = curl_easy_perform(curl);
-	if (res != CURLE_OK) {
-		if (*error_buffer) { /* Anything in the error buffer? */
-			failed = 1;
-			if (!myrpt->last_statpost_failed) {
-				ast_log(LOG_WARNING, "statpost to URL '%s' failed with error: %s\n", url, error_buffer);
-			}
-		} else {
-			failed = 1;
-			if (!myrpt->last_statpost_failed) {
-				ast_log(LOG_WARNING, "statpost to URL '%s' failed with error: %s\n", url, curl_easy_strerror(res));
-			}
-		}
-	} else {
-		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &rescode);
-		if (!is_http_success(rescode)) {
-			failed = 1;
-			if (!myrpt->last_statpost_failed) {
-				ast_log(LOG_WARNING, "statpost to URL '%s' failed with code %ld: %s\n", url, rescode, http_status_text(rescode));
-			}
-		}
-	}
-	myrpt->last_statpost_failed = ((failed) ? 1 : 0);
-
-	ast_debug(5, "Response: %s\n", ast_str_buffer(response_msg));
-	ast_free(sp->stats_url); /* Free here since parent is not responsible for it. */
-	ast_free(sp);
-	ast_free(response_msg);
-	curl_easy_cleanup(curl);
-	return NULL;
-}
-
-static void statpost(struct rpt *myrpt, struct ast_str *pairs)
-{
-	time_t now;
-	unsigned int seq;
-	int res;
-	pthread_t statpost_thread;
-	struct statpost *sp;
-
-	if (!myrpt->p.statpost_url) {
-		return;
-	}
-	sp = ast_malloc(sizeof(struct statpost));
-	if (!sp) {
-		return;
-	}
-
-	sp->stats_url = ast_str_create(RPT_AST_STR_INIT_SIZE);
-	if (!sp->stats_url) {
-		ast_free(sp);
-		return;
-	}
-	ast_mutex_lock(&myrpt->statpost_lock);
-	seq = ++myrpt->statpost_seqno;
-	ast_mutex_unlock(&myrpt->statpost_lock);
-
-	time(&now);
-	sp->myrpt = myrpt;
-	ast_str_set(&sp->stats_url, 0, "%s?node=%s&time=%u&seqno=%u%s", myrpt->p.statpost_url, myrpt->name, (unsigned int) now, seq,
-		ast_str_buffer(pairs));
-
-	/* Make the actual cURL call in a separate thread, so we can continue without blocking. */
-	ast_debug(4, "Making statpost to %s\n", ast_str_buffer(sp->stats_url));
-	res = ast_pthread_create_detached(&statpost_thread, NULL, perform_statpost, sp);
-	if (res) {
-		ast_log(LOG_ERROR, "Error creating statpost thread: %s\n", strerror(res));
-		ast_free(sp->stats_url);
-		ast_free(sp);
-	}
-}
-
 /*
  * Function stream data
  */
@@ -1251,33 +811,6 @@ static int topcompar(const void *a, const void *b)
 	return (x->timesince - y->timesince);
 }
 
-#ifdef __RPT_NOTCH
-
-/* rpt filter routine */
-static void rpt_filter(struct rpt *myrpt, volatile short *buf, int len)
-{
-	int i, j;
-	struct rptfilter *f;
-
-	for (i = 0; i < len; i++) {
-		for (j = 0; j < MAXFILTERS; j++) {
-			f = &myrpt->filters[j];
-			if (!*f->desc) {
-				continue;
-			}
-			f->x0 = f->x1;
-			f->x1 = f->x2;
-			f->x2 = ((float) buf[i]) / f->gain;
-			f->y0 = f->y1;
-			f->y1 = f->y2;
-			f->y2 = (f->x0 + f->x2) + f->const0 * f->x1 + (f->const1 * f->y0) + (f->const2 * f->y1);
-			buf[i] = (short) f->y2;
-		}
-	}
-}
-
-#endif
-
 struct rpt_autopatch {
 	struct rpt *myrpt;
 	struct ast_channel *mychannel;
@@ -1618,13 +1151,14 @@ cleanup:
  */
 static enum rpt_function_response collect_function_digits(struct rpt *myrpt, char *digits, int command_source, struct rpt_link *mylink)
 {
-	int i, rv;
-	char *stringp, *action, *param, *functiondigits;
-	char function_table_name[30] = "";
+	int rv;
+	const char *function_table_name;
 	char authed_function_table_name[30] = "";
 	char workstring[200];
-
-	struct ast_variable *vp;
+	const struct rpt_functrie_entry *entry = NULL;
+	enum rpt_functrie_result match = RPT_FUNCTRIE_NOMATCH, authmatch = RPT_FUNCTRIE_NOMATCH;
+	void *trie = NULL;
+	char *param;
 
 	ast_debug(7, "digits=%s  source=%d\n", digits, command_source);
 
@@ -1632,21 +1166,21 @@ static enum rpt_function_response collect_function_digits(struct rpt *myrpt, cha
 		if (!myrpt->p.dphone_functions) {
 			return DC_INDETERMINATE;
 		}
-		ast_copy_string(function_table_name, myrpt->p.dphone_functions, sizeof(function_table_name));
+		function_table_name = myrpt->p.dphone_functions;
 	} else if (command_source == SOURCE_ALT) {
 		if (!myrpt->p.alt_functions) {
 			return DC_INDETERMINATE;
 		}
-		ast_copy_string(function_table_name, myrpt->p.alt_functions, sizeof(function_table_name));
+		function_table_name = myrpt->p.alt_functions;
 	} else if (command_source == SOURCE_PHONE) {
 		if (!myrpt->p.phone_functions) {
 			return DC_INDETERMINATE;
 		}
-		ast_copy_string(function_table_name, myrpt->p.phone_functions, sizeof(function_table_name));
+		function_table_name = myrpt->p.phone_functions;
 	} else if (command_source == SOURCE_LNK) {
-		ast_copy_string(function_table_name, myrpt->p.link_functions, sizeof(function_table_name));
+		function_table_name = myrpt->p.link_functions;
 	} else {
-		ast_copy_string(function_table_name, myrpt->p.functions, sizeof(function_table_name));
+		function_table_name = myrpt->p.functions;
 	}
 
 	/*
@@ -1655,71 +1189,36 @@ static enum rpt_function_response collect_function_digits(struct rpt *myrpt, cha
 	 * the source stanza on prefix collision (admin's responsibility to avoid).
 	 * No-op when no active session.
 	 */
-	vp = NULL;
 	if (rpt_auth_get_active_stanza(myrpt, authed_function_table_name, sizeof(authed_function_table_name))) {
-		struct ast_variable *avp = ast_variable_browse(myrpt->cfg, authed_function_table_name);
-		while (avp) {
-			if (!strncasecmp(avp->name, digits, strlen(avp->name))) {
-				vp = avp;
-				break;
-			}
-			avp = avp->next;
-		}
+		authmatch = rpt_functrie_match(myrpt, authed_function_table_name, digits, &entry, &trie);
 	}
 
 	/* Fall through to source stanza if no authed match */
-	if (!vp) {
-		vp = ast_variable_browse(myrpt->cfg, function_table_name);
-		while (vp) {
-			if (!strncasecmp(vp->name, digits, strlen(vp->name))) {
-				break;
-			}
-			vp = vp->next;
-		}
+	if (authmatch != RPT_FUNCTRIE_MATCH) {
+		match = rpt_functrie_match(myrpt, function_table_name, digits, &entry, &trie);
 	}
 	/* if function context not found */
-	if (!vp) {
-		int n;
-
-		n = myrpt->longestfunc;
-		if (command_source == SOURCE_LNK) {
-			n = myrpt->link_longestfunc;
-		} else if (command_source == SOURCE_PHONE) {
-			n = myrpt->phone_longestfunc;
-		} else if (command_source == SOURCE_ALT) {
-			n = myrpt->alt_longestfunc;
-		} else if (command_source == SOURCE_DPHONE) {
-			n = myrpt->dphone_longestfunc;
-		}
-
-		/* Authed stanza may extend the "have we collected enough digits?" gate */
-		{
-			int an = rpt_auth_longestfunc(myrpt);
-			if (an > n) {
-				n = an;
-			}
-		}
-
-		if (strlen(digits) >= n) {
-			return DC_ERROR;
-		} else {
+	if (authmatch != RPT_FUNCTRIE_MATCH && match != RPT_FUNCTRIE_MATCH) {
+		/* Keep collecting only while more digits could still match something */
+		if (authmatch == RPT_FUNCTRIE_PARTIAL || match == RPT_FUNCTRIE_PARTIAL) {
 			return DC_INDETERMINATE;
 		}
+		return DC_ERROR;
 	}
-	/* Found a match, retrieve value part and parse */
-	ast_copy_string(workstring, vp->value, sizeof(workstring));
-	stringp = workstring;
-	action = strsep(&stringp, ",");
-	param = stringp;
-	ast_debug(1, "@@@@ action: %s, param = %s\n", action, (param) ? param : "(null)");
-	/* Look up the action */
-	i = rpt_function_lookup(action);
-	if (i < 0) {
+	if (entry->action < 0) {
 		/* Error, action not in table */
+		ao2_ref(trie, -1);
 		return DC_ERROR;
 	}
-	functiondigits = digits + strlen(vp->name);
-	rv = (*function_table[i].function)(myrpt, param, functiondigits, command_source, mylink);
+	ast_debug(1, "@@@@ action: %s, param = %s\n", function_table[entry->action].action, S_OR(entry->param, "(null)"));
+	/* Functions may modify their parameters, give them a copy */
+	param = NULL;
+	if (entry->param) {
+		ast_copy_string(workstring, entry->param, sizeof(workstring));
+		param = workstring;
+	}
+	rv = (*function_table[entry->action].function)(myrpt, param, digits + entry->namelen, command_source, mylink);
+	ao2_ref(trie, -1);
 	ast_debug(7, "rv=%i\n", rv);
 
 	/* Refresh sliding session timeout on any successful function dispatch */
@@ -1801,6 +1300,7 @@ static int distribute_to_all_links(struct rpt *myrpt, struct rpt_link *mylink, c
 {
 	struct rpt_link *l;
 	struct ao2_iterator l_it;
+	struct rpt_text_payload *payload;
 
 	/* see if this is one in list */
 	rpt_mutex_lock(&myrpt->lock);
@@ -1809,6 +1309,29 @@ static int distribute_to_all_links(struct rpt *myrpt, struct rpt_link *mylink, c
 		return -1;
 	}
 
+	if (dest) {
+		l = rpt_link_find(myrpt, dest);
+		/* dont send back from where it came */
+		if (!l || l->name[0] == '0' || l == mylink || !strcmp(l->name, mylink->name)) {
+			ao2_cleanup(l);
+			rpt_mutex_unlock(&myrpt->lock);
+			return 0;
+		}
+		/* if it is, send it (but not to src) and we're done */
+		if (strcmp(l->name, src) && l->chan) {
+			rpt_qwrite(l, wf);
+		}
+		ao2_ref(l, -1);
+		rpt_mutex_unlock(&myrpt->lock);
+		return 1;
+	}
+
+	/* Every link gets a reference to the same copy of the frame */
+	payload = rpt_text_payload_alloc(wf);
+	if (!payload) {
+		rpt_mutex_unlock(&myrpt->lock);
+		return 0;
+	}
 	RPT_LIST_TRAVERSE(myrpt->links, l, l_it) {
 		if (l->name[0] == '0') {
 			continue;
@@ -1817,24 +1340,14 @@ static int distribute_to_all_links(struct rpt *myrpt, struct rpt_link *mylink, c
 		if (l == mylink || !strcmp(l->name, mylink->name)) {
 			continue;
 		}
-		if (!dest || !strcmp(l->name, dest)) {
-			/* send, but not to src */
-			if (strcmp(l->name, src)) {
-				if (l->chan) {
-					rpt_qwrite(l, wf);
-				}
-			}
-			if (dest) {
-				/* if it is, send it and we're done */
-				ao2_ref(l, -1);
-				rpt_mutex_unlock(&myrpt->lock);
-				ao2_iterator_destroy(&l_it);
-				return 1;
-			}
+		/* send, but not to src */
+		if (strcmp(l->name, src) && l->chan) {
+			rpt_qwrite_payload(l, payload);
 		}
 	}
 	rpt_mutex_unlock(&myrpt->lock);
 	ao2_iterator_destroy(&l_it);
+	ao2_ref(payload, -1);
 	return 0;
 }
 
@@ -1946,7 +1459,11 @@ static void handle_link_data(struct rpt *myrpt, struct rpt_link *mylink, char *s
 			return;
 		}
 		rpt_mutex_lock(&myrpt->lock);
-		ast_str_set(&mylink->linklist, 0, "%s", str + 2); /* Dropping the "L " of the message */
+		/* Links resend their list periodically, it usually hasn't changed */
+		if (strcmp(ast_str_buffer(mylink->linklist), str + 2)) {
+			ast_str_set(&mylink->linklist, 0, "%s", str + 2); /* Dropping the "L " of the message */
+			rpt_linklist_changed(myrpt);
+		}
 		rpt_mutex_unlock(&myrpt->lock);
 		ast_debug(7, "@@@@ node %s received node list %s from node %s\n", myrpt->name, str, mylink->name);
 		return;
@@ -2509,7 +2026,6 @@ static void *attempt_reconnect(struct rpt *myrpt, struct rpt_link *l)
 	char *s1, *tele;
 	char tmp[300], deststr[325] = "";
 	char sx[320];
-	struct ast_frame *f1;
 	struct ast_format_cap *cap;
 
 	ast_debug(1, "Attempting Reconnect");
@@ -2547,6 +2063,7 @@ static void *attempt_reconnect(struct rpt *myrpt, struct rpt_link *l)
 	l->thisconnected = 0;
 	l->linkmode = 0;
 	l->lastrx1 = 0;
+	rpt_linklist_changed(myrpt);
 	l->lastrealrx = 0;
 	l->last_frame_sent = 0;
 	l->rxlingertimer = RX_LINGER_TIME;
@@ -2554,9 +2071,7 @@ static void *attempt_reconnect(struct rpt *myrpt, struct rpt_link *l)
 	l->link_newkey = RADIO_KEY_NOT_ALLOWED;
 	l->chan = ast_request(deststr, cap, NULL, NULL, tele, NULL);
 	ao2_ref(cap, -1);
-	while ((f1 = AST_LIST_REMOVE_HEAD(&l->textq, frame_list))) {
-		ast_frfree(f1);
-	}
+	rpt_textq_flush(l);
 	if (l->chan) {
 		if (rpt_make_call(l->chan, tele, 999, deststr, "Remote Rx", "attempt_reconnect", myrpt->name, l->name)) {
 			ast_log(LOG_WARNING, "Unable to place call to %s/%s\n", deststr, tele);
@@ -3391,6 +2906,7 @@ static inline void rxunkey_helper(struct rpt *myrpt, struct rpt_link *l)
 	if (l->lastrx1) {
 		donodelog_fmt(myrpt, "RXUNKEY,%s", l->name);
 		l->lastrx1 = 0;
+		rpt_linklist_changed(myrpt);
 		/* XXX Note in first usage, rpt_update_links is first,
 		 * but in second, time was first. Don't think it matters though. */
 		rpt_update_links(myrpt);
@@ -3402,32 +2918,61 @@ static inline void rxunkey_helper(struct rpt *myrpt, struct rpt_link *l)
 
 /*!
  * \brief Send all text messages in a link's text queue
- * \param myrpt Pointer to the rpt structure
+ * \note Only called from the thread servicing the link, does not need myrpt->lock.
  * \param l Pointer to the link structure
  */
-static inline void link_process_textq(struct rpt *myrpt, struct rpt_link *l)
+static inline void link_process_textq(struct rpt_link *l)
 {
-	struct ast_frame *f;
+	struct rpt_text_payload *payload;
+
+	while (l->chan && l->thisconnected && (payload = rpt_textq_pop(l))) {
+		struct ast_frame f = {
+			.frametype = AST_FRAME_TEXT,
+			.src = __PRETTY_FUNCTION__,
+			.data.ptr = payload->data,
+			.datalen = payload->datalen,
+		};
+
+		ast_write(l->chan, &f);
+		ao2_ref(payload, -1);
+	}
+}
 
+/*!
+ * \brief Wake the rpt() loop, which may be sleeping until its next timer
+ * \note A null frame is queued on the rxpchannel, which the loop reads and ignores.
+ * \param myrpt
+ */
+static void rpt_wake(struct rpt *myrpt)
+{
 	rpt_mutex_lock(&myrpt->lock);
-	while (l->chan && l->thisconnected && !AST_LIST_EMPTY(&l->textq)) {
-		struct ast_channel *chan = ast_channel_ref(l->chan);
-		f = AST_LIST_REMOVE_HEAD(&l->textq, frame_list);
-		rpt_mutex_unlock(&myrpt->lock);
-		ast_write(chan, f);
-		rpt_mutex_lock(&myrpt->lock);
-		ast_frfree(f);
-		ast_channel_unref(chan);
+	if (myrpt->rxpchannel) {
+		ast_queue_frame(myrpt->rxpchannel, &ast_null_frame);
 	}
 	rpt_mutex_unlock(&myrpt->lock);
 }
 
-static inline void periodic_process_link(struct rpt *myrpt, struct rpt_link *l, const int elap)
+/*!
+ * \brief Keep myrpt->rxlinks in step with the receive state of a link
+ * \note Only called from the thread servicing the link.
+ * \param myrpt
+ * \param l
+ * \param receiving Whether the link should be counted as receiving
+ */
+static inline void link_update_rxcount(struct rpt *myrpt, struct rpt_link *l, int receiving)
+{
+	if (receiving != l->rxcounted) {
+		l->rxcounted = receiving;
+		ast_atomic_fetchadd_int(&myrpt->rxlinks, receiving ? 1 : -1);
+	}
+}
+
+void periodic_process_link(struct rpt *myrpt, struct rpt_link *l, const int elap)
 {
 	int newkeytimer_last, max_retries;
 	int myrx;
 
-	link_process_textq(myrpt, l);
+	link_process_textq(l);
 
 	update_timer(&l->rxlingertimer, elap, 0);
 
@@ -3524,7 +3069,7 @@ static inline void periodic_process_link(struct rpt *myrpt, struct rpt_link *l,
 	}
 	myrx = l->lastrealrx;
 	if ((l->phonemode != RPT_PHONE_MODE_NONE) && (l->phonevox)) {
-		myrx = myrx || (!AST_LIST_EMPTY(&l->rxq));
+		myrx = myrx || l->rxq.len;
 		if (l->voxtotimer <= 0) {
 			if (l->voxtostate) {
 				l->voxtotimer = myrpt->p.voxtimeout_ms;
@@ -3537,7 +3082,12 @@ static inline void periodic_process_link(struct rpt *myrpt, struct rpt_link *l,
 		if (!l->voxtostate)
 			myrx = myrx || l->wasvox;
 	}
+	if (myrx && !l->lastrx) {
+		/* An idle node thread only notices a remote keyup when it wakes */
+		rpt_wake(myrpt);
+	}
 	l->lastrx = myrx;
+	link_update_rxcount(myrpt, l, myrx && (l->mode != MODE_LOCAL_MONITOR));
 
 	update_timer(&l->linklisttimer, elap, 0);
 
@@ -3549,7 +3099,7 @@ static inline void periodic_process_link(struct rpt *myrpt, struct rpt_link *l,
 		l->linklisttimer = myrpt->p.linkpost_time * 1000;
 		ast_str_set(&lstr, 0, "%s", "L ");
 		rpt_mutex_lock(&myrpt->lock);
-		__mklinklist(myrpt, l, &lstr, USE_FORMAT_RPT_LINK);
+		rpt_linklist_append(myrpt, l, &lstr, USE_FORMAT_RPT_LINK);
 		rpt_mutex_unlock(&myrpt->lock);
 		if (l->chan) {
 			struct ast_frame lf = {
@@ -3583,6 +3133,7 @@ static inline void periodic_process_link(struct rpt *myrpt, struct rpt_link *l,
 				if (myrpt->p.duplex)
 					rpt_telemetry(myrpt, LINKUNKEY, l);
 				l->lastrx1 = 0;
+				rpt_linklist_changed(myrpt);
 				rpt_update_links(myrpt);
 			}
 		}
@@ -3684,7 +3235,7 @@ static inline void do_key_post(struct rpt *myrpt)
 	time(&now);
 	ast_str_set(&str, 0, "&keyed=%d&keytime=%d", myrpt->keyed, myrpt->lastkeyedtime ? ((int) (now - myrpt->lastkeyedtime)) : 0);
 	rpt_mutex_unlock(&myrpt->lock);
-	statpost(myrpt, str);
+	rpt_statpost(myrpt, str);
 	ast_free(str);
 	rpt_mutex_lock(&myrpt->lock);
 }
@@ -3711,7 +3262,7 @@ static inline int do_link_post(struct rpt *myrpt)
 		return -1;
 	}
 	ast_str_set(&str, 0, "%s", "&nodes=");
-	__mklinklist(myrpt, NULL, &str, USE_FORMAT_RPT_LINKPOST);
+	rpt_linklist_append(myrpt, NULL, &str, USE_FORMAT_RPT_LINKPOST);
 	time(&now);
 
 	ast_str_append(&str, 0,
@@ -3721,7 +3272,7 @@ static inline int do_link_post(struct rpt *myrpt)
 		(int) myrpt->totaltxtime / 1000, myrpt->timeouts, myrpt->totalexecdcommands, myrpt->keyed,
 		myrpt->lastkeyedtime ? ((int) (now - myrpt->lastkeyedtime)) : 0);
 	rpt_mutex_unlock(&myrpt->lock);
-	statpost(myrpt, str);
+	rpt_statpost(myrpt, str);
 	rpt_mutex_lock(&myrpt->lock);
 	ast_free(str);
 	return 0;
@@ -3759,6 +3310,15 @@ static inline int update_timers(struct rpt *myrpt, const int elap, const int tot
 {
 	int last_time;
 
+	/* Sample the loop wakeup rate once a second */
+	myrpt->wakeups++;
+	myrpt->wakeuptimer += elap;
+	if (myrpt->wakeuptimer >= 1000) {
+		myrpt->wakeups_per_sec = (myrpt->wakeups * 1000) / myrpt->wakeuptimer;
+		myrpt->wakeups = 0;
+		myrpt->wakeuptimer = 0;
+	}
+
 	update_timer(&myrpt->linkposttimer, elap, 0);
 	if (myrpt->linkposttimer <= 0) {
 		if (do_link_post(myrpt)) {
@@ -3857,6 +3417,69 @@ static inline int update_timers(struct rpt *myrpt, const int elap, const int tot
 
 	return 0;
 }
+
+/*!
+ * \brief Shorten a wait so that it ends when a countdown timer reaches its end value
+ * \param ms Pointer to the wait in milliseconds
+ * \param timer Current timer value
+ * \param end_val Value at which the timer is considered expired
+ */
+static inline void next_deadline(int *ms, int timer, int end_val)
+{
+	if (timer > end_val && timer - end_val < *ms) {
+		*ms = timer - end_val;
+	}
+}
+
+/*!
+ * \brief Calculate how long the rpt() loop may sleep waiting for channel activity
+ * \note Must be called with myrpt->lock held.
+ *
+ * While the node is keyed, transmitting, receiving from a link or has
+ * work queued we keep the normal MSWAIT cadence.  An idle node instead
+ * sleeps until the next timer that update_timers() maintains would expire,
+ * bounded by RPT_MAXWAIT so the scheduler and anything not tracked here is
+ * still serviced.  A link that keys up while the node sleeps wakes it, see
+ * rpt_wake().
+ *
+ * \param myrpt
+ * \param totx Transmit state computed for this pass of the loop
+ * \return Milliseconds to pass to ast_waitfor_n()
+ */
+static int rpt_next_deadline(struct rpt *myrpt, int totx)
+{
+	int ms = RPT_MAXWAIT;
+
+	if (totx || myrpt->keyed || myrpt->remrx || myrpt->exttx || myrpt->localoverride || myrpt->reload || myrpt->tailevent ||
+		myrpt->deferid || myrpt->keypost != RPT_KEYPOST_NONE || myrpt->cmdAction.state == CMD_STATE_READY ||
+		ast_str_strlen(myrpt->macrobuf) || myrpt->dtmf_local_str[0] || myrpt->dtmfidx >= 0 || myrpt->rem_dtmfidx >= 0 ||
+		myrpt->callmode != CALLMODE_DOWN || myrpt->parrotstate != PARROT_STATE_IDLE || myrpt->tele.next != &myrpt->tele ||
+		myrpt->topkeystate == 1 || myrpt->txq.len || ast_atomic_fetchadd_int(&myrpt->rxlinks, 0)) {
+		return MSWAIT;
+	}
+
+	next_deadline(&ms, myrpt->skedtimer, 0);
+	next_deadline(&ms, myrpt->linkposttimer, 0);
+	next_deadline(&ms, myrpt->tailtimer, 0);
+	next_deadline(&ms, myrpt->totimer, 0);
+	next_deadline(&ms, myrpt->remote_time_out_reset_unkey_interval_timer, 0);
+	next_deadline(&ms, myrpt->time_out_reset_unkey_interval_timer, 0);
+	next_deadline(&ms, myrpt->first_keyup_timer, 0);
+	next_deadline(&ms, myrpt->first_keyup_inactivity_timer, 0);
+	next_deadline(&ms, myrpt->idtimer, 0);
+	next_deadline(&ms, myrpt->tmsgtimer, 0);
+	next_deadline(&ms, myrpt->voxtotimer, 0);
+	next_deadline(&ms, myrpt->lastkeytimer, 0);
+	next_deadline(&ms, myrpt->parrottimer, 0);
+	next_deadline(&ms, myrpt->macrotimer, 0);
+	next_deadline(&ms, myrpt->dtmf_local_timer, 1);
+	if (myrpt->telemmode != 0x7fffffff) {
+		next_deadline(&ms, myrpt->telemmode, 1);
+	}
+
+	return MAX(ms, MSWAIT);
+}
+
 /*!
  * \brief Update parrot channel -> parrot record timer is complete OR parrot mode changed to off
  */
@@ -3926,87 +3549,351 @@ static inline void outstream_write(struct rpt *myrpt, struct ast_frame *f)
 }
 
 /*!
- * \internal
- * \brief Free a frame if it exists
+ * \brief Mute the frames waiting in a frame_queue
+ * \note Audio is zeroed when each frame is emitted, not here.
+ * \param frame_queue The rpt_frame_queue structure to mute
  */
-static inline void free_frame(struct ast_frame **f)
+static inline void rpt_frame_queue_mute(struct rpt_frame_queue *frame_queue)
 {
-	if (!*f) {
-		return;
+	int i;
+
+	for (i = 0; i < RPT_FRAME_QUEUE_SLOTS; i++) {
+		frame_queue->slots[i].muted = 1;
 	}
-	ast_frfree(*f);
-	*f = NULL;
 }
 
 /*!
- * \brief Zero data in frame_queue->lastf1 and lastf2 registers (muting audio)
- * \param frame_queue The rpt_frame_queue structure to mute
+ * \brief Copy a voice frame into a frame_queue slot, reusing the slot's buffer
+ * \retval 0 on success
+ * \retval -1 if the slot buffer could not be grown
  */
-static inline void rpt_frame_queue_mute(struct rpt_frame_queue *frame_queue)
+static int rpt_frame_slot_store(struct rpt_frame_slot *slot, struct ast_frame *f, int mute)
 {
-	RPT_MUTE_FRAME(frame_queue->lastf1);
-	RPT_MUTE_FRAME(frame_queue->lastf2);
+	struct ast_format *oldformat = slot->fr.subclass.format;
+	size_t needed = AST_FRIENDLY_OFFSET + f->datalen;
+
+	if (needed > slot->bufsize) {
+		char *buf = ast_realloc(slot->buf, needed);
+
+		if (!buf) {
+			return -1;
+		}
+		slot->buf = buf;
+		slot->bufsize = needed;
+	}
+	slot->fr = *f;
+	memset(&slot->fr.frame_list, 0, sizeof(slot->fr.frame_list));
+	slot->fr.mallocd = 0;
+	slot->fr.src = __PRETTY_FUNCTION__;
+	slot->fr.offset = AST_FRIENDLY_OFFSET;
+	slot->fr.data.ptr = slot->buf + AST_FRIENDLY_OFFSET;
+	if (f->frametype == AST_FRAME_VOICE || f->frametype == AST_FRAME_VIDEO) {
+		ao2_bump(slot->fr.subclass.format);
+	} else {
+		slot->fr.subclass.format = NULL;
+	}
+	ao2_cleanup(oldformat);
+	/* A muted frame is zeroed when emitted, no need to copy its audio */
+	if (!mute && f->datalen) {
+		memcpy(slot->fr.data.ptr, f->data.ptr, f->datalen);
+	}
+	slot->muted = mute;
+	slot->valid = 1;
+	return 0;
 }
 
 /*!
- * \brief Shifts frames: frame_queue->lastf2 -> return value, lastf1 -> lastf2, f -> lastf1.
- * \param frame_queue - the rpt structure
- * \param f - the frame to be stored in lastf1
- * \param mute - if true, the frame is muted by filling f, lastf1 and lastf2 with zeros
- * \note If muted, lastf1, lastf2 and f are filled with zeros before shifting the frames, resulting in a muted return frame.
+ * \brief Shifts frames: the oldest queued frame is returned and f is queued in its place.
+ * \param frame_queue - the frame queue
+ * \param f - the frame to be queued
+ * \param mute - if true, f and every frame still in the queue are muted
+ * \param trace - if not NULL, the trace stamp of f, replaced with the stamp of the returned frame
+ * \note The returned frame belongs to the queue and stays valid until the next call,
+ * callers must not free it.  Muted frames are zeroed when they are returned.
  */
-static inline struct ast_frame *rpt_frame_queue_helper(struct rpt_frame_queue *frame_queue, struct ast_frame *f, int mute)
+static inline struct ast_frame *rpt_frame_queue_helper(struct rpt_frame_queue *frame_queue, struct ast_frame *f, int mute,
+	unsigned long long *trace)
 {
-	struct ast_frame *last_frame;
+	struct rpt_frame_slot *last_slot, *new_slot;
 
 	if (mute) {
 		RPT_MUTE_FRAME(f);
 		rpt_frame_queue_mute(frame_queue);
 	}
-	last_frame = frame_queue->lastf2;
-	frame_queue->lastf2 = frame_queue->lastf1;
-	frame_queue->lastf1 = f ? ast_frdup(f) : NULL;
-	return last_frame;
+	last_slot = &frame_queue->slots[(frame_queue->newest + RPT_FRAME_QUEUE_SLOTS - 1) % RPT_FRAME_QUEUE_SLOTS];
+	new_slot = &frame_queue->slots[(frame_queue->newest + 1) % RPT_FRAME_QUEUE_SLOTS];
+	frame_queue->newest = (frame_queue->newest + 1) % RPT_FRAME_QUEUE_SLOTS;
+	new_slot->valid = 0;
+	if (f) {
+		rpt_frame_slot_store(new_slot, f, mute);
+	}
+	new_slot->trace = trace ? *trace : 0;
+	if (trace) {
+		*trace = last_slot->valid ? last_slot->trace : 0;
+	}
+	if (!last_slot->valid) {
+		return NULL;
+	}
+	last_slot->valid = 0;
+	if (last_slot->muted) {
+		ast_frame_clear(&last_slot->fr);
+	}
+	return &last_slot->fr;
 }
 
 /*!
- * \brief Free frame_queue frames
+ * \brief Free frame_queue buffers
  * \param frame_queue The rpt_frame_queue structure to free
  */
 static inline void rpt_frame_queue_free(struct rpt_frame_queue *frame_queue)
 {
-	free_frame(&frame_queue->lastf1);
-	free_frame(&frame_queue->lastf2);
+	int i;
+
+	for (i = 0; i < RPT_FRAME_QUEUE_SLOTS; i++) {
+		struct rpt_frame_slot *slot = &frame_queue->slots[i];
+
+		ao2_cleanup(slot->fr.subclass.format);
+		ast_free(slot->buf);
+		memset(slot, 0, sizeof(*slot));
+	}
+	frame_queue->newest = 0;
 }
 
 static int rxchannel_qwrite_cb(void *obj, void *arg, int flags)
 {
 	struct rpt_link *link = obj;
-	struct ast_frame *wf = arg;
+	struct rpt_text_payload *payload = arg;
 
 	/* Dont send to other then IAXRPT client */
 	if ((link->name[0] != '0') || (link->phonemode)) {
 		return 0;
 	}
 	if (link->chan) {
-		rpt_qwrite(link, wf);
+		rpt_qwrite_payload(link, payload);
+	}
+	return 0;
+}
+
+/*! \brief Check and close parrot files if needed */
+static inline void check_parrot(struct rpt *myrpt)
+{
+	if (!(myrpt->p.parrotmode != PARROT_MODE_OFF || myrpt->parrotonce)) {
+		char myfname[300];
+
+		if (myrpt->parrotstream) {
+			ast_closestream(myrpt->parrotstream);
+			myrpt->parrotstream = NULL;
+		}
+
+		snprintf(myfname, sizeof(myfname), PARROTFILE ".wav", myrpt->name, myrpt->parrotcnt);
+		unlink(myfname);
+	}
+}
+
+/*! \brief Reset the rx burst tone detector */
+static void rx_burst_reset(struct rpt *myrpt)
+{
+#ifdef NATIVE_DSP
+	/*!
+	 * \brief this zeros out energy and lasthit, but not hit_count. If this proves to be a problem, we can add API to do that.
+	 * \todo we need to goertzel_reset on the tone, e.g. we need to add an ast_dsp_freqreset
+	 * \todo this may also fix the problem in app_sf where to be reliable we have to free on each match. Test and see
+	 */
+	ast_dsp_digitreset(myrpt->dsp); /* NOTE: THIS IS WRONG! See comment above. */
+#else
+	rpt_goertzel_reset(&myrpt->burst_tone_state.tone);
+	myrpt->burst_tone_state.last_hit = 0;
+	myrpt->burst_tone_state.hit_count = 0;
+#endif
+}
+
+/*!
+ * \brief Run the rx burst tone detector on a frame
+ * \param myrpt
+ * \param chan Channel the frame came from, or NULL on the DSP worker
+ * \param f Voice frame, left alone
+ * \retval 1 if the tone is present
+ */
+static int rx_burst_detect(struct rpt *myrpt, struct ast_channel *chan, struct ast_frame *f)
+{
+#ifdef NATIVE_DSP
+	struct ast_frame *frame = NULL;
+	struct ast_frame *f_dup;
+	int i = 0;
+
+	/* leave f alone */
+	f_dup = ast_frdup(f);
+	if (f_dup) {
+		frame = ast_dsp_process(chan, myrpt->dsp, f_dup);
+		i = (frame->frametype == AST_FRAME_DTMF && frame->subclass.integer == 'q') ? 1 : 0; /* q indicates frequency hit */
+		ast_frfree(frame);
+	}
+	return i;
+#else
+	return tone_detect(&myrpt->burst_tone_state, f->data.ptr, f->samples);
+#endif
+}
+
+/*! \brief Act on the rx burst tone detector's result for a frame */
+static void rx_burst(struct rpt *myrpt, int i)
+{
+	ast_debug(1, "Node %s got %d Hz Rx Burst\n", myrpt->name, myrpt->p.rxburstfreq);
+	if ((!i) && myrpt->lastrxburst) {
+		ast_debug(1, "Node %s now keyed after Rx Burst\n", myrpt->name);
+		myrpt->linkactivitytimer = 0;
+		rpt_keyed(myrpt, 1);
+	}
+	myrpt->lastrxburst = i;
+}
+
+#ifdef _MDC_DECODE_H_
+/*!
+ * \brief Run the MDC-1200 decoder on received audio
+ * \param myrpt
+ * \param samples Signed linear audio
+ * \param nsamples Number of samples
+ * \param[out] ev Filled in with the packet
+ * \retval 1 if a packet was decoded
+ */
+static int rx_mdc_decode(struct rpt *myrpt, int16_t *samples, int nsamples, struct rpt_dsp_event *ev)
+{
+	memset(ev, 0, sizeof(*ev));
+	ev->type = RPT_DSP_MDC;
+	ev->packet = mdc_decoder_process_samples(myrpt->mdc, samples, nsamples);
+	if (ev->packet == 1) {
+		mdc_decoder_get_packet(myrpt->mdc, &ev->op, &ev->arg, &ev->unitID);
+	} else if (ev->packet == 2) {
+		mdc_decoder_get_double_packet(myrpt->mdc, &ev->op, &ev->arg, &ev->unitID, &ev->extra[0], &ev->extra[1], &ev->extra[2],
+			&ev->extra[3]);
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+/*! \brief Act on a received MDC-1200 packet */
+static void rx_mdc(struct rpt *myrpt, const struct rpt_dsp_event *ev)
+{
+	if (ev->packet == 1) {
+		unsigned char op = ev->op, arg = ev->arg;
+		unsigned short unitID = ev->unitID;
+		char ustr[16];
+
+		ast_debug(2, "Got MDC-1200 (single-length) packet on node %s:\n", myrpt->name);
+		ast_debug(2, "op: %02x, arg: %02x, UnitID: %04x\n", op & 255, arg & 255, unitID);
+		/* if for PTT ID */
+		if ((op == 1) && ((arg == 0) || (arg == 0x80))) {
+			myrpt->lastunit = unitID;
+			snprintf(ustr, sizeof(ustr), "I%04X", unitID);
+			mdc1200_notify(myrpt, NULL, ustr);
+			mdc1200_send(myrpt, ustr);
+			mdc1200_cmd(myrpt, ustr);
+		}
+		/* if for EMERGENCY */
+		if ((op == 0) && ((arg == 0x81) || (arg == 0x80))) {
+			myrpt->lastunit = unitID;
+			snprintf(ustr, sizeof(ustr), "E%04X", unitID);
+			mdc1200_notify(myrpt, NULL, ustr);
+			mdc1200_send(myrpt, ustr);
+			mdc1200_cmd(myrpt, ustr);
+		}
+		/* if for Stun ACK W9CR */
+		if ((op == 0x0b) && (arg == 0x00)) {
+			myrpt->lastunit = unitID;
+			snprintf(ustr, sizeof(ustr), "STUN ACK %04X", unitID);
+		}
+		/* if for STS (status)  */
+		if (op == 0x46) {
+			myrpt->lastunit = unitID;
+			snprintf(ustr, sizeof(ustr), "S%04X-%X", unitID, arg & 0xf);
+
+#ifdef _MDC_ENCODE_H_
+			mdc1200_ack_status(myrpt, unitID);
+#endif
+			mdc1200_notify(myrpt, NULL, ustr);
+			mdc1200_send(myrpt, ustr);
+			mdc1200_cmd(myrpt, ustr);
+		}
+	} else if (ev->packet == 2) {
+		unsigned char op = ev->op, arg = ev->arg;
+		unsigned char ex1 = ev->extra[0], ex2 = ev->extra[1], ex3 = ev->extra[2], ex4 = ev->extra[3];
+		unsigned short unitID = ev->unitID;
+		char ustr[20];
+
+		ast_debug(2, "Got MDC-1200 (double-length) packet on node %s:\n", myrpt->name);
+		ast_debug(2, "op: %02x, arg: %02x, UnitID: %04x\n", op & 255, arg & 255, unitID);
+		ast_debug(2, "ex1: %02x, ex2: %02x, ex3: %02x, ex4: %02x\n", ex1 & 255, ex2 & 255, ex3 & 255, ex4 & 255);
+		/* if for SelCall or Alert */
+		if ((op == 0x35) && (arg = 0x89)) {
+			/* if is Alert */
+			if (ex1 & 1)
+				snprintf(ustr, sizeof(ustr), "A%02X%02X-%04X", ex3 & 255, ex4 & 255, unitID);
+			/* otherwise is selcall */
+			else
+				snprintf(ustr, sizeof(ustr), "S%02X%02X-%04X", ex3 & 255, ex4 & 255, unitID);
+			mdc1200_notify(myrpt, NULL, ustr);
+			mdc1200_send(myrpt, ustr);
+			mdc1200_cmd(myrpt, ustr);
+		}
+	}
+}
+#endif
+
+/*! \brief Detectors to run on a frame queued for the DSP worker */
+#define RX_DSP_BURST (1 << 0)		/*!< \brief Rx burst tone detector */
+#define RX_DSP_BURST_RESET (1 << 1) /*!< \brief Reset the rx burst tone detector */
+#define RX_DSP_MDC (1 << 2)			/*!< \brief MDC-1200 decoder */
+
+/*! \brief Run the rx detectors on a frame, on the DSP worker */
+static void rx_dsp_detect(struct rpt_dsp_worker *worker, void *data, int16_t *samples, int nsamples, unsigned int flags)
+{
+	struct rpt *myrpt = data;
+	struct rpt_dsp_event ev;
+
+	if (flags & RX_DSP_BURST_RESET) {
+		rx_burst_reset(myrpt);
+	}
+	if (flags & RX_DSP_BURST) {
+		struct ast_frame f = {
+			.frametype = AST_FRAME_VOICE,
+			.subclass.format = ast_format_slin,
+			.data.ptr = samples,
+			.datalen = nsamples * 2,
+			.samples = nsamples,
+			.src = "rpt_dsp",
+		};
+
+		memset(&ev, 0, sizeof(ev));
+		ev.type = RPT_DSP_RXBURST;
+		ev.hit = rx_burst_detect(myrpt, NULL, &f);
+		rpt_dsp_worker_post(worker, &ev);
+	}
+#ifdef _MDC_DECODE_H_
+	if ((flags & RX_DSP_MDC) && rx_mdc_decode(myrpt, samples, nsamples, &ev)) {
+		rpt_dsp_worker_post(worker, &ev);
 	}
-	return 0;
+#endif
 }
 
-/*! \brief Check and close parrot files if needed */
-static inline void check_parrot(struct rpt *myrpt)
+/*! \brief Act on what the DSP worker found, on the node thread */
+static void rx_dsp_events(struct rpt *myrpt)
 {
-	if (!(myrpt->p.parrotmode != PARROT_MODE_OFF || myrpt->parrotonce)) {
-		char myfname[300];
+	struct rpt_dsp_event ev;
 
-		if (myrpt->parrotstream) {
-			ast_closestream(myrpt->parrotstream);
-			myrpt->parrotstream = NULL;
+	while (rpt_dsp_worker_event(myrpt->dspworker, &ev)) {
+		switch (ev.type) {
+		case RPT_DSP_RXBURST:
+			/* The node may have keyed or unkeyed since the frame was queued */
+			if (myrpt->reallykeyed && !myrpt->keyed) {
+				rx_burst(myrpt, ev.hit);
+			}
+			break;
+		case RPT_DSP_MDC:
+#ifdef _MDC_DECODE_H_
+			rx_mdc(myrpt, &ev);
+#endif
+			break;
 		}
-
-		snprintf(myfname, sizeof(myfname), PARROTFILE ".wav", myrpt->name, myrpt->parrotcnt);
-		unlink(myfname);
 	}
 }
 
@@ -4040,49 +3927,25 @@ static inline int rxchannel_read(struct rpt *myrpt, const int lasttx)
 
 	if (f->frametype == AST_FRAME_VOICE) {
 #ifdef _MDC_DECODE_H_
-		unsigned char ubuf[2560];
-		short *sp;
-		int n;
+		struct rpt_dsp_event dspevent;
 #endif
+		unsigned int dspflags = 0;
+		unsigned long long trace;
+
+		rpt_perf_voice(myrpt->perf, RPT_PERF_RXVOICE);
+		trace = rpt_trace_sample(myrpt->trace ? &myrpt->trace->stats : NULL);
 		if (myrpt->p.rxburstfreq) {
 			if ((!myrpt->reallykeyed) || myrpt->keyed) {
 				myrpt->lastrxburst = 0;
-#ifdef NATIVE_DSP
-				/*!
-				 * \brief this zeros out energy and lasthit, but not hit_count. If this proves to be a problem, we can add API to do that.
-				 * \todo we need to goertzel_reset on the tone, e.g. we need to add an ast_dsp_freqreset
-				 * \todo this may also fix the problem in app_sf where to be reliable we have to free on each match. Test and see
-				 */
-				ast_dsp_digitreset(myrpt->dsp); /* NOTE: THIS IS WRONG! See comment above. */
-#else
-				goertzel_reset(&myrpt->burst_tone_state.tone);
-				myrpt->burst_tone_state.last_hit = 0;
-				myrpt->burst_tone_state.hit_count = 0;
-				myrpt->burst_tone_state.energy = 0.0;
-#endif
-			} else {
-#ifdef NATIVE_DSP
-				struct ast_frame *frame = NULL;
-				struct ast_frame *f_dup;
-
-				i = 0;
-				/* leave f alone */
-				f_dup = ast_frdup(f);
-				if (f_dup) {
-					frame = ast_dsp_process(myrpt->rxchannel, myrpt->dsp, f_dup);
-					i = (frame->frametype == AST_FRAME_DTMF && frame->subclass.integer == 'q') ? 1 : 0; /* q indicates frequency hit */
-					ast_frfree(frame);
-				}
-#else
-				i = tone_detect(&myrpt->burst_tone_state, f->data.ptr, f->samples);
-#endif
-				ast_debug(1, "Node %s got %d Hz Rx Burst\n", myrpt->name, myrpt->p.rxburstfreq);
-				if ((!i) && myrpt->lastrxburst) {
-					ast_debug(1, "Node %s now keyed after Rx Burst\n", myrpt->name);
-					myrpt->linkactivitytimer = 0;
-					rpt_keyed(myrpt, 1);
+				if (myrpt->dspworker) {
+					dspflags |= RX_DSP_BURST_RESET;
+				} else {
+					rx_burst_reset(myrpt);
 				}
-				myrpt->lastrxburst = i;
+			} else if (myrpt->dspworker) {
+				dspflags |= RX_DSP_BURST;
+			} else {
+				rx_burst(myrpt, rx_burst_detect(myrpt, myrpt->rxchannel, f));
 			}
 		}
 		if (myrpt->p.dtmfkey) {
@@ -4101,81 +3964,18 @@ static inline int rxchannel_read(struct rpt *myrpt, const int lasttx)
 		if (!myrpt->reallykeyed) {
 			RPT_MUTE_FRAME(f);
 		}
-		sp = (short *) f->data.ptr;
-		/* convert block to unsigned char */
-		for (n = 0; n < f->datalen / 2; n++) {
-			ubuf[n] = (*sp++ >> 8) + 128;
-		}
-		n = mdc_decoder_process_samples(myrpt->mdc, ubuf, f->datalen / 2);
-		if (n == 1) {
-			unsigned char op, arg;
-			unsigned short unitID;
-			char ustr[16];
-
-			mdc_decoder_get_packet(myrpt->mdc, &op, &arg, &unitID);
-			ast_debug(2, "Got MDC-1200 (single-length) packet on node %s:\n", myrpt->name);
-			ast_debug(2, "op: %02x, arg: %02x, UnitID: %04x\n", op & 255, arg & 255, unitID);
-			/* if for PTT ID */
-			if ((op == 1) && ((arg == 0) || (arg == 0x80))) {
-				myrpt->lastunit = unitID;
-				snprintf(ustr, sizeof(ustr), "I%04X", unitID);
-				mdc1200_notify(myrpt, NULL, ustr);
-				mdc1200_send(myrpt, ustr);
-				mdc1200_cmd(myrpt, ustr);
-			}
-			/* if for EMERGENCY */
-			if ((op == 0) && ((arg == 0x81) || (arg == 0x80))) {
-				myrpt->lastunit = unitID;
-				snprintf(ustr, sizeof(ustr), "E%04X", unitID);
-				mdc1200_notify(myrpt, NULL, ustr);
-				mdc1200_send(myrpt, ustr);
-				mdc1200_cmd(myrpt, ustr);
-			}
-			/* if for Stun ACK W9CR */
-			if ((op == 0x0b) && (arg == 0x00)) {
-				myrpt->lastunit = unitID;
-				snprintf(ustr, sizeof(ustr), "STUN ACK %04X", unitID);
-			}
-			/* if for STS (status)  */
-			if (op == 0x46) {
-				myrpt->lastunit = unitID;
-				snprintf(ustr, sizeof(ustr), "S%04X-%X", unitID, arg & 0xf);
-
-#ifdef _MDC_ENCODE_H_
-				mdc1200_ack_status(myrpt, unitID);
-#endif
-				mdc1200_notify(myrpt, NULL, ustr);
-				mdc1200_send(myrpt, ustr);
-				mdc1200_cmd(myrpt, ustr);
-			}
-		}
-		if (n == 2) {
-			unsigned char op, arg, ex1, ex2, ex3, ex4;
-			unsigned short unitID;
-			char ustr[20];
-
-			mdc_decoder_get_double_packet(myrpt->mdc, &op, &arg, &unitID, &ex1, &ex2, &ex3, &ex4);
-			ast_debug(2, "Got MDC-1200 (double-length) packet on node %s:\n", myrpt->name);
-			ast_debug(2, "op: %02x, arg: %02x, UnitID: %04x\n", op & 255, arg & 255, unitID);
-			ast_debug(2, "ex1: %02x, ex2: %02x, ex3: %02x, ex4: %02x\n", ex1 & 255, ex2 & 255, ex3 & 255, ex4 & 255);
-			/* if for SelCall or Alert */
-			if ((op == 0x35) && (arg = 0x89)) {
-				/* if is Alert */
-				if (ex1 & 1)
-					snprintf(ustr, sizeof(ustr), "A%02X%02X-%04X", ex3 & 255, ex4 & 255, unitID);
-				/* otherwise is selcall */
-				else
-					snprintf(ustr, sizeof(ustr), "S%02X%02X-%04X", ex3 & 255, ex4 & 255, unitID);
-				mdc1200_notify(myrpt, NULL, ustr);
-				mdc1200_send(myrpt, ustr);
-				mdc1200_cmd(myrpt, ustr);
-			}
+		if (myrpt->dspworker) {
+			dspflags |= RX_DSP_MDC;
+		} else if (rx_mdc_decode(myrpt, f->data.ptr, f->datalen / 2, &dspevent)) {
+			rx_mdc(myrpt, &dspevent);
 		}
 #endif
-#ifdef __RPT_NOTCH
+		if (dspflags) {
+			/* The detectors run on the DSP worker, the frame carries on without waiting */
+			rpt_dsp_worker_queue(myrpt->dspworker, f->data.ptr, f->datalen / 2, dspflags);
+		}
 		/* apply inbound filters, if any */
-		rpt_filter(myrpt, f->data.ptr, f->datalen / 2);
-#endif
+		rpt_notch_process(&myrpt->notch, f->data.ptr, f->datalen / 2);
 		if ((!myrpt->localtx) && /* (!myrpt->p.linktolink) && */
 			(!myrpt->localoverride)) {
 			RPT_MUTE_FRAME(f);
@@ -4210,9 +4010,15 @@ static inline int rxchannel_read(struct rpt *myrpt, const int lasttx)
 		if (myrpt->p.votertype == 1 && myrpt->voted_link != NULL) {
 			ismuted = 1;
 		}
-		f1 = rpt_frame_queue_helper(&myrpt->frame_queue, f, ismuted);
+		f1 = rpt_frame_queue_helper(&myrpt->frame_queue, f, ismuted, &trace);
 		if (f1) {
 			ast_write(myrpt->localoverride ? myrpt->txpchannel : myrpt->rxpchannel, f1);
+			if (trace) {
+				unsigned long long now = rpt_perf_now();
+
+				rpt_trace_add(&myrpt->trace->stats, RPT_TRACE_RX_QUEUE, now - trace);
+				rpt_trace_mark(&myrpt->trace->rx, trace, now, NULL);
+			}
 			if (((myrpt->p.duplex < 2 && !myrpt->txkeyed) || myrpt->p.duplex == 3) && myrpt->keyed) {
 				if (myrpt->monstream) {
 					ast_writestream(myrpt->monstream, f1);
@@ -4224,7 +4030,6 @@ static inline int rxchannel_read(struct rpt *myrpt, const int lasttx)
 			if ((myrpt->p.duplex < 2) && myrpt->keyed && myrpt->p.outstreamcmd && (myrpt->outstreampipe[1] != -1)) {
 				outstream_write(myrpt, f1);
 			}
-			ast_frfree(f1);
 		}
 	} else if (f->frametype == AST_FRAME_DTMF_BEGIN) {
 		rpt_frame_queue_mute(&myrpt->frame_queue);
@@ -4424,6 +4229,7 @@ static inline int rxchannel_read(struct rpt *myrpt, const int lasttx)
 			if (!strcmp(f->data.ptr, "ENDPAGE")) {
 				myrpt->paging = ast_tv(0, 0);
 			} else {
+				struct rpt_text_payload *payload;
 				struct ast_frame wf = {
 					.frametype = AST_FRAME_TEXT,
 					.src = __PRETTY_FUNCTION__,
@@ -4432,12 +4238,14 @@ static inline int rxchannel_read(struct rpt *myrpt, const int lasttx)
 				snprintf(str, sizeof(str), "V %s %s", myrpt->name, (char *) f->data.ptr);
 				wf.datalen = strlen(str) + 1;
 				wf.data.ptr = str;
+				payload = rpt_text_payload_alloc(&wf);
 				rpt_mutex_lock(&myrpt->lock);
 				/* otherwise, send it to all of em */
-				if (myrpt->links) {
-					ao2_callback(myrpt->links, OBJ_MULTIPLE | OBJ_NODATA, rxchannel_qwrite_cb, &wf);
+				if (payload && myrpt->links) {
+					ao2_callback(myrpt->links, OBJ_MULTIPLE | OBJ_NODATA, rxchannel_qwrite_cb, payload);
 				}
 				rpt_mutex_unlock(&myrpt->lock);
+				ao2_cleanup(payload);
 			}
 		}
 	}
@@ -4500,54 +4308,39 @@ static inline int localtxchannel_read(struct rpt *myrpt, char *restrict myfirst)
 		return -1;
 	}
 	if (f->frametype == AST_FRAME_VOICE) {
-		struct ast_frame *f1;
+		struct rpt_trace_stats *linktrace = NULL;
+		unsigned long long t0 = 0, tconf = 0, now;
+		int traced;
 
+		traced = myrpt->trace && rpt_trace_take(&myrpt->trace->tx, &myrpt->trace->stats.seen, &t0, &tconf, &linktrace);
+		if (traced) {
+			now = rpt_perf_now();
+			rpt_trace_add(linktrace, RPT_TRACE_TX_CONF, now - tconf);
+			rpt_trace_add(&myrpt->trace->stats, RPT_TRACE_TX_CONF, now - tconf);
+		}
 		if (myrpt->p.duplex < 2) {
-			int x;
+			int preroll = 0;
+
 			if (myrpt->txrealkeyed) {
 				if (!*myfirst && (myrpt->callmode != CALLMODE_DOWN)) {
-					x = 0;
-					AST_LIST_TRAVERSE(&myrpt->txq, f1, frame_list) {
-						x++;
-					}
-
-					for (; x < myrpt->p.simplexpatchdelay; x++) {
-						f1 = ast_frdup(f);
-						if (!f1) {
-							return 0;
-						}
-						RPT_MUTE_FRAME(f1);
-						memset(&f1->frame_list, 0, sizeof(f1->frame_list));
-						AST_LIST_INSERT_TAIL(&myrpt->txq, f1, frame_list);
-					}
+					preroll = myrpt->p.simplexpatchdelay;
 					*myfirst = 1;
 				}
-				f1 = ast_frdup(f);
-				if (!f1) {
-					return 0;
-				}
-				memset(&f1->frame_list, 0, sizeof(f1->frame_list));
-				AST_LIST_INSERT_TAIL(&myrpt->txq, f1, frame_list);
 			} else {
 				*myfirst = 0;
 			}
-			x = 0;
-			AST_LIST_TRAVERSE(&myrpt->txq, f1, frame_list) {
-				x++;
-			}
-
-			if (!x) {
-				RPT_MUTE_FRAME(f);
-			} else {
-				ast_frfree(f);
-				f = AST_LIST_REMOVE_HEAD(&myrpt->txq, frame_list);
-			}
+			rpt_delay_line_frame(&myrpt->txq, f, myrpt->txrealkeyed, preroll);
 		} else {
-			while ((f1 = AST_LIST_REMOVE_HEAD(&myrpt->txq, frame_list))) {
-				ast_frfree(f1);
-			}
+			rpt_delay_line_reset(&myrpt->txq);
 		}
 		ast_write(myrpt->txchannel, f);
+		rpt_perf_voice(myrpt->perf, RPT_PERF_TXVOICE);
+		if (traced) {
+			now = rpt_perf_now();
+			rpt_trace_add(linktrace, RPT_TRACE_TX_TOTAL, now - t0);
+			rpt_trace_add(&myrpt->trace->stats, RPT_TRACE_TX_TOTAL, now - t0);
+			ao2_cleanup(linktrace);
+		}
 	}
 	return hangup_frame_helper(myrpt->localtxchannel, "localtxchannel", f);
 }
@@ -4578,18 +4371,27 @@ static inline void hangup_link_chan(struct rpt_link *l)
 /*!
  * \internal
  * \brief Final cleanup of link prior to node termination
- * \return 0 if disconnected hangup, 1 if reconnect possible
+ * \param defer For a pooled link, keep the link channel up and let the link worker finish later
+ * \return 0 if disconnected hangup, 1 if reconnect possible (or deferred)
  */
-static int remote_hangup_helper(struct rpt *myrpt, struct rpt_link *l)
+static int remote_hangup_helper(struct rpt *myrpt, struct rpt_link *l, int defer)
 {
-	if (l->chan) {
+	if (l->chan && l->pooled) {
+		/* A link worker can't sleep here without stalling its other links,
+		 * it keeps the link around instead while the text messages are sent */
+		link_process_textq(l);
+		if (defer) {
+			l->hangupdelay = MSWAIT * 10;
+			return 1;
+		}
+	} else if (l->chan) {
 		/* This will be a "long" delay, dump any audio in the l->pchan
 		 * as we are now about to close down the link channel.  If we don't
 		 * autoservice, l->pchan can report long voice queue and add unnecessary delay audio
 		 * on a reconnect
 		 */
 		ast_autoservice_start(l->pchan);
-		link_process_textq(myrpt, l);
+		link_process_textq(l);
 		ast_safe_sleep(l->chan, MSWAIT * 10); /* Allow the channel to send the text messages */
 		ast_autoservice_stop(l->pchan);
 	}
@@ -4601,6 +4403,7 @@ static int remote_hangup_helper(struct rpt *myrpt, struct rpt_link *l)
 	if (ast_str_strlen(l->linklist) > 0) {
 		rpt_mutex_lock(&myrpt->lock);
 		ast_str_reset(l->linklist);
+		rpt_linklist_changed(myrpt);
 		rpt_mutex_unlock(&myrpt->lock);
 		rpt_update_links(myrpt);
 	}
@@ -4632,6 +4435,7 @@ static int remote_hangup_helper(struct rpt *myrpt, struct rpt_link *l)
 				l->connecttime = ast_tv(0, 0); /* no longer connected */
 				l->lastkeytime = 0;
 				l->thisconnected = 0;
+				rpt_linklist_changed(myrpt);
 				rpt_mutex_unlock(&myrpt->lock);
 				return 1;
 			}
@@ -4649,343 +4453,313 @@ static inline void rxkey_helper(struct rpt *myrpt, struct rpt_link *l)
 	if (!l->lastrx1) {
 		donodelog_fmt(myrpt, "RXKEY,%s", l->name);
 		l->lastrx1 = 1;
+		rpt_linklist_changed(myrpt);
 		rpt_update_links(myrpt);
 		time(&l->lastkeytime);
 	}
 }
 
-void process_link_channel(struct rpt *myrpt, struct rpt_link *l)
+int process_link_activity(struct rpt *myrpt, struct rpt_link *l, struct ast_channel *who)
 {
-	struct ast_channel *who;
-	struct rpt_link *m;
-	int n = 0, ms = MSWAIT, myfirst = 0;
-	struct ast_channel *cs[2];
 	struct ast_frame wf = {
 		.frametype = AST_FRAME_CNG,
 		.src = __PRETTY_FUNCTION__,
 	};
-	struct ao2_iterator l_it;
 	int totx;
 	int remnomute, remrx;
 	struct timeval now;
-	struct timeval looptimestart;
-
-	looptimestart = rpt_tvnow();
-
-	while (ms >= 0 && l->disced == RPT_LINK_DISCONNECT_NONE) {
-		ms = MSWAIT;
-		n = 0;
-		cs[n++] = l->pchan;
-		if (l->chan) {
-			cs[n++] = l->chan;
-		}
-		who = ast_waitfor_n(cs, n, &ms);
-		periodic_process_link(myrpt, l, rpt_time_elapsed(&looptimestart));
-		if (!ms) {
-			/* No channels had activity before the timer expired,
-			 * so just continue to the next loop. */
-			continue;
-		}
 
-		remrx = 0;
-		/* see if any other links are receiving */
-		rpt_mutex_lock(&myrpt->lock);
-		RPT_LIST_TRAVERSE(myrpt->links, m, l_it) {
-			/* if not the link we are currently processing, and not localonly count it */
-			if ((m != l) && (m->lastrx) && (m->mode < 2)) {
-				remrx = 1;
-			}
-		}
-		ao2_iterator_destroy(&l_it);
-		rpt_mutex_unlock(&myrpt->lock);
+	/* see if any other links (not localonly) are receiving */
+	remrx = (ast_atomic_fetchadd_int(&myrpt->rxlinks, 0) - l->rxcounted) > 0;
 
-		now = rpt_tvnow();
-		if ((who == l->chan) || (!l->lastlinktv.tv_sec) || (ast_tvdiff_ms(now, l->lastlinktv) >= 19)) {
-			char mycalltx;
+	now = rpt_tvnow();
+	if ((who == l->chan) || (!l->lastlinktv.tv_sec) || (ast_tvdiff_ms(now, l->lastlinktv) >= 19)) {
+		char mycalltx;
 
-			l->lastlinktv = now;
-			remnomute = myrpt->localtx && (!(myrpt->cmdnode[0] || (myrpt->dtmfidx > -1)));
-			mycalltx = myrpt->callmode;
+		l->lastlinktv = now;
+		remnomute = myrpt->localtx && (!(myrpt->cmdnode[0] || (myrpt->dtmfidx > -1)));
+		mycalltx = myrpt->callmode;
 #ifdef DONT_USE__CAUSES_CLIPPING_OF_FIRST_SYLLABLE_ON_LINK
-			if (myrpt->patchvoxalways)
-				mycalltx = mycalltx && ((!myrpt->voxtostate) && myrpt->wasvox);
+		if (myrpt->patchvoxalways)
+			mycalltx = mycalltx && ((!myrpt->voxtostate) && myrpt->wasvox);
 #endif
-			totx = ((l->isremote) ? (remnomute) : (myrpt->localtx && myrpt->totimer) || mycalltx) || remrx;
+		totx = ((l->isremote) ? (remnomute) : (myrpt->localtx && myrpt->totimer) || mycalltx) || remrx;
 
-			/* foop */
-			if ((!l->lastrx) && altlink(myrpt, l))
-				totx = myrpt->txkeyed;
-			if (altlink1(myrpt, l))
-				totx = 1;
-			l->wouldtx = totx;
-			if (l->mode != MODE_TRANSCEIVE) {
-				totx = 0;
-			}
-			if (l->phonemode == RPT_PHONE_MODE_NONE && l->chan && (l->lasttx != totx)) {
-				if (totx && !l->voterlink) {
-					if (l->link_newkey != RADIO_KEY_NOT_ALLOWED)
-						ast_indicate(l->chan, AST_CONTROL_RADIO_KEY);
-				} else {
-					ast_indicate(l->chan, AST_CONTROL_RADIO_UNKEY);
-					if (l->last_frame_sent) {
-						ast_write(l->chan, &wf);
-						l->last_frame_sent = 0;
-					}
+		/* foop */
+		if ((!l->lastrx) && altlink(myrpt, l))
+			totx = myrpt->txkeyed;
+		if (altlink1(myrpt, l))
+			totx = 1;
+		l->wouldtx = totx;
+		if (l->mode != MODE_TRANSCEIVE) {
+			totx = 0;
+		}
+		if (l->phonemode == RPT_PHONE_MODE_NONE && l->chan && (l->lasttx != totx)) {
+			if (totx && !l->voterlink) {
+				if (l->link_newkey != RADIO_KEY_NOT_ALLOWED)
+					ast_indicate(l->chan, AST_CONTROL_RADIO_KEY);
+			} else {
+				ast_indicate(l->chan, AST_CONTROL_RADIO_UNKEY);
+				if (l->last_frame_sent) {
+					ast_write(l->chan, &wf);
+					l->last_frame_sent = 0;
 				}
-				donodelog_fmt(myrpt, totx ? "TXKEY,%s" : "TXUNKEY,%s", l->name);
 			}
-			l->lasttx = totx;
+			donodelog_fmt(myrpt, totx ? "TXKEY,%s" : "TXUNKEY,%s", l->name);
 		}
+		l->lasttx = totx;
+	}
 
-		if (who == l->chan) { /* if it was a read from rx */
-			struct ast_frame *f;
-			f = ast_read(l->chan);
-			if (!f) {
-				ast_debug(3, "Failed to read frame on %s, must've hung up\n", ast_channel_name(l->chan));
-				/* If IAX disappears, keep running to attempt reconnect if possible */
-				if (remote_hangup_helper(myrpt, l)) {
-					/* A reconnect is possible */
-					continue;
+	if (who == l->chan) { /* if it was a read from rx */
+		struct ast_frame *f;
+		f = ast_read(l->chan);
+		if (!f) {
+			ast_debug(3, "Failed to read frame on %s, must've hung up\n", ast_channel_name(l->chan));
+			/* If IAX disappears, keep running to attempt reconnect if possible */
+			if (remote_hangup_helper(myrpt, l, 1)) {
+				/* A reconnect is possible */
+				return 0;
+			}
+			/* A reconnect is not possible */
+			return -1;
+		}
+		if (f->frametype == AST_FRAME_VOICE) {
+			int ismuted, n1;
+			float fac;
+			unsigned long long trace = rpt_trace_sample(l->trace);
+
+			fac = 1.0;
+			if (l->chan) {
+				if (CHAN_TECH(l->chan, "echolink")) {
+					fac = myrpt->p.erxgain;
+				} else if (CHAN_TECH(l->chan, "tlb")) {
+					fac = myrpt->p.trxgain;
+				}
+			}
+			if ((myrpt->p.linkmongain != 1.0) && (l->mode != MODE_TRANSCEIVE) && (l->wouldtx))
+				fac *= myrpt->p.linkmongain;
+			if (fac != 1.0) {
+				if (f->data.ptr && (f->samples == f->datalen / 2)) {
+					ast_frame_adjust_volume_float(f, fac);
+				} else {
+					ast_debug(3, "Skip volume adjust on %s, fac = %f, data = %p, datalen = %d, samples = %d, src = %s\n",
+						ast_channel_name(l->chan), fac, f->data.ptr, f->datalen, f->samples, f->src ? f->src : "(nil)");
 				}
-				/* A reconnect is not possible */
-				break;
 			}
-			if (f->frametype == AST_FRAME_VOICE) {
-				int ismuted, n1;
-				float fac;
 
-				fac = 1.0;
-				if (l->chan) {
-					if (CHAN_TECH(l->chan, "echolink")) {
-						fac = myrpt->p.erxgain;
-					} else if (CHAN_TECH(l->chan, "tlb")) {
-						fac = myrpt->p.trxgain;
+			l->rxlingertimer = RX_LINGER_TIME;
+
+			if ((l->link_newkey == RADIO_KEY_NOT_ALLOWED) && (!l->lastrealrx)) {
+				rxkey_helper(myrpt, l);
+			}
+			if (((l->phonemode != RPT_PHONE_MODE_NONE) && (l->phonevox)) || (CHAN_TECH(l->chan, "echolink")) ||
+				(CHAN_TECH(l->chan, "tlb"))) {
+				struct ast_frame *f1;
+				if (l->phonevox) {
+					int preroll = 0;
+					n1 = dovox(&l->vox, f->data.ptr, f->datalen / 2);
+					if (n1 != l->wasvox) {
+						ast_debug(1, "Link Node %s, vox %d\n", l->name, n1);
+						l->wasvox = n1;
+						l->voxtostate = 0;
+						if (n1)
+							l->voxtotimer = myrpt->p.voxtimeout_ms;
+						else
+							l->voxtotimer = 0;
 					}
-				}
-				if ((myrpt->p.linkmongain != 1.0) && (l->mode != MODE_TRANSCEIVE) && (l->wouldtx))
-					fac *= myrpt->p.linkmongain;
-				if (fac != 1.0) {
-					if (f->data.ptr && (f->samples == f->datalen / 2)) {
-						ast_frame_adjust_volume_float(f, fac);
+					if (l->lastrealrx || n1) {
+						if (!l->rxqfirst) {
+							preroll = myrpt->p.simplexphonedelay;
+							l->rxqfirst = 1;
+						}
 					} else {
-						ast_debug(3, "Skip volume adjust on %s, fac = %f, data = %p, datalen = %d, samples = %d, src = %s\n",
-							ast_channel_name(l->chan), fac, f->data.ptr, f->datalen, f->samples, f->src ? f->src : "(nil)");
+						l->rxqfirst = 0;
 					}
+					rpt_delay_line_frame(&l->rxq, f, l->lastrealrx || n1, preroll);
 				}
-
-				l->rxlingertimer = RX_LINGER_TIME;
-
-				if ((l->link_newkey == RADIO_KEY_NOT_ALLOWED) && (!l->lastrealrx)) {
-					rxkey_helper(myrpt, l);
+				ismuted = rpt_conf_get_muted(l->chan, myrpt);
+				/* if not receiving, zero-out audio */
+				ismuted |= (!l->lastrx);
+				if (l->dtmfed &&
+					((l->phonemode != RPT_PHONE_MODE_NONE) || (CHAN_TECH(l->chan, "echolink")) || (CHAN_TECH(l->chan, "tlb")))) {
+					ismuted = 1;
 				}
-				if (((l->phonemode != RPT_PHONE_MODE_NONE) && (l->phonevox)) || (CHAN_TECH(l->chan, "echolink")) ||
-					(CHAN_TECH(l->chan, "tlb"))) {
-					struct ast_frame *f1;
-					if (l->phonevox) {
-						int x;
-						n1 = dovox(&l->vox, f->data.ptr, f->datalen / 2);
-						if (n1 != l->wasvox) {
-							ast_debug(1, "Link Node %s, vox %d\n", l->name, n1);
-							l->wasvox = n1;
-							l->voxtostate = 0;
-							if (n1)
-								l->voxtotimer = myrpt->p.voxtimeout_ms;
-							else
-								l->voxtotimer = 0;
-						}
-						if (l->lastrealrx || n1) {
-							if (!myfirst) {
-								x = 0;
-								AST_LIST_TRAVERSE(&l->rxq, f1, frame_list) {
-									x++;
-								}
-
-								for (; x < myrpt->p.simplexphonedelay; x++) {
-									f1 = ast_frdup(f);
-									if (!f1) {
-										continue; /* Shorten the delay if we fail one */
-									}
-									RPT_MUTE_FRAME(f1);
-									memset(&f1->frame_list, 0, sizeof(f1->frame_list));
-									AST_LIST_INSERT_TAIL(&l->rxq, f1, frame_list);
-								}
-								myfirst = 1;
-							}
-							f1 = ast_frdup(f);
-							if (!f1) {
-								ast_frfree(f);
-								break;
-							}
-							memset(&f1->frame_list, 0, sizeof(f1->frame_list));
-							AST_LIST_INSERT_TAIL(&l->rxq, f1, frame_list);
-						} else {
-							myfirst = 0;
-						}
-						x = 0;
-						AST_LIST_TRAVERSE(&l->rxq, f1, frame_list) {
-							x++;
-						}
-
-						if (!x) {
-							RPT_MUTE_FRAME(f);
-						} else {
-							ast_frfree(f);
-							f = AST_LIST_REMOVE_HEAD(&l->rxq, frame_list);
-						}
-					}
-					ismuted = rpt_conf_get_muted(l->chan, myrpt);
-					/* if not receiving, zero-out audio */
-					ismuted |= (!l->lastrx);
-					if (l->dtmfed &&
-						((l->phonemode != RPT_PHONE_MODE_NONE) || (CHAN_TECH(l->chan, "echolink")) || (CHAN_TECH(l->chan, "tlb")))) {
-						ismuted = 1;
-					}
-					l->dtmfed = 0;
+				l->dtmfed = 0;
 
-					/* if a voting rx link and not the winner, mute audio */
-					if (myrpt->p.votertype == 1 && l->voterlink && myrpt->voted_link != l) {
-						ismuted = 1;
-					}
+				/* if a voting rx link and not the winner, mute audio */
+				if (myrpt->p.votertype == 1 && l->voterlink && myrpt->voted_link != l) {
+					ismuted = 1;
+				}
 
-					f1 = rpt_frame_queue_helper(&l->frame_queue, f, ismuted);
-					if (f1) {
-						ast_write(l->pchan, f1);
-						ast_frfree(f1);
-					}
+				f1 = rpt_frame_queue_helper(&l->frame_queue, f, ismuted, &trace);
+				if (f1) {
+					ast_write(l->pchan, f1);
 				} else {
-					/* if a voting rx link and not the winner, mute audio */
-					ismuted = (myrpt->p.votertype == 1) && l->voterlink && (myrpt->voted_link != l);
-					if (!l->lastrx || ismuted)
-						RPT_MUTE_FRAME(f);
-					ast_write(l->pchan, f);
-				}
-			} else if (f->frametype == AST_FRAME_DTMF_BEGIN) {
-				rpt_frame_queue_mute(&l->frame_queue);
-				l->dtmfed = 1;
-			} else if (f->frametype == AST_FRAME_TEXT) {
-				char *tstr = ast_malloc(f->datalen + 1);
-				if (tstr) {
-					memcpy(tstr, f->data.ptr, f->datalen);
-					tstr[f->datalen] = 0;
-					handle_link_data(myrpt, l, tstr);
-					ast_free(tstr);
-				}
-			} else if (f->frametype == AST_FRAME_DTMF) {
-				rpt_frame_queue_mute(&l->frame_queue);
-				l->dtmfed = 1;
-				handle_link_phone_dtmf(myrpt, l, f->subclass.integer);
-			} else if (f->frametype == AST_FRAME_CONTROL) {
-				if (f->subclass.integer == AST_CONTROL_ANSWER) {
-					char lconnected = l->connected;
-
-					__kickshort(myrpt);
-					myrpt->rxlingertimer = RX_LINGER_TIME;
-					l->connected = 1;
-					l->hasconnected = 1;
-					l->thisconnected = 1;
-					l->elaptime = -1;
-					if (l->phonemode == RPT_PHONE_MODE_NONE) {
-						send_newkey(l->chan);
-					}
-					if (!l->isremote)
-						l->retries = 0;
-					if (!lconnected) {
-						rpt_telemetry(myrpt, CONNECTED, l);
-						if (l->mode == MODE_TRANSCEIVE) {
-							donodelog_fmt(myrpt, "LINKTRX,%s", l->name);
-						} else if (l->mode == MODE_LOCAL_MONITOR) {
-							donodelog_fmt(myrpt, "LINKLOCALMONITOR,%s", l->name);
-						} else {
-							donodelog_fmt(myrpt, "LINKMONITOR,%s", l->name);
-						}
-						rpt_update_links(myrpt);
-						doconpgm(myrpt, l->name);
-					} else
-						l->reconnects++;
-				}
-				/* if RX key */
-				if ((f->subclass.integer == AST_CONTROL_RADIO_KEY) && (l->link_newkey != RADIO_KEY_NOT_ALLOWED)) {
-					rxkey_helper(myrpt, l);
+					trace = 0;
 				}
-				/* if RX un-key */
-				if (f->subclass.integer == AST_CONTROL_RADIO_UNKEY) {
-					rxunkey_helper(myrpt, l);
+			} else {
+				/* if a voting rx link and not the winner, mute audio */
+				ismuted = (myrpt->p.votertype == 1) && l->voterlink && (myrpt->voted_link != l);
+				if (!l->lastrx || ismuted)
+					RPT_MUTE_FRAME(f);
+				ast_write(l->pchan, f);
+			}
+			if (trace && myrpt->trace) {
+				unsigned long long now = rpt_perf_now();
+
+				rpt_trace_add(l->trace, RPT_TRACE_TX_QUEUE, now - trace);
+				rpt_trace_add(&myrpt->trace->stats, RPT_TRACE_TX_QUEUE, now - trace);
+				rpt_trace_mark(&myrpt->trace->tx, trace, now, l->trace);
+			}
+		} else if (f->frametype == AST_FRAME_DTMF_BEGIN) {
+			rpt_frame_queue_mute(&l->frame_queue);
+			l->dtmfed = 1;
+		} else if (f->frametype == AST_FRAME_TEXT) {
+			char *tstr = ast_malloc(f->datalen + 1);
+			if (tstr) {
+				memcpy(tstr, f->data.ptr, f->datalen);
+				tstr[f->datalen] = 0;
+				handle_link_data(myrpt, l, tstr);
+				ast_free(tstr);
+			}
+		} else if (f->frametype == AST_FRAME_DTMF) {
+			rpt_frame_queue_mute(&l->frame_queue);
+			l->dtmfed = 1;
+			handle_link_phone_dtmf(myrpt, l, f->subclass.integer);
+		} else if (f->frametype == AST_FRAME_CONTROL) {
+			if (f->subclass.integer == AST_CONTROL_ANSWER) {
+				char lconnected = l->connected;
+
+				__kickshort(myrpt);
+				myrpt->rxlingertimer = RX_LINGER_TIME;
+				l->connected = 1;
+				l->hasconnected = 1;
+				l->thisconnected = 1;
+				rpt_linklist_changed(myrpt);
+				l->elaptime = -1;
+				if (l->phonemode == RPT_PHONE_MODE_NONE) {
+					send_newkey(l->chan);
 				}
-				if (f->subclass.integer == AST_CONTROL_HANGUP) {
-					ast_frfree(f);
-					ast_debug(3, "Received hangup frame on %s\n", ast_channel_name(l->chan));
-					if (remote_hangup_helper(myrpt, l)) {
-						/* A reconnect is possible */
-						continue;
+				if (!l->isremote)
+					l->retries = 0;
+				if (!lconnected) {
+					rpt_telemetry(myrpt, CONNECTED, l);
+					if (l->mode == MODE_TRANSCEIVE) {
+						donodelog_fmt(myrpt, "LINKTRX,%s", l->name);
+					} else if (l->mode == MODE_LOCAL_MONITOR) {
+						donodelog_fmt(myrpt, "LINKLOCALMONITOR,%s", l->name);
+					} else {
+						donodelog_fmt(myrpt, "LINKMONITOR,%s", l->name);
 					}
-					break;
-				}
+					rpt_update_links(myrpt);
+					doconpgm(myrpt, l->name);
+				} else
+					l->reconnects++;
 			}
-			ast_frfree(f);
-			continue;
-		} else if (who == l->pchan) {
-			struct ast_frame *f;
-			f = ast_read(l->pchan);
-			if (!f) {
-				/* This should never happen, but if it does we need to cleanup */
-				ast_debug(1, "@@@@ rpt:Hung Up\n");
-				break;
+			/* if RX key */
+			if ((f->subclass.integer == AST_CONTROL_RADIO_KEY) && (l->link_newkey != RADIO_KEY_NOT_ALLOWED)) {
+				rxkey_helper(myrpt, l);
 			}
-			if (f->frametype == AST_FRAME_VOICE) {
-				float fac = 1.0;
-				if (l->chan) {
-					if (CHAN_TECH(l->chan, "echolink")) {
-						fac = myrpt->p.etxgain;
-					} else if (CHAN_TECH(l->chan, "tlb")) {
-						fac = myrpt->p.ttxgain;
-					}
+			/* if RX un-key */
+			if (f->subclass.integer == AST_CONTROL_RADIO_UNKEY) {
+				rxunkey_helper(myrpt, l);
+			}
+			if (f->subclass.integer == AST_CONTROL_HANGUP) {
+				ast_frfree(f);
+				ast_debug(3, "Received hangup frame on %s\n", ast_channel_name(l->chan));
+				if (remote_hangup_helper(myrpt, l, 1)) {
+					/* A reconnect is possible */
+					return 0;
 				}
-				if (fac != 1.0) {
-					if (f->data.ptr && (f->samples == f->datalen / 2)) {
-						ast_frame_adjust_volume_float(f, fac);
-					} else {
-						ast_debug(3, "Skip volume adjust on %s, fac = %f, data = %p, datalen = %d, samples = %d, src = %s\n",
-							ast_channel_name(l->chan), fac, f->data.ptr, f->datalen, f->samples, f->src ? f->src : "(nil)");
-					}
+				return -1;
+			}
+		}
+		ast_frfree(f);
+		return 0;
+	} else if (who == l->pchan) {
+		struct ast_frame *f;
+		f = ast_read(l->pchan);
+		if (!f) {
+			/* This should never happen, but if it does we need to cleanup */
+			ast_debug(1, "@@@@ rpt:Hung Up\n");
+			return -1;
+		}
+		if (f->frametype == AST_FRAME_VOICE) {
+			float fac = 1.0;
+			unsigned long long t0 = 0, tconf = 0, now = 0;
+
+			if (myrpt->trace && l->trace && rpt_trace_take(&myrpt->trace->rx, &l->trace->seen, &t0, &tconf, NULL)) {
+				now = rpt_perf_now();
+				rpt_trace_add(l->trace, RPT_TRACE_RX_CONF, now - tconf);
+				rpt_trace_add(&myrpt->trace->stats, RPT_TRACE_RX_CONF, now - tconf);
+			}
+			if (l->chan) {
+				if (CHAN_TECH(l->chan, "echolink")) {
+					fac = myrpt->p.etxgain;
+				} else if (CHAN_TECH(l->chan, "tlb")) {
+					fac = myrpt->p.ttxgain;
 				}
-				/* foop */
-				if (l->chan && (l->lastrx || (!altlink(myrpt, l))) &&
-					((l->link_newkey != RADIO_KEY_NOT_ALLOWED) || l->lasttx || !CHAN_TECH(l->chan, "IAX2"))) {
-					/* Reverse-engineering comments from NA debugging issue #46:
-					 * We may be receiving frames from channel drivers but we discard them and don't pass them on if newkey is set
-					 * to != RADIO_KEY_NOT_ALLOWED yet. This happens when the reset code forces it to RADIO_ALLOWED. Of course if
-					 * handle_link_data is never called to set newkey to RADIO_KEY_NOT_ALLOWED and stop newkeytimer, then at some
-					 * point, we'll set newkey = RADIO_KEY_ALLOWED forcibly (see comments in that part of the code for more info),
-					 * If this happens, we're passing voice frames and now sending AST_RADIO_KEY messages
-					 * so we're keyed up and transmitting, essentially, which we don't want to happen.
-					 *
-					 */
-					ast_write(l->chan, f);
-					l->last_frame_sent = 1;
-				} else if (l->chan && altlink(myrpt, l) && (!l->lastrx) &&
-						   ((l->link_newkey != RADIO_KEY_NOT_ALLOWED) || l->lasttx || !CHAN_TECH(l->chan, "IAX2"))) {
-					/* If we are and alt link, copy audio frames when NOT transmitting, like a "normal" asterisk link.
-					 * If the repeater is not receiving (either remote or local), we use the audiohook to "whisper" any
-					 * repeater output frames into the l->pchan.
-					 */
-					ast_write(l->chan, f);
+			}
+			if (fac != 1.0) {
+				if (f->data.ptr && (f->samples == f->datalen / 2)) {
+					ast_frame_adjust_volume_float(f, fac);
+				} else {
+					ast_debug(3, "Skip volume adjust on %s, fac = %f, data = %p, datalen = %d, samples = %d, src = %s\n",
+						ast_channel_name(l->chan), fac, f->data.ptr, f->datalen, f->samples, f->src ? f->src : "(nil)");
 				}
 			}
-			if (f->frametype == AST_FRAME_CONTROL && f->subclass.integer == AST_CONTROL_HANGUP) {
-				ast_debug(1, "@@@@ rpt:Hung Up\n");
-				ast_frfree(f);
-				remote_hangup_helper(myrpt, l); /* A reconnect is never possible on pchan hangup */
-				break;
+			/* foop */
+			if (l->chan && (l->lastrx || (!altlink(myrpt, l))) &&
+				((l->link_newkey != RADIO_KEY_NOT_ALLOWED) || l->lasttx || !CHAN_TECH(l->chan, "IAX2"))) {
+				/* Reverse-engineering comments from NA debugging issue #46:
+				 * We may be receiving frames from channel drivers but we discard them and don't pass them on if newkey is set
+				 * to != RADIO_KEY_NOT_ALLOWED yet. This happens when the reset code forces it to RADIO_ALLOWED. Of course if
+				 * handle_link_data is never called to set newkey to RADIO_KEY_NOT_ALLOWED and stop newkeytimer, then at some
+				 * point, we'll set newkey = RADIO_KEY_ALLOWED forcibly (see comments in that part of the code for more info),
+				 * If this happens, we're passing voice frames and now sending AST_RADIO_KEY messages
+				 * so we're keyed up and transmitting, essentially, which we don't want to happen.
+				 *
+				 */
+				ast_write(l->chan, f);
+				l->last_frame_sent = 1;
+				if (now) {
+					now = rpt_perf_now();
+					rpt_trace_add(l->trace, RPT_TRACE_RX_TOTAL, now - t0);
+					rpt_trace_add(&myrpt->trace->stats, RPT_TRACE_RX_TOTAL, now - t0);
+				}
+			} else if (l->chan && altlink(myrpt, l) && (!l->lastrx) &&
+					   ((l->link_newkey != RADIO_KEY_NOT_ALLOWED) || l->lasttx || !CHAN_TECH(l->chan, "IAX2"))) {
+				/* If we are and alt link, copy audio frames when NOT transmitting, like a "normal" asterisk link.
+				 * If the repeater is not receiving (either remote or local), we use the audiohook to "whisper" any
+				 * repeater output frames into the l->pchan.
+				 */
+				ast_write(l->chan, f);
 			}
+		}
+		if (f->frametype == AST_FRAME_CONTROL && f->subclass.integer == AST_CONTROL_HANGUP) {
+			ast_debug(1, "@@@@ rpt:Hung Up\n");
 			ast_frfree(f);
-			continue;
+			remote_hangup_helper(myrpt, l, 0); /* A reconnect is never possible on pchan hangup */
+			return -1;
 		}
-		continue;
+		ast_frfree(f);
+		return 0;
 	}
-	/* Link is done: Cleanup channels and link structure */
+	return 0;
+}
+
+int process_link_hangup(struct rpt *myrpt, struct rpt_link *l)
+{
+	l->hangupdelay = 0;
+	return remote_hangup_helper(myrpt, l, 0) ? 0 : -1;
+}
+
+void process_link_cleanup(struct rpt *myrpt, struct rpt_link *l)
+{
+	link_update_rxcount(myrpt, l, 0);
 	rpt_mutex_lock(&myrpt->lock);
 	ao2_ref(l, +1);					  /* prevent freeing while we finish up */
-	rpt_link_remove(myrpt->links, l); /* remove from queue */
+	rpt_link_remove(myrpt, l); /* remove from queue */
 	if (!strcmp(myrpt->cmdnode, l->name)) {
 		myrpt->cmdnode[0] = 0;
 	}
@@ -5003,6 +4777,7 @@ void process_link_channel(struct rpt *myrpt, struct rpt_link *l)
 		donodelog_fmt(myrpt, l->hasconnected ? "LINKDISC,%s" : "LINKFAIL,%s", l->name);
 	}
 	rpt_frame_queue_free(&l->frame_queue);
+	rpt_delay_line_free(&l->rxq);
 
 	/* hang-up on call to device */
 	hangup_link_chan(l);
@@ -5017,8 +4792,36 @@ void process_link_channel(struct rpt *myrpt, struct rpt_link *l)
 	ast_audiohook_unlock(&l->altaudio);
 	ast_audiohook_destroy(&l->altaudio);
 	ao2_ref(l, -1); /* and drop the extra ref we're holding */
+}
 
-	return;
+void process_link_channel(struct rpt *myrpt, struct rpt_link *l)
+{
+	struct ast_channel *who;
+	int n = 0, ms = MSWAIT;
+	struct ast_channel *cs[2];
+	struct timeval looptimestart;
+
+	looptimestart = rpt_tvnow();
+
+	while (ms >= 0 && l->disced == RPT_LINK_DISCONNECT_NONE) {
+		ms = MSWAIT;
+		n = 0;
+		cs[n++] = l->pchan;
+		if (l->chan) {
+			cs[n++] = l->chan;
+		}
+		who = ast_waitfor_n(cs, n, &ms);
+		periodic_process_link(myrpt, l, rpt_time_elapsed(&looptimestart));
+		if (!ms) {
+			/* No channels had activity before the timer expired,
+			 * so just continue to the next loop. */
+			continue;
+		}
+		if (process_link_activity(myrpt, l, who)) {
+			break;
+		}
+	}
+	process_link_cleanup(myrpt, l);
 }
 
 static inline int monchannel_read(struct rpt *myrpt)
@@ -5120,12 +4923,20 @@ static void *rpt(void *this)
 	struct ast_format_cap *cap;
 	struct timeval looptimestart;
 	struct ao2_iterator l_it;
+	unsigned long long workstart = 0, waitstart, readstart;
 
 	if (myrpt->p.archivedir) {
 		mkdir(myrpt->p.archivedir, 0700);
 		snprintf(tmpstr, sizeof(tmpstr), "%s/%s", myrpt->p.archivedir, myrpt->name);
 		mkdir(tmpstr, 0775);
 	}
+	if (!myrpt->perf) {
+		/* Kept across thread restarts, freed on unload */
+		myrpt->perf = ast_calloc(1, sizeof(*myrpt->perf));
+	}
+	if (!myrpt->trace) {
+		myrpt->trace = ast_calloc(1, sizeof(*myrpt->trace));
+	}
 	myrpt->ready = 0;
 	rpt_mutex_lock(&myrpt->lock);
 	myrpt->remrx = 0;
@@ -5211,12 +5022,18 @@ static void *rpt(void *this)
 		}
 	}
 
+	myrpt->rxlinks = 0;
 	myrpt->links = ao2_container_alloc_list(0, /* AO2 object flags. 0 means to use the default behavior */
 		AO2_CONTAINER_ALLOC_OPT_INSERT_BEGIN,  /* AO2 container flags. New items should be added to the front of the list */
 		NULL,								   /* Sorting function. NULL means the list will not be sorted */
 		rpt_link_find_by_name);				   /* Comparison function */
+	myrpt->links_byname = rpt_link_index_alloc();
 
-	if (!myrpt->links) {
+	if (!myrpt->links || !myrpt->links_byname) {
+		ao2_cleanup(myrpt->links);
+		myrpt->links = NULL;
+		ao2_cleanup(myrpt->links_byname);
+		myrpt->links_byname = NULL;
 		rpt_mutex_unlock(&myrpt->lock);
 		rpt_autoservice_stop(myrpt);
 		rpt_hangup_rx_tx(myrpt);
@@ -5307,6 +5124,8 @@ static void *rpt(void *this)
 			myrpt->macrobuf = NULL;
 			ao2_cleanup(myrpt->links);
 			myrpt->links = NULL;
+			ao2_cleanup(myrpt->links_byname);
+			myrpt->links_byname = NULL;
 			return NULL;
 		}
 		ast_dsp_set_features(myrpt->dsp, DSP_FEATURE_FREQ_DETECT);
@@ -5315,6 +5134,12 @@ static void *rpt(void *this)
 		tone_detect_init(&myrpt->burst_tone_state, myrpt->p.rxburstfreq, myrpt->p.rxbursttime, myrpt->p.rxburstthreshold);
 #endif
 	}
+	if (myrpt->p.dspworker) {
+		myrpt->dspworker = rpt_dsp_worker_start(myrpt->name, rx_dsp_detect, myrpt);
+		if (!myrpt->dspworker) {
+			ast_log(LOG_WARNING, "Node %s could not start its DSP worker, running the rx detectors inline\n", myrpt->name);
+		}
+	}
 	if (myrpt->p.startupmacro) {
 		ast_str_set(&myrpt->macrobuf, 0, "PPPP%s", myrpt->p.startupmacro);
 	}
@@ -5356,7 +5181,7 @@ static void *rpt(void *this)
 	while (ms >= 0) {
 		struct ast_channel *who;
 		struct ast_channel *cs[8];
-		int totx = 0, elap = 0, n, x;
+		int totx = 0, elap = 0, n, x, waitms;
 		time_t t, t_mono;
 		struct rpt_link *l;
 
@@ -5735,7 +5560,7 @@ static void *rpt(void *this)
 		myrpt->txrealkeyed = totx;
 		/* Control op tx disable overrides everything prior to this. */
 		/* Hold up the TX as long as there are frames in the tx queue */
-		totx = totx || (!AST_LIST_EMPTY(&myrpt->txq));
+		totx = totx || myrpt->txq.len;
 		/* if in 1/2 or 3/4 duplex, give rx priority */
 		if ((myrpt->p.duplex < 2) && (!myrpt->p.linktolink) && (!myrpt->p.dias) && (myrpt->keyed)) {
 			totx = 0;
@@ -5858,16 +5683,32 @@ static void *rpt(void *this)
 			myrpt->topkeystate = 2;
 			qsort(myrpt->topkey, TOPKEYN, sizeof(struct rpt_topkey), topcompar);
 		}
+		waitms = rpt_next_deadline(myrpt, totx);
 		rpt_mutex_unlock(&myrpt->lock);
+		/* Run the event rules for variables changed while the node was locked */
+		rpt_events_run(myrpt);
+		rpt_telemetry_reap(myrpt);
 
 		if (myrpt->topkeystate == 2) {
 			rpt_telemetry(myrpt, TOPKEY, NULL);
 			myrpt->topkeystate = 3;
+			waitms = MSWAIT;
+		}
+		ms = waitms;
+		waitstart = rpt_perf_now();
+		if (workstart) {
+			rpt_perf_end(myrpt->perf, RPT_PERF_LOOP, workstart);
 		}
-		ms = MSWAIT;
 		who = ast_waitfor_n(cs, n, &ms);
+		workstart = rpt_perf_now();
 		if (who == NULL) {
 			ms = 0;
+			if (workstart - waitstart > waitms * 1000ULL) {
+				rpt_perf_add(myrpt->perf, RPT_PERF_LATE, workstart - waitstart - waitms * 1000ULL);
+			}
+		}
+		if (myrpt->dspworker) {
+			rx_dsp_events(myrpt);
 		}
 		elap = rpt_time_elapsed(&looptimestart); /* calculate loop time */
 		rpt_mutex_lock(&myrpt->lock);
@@ -5923,13 +5764,17 @@ static void *rpt(void *this)
 		}
 
 		if (who == myrpt->rxchannel) { /* if it was a read from rx */
+			readstart = rpt_perf_now();
 			if (rxchannel_read(myrpt, lasttx)) {
 				break;
 			}
+			rpt_perf_end(myrpt->perf, RPT_PERF_RXREAD, readstart);
 		} else if (who == myrpt->pchannel) { /* if it was a read from pseudo */
+			readstart = rpt_perf_now();
 			if (pchannel_read(myrpt)) {
 				break;
 			}
+			rpt_perf_end(myrpt->perf, RPT_PERF_PREAD, readstart);
 		} else if (who == myrpt->rxpchannel) {
 			if (rxpchannel_read(myrpt)) {
 				break;
@@ -5939,9 +5784,11 @@ static void *rpt(void *this)
 				break;
 			}
 		} else if (who == myrpt->localtxchannel) { /* if it was a read from local-tx */
+			readstart = rpt_perf_now();
 			if (localtxchannel_read(myrpt, &myfirst)) {
 				break;
 			}
+			rpt_perf_end(myrpt->perf, RPT_PERF_LOCALTXREAD, readstart);
 		} else if (who == myrpt->txpchannel) { /* if it was a read from remote tx */
 			if (txpchannel_read(myrpt)) {
 				break;
@@ -5962,6 +5809,7 @@ static void *rpt(void *this)
 		/* wait for telem to be done */
 		usleep(50000);
 	}
+	rpt_telemetry_stop(myrpt);
 	rpt_mutex_lock(&myrpt->lock);
 	RPT_LIST_TRAVERSE(myrpt->links, l, l_it) {
 		/* hang-up any running links */
@@ -5983,6 +5831,7 @@ static void *rpt(void *this)
 	}
 	rpt_hangup_rx_tx(myrpt);
 	rpt_frame_queue_free(&myrpt->frame_queue);
+	rpt_delay_line_free(&myrpt->txq);
 
 	ast_debug(1, "@@@@ rpt:Hung up channel\n");
 	stop_outstream(myrpt);
@@ -5998,8 +5847,15 @@ static void *rpt(void *this)
 		usleep(60000);
 		rpt_mutex_lock(&myrpt->lock);
 	}
+	rpt_mutex_unlock(&myrpt->lock);
+	rpt_link_pool_destroy(myrpt);
+	rpt_mutex_lock(&myrpt->lock);
 
 	/* Free dynamically allocated memory */
+	if (myrpt->dspworker) {
+		rpt_dsp_worker_stop(myrpt->dspworker);
+		myrpt->dspworker = NULL;
+	}
 #ifdef NATIVE_DSP
 	if (myrpt->dsp) {
 		ast_dsp_free(myrpt->dsp);
@@ -6017,6 +5873,9 @@ static void *rpt(void *this)
 
 	ao2_cleanup(myrpt->links);
 	myrpt->links = NULL;
+	ao2_cleanup(myrpt->links_byname);
+	myrpt->links_byname = NULL;
+	rpt_linklist_flush(myrpt);
 	rpt_mutex_unlock(&myrpt->lock);
 
 	ast_debug(1, "%s thread now exiting...\n", myrpt->name);
@@ -6080,6 +5939,8 @@ static int load_config(int reload)
 		rpt_dns_node_domain = DEFAULT_DNS_NODE_DOMAIN;
 	}
 	ast_log(LOG_NOTICE, "Domain used for DNS node lookup is: %s", rpt_dns_node_domain);
+	/* Cached answers may be for a different domain */
+	rpt_dns_cache_flush();
 	val = ast_variable_retrieve(cfg, "general", "max_dns_node_length");
 	if (val) {
 		i = atoi(val);
@@ -6091,6 +5952,14 @@ static int load_config(int reload)
 		}
 		rpt_max_dns_node_length = i;
 	}
+	val = ast_variable_retrieve(cfg, "general", "sound_cache_size");
+	i = val ? atoi(val) : RPT_SOUNDCACHE_DEFAULT_KB;
+	if (i < 0) {
+		i = 0;
+	}
+	rpt_soundcache_configure(i, ast_true(ast_variable_retrieve(cfg, "general", "sound_cache_preload")));
+	val = ast_variable_retrieve(cfg, "general", "frame_trace_rate");
+	rpt_trace_set_rate(val ? atof(val) : 0);
 
 	/* process the sections looking for the nodes */
 	while ((this = ast_category_browse(cfg, this)) != NULL) {
@@ -6217,46 +6086,6 @@ static int load_config(int reload)
 	return 0;
 }
 
-/*! \brief Write log messages to the log file */
-static void rpt_nodelog(void)
-{
-	for (;;) {
-		struct nodelog *nodep;
-		char datestr[10], fname[1024], *str;
-		int fd;
-		int n;
-
-		ast_mutex_lock(&nodeloglock);
-		nodep = nodelog.next;
-		if (nodep == &nodelog) { /* if nothing in queue */
-			ast_mutex_unlock(&nodeloglock);
-			break;
-		}
-		remque((struct qelem *) nodep);
-		ast_mutex_unlock(&nodeloglock);
-		str = strchr(nodep->str, ' ');
-		if (!str) {
-			ast_free(nodep);
-			continue;
-		}
-		*str++ = '\0';
-		strftime(datestr, sizeof(datestr), "%Y%m%d", localtime(&nodep->timestamp));
-		snprintf(fname, sizeof(fname), "%s/%s/%s.txt", nodep->archivedir, nodep->str, datestr);
-		fd = open(fname, O_WRONLY | O_CREAT | O_APPEND, 0644);
-		if (fd == -1) {
-			ast_log(LOG_ERROR, "Cannot open node log file %s for write: %s", fname, strerror(errno));
-			ast_free(nodep);
-			continue;
-		}
-		n = strlen(str);
-		if (write(fd, str, n) != n) {
-			ast_log(LOG_ERROR, "Cannot write node log file %s for write: %s", fname, strerror(errno));
-		}
-		close(fd);
-		ast_free(nodep);
-	}
-}
-
 /*! \brief Master thread for managing repeater threads */
 static void *rpt_master(void *ignore)
 {
@@ -6265,8 +6094,6 @@ static void *rpt_master(void *ignore)
 	time_t last_thread_time[MAXRPTS] = { 0 };
 	time_t current_time = rpt_time_monotonic();
 
-	/* init nodelog queue */
-	nodelog.next = nodelog.prev = &nodelog;
 	/* go thru all the specified repeaters */
 
 	/* wait until asterisk starts */
@@ -6430,7 +6257,6 @@ static void *rpt_master(void *ignore)
 			rpt_vars[i].outstreampid = 0;
 			startoutstream(&rpt_vars[i]);
 		}
-		rpt_nodelog();
 		ast_mutex_unlock(&rpt_master_lock);
 		while (shutting_down) {
 			int done = 0, jrv;
@@ -6481,7 +6307,6 @@ static void *rpt_master(void *ignore)
 	}
 
 done:
-	rpt_nodelog(); /* Empty the nodelog to the filesystem and free memory */
 	ast_mutex_unlock(&rpt_master_lock);
 	ast_debug(1, "app_rpt master thread exiting\n");
 	return NULL;
@@ -6506,7 +6331,7 @@ static inline int exec_chan_read(struct rpt *myrpt, struct ast_channel *chan, ch
 			}
 		}
 		if ((phone_mode != RPT_PHONE_MODE_NONE) && phone_vox) {
-			int x;
+			int preroll = 0;
 			int n1 = dovox(&myrpt->vox, f->data.ptr, f->datalen / 2);
 			if (n1 != myrpt->wasvox) {
 				ast_debug(1, "Remote  vox %d\n", n1);
@@ -6519,43 +6344,12 @@ static inline int exec_chan_read(struct rpt *myrpt, struct ast_channel *chan, ch
 			}
 			if (n1) {
 				if (!*myfirst) {
-					x = 0;
-					AST_LIST_TRAVERSE(&myrpt->rxq, f1, frame_list) {
-						x++;
-					}
-
-					for (; x < myrpt->p.simplexphonedelay; x++) {
-						f1 = ast_frdup(f);
-						if (!f1) {
-							ast_frfree(f);
-							return -1;
-						}
-						RPT_MUTE_FRAME(f1);
-						memset(&f1->frame_list, 0, sizeof(f1->frame_list));
-						AST_LIST_INSERT_TAIL(&myrpt->rxq, f1, frame_list);
-					}
+					preroll = myrpt->p.simplexphonedelay;
 					*myfirst = 1;
 				}
-				f1 = ast_frdup(f);
-				if (!f1) {
-					ast_frfree(f);
-					return -1;
-				}
-				memset(&f1->frame_list, 0, sizeof(f1->frame_list));
-				AST_LIST_INSERT_TAIL(&myrpt->rxq, f1, frame_list);
 			} else
 				*myfirst = 0;
-			x = 0;
-			AST_LIST_TRAVERSE(&myrpt->rxq, f1, frame_list) {
-				x++;
-			}
-
-			if (!x) {
-				RPT_MUTE_FRAME(f);
-			} else {
-				ast_frfree(f);
-				f = AST_LIST_REMOVE_HEAD(&myrpt->rxq, frame_list);
-			}
+			rpt_delay_line_frame(&myrpt->rxq, f, n1, preroll);
 		}
 		ismuted = rpt_conf_get_muted(chan, myrpt);
 		/* if not transmitting, zero-out audio */
@@ -6564,7 +6358,7 @@ static inline int exec_chan_read(struct rpt *myrpt, struct ast_channel *chan, ch
 			ismuted = 1;
 		}
 		*dtmfed = 0;
-		f1 = rpt_frame_queue_helper(&myrpt->frame_queue, f, ismuted);
+		f1 = rpt_frame_queue_helper(&myrpt->frame_queue, f, ismuted, NULL);
 		if (!myrpt->remstopgen) {
 			if (phone_mode == RPT_PHONE_MODE_NONE) {
 				ast_write(myrpt->txchannel, f); /* write frame w/no delay */
@@ -6572,7 +6366,6 @@ static inline int exec_chan_read(struct rpt *myrpt, struct ast_channel *chan, ch
 				ast_write(myrpt->txchannel, f1); /* write delayed frame */
 			}
 		}
-		ast_frfree(f1);
 	} else if (f->frametype == AST_FRAME_DTMF_BEGIN) {
 		rpt_frame_queue_mute(&myrpt->frame_queue);
 		*dtmfed = 1;
@@ -7252,7 +7045,7 @@ static int rpt_exec(struct ast_channel *chan, const char *data)
 		if (!b1[i]) {
 			/* if not a call-based node number */
 			rpt_mutex_lock(&myrpt->lock);
-			l = ao2_find(myrpt->links, b1, 0); /* try to find this node in queue of connected nodes */
+			l = rpt_link_find(myrpt, b1); /* try to find this node in queue of connected nodes */
 			if (l != NULL) {
 				/* if found, we already have a connection, kill the existing connection */
 				l->killme = 1;
@@ -7277,6 +7070,8 @@ static int rpt_exec(struct ast_channel *chan, const char *data)
 			ao2_ref(l, -1);
 			return -1;
 		}
+		rpt_textq_init(l);
+		l->trace = rpt_trace_stats_alloc();
 		l->mode = MODE_TRANSCEIVE;
 		ast_copy_string(l->name, b1, MAXNODESTR);
 		l->chan = chan;
@@ -7390,14 +7185,16 @@ static int rpt_exec(struct ast_channel *chan, const char *data)
 
 		/* insert at end of queue */
 		rpt_mutex_lock(&myrpt->lock);
-		rpt_link_add(myrpt->links, l); /* After putting the link in the link list, other threads can start using it */
+		rpt_link_add(myrpt, l); /* After putting the link in the link list, other threads can start using it */
 		__kickshort(myrpt);
 		myrpt->lastlinktime = rpt_tvnow();
 		rpt_mutex_unlock(&myrpt->lock);
 		rpt_update_links(myrpt);
-		/* Service the link channel */
-		process_link_channel(myrpt, l);
-		/* call has ended, clean up */
+		/* Service the link channel, either from the shared link workers or from this thread */
+		if (rpt_link_pool_add(myrpt, l)) {
+			process_link_channel(myrpt, l);
+		}
+		/* call has ended (or is now owned by a link worker), clean up */
 		ao2_ref(l, -1); /* and drop the ref we're holding */
 
 		return 0;
@@ -7808,6 +7605,8 @@ static int rpt_exec(struct ast_channel *chan, const char *data)
 				}
 			}
 		}
+		rpt_events_run(myrpt);
+		rpt_telemetry_reap(myrpt);
 		ms = MSWAIT;
 		who = ast_waitfor_n(cs, n, &ms);
 		elap = rpt_time_elapsed(&looptimestart); /* calculate loop time */
@@ -7820,7 +7619,7 @@ static int rpt_exec(struct ast_channel *chan, const char *data)
 		update_timer(&myrpt->voxtotimer, elap, 0);
 		myrx = keyed;
 		if (phone_mode != RPT_PHONE_MODE_NONE && phone_vox) {
-			myrx = (!AST_LIST_EMPTY(&myrpt->rxq));
+			myrx = myrpt->rxq.len ? 1 : 0;
 			if (myrpt->voxtotimer <= 0) {
 				voxtostate_to_voxtotimer(myrpt);
 			}
@@ -8008,6 +7807,7 @@ static int rpt_exec(struct ast_channel *chan, const char *data)
 	while (myrpt->tele.next != &myrpt->tele) {
 		usleep(50000);
 	}
+	rpt_telemetry_stop(myrpt);
 	ast_stop_mixmonitor(chan, NULL);
 	rpt_mutex_lock(&myrpt->lock);
 	myrpt->hfscanmode = HF_SCAN_OFF;
@@ -8015,6 +7815,7 @@ static int rpt_exec(struct ast_channel *chan, const char *data)
 	myrpt->remoteon = 0;
 	rpt_mutex_unlock(&myrpt->lock);
 	rpt_frame_queue_free(&myrpt->frame_queue);
+	rpt_delay_line_free(&myrpt->rxq);
 	if ((iskenwood_pci4) && (myrpt->txchannel == myrpt->localtxchannel)) {
 		if (kenwood_uio_helper(myrpt)) {
 			return -1;
@@ -8126,6 +7927,7 @@ static int unload_module(void)
 		if (!strcmp(rpt_vars[i].name, rpt_vars[i].p.nodes)) {
 			continue;
 		}
+		rpt_telemetry_stop(&rpt_vars[i]);
 		ast_debug(3, "Destroying locks for repeater %s\n", rpt_vars[i].name);
 		ast_mutex_destroy(&rpt_vars[i].lock);
 		ast_mutex_destroy(&rpt_vars[i].remlock);
@@ -8151,6 +7953,14 @@ static int unload_module(void)
 			ast_free(rpt_vars[i].mdc);
 			rpt_vars[i].mdc = NULL;
 		}
+		if (rpt_vars[i].perf) {
+			ast_free(rpt_vars[i].perf);
+			rpt_vars[i].perf = NULL;
+		}
+		rpt_trace_free(rpt_vars[i].trace);
+		rpt_vars[i].trace = NULL;
+		rpt_functries_free(&rpt_vars[i]);
+		rpt_events_free(&rpt_vars[i]);
 	}
 
 	res = ast_unregister_application(app);
@@ -8161,8 +7971,24 @@ static int unload_module(void)
 	res |= mdc1200_unload();
 #endif
 
+#ifdef TEST_FRAMEWORK
+	rpt_goertzel_tests_unregister();
+	rpt_notch_tests_unregister();
+	rpt_vox_tests_unregister();
+	rpt_statpost_tests_unregister();
+	rpt_telemetry_tests_unregister();
+	rpt_mdc1200_tests_unregister();
+#endif
+
 	rpt_cli_unload();
 	res |= rpt_manager_unload();
+	rpt_extnode_cache_cleanup();
+	rpt_dns_cache_cleanup();
+	rpt_tonecache_cleanup();
+	rpt_soundcache_cleanup();
+	rpt_statpost_cleanup();
+	rpt_nodelog_cleanup();
+	rpt_lockstats_cleanup();
 	close(nullfd);
 	return res;
 }
@@ -8176,6 +8002,17 @@ static int load_module(void)
 		ast_log(LOG_ERROR, "Can not open /dev/null: %s\n", strerror(errno));
 		return -1;
 	}
+	if (rpt_extnode_cache_init() || rpt_dns_cache_init() || rpt_tonecache_init() || rpt_soundcache_init() || rpt_statpost_init() ||
+		rpt_lockstats_init() || rpt_nodelog_init()) {
+		rpt_extnode_cache_cleanup();
+		rpt_dns_cache_cleanup();
+		rpt_tonecache_cleanup();
+		rpt_soundcache_cleanup();
+		rpt_statpost_cleanup();
+		rpt_lockstats_cleanup();
+		close(nullfd);
+		return -1;
+	}
 	ast_pthread_create(&rpt_master_thread, NULL, rpt_master, NULL);
 
 	res |= rpt_cli_load();
@@ -8188,6 +8025,15 @@ static int load_module(void)
 	res |= mdc1200_load();
 #endif
 
+#ifdef TEST_FRAMEWORK
+	rpt_goertzel_tests_register();
+	rpt_notch_tests_register();
+	rpt_vox_tests_register();
+	rpt_statpost_tests_register();
+	rpt_telemetry_tests_register();
+	rpt_mdc1200_tests_register();
+#endif
+
 	return res;
 }
 
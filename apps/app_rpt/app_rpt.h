@@ -27,30 +27,20 @@
 #define HAVE_SYS_IO
 #endif
 
-/* Un-comment the following to include support for notch filters in the
-	rx audio stream (using Tony Fisher's mknotch (mkfilter) implementation) */
-/* #include "rpt_notch.c" */
+/* Start from the include directory, so that it works for both apps/app_rpt.c and files in apps/app_rpt */
+#include "../apps/app_rpt/rpt_notch.h"
 
 #ifndef NATIVE_DSP
-typedef struct {
-	int v2;
-	int v3;
-	int chunky;
-	int fac;
-} goertzel_state_t;
-
-typedef struct {
-	int value;
-	int power;
-} goertzel_result_t;
+/* Start from the include directory, so that it works for both apps/app_rpt.c and files in apps/app_rpt */
+#include "../apps/app_rpt/rpt_goertzel.h"
 
 typedef struct {
 	int freq;
 	int block_size;
 	int squelch; /* Remove (squelch) tone */
-	goertzel_state_t tone;
-	float energy;		 /* Accumulated energy of the current block */
-	int samples_pending; /* Samples remain to complete the current block */
+	struct rpt_goertzel_bank bank;
+	struct rpt_goertzel_state tone; /* Also accumulates the energy of the current block */
+	int samples_pending;			/* Samples remain to complete the current block */
 	int mute_samples;	 /* How many additional samples needs to be muted to suppress already detected tone */
 
 	int hits_required; /* How many successive blocks with tone we are looking for */
@@ -65,16 +55,13 @@ typedef struct {
 #define TONE_SAMPLE_RATE 8000
 #define TONE_SAMPLES_IN_FRAME 160
 
-#ifdef __RPT_NOTCH
-#define MAXFILTERS 10
-#endif
-
 /* maximum digits in DTMF buffer, and seconds after * for DTMF command timeout */
 #define MAXDTMF 32
 #define MAXMACRO 2048
 #define RPT_AST_STR_INIT_SIZE 500 /* initial guess for ast_str size */
 
 #define LINKLISTSHORTTIME 150
+#define RPT_LINKLIST_SLOTS 8 /* cached link list formats, see rpt_linklist_get() */
 #define LINKPOSTSHORTTIME 200
 #define KEYTIMERTIME 250
 #define MACROTIME 100
@@ -472,6 +459,7 @@ enum patch_call_mode {
 #define IS_XPMR(x) (!strncasecmp(x->rxchanname, "rad", 3))
 
 #define MSWAIT 20
+#define RPT_MAXWAIT 200 /* longest time in ms the rpt() loop sleeps while idle, matches the scheduler tick */
 #define HANGTIME 5000
 #define SLEEPTIME 900					 /* default # of seconds for of no activity before entering sleep mode */
 #define TOTIME 180000					 /* default timeout time to 180000ms (3 minutes) */
@@ -546,8 +534,31 @@ struct rpt_xlat {
 	time_t lastone;
 };
 
+/*! \brief Ring of signed linear samples used to delay audio, see rpt_delayline.h */
+struct rpt_delay_line {
+	short *buf;
+	unsigned int size; /*!< \brief Capacity in samples */
+	unsigned int head; /*!< \brief Index of the oldest sample */
+	unsigned int len;  /*!< \brief Number of samples queued */
+};
+
+/*! \brief Number of slots in a rpt_frame_queue, the two delayed frames plus the one being emitted */
+#define RPT_FRAME_QUEUE_SLOTS 3
+
+/*! \brief A reusable voice frame buffer in a rpt_frame_queue */
+struct rpt_frame_slot {
+	struct ast_frame fr; /*!< \brief Frame header, data points into buf */
+	char *buf;			 /*!< \brief Frame data, including AST_FRIENDLY_OFFSET, reused for every frame */
+	size_t bufsize;
+	unsigned long long trace; /*!< \brief Trace stamp of the frame, 0 if it isn't traced */
+	rpt_bool valid:1; /*!< \brief Slot holds a frame */
+	rpt_bool muted:1; /*!< \brief Frame is zeroed when it is emitted */
+};
+
+/*! \brief Two frame audio delay line, used to remove DTMF and muted audio */
 struct rpt_frame_queue {
-	struct ast_frame *lastf1, *lastf2;
+	struct rpt_frame_slot slots[RPT_FRAME_QUEUE_SLOTS];
+	unsigned int newest; /*!< \brief Slot holding the most recently queued frame */
 };
 
 enum rpt_link_disconnect {
@@ -560,6 +571,32 @@ enum rpt_link_disconnect {
 struct rpt;
 
 /*! \brief Structure used to manage links */
+/*! \brief Immutable text frame payload, shared by every link text queue it is written to */
+struct rpt_text_payload {
+	int datalen;
+	char data[0];
+};
+
+/*! \brief Number of text frames a link can have queued, must be a power of 2 */
+#define RPT_TEXTQ_SIZE 64
+
+/*! \brief Link text queue slot */
+struct rpt_textq_slot {
+	unsigned int seq;				  /*!< \brief Sequence number, tells producers and the consumer who owns the slot */
+	struct rpt_text_payload *payload; /*!< \brief ao2 reference held by the queue */
+};
+
+/*!
+ * \brief Bounded multi-producer, single-consumer link text queue
+ * \note Any thread may write to it, only the thread servicing the link reads from it.
+ */
+struct rpt_textq {
+	unsigned int head;	/*!< \brief Next slot to read, only used by the consumer */
+	unsigned int tail;	/*!< \brief Next slot to claim, shared by producers */
+	unsigned int drops; /*!< \brief Frames discarded because the queue was full */
+	struct rpt_textq_slot slots[RPT_TEXTQ_SIZE];
+};
+
 struct rpt_link {
 	struct rpt_link *next;
 	struct rpt_link *prev;
@@ -584,6 +621,7 @@ struct rpt_link {
 	rpt_bool killme:1;
 	rpt_bool dtmfed:1;
 	rpt_bool gott:1;
+	rpt_bool rxqfirst:1; /* phone vox delay has been primed */
 	enum rpt_link_disconnect disced:2; /* NOTE: bit-field is 2 bits => max value 3; keep enum values within range. */
 	long elaptime;
 	int disctime;
@@ -616,8 +654,13 @@ struct rpt_link {
 	int votewinner; /*!< \brief set if node won the rssi competition */
 	time_t lastkeytime;
 	time_t lastunkeytime;
-	AST_LIST_HEAD_NOLOCK(, ast_frame) rxq;
-	AST_LIST_HEAD_NOLOCK(, ast_frame) textq;
+	char rxcounted; /*!< \brief This link is included in myrpt->rxlinks */
+	struct rpt_delay_line rxq; /*!< \brief Phone vox audio delay */
+	struct rpt_textq textq;
+	struct rpt_trace_stats *trace; /*!< \brief Latency tracing, see rpt_trace.h */
+	struct rpt_linklist *linklist_sent; /*!< \brief Cached list of the other links, sent to this one */
+	char pooled; /*!< \brief Serviced by a link worker, see rpt_link_pool.h */
+	int hangupdelay; /*!< \brief Milliseconds a link worker waits before finishing a hangup */
 };
 
 /*!
@@ -638,13 +681,20 @@ struct rpt_lstat {
 	struct timeval connecttime;
 };
 
+/*! \brief The parts of a link a telemetry job needs */
+struct rpt_tele_link {
+	char name[MAXNODESTR];
+	int linkunkeytocttimer;
+	rpt_bool hasconnected:1;
+};
+
 struct rpt_tele {
 	struct rpt_tele *next;
 	struct rpt_tele *prev;
 	struct rpt *rpt;
 	struct ast_channel *chan;
 	enum rpt_tele_mode mode;
-	struct rpt_link mylink;
+	struct rpt_tele_link mylink;
 	char param[TELEPARAMSIZE];
 	union {
 		int i;
@@ -652,8 +702,8 @@ struct rpt_tele {
 		char _filler[8];
 	} submode;
 	unsigned int parrot;
+	int ctwait; /*!< \brief Unkey still waiting out its hang time.  Protected by myrpt->lock. */
 	rpt_bool killed:1;
-	pthread_t threadid;
 };
 
 struct function_table_tag {
@@ -837,6 +887,7 @@ struct rpt {
 		char endchar;
 		rpt_bool simple:1;
 		rpt_bool archiveaudio:1;
+		rpt_bool archivejson:1;
 		rpt_bool nobusyout:1;
 		rpt_bool notelemtx:1;
 		rpt_bool propagate_dtmf:1;
@@ -851,6 +902,7 @@ struct rpt {
 		rpt_bool itxctcss:1;
 		rpt_bool gpsfeet:1;
 		rpt_bool dtmfkey:1;
+		rpt_bool dspworker:1;
 		unsigned char civaddr;
 		struct rpt_xlat inxlat;
 		struct rpt_xlat outxlat;
@@ -879,6 +931,7 @@ struct rpt {
 		char telemdefault;
 		int linkpost_time;
 		int linkpost_max_message_len;
+		int linkworkers;
 		const char *statpost_url;
 		int statpost_time;
 		enum rpt_linkmode linkmode[10];
@@ -941,6 +994,9 @@ struct rpt {
 		int auth_otp_window;
 	} p;
 	struct ao2_container *links;
+	struct ao2_container *links_byname; /*!< \brief Hash index of links by node name */
+	struct rpt_link_pool *linkpool; /*!< \brief Shared link workers, NULL unless linkworkers is set */
+	int rxlinks;					/*!< \brief Number of non local monitor links receiving, updated atomically */
 	int unkeytocttimer;
 	time_t lastkeyedtime;
 	time_t lasttxkeyedtime;
@@ -1030,12 +1086,16 @@ struct rpt {
 	char patchexten[AST_MAX_EXTENSION];
 	int patchdialtime;
 	int macro_longest;
-	int phone_longestfunc;
-	int alt_longestfunc;
-	int dphone_longestfunc;
-	int link_longestfunc;
-	int longestfunc;
+	struct ao2_container *functries; /*!< Compiled DTMF function stanzas, see rpt_functrie.h */
+	struct rpt_events *eventengine;  /*!< Compiled events stanza, see rpt_events.h */
+	struct rpt_tele_exec *telexec;   /*!< Telemetry executor, started with the first telemetry */
+	struct rpt_perf *perf;           /*!< Main loop timing, see rpt_perf.h */
+	struct rpt_trace *trace;         /*!< Audio path latency tracing, see rpt_trace.h */
+	struct rpt_dsp_worker *dspworker; /*!< Rx detector worker, see rpt_dspworker.h */
+	unsigned int linklist_version;   /*!< Bumped by rpt_linklist_changed() */
+	struct rpt_linklist *linklists[RPT_LINKLIST_SLOTS]; /*!< Cached link lists, by format, see rpt_linklist_get() */
 	int longestnode;
+	int longestlocalnode; /*!< Longest node number in the nodes stanza, not counting a leading '_' */
 	int threadrestarts;
 	int tailmessagen;
 	time_t disgorgetime;
@@ -1095,29 +1155,18 @@ struct rpt {
 	struct ast_channel *remote_webtransceiver;
 	struct timeval lastdtmftime;
 	int keyed_time_ms; /*!< Time in milliseconds that a user has been keyed on the local RX */
+	int wakeups;		 /*!< \brief rpt() loop wakeups counted in the current sample window */
+	int wakeuptimer;	 /*!< \brief Milliseconds accumulated in the current wakeup sample window */
+	int wakeups_per_sec; /*!< \brief rpt() loop wakeups per second over the last sample window */
 #ifdef NATIVE_DSP
 	struct ast_dsp *dsp;
 #else
 	tone_detect_state_t burst_tone_state;
 #endif
-	AST_LIST_HEAD_NOLOCK(, ast_frame) txq;
-	AST_LIST_HEAD_NOLOCK(, ast_frame) rxq;
+	struct rpt_delay_line txq; /*!< \brief Simplex patch audio delay */
+	struct rpt_delay_line rxq; /*!< \brief Remote phone vox audio delay */
 	char txrealkeyed;
-#ifdef __RPT_NOTCH
-	struct rptfilter {
-		char desc[100];
-		float x0;
-		float x1;
-		float x2;
-		float y0;
-		float y1;
-		float y2;
-		float gain;
-		float const0;
-		float const1;
-		float const2;
-	} filters[MAXFILTERS];
-#endif
+	struct rpt_notch notch; /*!< \brief rxnotch filters */
 #ifdef _MDC_DECODE_H_
 	unsigned short lastunit;
 	char lastmdc[32];
@@ -1129,19 +1178,6 @@ struct rpt {
 	struct timeval lastlinktime;
 };
 
-struct nodelog {
-	struct nodelog *next;
-	struct nodelog *prev;
-	time_t timestamp;
-	char archivedir[MAXNODESTR];
-	char str[MAXNODESTR * 2];
-};
-
-struct statpost {
-	struct rpt *myrpt;
-	struct ast_str *stats_url;
-};
-
 /*! \brief Whether a channel is using a specified technology */
 #define CHAN_TECH(c, s) (!strcasecmp(ast_channel_tech(c)->type, s))
 
@@ -1165,14 +1201,6 @@ void donodelog(struct rpt *myrpt, char *str);
 #define donodelog_fmt(myrpt, fmt, ...) __donodelog_fmt(myrpt, __FILE__, __LINE__, __FUNCTION__, fmt, __VA_ARGS__)
 void __donodelog_fmt(struct rpt *myrpt, const char *file, int lineno, const char *func, const char *fmt, ...);
 
-/*!
- * \brief Process RPT events for a repeater using a caller-owned channel reference.
- *
- * \param myrpt Non-NULL reference to the repeater structure.
- * \param chan  Non-NULL channel reference that remains valid for the duration of this call.
- */
-void rpt_event_process(struct rpt *myrpt, struct ast_channel *chan);
-
 void *rpt_call(void *this);
 
 /*!
@@ -1183,6 +1211,40 @@ void *rpt_call(void *this);
 
 void process_link_channel(struct rpt *myrpt, struct rpt_link *l);
 
+/*!
+ * \brief Run the timer driven processing for a link
+ * \param myrpt Pointer to rpt structure
+ * \param l Pointer to rpt_link structure
+ * \param elap Milliseconds elapsed since the last call for this link
+ */
+void periodic_process_link(struct rpt *myrpt, struct rpt_link *l, const int elap);
+
+/*!
+ * \brief Service one ready channel of a link
+ * \param myrpt Pointer to rpt structure
+ * \param l Pointer to rpt_link structure
+ * \param who The link channel (l->chan or l->pchan) that has a frame waiting
+ * \retval 0 if the link is still up
+ * \retval -1 if the link is done and process_link_cleanup() must be called
+ */
+int process_link_activity(struct rpt *myrpt, struct rpt_link *l, struct ast_channel *who);
+
+/*!
+ * \brief Finish a hangup that process_link_activity() deferred for a pooled link
+ * \param myrpt Pointer to rpt structure
+ * \param l Pointer to rpt_link structure
+ * \retval 0 if the link is still up, a reconnect is possible
+ * \retval -1 if the link is done and process_link_cleanup() must be called
+ */
+int process_link_hangup(struct rpt *myrpt, struct rpt_link *l);
+
+/*!
+ * \brief Remove a finished link from its node and hang up its channels
+ * \param myrpt Pointer to rpt structure
+ * \param l Pointer to rpt_link structure
+ */
+void process_link_cleanup(struct rpt *myrpt, struct rpt_link *l);
+
 /*!
  * \brief Generates a command line completion list for rpt cmd third argument
  */
@@ -4,6 +4,7 @@
  *   from input audio samples.
  *
  * 4 October 2010 - fixed for 64-bit
+ * 16 October 2026 - signed linear input, table driven bit clock, FSK pre-gate
  *
  * Author: Matthew Kaufman (matthew@eeph.com)
  *
@@ -37,10 +38,32 @@
 #include <stdlib.h>
 #include "mdc_decode.h"
 
+static int _gcd(int a, int b)
+{
+	while (b) {
+		int t = a % b;
+
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
 mdc_decoder_t *mdc_decoder_new(int sampleRate)
 {
 	mdc_decoder_t *decoder;
-	int i;
+	int i, t, period;
+
+	/* Each decoder's bit clock runs at 1200 Hz, a quarter cycle from the
+	   next, in a pattern that repeats every period samples */
+	if (sampleRate < 4800) {
+		return (mdc_decoder_t *) 0L;
+	}
+	period = 4 * sampleRate / _gcd(4 * sampleRate, 4800);
+	if (period > MDC_SCHED_MAX) {
+		return (mdc_decoder_t *) 0L;
+	}
 
 	decoder = ast_calloc(1, sizeof(mdc_decoder_t));
 	if (!decoder) {
@@ -48,10 +71,26 @@ mdc_decoder_t *mdc_decoder_new(int sampleRate)
 	}
 
 	decoder->hyst = 3;
-	decoder->incr = (1200.0 * TWOPI) / ((double) sampleRate);
+	decoder->rate = sampleRate;
+	decoder->period = period;
+	decoder->gatewin = sampleRate * MDC_GATE_WIN / 1000;
+	if (decoder->gatewin > MDC_GATE_WIN_MAX) {
+		decoder->gatewin = MDC_GATE_WIN_MAX;
+	}
 
-	for (i = 0; i < MDC_ND; i++) {
-		decoder->th[i] = 0.0 + (((double) i) * (TWOPI / (double) MDC_ND));
+	/* Phase in units of 1/(4 * sampleRate) of a cycle, decoder i starting
+	   i quarter cycles in; a tick is the sample the phase wraps on */
+	for (t = 0; t < period; t++) {
+		decoder->first[t] = decoder->nevents;
+		for (i = 0; i < MDC_ND; i++) {
+			long long before = (long long) i * sampleRate + 4800LL * t;
+
+			if ((before + 4800) / (4LL * sampleRate) != before / (4LL * sampleRate)) {
+				decoder->evoff[decoder->nevents] = t;
+				decoder->evdec[decoder->nevents] = i;
+				decoder->nevents++;
+			}
+		}
 	}
 
 	return decoder;
@@ -188,18 +227,6 @@ static void _procbits(mdc_decoder_t *decoder, int x)
 	}
 }
 
-static int _onebits(unsigned int n)
-{
-	int i = 0;
-
-	while (n) {
-		++i;
-		n &= (n - 1);
-	}
-
-	return i;
-}
-
 static void _shiftin(mdc_decoder_t *decoder, int x)
 {
 	int bit = decoder->xorb[x];
@@ -219,8 +246,8 @@ static void _shiftin(mdc_decoder_t *decoder, int x)
 			decoder->synclow[x] |= 1;
 		}
 
-		gcount = _onebits(0x000000ff & (0x00000007 ^ decoder->synchigh[x]));
-		gcount += _onebits(0x092a446f ^ decoder->synclow[x]);
+		gcount = __builtin_popcount(0x000000ff & (0x00000007 ^ decoder->synchigh[x]));
+		gcount += __builtin_popcount(0x092a446f ^ decoder->synclow[x]);
 
 		if (gcount <= MDC_GDTHRESH) {
 			decoder->shstate[x] = 1;
@@ -251,98 +278,153 @@ static void _shiftin(mdc_decoder_t *decoder, int x)
 	}
 }
 
-static void _zcproc(mdc_decoder_t *decoder, int x)
+/* What a bit clock tick does with the number of zero crossings since the
+   decoder's last tick: nothing, shift in the same bit, or flip and shift */
+static const unsigned char _zcaction[8] = { 0, 0, 1, 2, 1, 0, 0, 0 };
+
+/* Count zero crossings, with hysteresis on the differentiated signal at
+   8 bit resolution, leaving the running count after each sample in zcum */
+static void _zerocross(mdc_decoder_t *decoder, const int16_t *samples, int n, unsigned int *zcum)
 {
-	switch (decoder->zc[x]) {
-	case 2:
-	case 4:
-		break;
+	int hyst = decoder->hyst;
+	int level = decoder->level;
+	int lastv = decoder->lastv;
+	unsigned int zcount = decoder->zcount;
+	int i;
 
-	case 3:
-		decoder->xorb[x] = !(decoder->xorb[x]);
-		break;
+	for (i = 0; i < n; i++) {
+		int v = samples[i] >> 8;
+		int d = v - lastv;
+		int cross;
 
-	default:
-		return;
+		lastv = v;
+		cross = ((d > hyst) & !level) | ((d < -hyst) & level);
+		level ^= cross;
+		zcount += cross;
+		zcum[i] = zcount;
 	}
 
-	_shiftin(decoder, x);
+	decoder->level = level;
+	decoder->lastv = lastv;
+	decoder->zcount = zcount;
 }
 
-int mdc_decoder_process_samples(mdc_decoder_t *decoder, unsigned char *samples, int numSamples)
+/* Whether to run the decoders over a block.  MSK at 1200 baud is 1200 and
+   1800 Hz tones, two crossings a cycle.  The crossings are counted over a
+   window shorter than the block, sliding through it, so a burst that starts
+   part way through the block still opens the gate.  zcum[-gatewin] to
+   zcum[-1] are from the blocks before. */
+static int _gate(mdc_decoder_t *decoder, const unsigned int *zcum, int n)
 {
-	int i;
-	int j;
-	int k;
-	int v;
-	int d;
-	unsigned char s;
+	int w = decoder->gatewin;
+	int step = w / 4 > 0 ? w / 4 : 1;
+	int t, k;
 
-	if (!decoder)
-		return -1;
+	for (t = n - 1; t >= 0; t -= step) {
+		long long rate = (long long) (zcum[t] - zcum[t - w]) * decoder->rate;
 
-	for (i = 0; i < numSamples; i++) {
-		s = samples[i];
+		if (rate >= 2LL * MDC_GATE_LOW * w && rate <= 2LL * MDC_GATE_HIGH * w) {
+			decoder->hang = decoder->rate * MDC_GATE_HANG / 1000;
+			return 1;
+		}
+	}
 
-#ifdef DIFFERENTIATOR
-		v = (int) s;
+	if (decoder->hang > 0) {
+		decoder->hang -= n;
+		return 1;
+	}
 
-		d = v - decoder->lastv;
-		decoder->lastv = v;
+	for (k = 0; k < MDC_ND; k++) {
+		if (decoder->shstate[k]) {
+			return 1;
+		}
+	}
 
-		if (decoder->level == 0) {
-			if (d > decoder->hyst) {
-				for (k = 0; k < MDC_ND; k++) {
-					decoder->zc[k]++;
-				}
+	return 0;
+}
 
-				decoder->level = 1;
-			}
-		} else {
-			if (d < (-1 * decoder->hyst)) {
-				for (k = 0; k < MDC_ND; k++) {
-					decoder->zc[k]++;
-				}
+/* Start the decoders over after the pre-gate was closed.  The bits from
+   before are stale, and each decoder's first bit counts the crossings from
+   the given zcount. */
+static void _reopen(mdc_decoder_t *decoder, unsigned int zcount)
+{
+	int k;
 
-				decoder->level = 0;
-			}
+	for (k = 0; k < MDC_ND; k++) {
+		decoder->zcmark[k] = zcount;
+		decoder->xorb[k] = 0;
+		decoder->synclow[k] = 0;
+		decoder->synchigh[k] = 0;
+	}
+}
+
+/* Run the bit clock ticks that fall in a block starting at schedule
+   position pos */
+static void _bitclock(mdc_decoder_t *decoder, const unsigned int *zcum, int n, int pos)
+{
+	int e = decoder->first[pos];
+	int base = -pos;
+
+	for (;;) {
+		int t, x, act;
+		unsigned int zc;
+
+		if (e == decoder->nevents) {
+			e = 0;
+			base += decoder->period;
 		}
-#else
-		if (decoder->level == 0) {
-			if (s > 128 + decoder->hyst) {
-				for (k = 0; k < MDC_ND; k++) {
-					decoder->zc[k]++;
-				}
-
-				decoder->level = 1;
-			}
-		} else {
-			if (s < 127 - decoder->hyst) {
-				for (k = 0; k < MDC_ND; k++) {
-					decoder->zc[k]++;
-				}
 
-				decoder->level = 0;
-			}
+		t = base + decoder->evoff[e];
+		if (t >= n) {
+			break;
 		}
-#endif
 
-		for (j = 0; j < MDC_ND; j++) {
-			decoder->th[j] += decoder->incr;
+		x = decoder->evdec[e];
+		zc = zcum[t] - decoder->zcmark[x];
+		decoder->zcmark[x] = zcum[t];
 
-			if (decoder->th[j] >= TWOPI) {
-				_zcproc(decoder, j);
-				decoder->th[j] -= TWOPI;
-				decoder->zc[j] = 0;
-			}
+		act = _zcaction[zc < 7 ? zc : 7];
+		decoder->xorb[x] ^= act >> 1;
+		if (act) {
+			_shiftin(decoder, x);
 		}
+
+		e++;
 	}
+}
+
+int mdc_decoder_process_samples(mdc_decoder_t *decoder, const int16_t *samples, int numSamples)
+{
+	unsigned int zbuf[MDC_GATE_WIN_MAX + MDC_BLOCK];
+	unsigned int *zcum = zbuf + MDC_GATE_WIN_MAX;
+	int n, w;
 
-	if (decoder->good) {
-		return decoder->good;
+	if (!decoder)
+		return -1;
+
+	w = decoder->gatewin;
+	for (; numSamples > 0; samples += n, numSamples -= n) {
+		n = numSamples < MDC_BLOCK ? numSamples : MDC_BLOCK;
+
+		memcpy(zcum - w, decoder->ztail + MDC_GATE_WIN_MAX - w, w * sizeof(*zcum));
+		_zerocross(decoder, samples, n, zcum);
+		if (!_gate(decoder, zcum, n)) {
+			decoder->gated += n;
+			decoder->open = 0;
+		} else if (!decoder->open) {
+			/* Take in the window before the block too, where the burst may have started */
+			_reopen(decoder, zcum[-w]);
+			_bitclock(decoder, zcum - w, n + w, (decoder->pos + decoder->period - w % decoder->period) % decoder->period);
+			decoder->open = 1;
+		} else {
+			_bitclock(decoder, zcum, n, decoder->pos);
+		}
+
+		decoder->pos = (decoder->pos + n) % decoder->period;
+		memcpy(decoder->ztail + MDC_GATE_WIN_MAX - w, zcum + n - w, w * sizeof(*zcum));
 	}
 
-	return 0;
+	return decoder->good;
 }
 
 int mdc_decoder_get_packet(mdc_decoder_t *decoder, unsigned char *op, unsigned char *arg, unsigned short *unitID)
@@ -3,6 +3,7 @@
  *  header for mdc_decode.c
  *
  * 4 October 2010 - fixed for 64-bit
+ * 16 October 2026 - signed linear input, table driven bit clock, FSK pre-gate
  *
  * Author: Matthew Kaufman (matthew@eeph.com)
  *
@@ -36,22 +37,37 @@
 #ifndef _MDC_DECODE_H_
 #define _MDC_DECODE_H_
 
-#ifndef TWOPI
-#define TWOPI (2.0 * 3.1415926535)
-#endif
+#include <stdint.h>
 
 #define MDC_ND 4	   /* number of decoders */
 #define MDC_GDTHRESH 5 /* "good bits" threshold */
 
-#define DIFFERENTIATOR
+#define MDC_BLOCK 160 /* samples the pre-gate looks at in one go */
+#define MDC_SCHED_MAX 40 /* longest bit clock schedule, in samples */
+#define MDC_GATE_LOW 1000 /* lowest tone, in Hz, that opens the pre-gate */
+#define MDC_GATE_HIGH 2200 /* highest tone, in Hz, that opens the pre-gate */
+#define MDC_GATE_HANG 50 /* ms the pre-gate stays open after the last FSK */
+#define MDC_GATE_WIN 15 /* ms of audio the pre-gate looks for FSK in, sliding through each block */
+#define MDC_GATE_WIN_MAX 720 /* MDC_GATE_WIN at the highest sample rate, in samples */
 
 typedef struct {
 	int hyst;
-	double incr;
-	double th[MDC_ND];
 	int level;
 	int lastv;
-	int zc[MDC_ND];
+	int rate;
+	unsigned int zcount;				 /* zero crossings seen */
+	unsigned int zcmark[MDC_ND];		 /* zcount at each decoder's last bit */
+	int period;							 /* length of the bit clock schedule in samples */
+	int nevents;						 /* bit clock ticks in the schedule */
+	int pos;							 /* schedule position of the next sample */
+	unsigned char evoff[MDC_SCHED_MAX];	 /* schedule position of each tick */
+	unsigned char evdec[MDC_SCHED_MAX];	 /* decoder each tick is for */
+	unsigned char first[MDC_SCHED_MAX];	 /* first tick at or after each schedule position */
+	int hang;							 /* samples left before the pre-gate closes */
+	unsigned int gated;					 /* samples skipped by the pre-gate */
+	int gatewin;						 /* MDC_GATE_WIN in samples */
+	int open;							 /* whether the decoders ran over the last block */
+	unsigned int ztail[MDC_GATE_WIN_MAX]; /* zcount after each of the last gatewin samples, at the end */
 	int xorb[MDC_ND];
 	unsigned int synclow[MDC_ND];
 	unsigned int synchigh[MDC_ND];
@@ -73,7 +89,9 @@ typedef struct {
  mdc_decoder_new
  create a new mdc_decoder object
 
-  parameters: int sampleRate - the sampling rate in Hz
+  parameters: int sampleRate - the sampling rate in Hz, at least 4800 and
+			   one where the 1200 Hz bit clock repeats within MDC_SCHED_MAX
+			   samples (8, 16, 24 or 48 kHz)
 
   returns: an mdc_decoder object or null if failure
 
@@ -83,10 +101,14 @@ mdc_decoder_t *mdc_decoder_new(int sampleRate);
 /*
  mdc_decoder_process_samples
  process incoming samples using an mdc_decoder object
- (currently limited to 8-bit unsigned samples)
+
+ Blocks with no 1200/1800 Hz FSK in them are only scanned for zero
+ crossings; the decoders run while FSK is present, for MDC_GATE_HANG ms
+ after it stops, and while a packet is being received.  When FSK starts,
+ the decoders also get the MDC_GATE_WIN ms before the block it starts in.
 
  parameters: mdc_decoder_t *decoder - pointer to the decoder object
-			 unsigned char *samples - pointer to 8-bit unsigned samples
+			 const int16_t *samples - pointer to signed linear samples
 			 int numSamples - count of the number of samples in buffer
 
  returns: 0 if more samples are needed
@@ -95,7 +117,7 @@ mdc_decoder_t *mdc_decoder_new(int sampleRate);
 		  2 if a decoded double packet is available to read
 */
 
-int mdc_decoder_process_samples(mdc_decoder_t *decoder, unsigned char *samples, int numSamples);
+int mdc_decoder_process_samples(mdc_decoder_t *decoder, const int16_t *samples, int numSamples);
 
 /*
  mdc_decoder_get_packet
@@ -45,7 +45,6 @@ struct rpt_auth_state {
 	int session_active;
 	char session_user[RPT_AUTH_USER_ID_LEN + 1];
 	char *session_command_set;
-	int session_longestfunc;
 	time_t session_expires;
 };
 
@@ -123,7 +122,6 @@ static void clear_session_locked(struct rpt_auth_state *st)
 		ast_free(st->session_command_set);
 		st->session_command_set = NULL;
 	}
-	st->session_longestfunc = 0;
 	st->session_expires = 0;
 }
 
@@ -269,22 +267,6 @@ static void load_users_locked(struct rpt *myrpt, struct rpt_auth_state *st)
 	ast_log(LOG_NOTICE, "rpt_auth: loaded %d user(s) from %s for node %s\n", st->nusers, myrpt->p.auth_users, myrpt->name);
 }
 
-static int compute_longestfunc_locked(struct rpt *myrpt, const char *stanza)
-{
-	struct ast_variable *vp;
-	int longest = 0;
-	if (!myrpt->cfg || !stanza) {
-		return 0;
-	}
-	for (vp = ast_variable_browse(myrpt->cfg, stanza); vp; vp = vp->next) {
-		int j = (int) strlen(vp->name);
-		if (j > longest) {
-			longest = j;
-		}
-	}
-	return longest;
-}
-
 static struct rpt_auth_state *ensure_state_locked(struct rpt *myrpt)
 {
 	if (!myrpt->auth) {
@@ -357,20 +339,6 @@ void rpt_auth_touch(struct rpt *myrpt)
 	rpt_mutex_unlock(&myrpt->lock);
 }
 
-int rpt_auth_longestfunc(struct rpt *myrpt)
-{
-	struct rpt_auth_state *st;
-	int ret = 0;
-
-	rpt_mutex_lock(&myrpt->lock);
-	st = myrpt->auth;
-	if (st && st->session_active) {
-		ret = st->session_longestfunc;
-	}
-	rpt_mutex_unlock(&myrpt->lock);
-	return ret;
-}
-
 int rpt_auth_login(struct rpt *myrpt, const char *user_id4, const char *otp6)
 {
 	struct rpt_auth_state *st;
@@ -431,7 +399,6 @@ int rpt_auth_login(struct rpt *myrpt, const char *user_id4, const char *otp6)
 		rpt_mutex_unlock(&myrpt->lock);
 		return RPT_AUTH_LOGIN_BAD;
 	}
-	st->session_longestfunc = compute_longestfunc_locked(myrpt, u->command_set);
 	st->session_expires = now + effective_timeout(myrpt);
 	u->fail_count = 0;
 
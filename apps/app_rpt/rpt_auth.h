@@ -34,11 +34,6 @@ int rpt_auth_get_active_stanza(struct rpt *myrpt, char *buf, size_t buflen);
 /*! \brief Refresh the sliding session timeout.  No-op if no active session. */
 void rpt_auth_touch(struct rpt *myrpt);
 
-/*! \brief Longest function-name length in the active session's stanza.
- *  Returns 0 if no active session.  Used by the "have we collected enough
- *  digits?" gate in collect_function_digits(). */
-int rpt_auth_longestfunc(struct rpt *myrpt);
-
 /*! \brief Result codes from rpt_auth_login. */
 enum rpt_auth_login_result {
 	RPT_AUTH_LOGIN_OK = 0,
@@ -13,6 +13,8 @@
 #include "rpt_channel.h"
 #include "rpt_config.h"
 #include "rpt_utils.h"
+#include "rpt_tonecache.h"
+#include "rpt_soundcache.h"
 
 extern char *dtmf_tones[];
 
@@ -46,7 +48,7 @@ int wait_interval(struct rpt *myrpt, enum rpt_delay type, struct ast_channel *ch
 	int interval;
 
 	/* This code does NOT wait for previous telemetry to complete!
-	 * (that happens at the beginning of rpt_tele_thread).
+	 * (the telemetry executor only starts a job once it's its turn).
 	 * We only get here after it's our turn in the first place. */
 
 	do {
@@ -79,15 +81,58 @@ int priority_jump(struct rpt *myrpt, struct ast_channel *chan)
 	return res;
 }
 
+/*! \brief Most files in an announcement played from the sound cache */
+#define SAY_MAX_FILES 64
+
 int sayfile(struct ast_channel *mychannel, const char *fname)
 {
+	int res;
+
+	res = rpt_soundcache_play(mychannel, &fname, 1);
+	if (res != RPT_SOUNDCACHE_MISS) {
+		return res;
+	}
 	return ast_stream_and_wait(mychannel, fname, "");
 }
 
+/*!
+ * \internal
+ * \brief Say a string of characters from the sound cache
+ * \param prefix File to play first, or NULL
+ * \return As for rpt_soundcache_play()
+ */
+static int saychars_cached(struct ast_channel *mychannel, const char *prefix, const char *str, int phonetic)
+{
+	const char *files[SAY_MAX_FILES];
+	char *buf;
+	int n = 0, res;
+
+	buf = ast_malloc(12 * strlen(str) + 1);
+	if (!buf) {
+		return RPT_SOUNDCACHE_MISS;
+	}
+	if (prefix) {
+		files[n++] = prefix;
+	}
+	res = rpt_soundcache_chars(str, phonetic, files + n, ARRAY_LEN(files) - n, buf);
+	if (res < 0) {
+		ast_free(buf);
+		return RPT_SOUNDCACHE_MISS;
+	}
+	res = rpt_soundcache_play(mychannel, files, n + res);
+	ast_free(buf);
+	return res;
+}
+
 int saycharstr(struct ast_channel *mychannel, const char *str)
 {
 	int res;
 
+	res = saychars_cached(mychannel, NULL, str, 0);
+	if (res != RPT_SOUNDCACHE_MISS) {
+		return res;
+	}
+
 	res = ast_say_character_str(mychannel, str, NULL, ast_channel_language(mychannel), AST_SAY_CASE_NONE);
 	if (!res) {
 		res = ast_waitstream(mychannel, "");
@@ -102,6 +147,11 @@ int sayphoneticstr(struct ast_channel *mychannel, const char *str)
 {
 	int res;
 
+	res = saychars_cached(mychannel, NULL, str, 1);
+	if (res != RPT_SOUNDCACHE_MISS) {
+		return res;
+	}
+
 	res = ast_say_phonetic_str(mychannel, str, NULL, ast_channel_language(mychannel));
 	if (!res) {
 		res = ast_waitstream(mychannel, "");
@@ -115,6 +165,21 @@ int sayphoneticstr(struct ast_channel *mychannel, const char *str)
 int saynum(struct ast_channel *mychannel, int num)
 {
 	int res;
+	const char *files[16];
+	char buf[16 * ARRAY_LEN(files)];
+	const char *lang = ast_channel_language(mychannel);
+
+	/* Only English numbers are said from the sound cache */
+	if (ast_strlen_zero(lang) || !strcmp(lang, "en")) {
+		res = rpt_soundcache_number(num, files, ARRAY_LEN(files), buf);
+		if (res > 0) {
+			res = rpt_soundcache_play(mychannel, files, res);
+			if (res != RPT_SOUNDCACHE_MISS) {
+				return res;
+			}
+		}
+	}
+
 	res = ast_say_number(mychannel, num, NULL, ast_channel_language(mychannel), NULL);
 	if (!res) {
 		res = ast_waitstream(mychannel, "");
@@ -147,11 +212,16 @@ int saynode(struct rpt *myrpt, struct ast_channel *mychannel, char *name)
 		if (ast_fileexists(fname, NULL, ast_channel_language(mychannel)) > 0) {
 			return (sayfile(mychannel, fname));
 		}
+		res = saychars_cached(mychannel, "rpt/node", name, 0);
+		if (res != RPT_SOUNDCACHE_MISS) {
+			goto said;
+		}
 		res = sayfile(mychannel, "rpt/node");
 		if (!res) {
 			res = ast_say_character_str(mychannel, name, NULL, ast_channel_language(mychannel), AST_SAY_CASE_NONE);
 		}
 	}
+said:
 	if (tgn == 1) {
 		if (myrpt->p.tannmode < 2) {
 			return res;
@@ -225,6 +295,111 @@ void do_dtmf_local(struct rpt *myrpt, char c)
 	}
 }
 
+/*! \brief Most samples written in one frame by play_slin() */
+#define PLAY_SLIN_FRAME 1024
+
+/*! \brief Playback state of the play_slin() generator */
+struct play_slin_state {
+	void *owner;
+	const int16_t *data;
+	size_t samples;
+	size_t pos;
+	struct ast_format *origwfmt;
+	struct ast_frame f;
+	int16_t buf[AST_FRIENDLY_OFFSET / sizeof(int16_t) + PLAY_SLIN_FRAME];
+};
+
+static void *play_slin_alloc(struct ast_channel *chan, void *params)
+{
+	struct play_slin_state *src = params;
+	struct play_slin_state *ps;
+
+	ps = ast_calloc(1, sizeof(*ps));
+	if (!ps) {
+		return NULL;
+	}
+	ps->owner = ao2_bump(src->owner);
+	ps->data = src->data;
+	ps->samples = src->samples;
+	ps->origwfmt = ao2_bump(ast_channel_writeformat(chan));
+	if (ast_set_write_format(chan, ast_format_slin)) {
+		ast_log(LOG_WARNING, "Unable to set '%s' to signed linear format (write)\n", ast_channel_name(chan));
+		ao2_cleanup(ps->origwfmt);
+		ao2_ref(ps->owner, -1);
+		ast_free(ps);
+		return NULL;
+	}
+	return ps;
+}
+
+static void play_slin_release(struct ast_channel *chan, void *data)
+{
+	struct play_slin_state *ps = data;
+
+	if (ps->origwfmt) {
+		ast_set_write_format(chan, ps->origwfmt);
+		ao2_ref(ps->origwfmt, -1);
+	}
+	ao2_ref(ps->owner, -1);
+	ast_free(ps);
+}
+
+static int play_slin_generate(struct ast_channel *chan, void *data, int len, int samples)
+{
+	struct play_slin_state *ps = data;
+	int16_t *out = ps->buf + AST_FRIENDLY_OFFSET / sizeof(int16_t);
+
+	if (ps->pos >= ps->samples) {
+		return -1;
+	}
+	if (samples > PLAY_SLIN_FRAME) {
+		samples = PLAY_SLIN_FRAME;
+	}
+	if (samples > ps->samples - ps->pos) {
+		samples = ps->samples - ps->pos;
+	}
+
+	/* Copy, since audiohooks on the channel may adjust the frame in place */
+	memcpy(out, &ps->data[ps->pos], samples * sizeof(int16_t));
+	ps->pos += samples;
+
+	memset(&ps->f, 0, sizeof(ps->f));
+	ps->f.frametype = AST_FRAME_VOICE;
+	ps->f.subclass.format = ast_format_slin;
+	ps->f.datalen = samples * sizeof(int16_t);
+	ps->f.samples = samples;
+	ps->f.offset = AST_FRIENDLY_OFFSET;
+	ps->f.data.ptr = out;
+	ps->f.src = "play_slin";
+
+	return ast_write(chan, &ps->f) ? -1 : 0;
+}
+
+static struct ast_generator play_slin_generator = {
+	.alloc = play_slin_alloc,
+	.release = play_slin_release,
+	.generate = play_slin_generate,
+};
+
+int play_slin(struct ast_channel *chan, void *owner, const int16_t *data, size_t samples)
+{
+	struct play_slin_state params = {
+		.owner = owner,
+		.data = data,
+		.samples = samples,
+	};
+
+	if (ast_activate_generator(chan, &play_slin_generator, &params)) {
+		return -1;
+	}
+	while (ast_channel_generatordata(chan)) {
+		if (ast_safe_sleep(chan, 20)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
 int play_tone_pair(struct ast_channel *chan, int f1, int f2, int duration, int amplitude)
 {
 	int res;
@@ -247,6 +422,16 @@ int play_tone(struct ast_channel *chan, int freq, int duration, int amplitude)
 	return play_tone_pair(chan, freq, 0, duration, amplitude);
 }
 
+/*! \brief Append a Morse element to a tone sequence */
+static void morse_seg(struct rpt_tone_seg *segs, int *nsegs, int freq, int duration, int amplitude)
+{
+	segs[*nsegs].f1 = freq;
+	segs[*nsegs].f2 = 0;
+	segs[*nsegs].duration = duration;
+	segs[*nsegs].amplitude = freq ? amplitude : 0;
+	(*nsegs)++;
+}
+
 static int morse_cat(char *str, int freq, int duration)
 {
 	char *p;
@@ -340,15 +525,22 @@ int send_morse(struct ast_channel *chan, const char *string, int speed, int freq
 	int interwordtime;
 	int len, ddcomb;
 	int res;
-	int c;
-	char *str = NULL;
+	int c, i;
+	int nsegs = 0;
+	char *str = NULL, *key = NULL;
+	struct rpt_tone_seg *segs;
+	struct rpt_tone_audio *audio;
 
 	res = 0;
 
-	str = ast_malloc(12 * 8 * strlen(string)); /* 12 chrs/element max, 8 elements/letter max */
-	if (!str)
+	segs = ast_malloc(16 * strlen(string) * sizeof(*segs)); /* 2 segments/element, 8 elements/letter max */
+	if (!segs) {
 		return -1;
-	str[0] = '\0';
+	}
+	if (ast_asprintf(&key, "M/%d/%d/%d/%s", speed, freq, amplitude, string) < 0) {
+		ast_free(segs);
+		return -1;
+	}
 
 	/* Approximate the dot time from the speed arg. */
 
@@ -379,11 +571,7 @@ int send_morse(struct ast_channel *chan, const char *string, int speed, int freq
 		/* If space char, wait the inter word time */
 
 		if (c == ' ') {
-			if (!res) {
-				if ((res = morse_cat(str, 0, interwordtime))) {
-					break;
-				}
-			}
+			morse_seg(segs, &nsegs, 0, interwordtime, amplitude);
 			continue;
 		}
 
@@ -399,20 +587,34 @@ int send_morse(struct ast_channel *chan, const char *string, int speed, int freq
 		/* Send the character */
 
 		for (; len; len--) {
-			if (!res) {
-				res = morse_cat(str, freq, (ddcomb & 1) ? dashtime : dottime);
-			}
-			if (!res) {
-				res = morse_cat(str, 0, intralettertime);
-			}
+			morse_seg(segs, &nsegs, freq, (ddcomb & 1) ? dashtime : dottime, amplitude);
+			morse_seg(segs, &nsegs, 0, intralettertime, amplitude);
 			ddcomb >>= 1;
 		}
 
 		/* Wait the interletter time */
 
-		if (!res) {
-			res = morse_cat(str, 0, interlettertime - intralettertime);
-		}
+		morse_seg(segs, &nsegs, 0, interlettertime - intralettertime, amplitude);
+	}
+
+	/* Play the pre-rendered audio if we can */
+
+	audio = rpt_tonecache_get(key, segs, nsegs);
+	if (audio) {
+		ast_safe_sleep(chan, 100);
+		res = rpt_tonecache_play(chan, audio);
+		ao2_ref(audio, -1);
+		goto done;
+	}
+
+	str = ast_malloc(12 * nsegs + 1); /* 12 chrs/element max */
+	if (!str) {
+		res = -1;
+		goto done;
+	}
+	str[0] = '\0';
+	for (i = 0; i < nsegs && !res; i++) {
+		res = morse_cat(str, segs[i].f1, segs[i].duration);
 	}
 
 	/* Wait for all the characters to be sent */
@@ -428,9 +630,10 @@ int send_morse(struct ast_channel *chan, const char *string, int speed, int freq
 			}
 		}
 	}
-	if (str) {
-		ast_free(str);
-	}
+done:
+	ast_free(str);
+	ast_free(key);
+	ast_free(segs);
 	return res;
 }
 
@@ -451,10 +654,10 @@ int send_usb_txt(struct rpt *myrpt, char *txt)
 static int rpt_qwrite_cb(void *obj, void *arg, int flags)
 {
 	struct rpt_link *link = obj;
-	struct ast_frame *wf = arg;
+	struct rpt_text_payload *payload = arg;
 
 	if ((link->chan) && link->name[0] && (link->name[0] != '0')) {
-		rpt_qwrite(link, wf);
+		rpt_qwrite_payload(link, payload);
 	}
 
 	return 0;
@@ -463,6 +666,7 @@ static int rpt_qwrite_cb(void *obj, void *arg, int flags)
 int send_link_pl(struct rpt *myrpt, const char *txt)
 {
 	char str[300];
+	struct rpt_text_payload *payload;
 	struct ast_frame wf = {
 		.frametype = AST_FRAME_TEXT,
 		.src = __PRETTY_FUNCTION__,
@@ -475,9 +679,14 @@ int send_link_pl(struct rpt *myrpt, const char *txt)
 	wf.datalen = strlen(str) + 1;
 	wf.data.ptr = str;
 	ast_debug(1, "send_link_pl %s\n", str);
+	payload = rpt_text_payload_alloc(&wf);
+	if (!payload) {
+		return 0;
+	}
 	rpt_mutex_lock(&myrpt->lock);
-	ao2_callback(myrpt->links, OBJ_MULTIPLE | OBJ_NODATA, rpt_qwrite_cb, &wf);
+	ao2_callback(myrpt->links, OBJ_MULTIPLE | OBJ_NODATA, rpt_qwrite_cb, payload);
 	rpt_mutex_unlock(&myrpt->lock);
+	ao2_ref(payload, -1);
 	return 0;
 }
 
@@ -26,6 +26,17 @@ int saynode(struct rpt *myrpt, struct ast_channel *mychannel, char *name);
 /*! \note must be called locked */
 void do_dtmf_local(struct rpt *myrpt, char c);
 
+/*!
+ * \brief Play signed linear audio from memory, waiting until it has been sent
+ * \param chan Channel, its write format is slin while playing
+ * \param owner ao2 object that owns data, referenced while playing
+ * \param data 8 kHz signed linear samples
+ * \param samples Number of samples
+ * \retval 0 on success
+ * \retval -1 on failure or hangup
+ */
+int play_slin(struct ast_channel *chan, void *owner, const int16_t *data, size_t samples);
+
 int play_tone_pair(struct ast_channel *chan, int f1, int f2, int duration, int amplitude);
 
 int play_tone(struct ast_channel *chan, int freq, int duration, int amplitude);
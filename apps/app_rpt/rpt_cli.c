@@ -20,10 +20,17 @@
 #include "rpt_cli.h"
 #include "rpt_utils.h"
 #include "rpt_config.h"
+#include "rpt_dns.h"
 #include "rpt_manager.h"
 #include "rpt_telemetry.h"
 #include "rpt_functions.h"
 #include "rpt_auth.h"
+#include "rpt_events.h"
+#include "rpt_tonecache.h"
+#include "rpt_statpost.h"
+#include "rpt_perf.h"
+#include "rpt_trace.h"
+#include "rpt_dspworker.h"
 
 extern struct rpt rpt_vars[MAXRPTS];
 
@@ -79,7 +86,7 @@ static int rpt_do_stats(int fd, int argc, const char *const *argv)
 	time_t now;
 	int totalkerchunks, dailykeyups, totalkeyups, timeouts;
 	int totalexecdcommands, dailyexecdcommands, hours, minutes, seconds;
-	int uptime;
+	int uptime, wakeups;
 	long long totaltxtime;
 	struct rpt_link *l;
 	char *lastdtmfcommand, *parrot_ena;
@@ -121,6 +128,7 @@ static int rpt_do_stats(int fd, int argc, const char *const *argv)
 			dailyexecdcommands = myrpt->dailyexecdcommands;
 			totalexecdcommands = myrpt->totalexecdcommands;
 			timeouts = myrpt->timeouts;
+			wakeups = myrpt->wakeups_per_sec;
 
 			/* Traverse the list of connected nodes */
 			reverse_patch_state = "DOWN";
@@ -279,6 +287,7 @@ static int rpt_do_stats(int fd, int argc, const char *const *argv)
 			uptime %= 60;
 
 			ast_cli(fd, "Uptime...........................................: %02d:%02d:%02d\n", hours, minutes, uptime);
+			ast_cli(fd, "Main loop wakeups per second.....................: %d\n", wakeups);
 
 			ast_cli(fd, "Nodes currently connected to us..................: ");
 			j = 0;
@@ -382,8 +391,8 @@ static int rpt_do_lstats(int fd, int argc, const char *const *argv)
 			}
 			rpt_mutex_unlock(&myrpt->lock);
 
-			ast_cli(fd, "NODE      PEER                RECONNECTS  DIRECTION  CONNECT TIME        CONNECT STATE\n");
-			ast_cli(fd, "----      ----                ----------  ---------  ------------        -------------\n");
+			ast_cli(fd, "NODE      PEER                RECONNECTS  DIRECTION  CONNECT TIME        CONNECT STATE  TEXTQ  DROPS\n");
+			ast_cli(fd, "----      ----                ----------  ---------  ------------        -------------  -----  -----\n");
 
 			/* Traverse the list of connected nodes */
 			now = rpt_tvnow();
@@ -419,7 +428,8 @@ static int rpt_do_lstats(int fd, int argc, const char *const *argv)
 					connstate = "CONNECTING";
 				}
 
-				ast_cli(fd, "%-10s%-20s%-12d%-11s%-20s%s\n", l->name, peer, l->reconnects, (l->outbound) ? "OUT" : "IN", conntime, connstate);
+				ast_cli(fd, "%-10s%-20s%-12d%-11s%-20s%-15s%-7u%u\n", l->name, peer, l->reconnects, (l->outbound) ? "OUT" : "IN", conntime,
+					connstate, rpt_textq_depth(l), __atomic_load_n(&l->textq.drops, __ATOMIC_RELAXED));
 			}
 			ao2_iterator_destroy(&l_it);
 			ao2_cleanup(links_copy); /* Free the copy container */
@@ -580,7 +590,7 @@ static int rpt_do_xnode(int fd, int argc, const char *const *argv)
 			/* ### GET CONNECTED NODE INFO ####################
 			 * Traverse the list of connected nodes
 			 */
-			n = __mklinklist(myrpt, NULL, &lbuf, USE_FORMAT_RPT_LINK) + 1;
+			n = rpt_linklist_append(myrpt, NULL, &lbuf, USE_FORMAT_RPT_LINK) + 1;
 			rpt_mutex_unlock(&myrpt->lock);
 
 			now = rpt_tvnow();
@@ -706,7 +716,7 @@ static int rpt_do_nodes(int fd, int argc, const char *const *argv)
 			/* Make a copy of all stat variables while locked */
 			myrpt = &rpt_vars[i];
 			rpt_mutex_lock(&myrpt->lock);
-			n = __mklinklist(myrpt, NULL, &lbuf, USE_FORMAT_RPT_LINK) + 1;
+			n = rpt_linklist_append(myrpt, NULL, &lbuf, USE_FORMAT_RPT_LINK) + 1;
 			rpt_mutex_unlock(&myrpt->lock);
 
 			strs = ast_malloc(n * sizeof(char *));
@@ -1166,6 +1176,7 @@ static int rpt_do_setvar(int fd, int argc, const char *const *argv)
 		if ((value = strchr(name, '='))) {
 			*value++ = '\0';
 			pbx_builtin_setvar_helper(rpt_vars[thisRpt].rxchannel, name, value);
+			rpt_events_setvar(&rpt_vars[thisRpt], name, value);
 		} else
 			ast_log(LOG_WARNING, "Ignoring entry '%s' with no = \n", name);
 	}
@@ -1290,6 +1301,381 @@ static int rpt_do_lookup(int fd, int argc, const char *const *argv)
 	return RESULT_SUCCESS;
 }
 
+static void dnscache_show_entry(const char *node, const char *nodedata, int ttl, void *arg)
+{
+	int fd = *(int *) arg;
+
+	ast_cli(fd, "%-10s%-8d%s\n", node, ttl, nodedata[0] ? nodedata : "(does not exist)");
+}
+
+/*! \brief Display DNS node cache statistics and entries */
+static int rpt_do_dnscache_show(int fd, int argc, const char *const *argv)
+{
+	struct rpt_dns_cache_stats stats;
+	unsigned int lookups;
+
+	if (argc != 3) {
+		return RESULT_SHOWUSAGE;
+	}
+
+	rpt_dns_cache_get_stats(&stats);
+	lookups = stats.hits + stats.negative_hits + stats.misses;
+
+	ast_cli(fd, "Cached nodes.....................................: %u\n", stats.entries);
+	ast_cli(fd, "Lookups..........................................: %u\n", lookups);
+	ast_cli(fd, "Hits.............................................: %u\n", stats.hits);
+	ast_cli(fd, "Negative hits....................................: %u\n", stats.negative_hits);
+	ast_cli(fd, "Misses...........................................: %u\n", stats.misses);
+	ast_cli(fd, "Hit rate.........................................: %u%%\n",
+		lookups ? (stats.hits + stats.negative_hits) * 100 / lookups : 0);
+	ast_cli(fd, "Background refreshes.............................: %u\n", stats.refreshes);
+	ast_cli(fd, "Resolver failures................................: %u\n", stats.failures);
+	ast_cli(fd, "\n");
+	ast_cli(fd, "NODE      TTL     DATA\n");
+	ast_cli(fd, "----      ---     ----\n");
+	rpt_dns_cache_foreach(dnscache_show_entry, &fd);
+
+	return RESULT_SUCCESS;
+}
+
+/*! \brief Empty the DNS node cache */
+static int rpt_do_dnscache_flush(int fd, int argc, const char *const *argv)
+{
+	if (argc != 3) {
+		return RESULT_SHOWUSAGE;
+	}
+	rpt_dns_cache_flush();
+	ast_cli(fd, "DNS node cache flushed\n");
+	return RESULT_SUCCESS;
+}
+
+static void tonecache_show_entry(const char *key, int ms, unsigned int plays, void *arg)
+{
+	int fd = *(int *) arg;
+
+	ast_cli(fd, "%-8d%-8u%s\n", ms, plays, key);
+}
+
+/*! \brief Display telemetry tone cache statistics and entries */
+static int rpt_do_tonecache_show(int fd, int argc, const char *const *argv)
+{
+	struct rpt_tonecache_stats stats;
+	unsigned int plays;
+
+	if (argc != 3) {
+		return RESULT_SHOWUSAGE;
+	}
+
+	rpt_tonecache_get_stats(&stats);
+	plays = stats.hits + stats.misses + stats.uncached;
+
+	ast_cli(fd, "Cached tones.....................................: %u\n", stats.entries);
+	ast_cli(fd, "Cache size (bytes)...............................: %zu\n", stats.bytes);
+	ast_cli(fd, "Plays............................................: %u\n", plays);
+	ast_cli(fd, "Hits.............................................: %u\n", stats.hits);
+	ast_cli(fd, "Misses...........................................: %u\n", stats.misses);
+	ast_cli(fd, "Not cached.......................................: %u\n", stats.uncached);
+	ast_cli(fd, "Hit rate.........................................: %u%%\n", plays ? stats.hits * 100 / plays : 0);
+	ast_cli(fd, "\n");
+	ast_cli(fd, "MS      PLAYS   KEY\n");
+	ast_cli(fd, "--      -----   ---\n");
+	rpt_tonecache_foreach(tonecache_show_entry, &fd);
+
+	return RESULT_SUCCESS;
+}
+
+/*! \brief Empty the telemetry tone cache */
+static int rpt_do_tonecache_flush(int fd, int argc, const char *const *argv)
+{
+	if (argc != 3) {
+		return RESULT_SHOWUSAGE;
+	}
+	rpt_tonecache_flush();
+	ast_cli(fd, "Telemetry tone cache flushed\n");
+	return RESULT_SUCCESS;
+}
+
+/*! \brief Display status post counters */
+static int rpt_do_statpost_show(int fd, int argc, const char *const *argv)
+{
+	struct rpt_statpost_stats stats;
+
+	if (argc != 3) {
+		return RESULT_SHOWUSAGE;
+	}
+
+	rpt_statpost_get_stats(&stats);
+
+	ast_cli(fd, "Queued...........................................: %u\n", stats.queued);
+	ast_cli(fd, "Sent.............................................: %u\n", stats.sent);
+	ast_cli(fd, "Failed...........................................: %u\n", stats.failed);
+	ast_cli(fd, "Coalesced........................................: %u\n", stats.coalesced);
+	ast_cli(fd, "Dropped (queue full).............................: %u\n", stats.dropped);
+	ast_cli(fd, "Waiting..........................................: %u\n", stats.waiting);
+
+	return RESULT_SUCCESS;
+}
+
+static void perf_show_hist(int fd, const char *window, enum rpt_perf_metric metric, const struct rpt_perf_hist *hist)
+{
+	int i;
+
+	ast_cli(fd, "%-22s%-9s%-10llu%-10llu%-10u", rpt_perf_name(metric), window, hist->count, hist->count ? hist->sum_us / hist->count : 0,
+		hist->max_us);
+	if (metric == RPT_PERF_RXVOICE || metric == RPT_PERF_TXVOICE) {
+		ast_cli(fd, "%-10u", hist->jitter_us);
+	} else {
+		ast_cli(fd, "%-10s", "-");
+	}
+	for (i = 0; i < RPT_PERF_BUCKETS; i++) {
+		if (!hist->buckets[i]) {
+			continue;
+		}
+		if (rpt_perf_bucket_us(i)) {
+			ast_cli(fd, " <%u:%u", rpt_perf_bucket_us(i), hist->buckets[i]);
+		} else {
+			ast_cli(fd, " >=%u:%u", rpt_perf_bucket_us(i - 1), hist->buckets[i]);
+		}
+	}
+	ast_cli(fd, "\n");
+}
+
+/*! \brief Display or reset a node's main loop timing */
+static int rpt_do_stats_perf(int fd, int argc, const char *const *argv)
+{
+	struct rpt_perf perf;
+	struct rpt_dsp_stats dsp;
+	struct rpt *myrpt = NULL;
+	int i, dspworker = 0, nrpts = rpt_num_rpts();
+
+	if (argc != 4 && (argc != 5 || strcasecmp(argv[4], "reset"))) {
+		return RESULT_SHOWUSAGE;
+	}
+	for (i = 0; i < nrpts; i++) {
+		if (!strcmp(argv[3], rpt_vars[i].name)) {
+			myrpt = &rpt_vars[i];
+			break;
+		}
+	}
+	if (!myrpt || !myrpt->perf) {
+		ast_cli(fd, "No timing for node %s\n", argv[3]);
+		return RESULT_FAILURE;
+	}
+	if (argc == 5) {
+		rpt_perf_reset(myrpt->perf);
+		ast_cli(fd, "Timing for node %s cleared\n", argv[3]);
+		return RESULT_SUCCESS;
+	}
+
+	/* A snapshot, the node thread keeps updating it */
+	memcpy(&perf, myrpt->perf, sizeof(perf));
+	ast_cli(fd, "Times in microseconds, histogram buckets are <upper bound:count\n\n");
+	ast_cli(fd, "%-22s%-9s%-10s%-10s%-10s%-10s%s\n", "METRIC", "WINDOW", "COUNT", "AVG", "MAX", "JITTER", "HISTOGRAM");
+	for (i = 0; i < RPT_PERF_METRICS; i++) {
+		perf_show_hist(fd, "total", i, &perf.total[i]);
+		perf_show_hist(fd, "1 min", i, &perf.last[i]);
+	}
+	/* The worker is stopped and freed with the node locked */
+	rpt_mutex_lock(&myrpt->lock);
+	if (myrpt->dspworker) {
+		rpt_dsp_worker_get_stats(myrpt->dspworker, &dsp);
+		dspworker = 1;
+	}
+	rpt_mutex_unlock(&myrpt->lock);
+	if (dspworker) {
+		ast_cli(fd, "\nDSP worker: %llu frames, %llu dropped, %llu events, %llu lost, avg %llu, max %u, %u waiting\n", dsp.frames,
+			dsp.dropped, dsp.events, dsp.lost, dsp.frames ? dsp.busy_us / dsp.frames : 0, dsp.max_us, dsp.depth);
+	}
+	return RESULT_SUCCESS;
+}
+
+static void trace_show_stats(int fd, const char *name, const struct rpt_trace_stats *stats)
+{
+	const struct rpt_trace_hist *hist;
+	int i;
+
+	for (i = 0; i < RPT_TRACE_HOPS; i++) {
+		hist = &stats->hops[i];
+		if (!hist->count) {
+			continue;
+		}
+		ast_cli(fd, "%-10s%-16s%-8u%-10.2f%-10.2f%-10.2f%-10.2f\n", name, rpt_trace_hop_name(i), hist->count,
+			rpt_trace_percentile(hist, 50) / 1000.0, rpt_trace_percentile(hist, 90) / 1000.0, rpt_trace_percentile(hist, 99) / 1000.0,
+			hist->max_us / 1000.0);
+	}
+}
+
+static struct rpt *trace_find_node(const char *name)
+{
+	int i, nrpts = rpt_num_rpts();
+
+	for (i = 0; i < nrpts; i++) {
+		if (!strcmp(name, rpt_vars[i].name)) {
+			return &rpt_vars[i];
+		}
+	}
+	return NULL;
+}
+
+/*! \brief Display a node's audio path latency percentiles, for the node and each link */
+static int rpt_do_trace_show(int fd, int argc, const char *const *argv)
+{
+	struct rpt *myrpt;
+	struct rpt_link *l;
+	struct ao2_iterator l_it;
+
+	if (argc != 4) {
+		return RESULT_SHOWUSAGE;
+	}
+	myrpt = trace_find_node(argv[3]);
+	if (!myrpt || !myrpt->trace) {
+		ast_cli(fd, "No trace for node %s\n", argv[3]);
+		return RESULT_FAILURE;
+	}
+
+	ast_cli(fd, "Sample rate: %.2f%%\n\n", rpt_trace_get_rate());
+	ast_cli(fd, "%-10s%-16s%-8s%-10s%-10s%-10s%-10s\n", "LINK", "HOP", "COUNT", "P50 (ms)", "P90 (ms)", "P99 (ms)", "MAX (ms)");
+	trace_show_stats(fd, "(all)", &myrpt->trace->stats);
+
+	rpt_mutex_lock(&myrpt->lock);
+	RPT_LIST_TRAVERSE(myrpt->links, l, l_it) {
+		if (l->trace) {
+			trace_show_stats(fd, l->name, l->trace);
+		}
+	}
+	ao2_iterator_destroy(&l_it);
+	rpt_mutex_unlock(&myrpt->lock);
+	return RESULT_SUCCESS;
+}
+
+/*! \brief Set the frame trace sample rate, or clear a node's trace */
+static int rpt_do_trace(int fd, int argc, const char *const *argv)
+{
+	struct rpt *myrpt;
+	struct rpt_link *l;
+	struct ao2_iterator l_it;
+
+	if (argc != 4) {
+		return RESULT_SHOWUSAGE;
+	}
+	if (!strcasecmp(argv[2], "rate")) {
+		rpt_trace_set_rate(atof(argv[3]));
+		ast_cli(fd, "Tracing %.2f%% of voice frames\n", rpt_trace_get_rate());
+		return RESULT_SUCCESS;
+	}
+
+	myrpt = trace_find_node(argv[3]);
+	if (!myrpt || !myrpt->trace) {
+		ast_cli(fd, "No trace for node %s\n", argv[3]);
+		return RESULT_FAILURE;
+	}
+	rpt_trace_reset(&myrpt->trace->stats);
+	rpt_mutex_lock(&myrpt->lock);
+	RPT_LIST_TRAVERSE(myrpt->links, l, l_it) {
+		if (l->trace) {
+			rpt_trace_reset(l->trace);
+		}
+	}
+	ao2_iterator_destroy(&l_it);
+	rpt_mutex_unlock(&myrpt->lock);
+	ast_cli(fd, "Trace for node %s cleared\n", argv[3]);
+	return RESULT_SUCCESS;
+}
+
+#ifndef APP_RPT_LOCK_DEBUG
+/*! \brief Turn the lock profiler on or off, or clear its statistics */
+static int rpt_do_lockstats(int fd, int argc, const char *const *argv)
+{
+	if (argc != 3) {
+		return RESULT_SHOWUSAGE;
+	}
+	if (!strcasecmp(argv[2], "on")) {
+		rpt_lockstats_enable(1);
+		ast_cli(fd, "Lock profiling enabled\n");
+	} else if (!strcasecmp(argv[2], "off")) {
+		rpt_lockstats_enable(0);
+		ast_cli(fd, "Lock profiling disabled\n");
+	} else if (!strcasecmp(argv[2], "reset")) {
+		rpt_lockstats_reset();
+		ast_cli(fd, "Lock statistics cleared\n");
+	} else {
+		return RESULT_SHOWUSAGE;
+	}
+	return RESULT_SUCCESS;
+}
+
+static void lockstats_show_hist(int fd, const char *name, const unsigned long long *hist)
+{
+	int i;
+
+	ast_cli(fd, "    %s:", name);
+	for (i = 0; i < RPT_LOCKSTAT_BUCKETS; i++) {
+		if (hist[i]) {
+			ast_cli(fd, " <%uus:%llu", 1U << i, hist[i]);
+		}
+	}
+	ast_cli(fd, "\n");
+}
+
+/*! \brief Display lock contention statistics, worst first */
+static int rpt_do_show_lockstats(int fd, int argc, const char *const *argv)
+{
+	struct rpt_lockstat *stats;
+	unsigned long long count, contended, wait, hold;
+	int i, j, n, nrpts = rpt_num_rpts();
+	const char *name;
+
+	if (argc != 3 && argc != 4) {
+		return RESULT_SHOWUSAGE;
+	}
+
+	n = rpt_lockstats_get(&stats);
+	if (n < 0) {
+		return RESULT_FAILURE;
+	}
+
+	ast_cli(fd, "Lock profiling is %s\n\n", rpt_lockstats_enabled ? "enabled" : "disabled");
+	ast_cli(fd, "%-10s%-12s%-12s%-14s%-14s\n", "NODE", "LOCKS", "CONTENDED", "WAIT (us)", "HOLD (us)");
+	for (i = 0; i < nrpts; i++) {
+		if (argc == 4 && strcmp(argv[3], rpt_vars[i].name)) {
+			continue;
+		}
+		count = contended = wait = hold = 0;
+		for (j = 0; j < n; j++) {
+			if (stats[j].node == i) {
+				count += stats[j].count;
+				contended += stats[j].contended;
+				wait += stats[j].wait_ns;
+				hold += stats[j].hold_ns;
+			}
+		}
+		if (count) {
+			ast_cli(fd, "%-10s%-12llu%-12llu%-14llu%-14llu\n", rpt_vars[i].name, count, contended, wait / 1000, hold / 1000);
+		}
+	}
+
+	ast_cli(fd, "\n%-32s%-10s%-10s%-10s%-10s%-10s%-10s%-10s\n", "SITE", "NODE", "COUNT", "CONTENDED", "AVGWAIT", "MAXWAIT", "AVGHOLD", "MAXHOLD");
+	for (i = 0; i < n; i++) {
+		char site[64];
+
+		name = stats[i].node < 0 ? "-" : rpt_vars[stats[i].node].name;
+		if (argc == 4 && strcmp(argv[3], name)) {
+			continue;
+		}
+		snprintf(site, sizeof(site), "%s:%d", stats[i].file, stats[i].line);
+		ast_cli(fd, "%-32s%-10s%-10llu%-10llu%-10llu%-10llu%-10llu%-10llu\n", site, name, stats[i].count, stats[i].contended,
+			stats[i].contended ? stats[i].wait_ns / stats[i].contended / 1000 : 0, stats[i].wait_max_ns / 1000,
+			stats[i].count ? stats[i].hold_ns / stats[i].count / 1000 : 0, stats[i].hold_max_ns / 1000);
+		if (stats[i].contended) {
+			lockstats_show_hist(fd, "wait", stats[i].wait_hist);
+		}
+		lockstats_show_hist(fd, "hold", stats[i].hold_hist);
+	}
+	ast_free(stats);
+	return RESULT_SUCCESS;
+}
+#endif
+
 /*! \brief Hooks for CLI functions */
 static char *res2cli(int r)
 {
@@ -1353,6 +1739,58 @@ static char *handle_cli_stats(struct ast_cli_entry *e, int cmd, struct ast_cli_a
 	return res2cli(rpt_do_stats(a->fd, a->argc, a->argv));
 }
 
+static char *handle_cli_stats_perf(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "rpt stats perf";
+		e->usage = "Usage: rpt stats perf <nodename> [reset]\n"
+				   "	Display histograms of the node's main loop and channel read times,\n"
+				   "	and the time between voice frames on receive and transmit, since the\n"
+				   "	last reset and over the last complete minute.  With reset, clear them.\n";
+		return NULL;
+
+	case CLI_GENERATE:
+		return rpt_complete_node_list(a->line, a->word, a->pos, 3);
+	}
+
+	return res2cli(rpt_do_stats_perf(a->fd, a->argc, a->argv));
+}
+
+static char *handle_cli_trace_show(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "rpt trace show";
+		e->usage = "Usage: rpt trace show <nodename>\n"
+				   "	Display audio path latency percentiles for the node and each of its links.\n";
+		return NULL;
+
+	case CLI_GENERATE:
+		return rpt_complete_node_list(a->line, a->word, a->pos, 3);
+	}
+
+	return res2cli(rpt_do_trace_show(a->fd, a->argc, a->argv));
+}
+
+static char *handle_cli_trace(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "rpt trace {rate|reset}";
+		e->usage = "Usage: rpt trace rate <percent>\n"
+				   "	Trace this percentage of voice frames, 0 to stop tracing.\n"
+				   "       rpt trace reset <nodename>\n"
+				   "	Clear the node's audio path latency trace.\n";
+		return NULL;
+
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	return res2cli(rpt_do_trace(a->fd, a->argc, a->argv));
+}
+
 static char *handle_cli_nodes(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
 	switch (cmd) {
@@ -1573,6 +2011,120 @@ static char *handle_cli_lookup(struct ast_cli_entry *e, int cmd, struct ast_cli_
 	return res2cli(rpt_do_lookup(a->fd, a->argc, a->argv));
 }
 
+static char *handle_cli_dnscache_show(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "rpt dnscache show";
+		e->usage = "Usage: rpt dnscache show\n"
+				   "	Display DNS node lookup cache statistics and entries.\n";
+		return NULL;
+
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	return res2cli(rpt_do_dnscache_show(a->fd, a->argc, a->argv));
+}
+
+static char *handle_cli_dnscache_flush(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "rpt dnscache flush";
+		e->usage = "Usage: rpt dnscache flush\n"
+				   "	Remove all entries from the DNS node lookup cache.\n";
+		return NULL;
+
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	return res2cli(rpt_do_dnscache_flush(a->fd, a->argc, a->argv));
+}
+
+static char *handle_cli_tonecache_show(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "rpt tonecache show";
+		e->usage = "Usage: rpt tonecache show\n"
+				   "	Display telemetry tone cache statistics and entries.\n";
+		return NULL;
+
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	return res2cli(rpt_do_tonecache_show(a->fd, a->argc, a->argv));
+}
+
+static char *handle_cli_tonecache_flush(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "rpt tonecache flush";
+		e->usage = "Usage: rpt tonecache flush\n"
+				   "	Remove all rendered tones from the telemetry tone cache.\n";
+		return NULL;
+
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	return res2cli(rpt_do_tonecache_flush(a->fd, a->argc, a->argv));
+}
+
+static char *handle_cli_statpost_show(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "rpt statpost show";
+		e->usage = "Usage: rpt statpost show\n"
+				   "	Display status post (statpost_url) counters.\n";
+		return NULL;
+
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	return res2cli(rpt_do_statpost_show(a->fd, a->argc, a->argv));
+}
+
+#ifndef APP_RPT_LOCK_DEBUG
+static char *handle_cli_lockstats(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "rpt lockstats {on|off|reset}";
+		e->usage = "Usage: rpt lockstats <on|off|reset>\n"
+				   "	Turn node lock contention profiling on or off, or clear its statistics.\n";
+		return NULL;
+
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	return res2cli(rpt_do_lockstats(a->fd, a->argc, a->argv));
+}
+
+static char *handle_cli_show_lockstats(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
+{
+	switch (cmd) {
+	case CLI_INIT:
+		e->command = "rpt show lockstats";
+		e->usage = "Usage: rpt show lockstats [nodename]\n"
+				   "	Display node lock wait and hold times by call site, worst first.\n";
+		return NULL;
+
+	case CLI_GENERATE:
+		return NULL;
+	}
+
+	return res2cli(rpt_do_show_lockstats(a->fd, a->argc, a->argv));
+}
+#endif
+
 static char *handle_cli_localplay(struct ast_cli_entry *e, int cmd, struct ast_cli_args *a)
 {
 	switch (cmd) {
@@ -1731,6 +2283,9 @@ static struct ast_cli_entry rpt_cli[] = {
 	AST_CLI_DEFINE(handle_cli_debug, "Enable app_rpt debugging"),
 	AST_CLI_DEFINE(handle_cli_dump, "Dump app_rpt structs for debugging"),
 	AST_CLI_DEFINE(handle_cli_stats, "Dump node statistics"),
+	AST_CLI_DEFINE(handle_cli_stats_perf, "Show node main loop timing"),
+	AST_CLI_DEFINE(handle_cli_trace_show, "Show audio path latency"),
+	AST_CLI_DEFINE(handle_cli_trace, "Control audio path latency tracing"),
 	AST_CLI_DEFINE(handle_cli_nodes, "Dump node list"),
 	AST_CLI_DEFINE(handle_cli_xnode, "Dump extended node info"),
 	AST_CLI_DEFINE(handle_cli_local_nodes, "Dump list of local node numbers"),
@@ -1748,6 +2303,15 @@ static struct ast_cli_entry rpt_cli[] = {
 	AST_CLI_DEFINE(handle_cli_sendtext, "Send a Text message to a specified nodes"),
 	AST_CLI_DEFINE(handle_cli_page, "Send a page to a user on a node"),
 	AST_CLI_DEFINE(handle_cli_lookup, "Lookup Allstar nodes"),
+	AST_CLI_DEFINE(handle_cli_dnscache_show, "Show the DNS node lookup cache"),
+	AST_CLI_DEFINE(handle_cli_dnscache_flush, "Flush the DNS node lookup cache"),
+	AST_CLI_DEFINE(handle_cli_tonecache_show, "Show the telemetry tone cache"),
+	AST_CLI_DEFINE(handle_cli_tonecache_flush, "Flush the telemetry tone cache"),
+	AST_CLI_DEFINE(handle_cli_statpost_show, "Show status post counters"),
+#ifndef APP_RPT_LOCK_DEBUG
+	AST_CLI_DEFINE(handle_cli_lockstats, "Control node lock profiling"),
+	AST_CLI_DEFINE(handle_cli_show_lockstats, "Show node lock contention"),
+#endif
 	AST_CLI_DEFINE(handle_cli_show_version, "Show app_rpt version"),
 	AST_CLI_DEFINE(handle_cli_auth_show, "Show TOTP auth session status for a node"),
 	AST_CLI_DEFINE(handle_cli_auth_logout, "Force-logout TOTP auth session for a node"),
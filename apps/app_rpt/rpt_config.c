@@ -12,20 +12,20 @@
 #include "asterisk/pbx.h"
 #include "asterisk/cli.h"		   /* use ast_cli_command */
 #include "asterisk/module.h"	   /* use ast_module_check */
-#include "asterisk/dns_core.h"	   /* use for dns lookup */
-#include "asterisk/dns_resolver.h" /* use for dns lookup */
-#include "asterisk/dns_srv.h"	   /* use for srv dns lookup */
-#include "asterisk/vector.h"	   /* required for dns */
 #include "asterisk/utils.h"		   /* required for ARRAY_LEN */
 
 #include "app_rpt.h"
-#include <arpa/nameser.h> /* needed for dns - must be after app_rpt.h */
 #include "rpt_lock.h"
 #include "rpt_config.h"
+#include "rpt_dns.h"
+#include "rpt_functrie.h"
+#include "rpt_events.h"
+#include "rpt_tonecache.h"
 #include "rpt_manager.h"
 #include "rpt_utils.h" /* use myatoi */
 #include "rpt_rig.h"   /* use setrem */
 #include "rpt_auth.h"  /* TOTP per-user authentication */
+#include "rpt_link.h"  /* use rpt_linklist_changed */
 
 /*! \brief Echolink queryoption for retrieving call sign */
 #define ECHOLINK_QUERY_CALLSIGN 2
@@ -40,7 +40,6 @@
 
 extern struct rpt rpt_vars[MAXRPTS];
 extern enum rpt_dns_method rpt_node_lookup_method;
-extern char *rpt_dns_node_domain;
 extern int rpt_max_dns_node_length;
 
 static struct ast_flags config_flags = { CONFIG_FLAG_WITHCOMMENTS };
@@ -365,115 +364,197 @@ int tlb_query_callsign(const char *node, char *callsign, int callsignlen)
 	return res;
 }
 
+/*! \brief One entry of an external node file */
+struct rpt_extnode {
+	const char *value;
+	char name[0];
+};
+
+/*! \brief Parsed and indexed section of an external node file */
+struct rpt_extnode_index {
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	off_t size;
+	int longestnode;			 /*!< \brief Longest node number in the section, not counting a leading '_' */
+	struct ao2_container *nodes; /*!< \brief struct rpt_extnode, hashed by name, NULL if the file could not be parsed */
+	char key[0];				 /*!< \brief "section:filename" */
+};
+
+/*! \brief Indexed external node files, by "section:filename" */
+static struct ao2_container *extnode_indexes;
+
+AO2_STRING_FIELD_HASH_FN(rpt_extnode, name);
+AO2_STRING_FIELD_CMP_FN(rpt_extnode, name);
+AO2_STRING_FIELD_HASH_FN(rpt_extnode_index, key);
+AO2_STRING_FIELD_CMP_FN(rpt_extnode_index, key);
+
+static void extnode_index_destroy(void *obj)
+{
+	struct rpt_extnode_index *idx = obj;
+
+	ao2_cleanup(idx->nodes);
+}
+
+/*! \brief Allocate an empty index for a file as it is now */
+static struct rpt_extnode_index *extnode_index_alloc(const char *key, const struct stat *st)
+{
+	struct rpt_extnode_index *idx;
+
+	idx = ao2_alloc_options(sizeof(*idx) + strlen(key) + 1, extnode_index_destroy, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!idx) {
+		return NULL;
+	}
+	strcpy(idx->key, key); /* Safe */
+	idx->dev = st->st_dev;
+	idx->ino = st->st_ino;
+	idx->mtime = st->st_mtime;
+	idx->size = st->st_size;
+	return idx;
+}
+
 /*!
- * \brief AllStar Network node lookup by dns.
- * Calling routine should pass a buffer for nodedata and nodedatalength
- * of sufficient length. A typical response is
- * "radio@123.123.123.123:4569/50000,123.123.123.123
- * This routine uses the SRV records provided by AllStarLink and resolves
- * the returned host's A record
- *
- * \note This routine can be called by app_rpt multiple times as
- * it constructs the node number.  The routine will only perform a
- * lookup after it receives 4 digits.  The actual node number may be
- * longer than 4 digits.
- *
- * \param node				Node number to lookup
- * \param nodedata			Buffer to hold the matching node information
- * \param nodedatalength	Length of the nodedata buffer
- * \retval -1 				if not successful
- * \retval 0 				if successful
+ * \internal
+ * \brief Parse one section of an external node file into a new index
+ * \note Called with nodelookuplock held, so a file is only parsed by one thread at a time.
+ * \return New index, one without nodes if the file could not be parsed, or NULL on allocation failure
  */
-static int node_lookup_bydns(const char *node, char *nodedata, size_t nodedatalength)
+static struct rpt_extnode_index *extnode_index_build(const char *key, const char *filename, const char *section, const struct stat *st)
 {
-	struct ast_dns_result *result;
-	const struct ast_dns_record *record;
-	char domain[256];
-	int res;
+	struct rpt_extnode_index *idx;
+	struct ast_config *ourcfg;
+	struct ast_variable *vp;
+	int count = 0;
 
-	/* we require at least a node length of 4 digits */
-	if (strlen(node) < 4) {
-		return -1;
+	ourcfg = ast_config_load(filename, config_flags);
+	if (!ourcfg || (ourcfg == CONFIG_STATUS_FILEINVALID)) {
+		/* Remember the failure, so the file isn't parsed again until it changes */
+		ast_debug(3, "Could not parse %s, not reading it again until it changes\n", filename);
+		return extnode_index_alloc(key, st);
+	}
+	for (vp = ast_variable_browse(ourcfg, section); vp; vp = vp->next) {
+		count++;
 	}
 
-	/* make sure we have buffers to return the data */
-	ast_assert(nodedata != NULL);
-	ast_assert(nodedatalength > 0);
+	idx = extnode_index_alloc(key, st);
+	if (!idx) {
+		ast_config_destroy(ourcfg);
+		return NULL;
+	}
+	/* The index is never modified once built, readers don't need to lock it */
+	idx->nodes = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, AO2_CONTAINER_ALLOC_OPT_DUPS_REJECT, MAX(count, 1) | 1,
+		rpt_extnode_hash_fn, NULL, rpt_extnode_cmp_fn);
+	if (!idx->nodes) {
+		ao2_ref(idx, -1);
+		ast_config_destroy(ourcfg);
+		return NULL;
+	}
 
-	/* Resolve the node by using SRV record followed by A record lookup */
-	{
-		char *hostname;
-		const char *ipaddress;
-		unsigned short iaxport;
+	for (vp = ast_variable_browse(ourcfg, section); vp; vp = vp->next) {
+		struct rpt_extnode *node;
+		size_t namelen = strlen(vp->name);
+		int j = namelen;
 
-		/* setup the domain to lookup */
-		memset(domain, 0, sizeof(domain));
-		res = snprintf(domain, sizeof(domain), "_iax._udp.%s.%s", node, rpt_dns_node_domain);
-		if (res < 0) {
-			return -1;
+		if (*vp->name == '_') {
+			j--;
 		}
+		idx->longestnode = MAX(idx->longestnode, j);
 
-		ast_debug(4, "Resolving DNS SRV records for: %s\n", domain);
-
-		if (ast_dns_resolve(domain, T_SRV, C_IN, &result)) {
-			ast_log(LOG_ERROR, "DNS SRV request failed\n");
-			return -1;
+		node = ao2_alloc_options(sizeof(*node) + namelen + strlen(vp->value) + 2, NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+		if (!node) {
+			continue;
 		}
-		if (!result) {
-			ast_debug(4, "No SRV results returned for %s\n", domain);
-			return -1;
-		}
-
-		/* get the response */
-		record = ast_dns_result_get_records(result);
+		strcpy(node->name, vp->name); /* Safe */
+		node->value = strcpy(node->name + namelen + 1, vp->value); /* Safe */
+		/* A duplicate is rejected, the first entry wins as it did with ast_variable_retrieve() */
+		ao2_link(idx->nodes, node);
+		ao2_ref(node, -1);
+	}
+	ast_config_destroy(ourcfg);
 
-		if (!record) {
-			ast_debug(4, "No SRV records returned for %s\n", domain);
-			ast_dns_result_free(result);
-			return -1;
-		}
+	ast_debug(3, "Indexed %d nodes from section %s of %s\n", ao2_container_count(idx->nodes), section, filename);
+	return idx;
+}
 
-		hostname = ast_strdupa(ast_dns_srv_get_host(record));
-		iaxport = ast_dns_srv_get_port(record);
+/*! \brief Whether an index was built from the file as it is now */
+static inline int extnode_index_current(const struct rpt_extnode_index *idx, const struct stat *st)
+{
+	return idx->dev == st->st_dev && idx->ino == st->st_ino && idx->mtime == st->st_mtime && idx->size == st->st_size;
+}
 
-		ast_debug(4, "Resolving A record for host: %s, port: %d\n", hostname, iaxport);
+/*! \brief Pass on an index with nodes, or release one left by a failed parse */
+static inline struct rpt_extnode_index *extnode_index_nodes(struct rpt_extnode_index *idx)
+{
+	if (!idx->nodes) {
+		ao2_ref(idx, -1);
+		return NULL;
+	}
+	return idx;
+}
 
-		ast_dns_result_free(result);
+/*!
+ * \internal
+ * \brief Get the index for a section of an external node file
+ * The file is only parsed again when it is replaced or modified, whether or not it parsed the last time.
+ * \return Index with a reference the caller must release, or NULL if the file is missing or invalid
+ */
+static struct rpt_extnode_index *extnode_index_get(const char *filename, const char *section)
+{
+	struct rpt_extnode_index *idx;
+	struct stat st;
+	char key[PATH_MAX + 128];
 
-		if (ast_dns_resolve(hostname, T_A, C_IN, &result)) {
-			ast_log(LOG_ERROR, "DNS resolve request failed\n");
-			return -1;
-		}
-		if (!result) {
-			ast_debug(4, "No A results returned for %s\n", hostname);
-			return -1;
-		}
+	if (stat(filename, &st) == -1 || !extnode_indexes) {
+		return NULL;
+	}
+	snprintf(key, sizeof(key), "%s:%s", section, filename);
 
-		/* get the response */
-		record = ast_dns_result_get_records(result);
-		if (!record) {
-			ast_debug(4, "No A records returned for %s\n", hostname);
-			ast_dns_result_free(result);
-			return -1;
-		}
+	idx = ao2_find(extnode_indexes, key, OBJ_SEARCH_KEY);
+	if (idx && extnode_index_current(idx, &st)) {
+		return extnode_index_nodes(idx);
+	}
+	ao2_cleanup(idx);
 
-		ipaddress = ast_inet_ntoa(*(struct in_addr *) ast_dns_record_get_data(record));
+	ast_mutex_lock(&nodelookuplock);
+	/* Another thread may have rebuilt it while we waited */
+	idx = ao2_find(extnode_indexes, key, OBJ_SEARCH_KEY);
+	if (idx && extnode_index_current(idx, &st)) {
+		ast_mutex_unlock(&nodelookuplock);
+		return extnode_index_nodes(idx);
+	}
+	ao2_cleanup(idx);
 
-		ast_dns_result_free(result);
+	idx = extnode_index_build(key, filename, section, &st);
 
-		/* format the response */
-		memset(nodedata, 0, nodedatalength);
-		snprintf(nodedata, nodedatalength, "radio@%s:%d/%s,%s", ipaddress, iaxport, node, ipaddress);
+	/* Swap in the new index, lookups already holding the old one finish with it */
+	ao2_wrlock(extnode_indexes);
+	ao2_find(extnode_indexes, key, OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NODATA | OBJ_NOLOCK);
+	if (idx) {
+		ao2_link_flags(extnode_indexes, idx, OBJ_NOLOCK);
 	}
-	return 0;
+	ao2_unlock(extnode_indexes);
+	ast_mutex_unlock(&nodelookuplock);
+
+	return idx ? extnode_index_nodes(idx) : NULL;
+}
+
+int rpt_extnode_cache_init(void)
+{
+	extnode_indexes = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, AO2_CONTAINER_ALLOC_OPT_DUPS_REJECT, 7,
+		rpt_extnode_index_hash_fn, NULL, rpt_extnode_index_cmp_fn);
+	return extnode_indexes ? 0 : -1;
+}
+
+void rpt_extnode_cache_cleanup(void)
+{
+	ao2_cleanup(extnode_indexes);
+	extnode_indexes = NULL;
 }
 
 int node_lookup(struct rpt *myrpt, char *digitbuf, char *nodedata, size_t nodedatalength, int wilds)
 {
 	const char *val;
-	int longestnode, i, j, found = 0;
-	struct stat mystat;
-	struct ast_config *ourcfg;
+	int longestnode, i, found = 0;
 	struct ast_variable *vp;
 
 	/* try to look it up locally first */
@@ -501,7 +582,7 @@ int node_lookup(struct rpt *myrpt, char *digitbuf, char *nodedata, size_t nodeda
 
 	/* try to look up the node using dns */
 	if (rpt_node_lookup_method == LOOKUP_BOTH || rpt_node_lookup_method == LOOKUP_DNS) {
-		if (!node_lookup_bydns(digitbuf, nodedata, nodedatalength)) {
+		if (!rpt_dns_node_lookup(digitbuf, nodedata, nodedatalength)) {
 			ast_debug(4, "Resolved by DNS: node %s to %s\n", digitbuf, nodedata);
 			return 0;
 		}
@@ -509,64 +590,36 @@ int node_lookup(struct rpt *myrpt, char *digitbuf, char *nodedata, size_t nodeda
 
 	/* try to lookup using the external file(s) */
 	if (rpt_node_lookup_method == LOOKUP_BOTH || rpt_node_lookup_method == LOOKUP_FILE) {
-		ast_mutex_lock(&nodelookuplock);
 		if (!myrpt->p.extnodefilesn) {
-			ast_mutex_unlock(&nodelookuplock);
 			return -1;
 		}
 
-		/* determine longest node length again */
-		longestnode = 0;
-		vp = ast_variable_browse(myrpt->cfg, myrpt->p.nodes);
-		while (vp) {
-			j = strlen(vp->name);
-			if (*vp->name == '_') {
-				j--;
-			}
-			longestnode = MAX(longestnode, j);
-			vp = vp->next;
-		}
-		found = 0;
+		longestnode = myrpt->longestlocalnode;
 
 		/* process each external node file */
 		for (i = 0; i < myrpt->p.extnodefilesn; i++) {
-			/* see if the external node file exists */
-			if (stat(myrpt->p.extnodefiles[i], &mystat) == -1) {
-				continue;
-			}
+			struct rpt_extnode_index *idx;
+			struct rpt_extnode *node;
 
-			ourcfg = ast_config_load(myrpt->p.extnodefiles[i], config_flags);
-			if (!ourcfg || (ourcfg == CONFIG_STATUS_FILEINVALID)) {
+			idx = extnode_index_get(myrpt->p.extnodefiles[i], myrpt->p.extnodes);
+			if (!idx) {
 				/* if file is not present or not valid, try the next one */
 				continue;
 			}
-
-			/* determine the longest node */
-			vp = ast_variable_browse(ourcfg, myrpt->p.extnodes);
-			while (vp) {
-				j = strlen(vp->name);
-				if (*vp->name == '_') {
-					j--;
-				}
-				longestnode = MAX(longestnode, j);
-				vp = vp->next;
-			}
+			longestnode = MAX(longestnode, idx->longestnode);
 
 			/* if we have not found a match, attempt to load a matching node */
-			if (!found) {
-				val = ast_variable_retrieve(ourcfg, myrpt->p.extnodes, digitbuf);
-				if (val) {
-					found = 1;
-					if (nodedata && nodedatalength) {
-						snprintf(nodedata, nodedatalength, "%s", val);
-						ast_debug(4, "Resolved from file: node %s to %s\n", digitbuf, nodedata);
-					}
+			if (!found && (node = ao2_find(idx->nodes, digitbuf, OBJ_SEARCH_KEY))) {
+				found = 1;
+				if (nodedata && nodedatalength) {
+					snprintf(nodedata, nodedatalength, "%s", node->value);
+					ast_debug(4, "Resolved from file: node %s to %s\n", digitbuf, nodedata);
 				}
+				ao2_ref(node, -1);
 			}
-			ast_config_destroy(ourcfg);
+			ao2_ref(idx, -1);
 		}
 		myrpt->longestnode = MAX(longestnode, rpt_max_dns_node_length);
-		ast_mutex_unlock(&nodelookuplock);
 	}
 
 	return (found ? 0 : -1);
@@ -576,16 +629,14 @@ int forward_node_lookup(char *digitbuf, struct ast_config *cfg, char *nodedata,
 {
 	char *efil, *strs[100];
 	const char *enod, *val;
-	int i, n;
-	struct stat mystat;
-	struct ast_config *ourcfg;
+	int i, n, found = 0;
 
 	memset(nodedata, 0, nodedatalength);
 	val = NULL;
 
 	/* try to look up the node using dns */
 	if (rpt_node_lookup_method == LOOKUP_BOTH || rpt_node_lookup_method == LOOKUP_DNS) {
-		if (!node_lookup_bydns(digitbuf, nodedata, nodedatalength)) {
+		if (!rpt_dns_node_lookup(digitbuf, nodedata, nodedatalength)) {
 			ast_debug(4, "Forward lookup resolved by DNS: node %s to %s\n", digitbuf, nodedata);
 			return 0;
 		}
@@ -606,10 +657,8 @@ int forward_node_lookup(char *digitbuf, struct ast_config *cfg, char *nodedata,
 		}
 
 		/* prepare to lookup using the external file(s) */
-		ast_mutex_lock(&nodelookuplock);
 		efil = ast_strdup(val);
 		if (!efil) {
-			ast_mutex_unlock(&nodelookuplock);
 			return -1;
 		}
 
@@ -617,41 +666,34 @@ int forward_node_lookup(char *digitbuf, struct ast_config *cfg, char *nodedata,
 		n = finddelim(efil, strs, ARRAY_LEN(strs));
 		if (n < 1) {
 			ast_free(efil);
-			ast_mutex_unlock(&nodelookuplock);
 			return -1;
 		}
-		val = NULL;
 
-		/* process each external node file */
-		for (i = 0; i < n; i++) {
-			/* see if the external node file exists */
-			if (stat(strs[i], &mystat) == -1) {
-				continue;
-			}
+		/* process each external node file, the first match wins */
+		for (i = 0; i < n && !found; i++) {
+			struct rpt_extnode_index *idx;
+			struct rpt_extnode *node;
 
-			ourcfg = ast_config_load(strs[i], config_flags);
+			idx = extnode_index_get(strs[i], enod);
 			/* if file is not there, try the next one */
-			if (!ourcfg) {
+			if (!idx) {
 				continue;
 			}
 
-			/* if we have not found a match, attempt to load a matching node */
-			if (!val) {
-				val = ast_variable_retrieve(ourcfg, enod, digitbuf);
+			node = ao2_find(idx->nodes, digitbuf, OBJ_SEARCH_KEY);
+			if (node) {
+				found = 1;
+				ast_copy_string(nodedata, node->value, nodedatalength);
+				ast_debug(4, "Forward lookup resolved from file: node %s to %s\n", digitbuf, nodedata);
+				ao2_ref(node, -1);
 			}
-			ast_config_destroy(ourcfg);
-		}
-
-		if (val) {
-			ast_copy_string(nodedata, val, nodedatalength);
-			ast_debug(4, "Forward lookup resolved from file: node %s to %s\n", digitbuf, nodedata);
+			ao2_ref(idx, -1);
 		}
 
-		ast_mutex_unlock(&nodelookuplock);
 		ast_free(efil);
 	}
 
-	return (val ? 0 : -1);
+	return (found ? 0 : -1);
 }
 
 void rpt_free_config_vars(struct rpt *myrpt)
@@ -728,10 +770,8 @@ void load_rpt_vars(int n, int init)
 		rpt_vars[n].outstreampipe[0] = -1;
 		rpt_vars[n].outstreampipe[1] = -1;
 	}
-#ifdef __RPT_NOTCH
 	/* zot out filters stuff */
-	memset(&rpt_vars[n].filters, 0, sizeof(rpt_vars[n].filters));
-#endif
+	rpt_notch_clear(&rpt_vars[n].notch);
 
 #define RPT_CONFIG_VAR(var, name) \
 	val = ast_variable_retrieve(cfg, cat, name); \
@@ -864,11 +904,16 @@ void load_rpt_vars(int n, int init)
 		/* if message truncation enabled, set minimum */
 		rpt_vars[n].p.linkpost_max_message_len = 500;
 	}
+	/* Cached link lists may have been truncated to the old length */
+	rpt_linklist_changed(&rpt_vars[n]);
 	/* Due to a limit imposed by some old clients, 40 seconds is the maximum time allowed
 	 * Without the old client limitation, the upper limit could be increased in the future
 	 * Refer to PR #974 for further details
 	 */
 	RPT_CONFIG_VAR_INT_DEFAULT_MIN_MAX(linkpost_time, "linkpost_time", 30, 10, 40);
+	/* 0 services each link from its own thread */
+	RPT_CONFIG_VAR_INT_DEFAULT_MIN_MAX(linkworkers, "linkworkers", 0, 0, 64);
+	RPT_CONFIG_VAR_BOOL(dspworker, "dspworker");
 
 	/* configure how we interact with "stats.allstarlink.org" */
 	RPT_CONFIG_VAR_INT_DEFAULT_MIN_MAX(statpost_time, "statpost_time", 60, 30, 600);
@@ -940,6 +985,7 @@ void load_rpt_vars(int n, int init)
 	RPT_CONFIG_VAR(patchconnect, "patchconnect");
 	RPT_CONFIG_VAR(archivedir, "archivedir");
 	RPT_CONFIG_VAR_BOOL_DEFAULT(archiveaudio, "archiveaudio", 1);
+	RPT_CONFIG_VAR_BOOL_DEFAULT(archivejson, "archivejson", 0);
 	RPT_CONFIG_VAR(archivedatefmt, "archivedatefmt");
 	RPT_CONFIG_VAR(archiveformat, "archiveformat");
 	RPT_CONFIG_VAR_INT(authlevel, "authlevel");
@@ -1022,21 +1068,17 @@ void load_rpt_vars(int n, int init)
 	RPT_CONFIG_VAR_INT_DEFAULT_MIN_MAX(auth_otp_step, "auth_otp_step", 30, 10, 120);
 	RPT_CONFIG_VAR_INT_DEFAULT_MIN_MAX(auth_otp_window, "auth_otp_window", 1, 0, 3);
 
-#ifdef __RPT_NOTCH
-	val = ast_variable_retrieve(cfg, this, "rxnotch");
+	val = ast_variable_retrieve(cfg, cat, "rxnotch");
 	if (val) {
-		i = finddelim((char *) val, strs,
-			MIN(ARRAY_LEN(strs), ARRAY_LEN(rpt_vars[n].filters) * 2)); /*! \todo This is illegal, cannot cast the const away */
-		i &= ~1;													   /* force an even number, rounded down */
-		if (i >= 2) {
-			for (j = 0; j < i; j += 2) {
-				rpt_mknotch(atof(strs[j]), atof(strs[j + 1]), &rpt_vars[n].filters[j >> 1].gain,
-					&rpt_vars[n].filters[j >> 1].const0, &rpt_vars[n].filters[j >> 1].const1, &rpt_vars[n].filters[j >> 1].const2);
-				sprintf(rpt_vars[n].filters[j >> 1].desc, "%s Hz, BW = %s", strs[j], strs[j + 1]);
+		tmp = ast_strdupa(val);
+		i = finddelim(tmp, strs, MIN(ARRAY_LEN(strs), RPT_NOTCH_MAX * 2));
+		i &= ~1; /* force an even number, rounded down */
+		for (j = 0; j < i; j += 2) {
+			if (rpt_notch_add(&rpt_vars[n].notch, atof(strs[j]), atof(strs[j + 1]))) {
+				ast_log(LOG_WARNING, "Invalid rxnotch %s Hz, BW = %s in node %s\n", strs[j], strs[j + 1], rpt_vars[n].name);
 			}
 		}
 	}
-#endif
 
 	RPT_CONFIG_VAR_INT(votertype, "votertype");
 	RPT_CONFIG_VAR_INT(votermode, "votermode");
@@ -1155,71 +1197,26 @@ void load_rpt_vars(int n, int init)
 	}
 
 	longestnode = 0;
+	rpt_vars[n].longestlocalnode = 0;
 
 	vp = ast_variable_browse(cfg, rpt_vars[n].p.nodes);
 
 	while (vp) {
 		j = strlen(vp->name);
 		longestnode = MAX(longestnode, j);
+		/* node_lookup() doesn't count the leading '_' of a pattern */
+		rpt_vars[n].longestlocalnode = MAX(rpt_vars[n].longestlocalnode, *vp->name == '_' ? j - 1 : j);
 		vp = vp->next;
 	}
 
 	rpt_vars[n].longestnode = MAX(longestnode, rpt_max_dns_node_length);
 
-	/* For this repeater, Determine the length of the longest function */
-	rpt_vars[n].longestfunc = 0;
-	vp = ast_variable_browse(cfg, rpt_vars[n].p.functions);
-	while (vp) {
-		j = strlen(vp->name);
-		if (j > rpt_vars[n].longestfunc) {
-			rpt_vars[n].longestfunc = j;
-		}
-		vp = vp->next;
-	}
+	/* Compile the DTMF function stanzas */
+	rpt_functries_load(&rpt_vars[n], cfg);
+	rpt_events_load(&rpt_vars[n], cfg);
+	/* Morse and tone settings may have changed */
+	rpt_tonecache_flush();
 
-	/* For this repeater, Determine the length of the longest function */
-	rpt_vars[n].link_longestfunc = 0;
-	vp = ast_variable_browse(cfg, rpt_vars[n].p.link_functions);
-	while (vp) {
-		j = strlen(vp->name);
-		if (j > rpt_vars[n].link_longestfunc) {
-			rpt_vars[n].link_longestfunc = j;
-		}
-		vp = vp->next;
-	}
-	rpt_vars[n].phone_longestfunc = 0;
-	if (rpt_vars[n].p.phone_functions) {
-		vp = ast_variable_browse(cfg, rpt_vars[n].p.phone_functions);
-		while (vp) {
-			j = strlen(vp->name);
-			if (j > rpt_vars[n].phone_longestfunc) {
-				rpt_vars[n].phone_longestfunc = j;
-			}
-			vp = vp->next;
-		}
-	}
-	rpt_vars[n].dphone_longestfunc = 0;
-	if (rpt_vars[n].p.dphone_functions) {
-		vp = ast_variable_browse(cfg, rpt_vars[n].p.dphone_functions);
-		while (vp) {
-			j = strlen(vp->name);
-			if (j > rpt_vars[n].dphone_longestfunc) {
-				rpt_vars[n].dphone_longestfunc = j;
-			}
-			vp = vp->next;
-		}
-	}
-	rpt_vars[n].alt_longestfunc = 0;
-	if (rpt_vars[n].p.alt_functions) {
-		vp = ast_variable_browse(cfg, rpt_vars[n].p.alt_functions);
-		while (vp) {
-			j = strlen(vp->name);
-			if (j > rpt_vars[n].alt_longestfunc) {
-				rpt_vars[n].alt_longestfunc = j;
-			}
-			vp = vp->next;
-		}
-	}
 	rpt_vars[n].macro_longest = 1;
 	vp = ast_variable_browse(cfg, rpt_vars[n].p.macro);
 	while (vp) {
@@ -1379,8 +1376,11 @@ void rpt_update_boolean(struct rpt *myrpt, char *varname, int newval)
 
 	pbx_builtin_setvar_helper(chan, varname, buf);
 	rpt_manager_trigger(myrpt, chan, varname, buf);
+	/* Often called with the node locked, the node thread runs the rules */
 	if (newval >= 0) {
-		rpt_event_process(myrpt, chan);
+		rpt_events_update(myrpt, varname, buf);
+	} else {
+		rpt_events_setvar(myrpt, varname, buf);
 	}
 	ast_channel_unref(chan);
 }
@@ -61,6 +61,18 @@ int tlb_query_callsign(const char *node, char *callsign, int callsignlen);
  */
 int node_lookup(struct rpt *myrpt, char *digitbuf, char *nodedata, size_t nodedatalength, int wilds);
 
+/*!
+ * \brief Allocate the cache of indexed external node files
+ * \retval 0 on success
+ * \retval -1 on failure
+ */
+int rpt_extnode_cache_init(void);
+
+/*!
+ * \brief Free the cache of indexed external node files
+ */
+void rpt_extnode_cache_cleanup(void);
+
 /*!
  * \brief Forward node lookup function.  This function will take the nodelist
  * and try to match the node number that was passed to it.  If it is found, the function requested will succeed.
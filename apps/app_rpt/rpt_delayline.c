@@ -0,0 +1,148 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT audio delay line
+ */
+
+#include "asterisk.h"
+
+#include "asterisk/frame.h"
+#include "asterisk/utils.h"
+
+#include "app_rpt.h"
+#include "rpt_delayline.h"
+
+/*!
+ * \internal
+ * \brief Copy n samples out of the ring starting at pos, handling wrap around
+ */
+static void delay_line_copy_out(const struct rpt_delay_line *dl, unsigned int pos, short *samples, unsigned int n)
+{
+	unsigned int first = MIN(n, dl->size - pos);
+
+	memcpy(samples, dl->buf + pos, first * sizeof(*samples));
+	if (n > first) {
+		memcpy(samples + first, dl->buf, (n - first) * sizeof(*samples));
+	}
+}
+
+int rpt_delay_line_reserve(struct rpt_delay_line *dl, unsigned int samples)
+{
+	short *buf;
+
+	if (samples <= dl->size) {
+		return 0;
+	}
+	buf = ast_malloc(samples * sizeof(*buf));
+	if (!buf) {
+		return -1;
+	}
+	/* Linearize whatever is queued into the new buffer */
+	if (dl->len) {
+		delay_line_copy_out(dl, dl->head, buf, dl->len);
+	}
+	ast_free(dl->buf);
+	dl->buf = buf;
+	dl->size = samples;
+	dl->head = 0;
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Make room for n more samples
+ */
+static int delay_line_grow(struct rpt_delay_line *dl, unsigned int n)
+{
+	if (dl->len + n <= dl->size) {
+		return 0;
+	}
+	return rpt_delay_line_reserve(dl, MAX(dl->size * 2, dl->len + n));
+}
+
+int rpt_delay_line_preroll(struct rpt_delay_line *dl, unsigned int samples)
+{
+	unsigned int tail, n, first;
+
+	if (dl->len >= samples) {
+		return 0;
+	}
+	n = samples - dl->len;
+	if (delay_line_grow(dl, n)) {
+		return -1;
+	}
+	tail = (dl->head + dl->len) % dl->size;
+	first = MIN(n, dl->size - tail);
+	memset(dl->buf + tail, 0, first * sizeof(*dl->buf));
+	if (n > first) {
+		memset(dl->buf, 0, (n - first) * sizeof(*dl->buf));
+	}
+	dl->len += n;
+	return 0;
+}
+
+int rpt_delay_line_push(struct rpt_delay_line *dl, const short *samples, unsigned int n)
+{
+	unsigned int tail, first;
+
+	if (!n) {
+		return 0;
+	}
+	if (delay_line_grow(dl, n)) {
+		return -1;
+	}
+	tail = (dl->head + dl->len) % dl->size;
+	first = MIN(n, dl->size - tail);
+	memcpy(dl->buf + tail, samples, first * sizeof(*samples));
+	if (n > first) {
+		memcpy(dl->buf, samples + first, (n - first) * sizeof(*samples));
+	}
+	dl->len += n;
+	return 0;
+}
+
+unsigned int rpt_delay_line_pop(struct rpt_delay_line *dl, short *samples, unsigned int n)
+{
+	unsigned int m = MIN(n, dl->len);
+
+	if (m) {
+		delay_line_copy_out(dl, dl->head, samples, m);
+		dl->head = (dl->head + m) % dl->size;
+		dl->len -= m;
+	}
+	if (n > m) {
+		memset(samples + m, 0, (n - m) * sizeof(*samples));
+	}
+	return m;
+}
+
+int rpt_delay_line_frame(struct rpt_delay_line *dl, struct ast_frame *f, int push, int preroll)
+{
+	unsigned int n = f->samples;
+
+	if (!f->data.ptr || !n || f->datalen != n * sizeof(short)) {
+		return 0;
+	}
+	if (preroll > 0 && rpt_delay_line_preroll(dl, preroll * n)) {
+		return -1;
+	}
+	if (push && rpt_delay_line_push(dl, f->data.ptr, n)) {
+		return -1;
+	}
+	/* Replace the frame's audio with the oldest queued audio, silence if nothing is queued */
+	rpt_delay_line_pop(dl, f->data.ptr, n);
+	return 0;
+}
+
+void rpt_delay_line_reset(struct rpt_delay_line *dl)
+{
+	dl->head = 0;
+	dl->len = 0;
+}
+
+void rpt_delay_line_free(struct rpt_delay_line *dl)
+{
+	ast_free(dl->buf);
+	memset(dl, 0, sizeof(*dl));
+}
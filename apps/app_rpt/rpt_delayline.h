@@ -0,0 +1,71 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT audio delay line
+ *
+ * A ring of signed linear samples used to delay simplex patch and phone audio.
+ * Length, push and pop are O(1) in the number of queued frames and no memory
+ * is allocated once the ring has grown to the configured delay.
+ */
+
+/*!
+ * \brief Make sure a delay line can hold at least the given number of samples
+ * \param dl Delay line
+ * \param samples Required capacity
+ * \retval 0 on success
+ * \retval -1 on allocation failure, the delay line is unchanged
+ */
+int rpt_delay_line_reserve(struct rpt_delay_line *dl, unsigned int samples);
+
+/*!
+ * \brief Pad a delay line with silence
+ * \param dl Delay line
+ * \param samples Number of samples the delay line should hold once padded
+ * \retval 0 on success
+ * \retval -1 on allocation failure
+ */
+int rpt_delay_line_preroll(struct rpt_delay_line *dl, unsigned int samples);
+
+/*!
+ * \brief Add samples to the end of a delay line, growing it if needed
+ * \param dl Delay line
+ * \param samples Samples to add
+ * \param n Number of samples
+ * \retval 0 on success
+ * \retval -1 on allocation failure, nothing was added
+ */
+int rpt_delay_line_push(struct rpt_delay_line *dl, const short *samples, unsigned int n);
+
+/*!
+ * \brief Take samples from the start of a delay line
+ * \param dl Delay line
+ * \param samples Buffer for the samples, anything not available is filled with silence
+ * \param n Number of samples wanted
+ * \return Number of samples that came from the delay line
+ */
+unsigned int rpt_delay_line_pop(struct rpt_delay_line *dl, short *samples, unsigned int n);
+
+/*!
+ * \brief Delay a signed linear voice frame in place
+ * \param dl Delay line
+ * \param f Frame, its audio is queued and replaced by the oldest queued audio
+ * \param push Queue the frame's audio, if false the frame is only replaced
+ * \param preroll Pad the delay line with silence to this many frames before queuing, 0 for none
+ * \retval 0 on success
+ * \retval -1 on allocation failure, the frame passes through undelayed
+ * \note The frame is muted if nothing is queued.  Frames that are not signed linear pass through.
+ */
+int rpt_delay_line_frame(struct rpt_delay_line *dl, struct ast_frame *f, int push, int preroll);
+
+/*!
+ * \brief Discard everything queued in a delay line
+ * \param dl Delay line
+ */
+void rpt_delay_line_reset(struct rpt_delay_line *dl);
+
+/*!
+ * \brief Free a delay line's buffer
+ * \param dl Delay line
+ */
+void rpt_delay_line_free(struct rpt_delay_line *dl);
@@ -0,0 +1,417 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT DNS node lookup and cache
+ */
+
+#include "asterisk.h"
+
+#include "asterisk/astobj2.h"
+#include "asterisk/dns_core.h"	   /* use for dns lookup */
+#include "asterisk/dns_resolver.h" /* use for dns lookup */
+#include "asterisk/dns_srv.h"	   /* use for srv dns lookup */
+#include "asterisk/lock.h"
+#include "asterisk/utils.h"
+
+#include "app_rpt.h"
+#include <arpa/nameser.h> /* needed for dns - must be after app_rpt.h */
+#include "rpt_dns.h"
+
+extern const char *rpt_dns_node_domain;
+
+/*! \brief Number of hash buckets in the DNS cache */
+#define RPT_DNS_CACHE_BUCKETS 127
+
+/*! \brief A cached answer for a node number, never modified once published except for refreshing */
+struct rpt_dns_entry {
+	time_t expires;
+	unsigned int ttl;
+	int refreshing;				/*!< \brief A background refresh is in progress */
+	char nodedata[MAXNODESTR]; /*!< \brief Empty if the node doesn't exist */
+	char node[0];
+};
+
+static struct ao2_container *dns_cache;
+
+/*! \brief Protects dns_cache and dns_refreshing */
+AST_MUTEX_DEFINE_STATIC(dns_lock);
+/*! \brief Signaled when a background refresh finishes */
+static ast_cond_t dns_refresh_cond;
+/*! \brief Number of background refresh threads running */
+static int dns_refreshing;
+/*! \brief Last time expired entries were removed, protected by the cache's lock */
+static time_t dns_swept;
+
+static struct rpt_dns_cache_stats dns_stats;
+
+AO2_STRING_FIELD_HASH_FN(rpt_dns_entry, node);
+AO2_STRING_FIELD_CMP_FN(rpt_dns_entry, node);
+
+/*!
+ * \internal
+ * \brief Resolve a node using its SRV record followed by an A record lookup
+ * \param node Node number
+ * \param nodedata Buffer for the node information
+ * \param nodedatalength Length of nodedata
+ * \param[out] ttl Lowest TTL of the records used
+ * \retval 0 if resolved
+ * \retval 1 if the node doesn't exist (NXDOMAIN)
+ * \retval -1 if the lookup failed, or returned no answer for another reason
+ */
+static int dns_resolve_node(const char *node, char *nodedata, size_t nodedatalength, unsigned int *ttl)
+{
+	struct ast_dns_result *result;
+	const struct ast_dns_record *record;
+	char domain[256];
+	char *hostname;
+	const char *ipaddress;
+	unsigned short iaxport;
+	int res;
+
+	/* setup the domain to lookup */
+	memset(domain, 0, sizeof(domain));
+	res = snprintf(domain, sizeof(domain), "_iax._udp.%s.%s", node, rpt_dns_node_domain);
+	if (res < 0) {
+		return -1;
+	}
+
+	ast_debug(4, "Resolving DNS SRV records for: %s\n", domain);
+
+	if (ast_dns_resolve(domain, T_SRV, C_IN, &result)) {
+		ast_log(LOG_ERROR, "DNS SRV request failed\n");
+		return -1;
+	}
+	if (!result) {
+		ast_debug(4, "No SRV results returned for %s\n", domain);
+		return -1;
+	}
+
+	/* get the response */
+	record = ast_dns_result_get_records(result);
+
+	if (!record) {
+		/* Only a node the server says doesn't exist is worth caching, not a SERVFAIL or timeout */
+		res = ast_dns_result_get_nxdomain(result) ? 1 : -1;
+		ast_debug(4, "No SRV records returned for %s, rcode %u\n", domain, ast_dns_result_get_rcode(result));
+		ast_dns_result_free(result);
+		return res;
+	}
+
+	hostname = ast_strdupa(ast_dns_srv_get_host(record));
+	iaxport = ast_dns_srv_get_port(record);
+	*ttl = ast_dns_result_get_lowest_ttl(result);
+
+	ast_debug(4, "Resolving A record for host: %s, port: %d\n", hostname, iaxport);
+
+	ast_dns_result_free(result);
+
+	if (ast_dns_resolve(hostname, T_A, C_IN, &result)) {
+		ast_log(LOG_ERROR, "DNS resolve request failed\n");
+		return -1;
+	}
+	if (!result) {
+		ast_debug(4, "No A results returned for %s\n", hostname);
+		return -1;
+	}
+
+	/* get the response */
+	record = ast_dns_result_get_records(result);
+	if (!record) {
+		ast_debug(4, "No A records returned for %s\n", hostname);
+		ast_dns_result_free(result);
+		return -1;
+	}
+
+	ipaddress = ast_inet_ntoa(*(struct in_addr *) ast_dns_record_get_data(record));
+	*ttl = MIN(*ttl, (unsigned int) ast_dns_result_get_lowest_ttl(result));
+
+	ast_dns_result_free(result);
+
+	/* format the response */
+	memset(nodedata, 0, nodedatalength);
+	snprintf(nodedata, nodedatalength, "radio@%s:%d/%s,%s", ipaddress, iaxport, node, ipaddress);
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Get a reference to the cache
+ * \return The cache, or NULL if it isn't allocated
+ */
+static struct ao2_container *dns_cache_get(void)
+{
+	struct ao2_container *cache;
+
+	ast_mutex_lock(&dns_lock);
+	cache = ao2_bump(dns_cache);
+	ast_mutex_unlock(&dns_lock);
+	return cache;
+}
+
+static int dns_entry_expired_cb(void *obj, void *arg, int flags)
+{
+	struct rpt_dns_entry *entry = obj;
+	time_t *now = arg;
+
+	return entry->expires <= *now ? CMP_MATCH : 0;
+}
+
+/*!
+ * \internal
+ * \brief Make room for a new entry
+ * \note Called with the cache write locked
+ */
+static void dns_cache_evict(struct ao2_container *cache, time_t now)
+{
+	struct ao2_iterator it;
+	struct rpt_dns_entry *entry, *oldest = NULL;
+
+	/* Expired entries of nodes that are never looked up again would otherwise stay forever */
+	if (now - dns_swept >= RPT_DNS_MIN_TTL || ao2_container_count(cache) >= RPT_DNS_CACHE_MAX) {
+		dns_swept = now;
+		ao2_callback(cache, OBJ_NOLOCK | OBJ_UNLINK | OBJ_MULTIPLE | OBJ_NODATA, dns_entry_expired_cb, &now);
+	}
+	if (ao2_container_count(cache) < RPT_DNS_CACHE_MAX) {
+		return;
+	}
+
+	/* Still full, drop the answer closest to expiring */
+	it = ao2_iterator_init(cache, AO2_ITERATOR_DONTLOCK);
+	while ((entry = ao2_iterator_next(&it))) {
+		if (!oldest || entry->expires < oldest->expires) {
+			ao2_replace(oldest, entry);
+		}
+		ao2_ref(entry, -1);
+	}
+	ao2_iterator_destroy(&it);
+	if (oldest) {
+		ao2_unlink_flags(cache, oldest, OBJ_NOLOCK);
+		ao2_ref(oldest, -1);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Resolve a node and publish the answer in the cache
+ * \return The new entry with a reference the caller must release, or NULL if the lookup failed
+ */
+static struct rpt_dns_entry *dns_cache_update(struct ao2_container *cache, const char *node)
+{
+	struct rpt_dns_entry *entry;
+	char nodedata[MAXNODESTR];
+	unsigned int ttl = 0;
+	time_t now;
+	int res;
+
+	res = dns_resolve_node(node, nodedata, sizeof(nodedata), &ttl);
+	if (res < 0) {
+		/* Don't cache resolver failures, the next lookup tries again */
+		__atomic_fetch_add(&dns_stats.failures, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	entry = ao2_alloc_options(sizeof(*entry) + strlen(node) + 1, NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!entry) {
+		return NULL;
+	}
+	strcpy(entry->node, node); /* Safe */
+	if (res) {
+		entry->ttl = RPT_DNS_NEGATIVE_TTL;
+	} else {
+		ast_copy_string(entry->nodedata, nodedata, sizeof(entry->nodedata));
+		entry->ttl = MAX(RPT_DNS_MIN_TTL, MIN(ttl, RPT_DNS_MAX_TTL));
+	}
+	now = time(NULL);
+	entry->expires = now + entry->ttl;
+
+	/* Replace any older answer in one step */
+	ao2_wrlock(cache);
+	ao2_find(cache, node, OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NODATA | OBJ_NOLOCK);
+	dns_cache_evict(cache, now);
+	ao2_link_flags(cache, entry, OBJ_NOLOCK);
+	ao2_unlock(cache);
+
+	return entry;
+}
+
+static void *dns_refresh_thread(void *data)
+{
+	struct rpt_dns_entry *old = data;
+	struct rpt_dns_entry *entry = NULL;
+	struct ao2_container *cache;
+
+	cache = dns_cache_get();
+	if (cache) {
+		entry = dns_cache_update(cache, old->node);
+		ao2_ref(cache, -1);
+	}
+	if (!entry) {
+		/* Let the next lookup after expiry try again */
+		ast_atomic_fetchadd_int(&old->refreshing, -1);
+	}
+	ao2_cleanup(entry);
+	ao2_ref(old, -1);
+
+	ast_mutex_lock(&dns_lock);
+	dns_refreshing--;
+	ast_cond_signal(&dns_refresh_cond);
+	ast_mutex_unlock(&dns_lock);
+	return NULL;
+}
+
+/*!
+ * \internal
+ * \brief Start a background refresh of an entry unless one is already running
+ */
+static void dns_cache_refresh(struct rpt_dns_entry *entry)
+{
+	pthread_t thread;
+
+	if (ast_atomic_fetchadd_int(&entry->refreshing, 1)) {
+		ast_atomic_fetchadd_int(&entry->refreshing, -1);
+		return;
+	}
+	ao2_ref(entry, +1);
+	/* rpt_dns_cache_cleanup() waits for the refresh threads */
+	ast_mutex_lock(&dns_lock);
+	if (!dns_cache || ast_pthread_create_detached(&thread, NULL, dns_refresh_thread, entry)) {
+		ast_mutex_unlock(&dns_lock);
+		ast_atomic_fetchadd_int(&entry->refreshing, -1);
+		ao2_ref(entry, -1);
+		return;
+	}
+	dns_refreshing++;
+	ast_mutex_unlock(&dns_lock);
+	__atomic_fetch_add(&dns_stats.refreshes, 1, __ATOMIC_RELAXED);
+}
+
+int rpt_dns_node_lookup(const char *node, char *nodedata, size_t nodedatalength)
+{
+	struct ao2_container *cache;
+	struct rpt_dns_entry *entry = NULL;
+	time_t now;
+	int res;
+
+	/* we require at least a node length of 4 digits */
+	if (strlen(node) < 4) {
+		return -1;
+	}
+
+	/* make sure we have buffers to return the data */
+	ast_assert(nodedata != NULL);
+	ast_assert(nodedatalength > 0);
+
+	now = time(NULL);
+	cache = dns_cache_get();
+	if (cache) {
+		entry = ao2_find(cache, node, OBJ_SEARCH_KEY);
+	}
+	if (entry && entry->expires > now) {
+		if (entry->nodedata[0]) {
+			__atomic_fetch_add(&dns_stats.hits, 1, __ATOMIC_RELAXED);
+			/* Refresh positive answers during the last quarter of their TTL */
+			if ((unsigned int) (entry->expires - now) <= entry->ttl / 4) {
+				dns_cache_refresh(entry);
+			}
+		} else {
+			__atomic_fetch_add(&dns_stats.negative_hits, 1, __ATOMIC_RELAXED);
+		}
+	} else {
+		ao2_cleanup(entry);
+		__atomic_fetch_add(&dns_stats.misses, 1, __ATOMIC_RELAXED);
+		if (!cache) {
+			unsigned int ttl;
+
+			return dns_resolve_node(node, nodedata, nodedatalength, &ttl) ? -1 : 0;
+		}
+		entry = dns_cache_update(cache, node);
+		if (!entry) {
+			ao2_ref(cache, -1);
+			return -1;
+		}
+	}
+	ao2_cleanup(cache);
+
+	if (entry->nodedata[0]) {
+		ast_copy_string(nodedata, entry->nodedata, nodedatalength);
+		res = 0;
+	} else {
+		res = -1;
+	}
+	ao2_ref(entry, -1);
+	return res;
+}
+
+int rpt_dns_cache_init(void)
+{
+	struct ao2_container *cache;
+
+	cache = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, AO2_CONTAINER_ALLOC_OPT_DUPS_REJECT, RPT_DNS_CACHE_BUCKETS,
+		rpt_dns_entry_hash_fn, NULL, rpt_dns_entry_cmp_fn);
+	if (!cache) {
+		return -1;
+	}
+	ast_cond_init(&dns_refresh_cond, NULL);
+	ast_mutex_lock(&dns_lock);
+	dns_cache = cache;
+	ast_mutex_unlock(&dns_lock);
+	return 0;
+}
+
+void rpt_dns_cache_cleanup(void)
+{
+	struct ao2_container *cache;
+
+	/* No refresh is started once the cache is gone, wait for those running before the module goes away */
+	ast_mutex_lock(&dns_lock);
+	cache = dns_cache;
+	dns_cache = NULL;
+	while (dns_refreshing) {
+		ast_cond_wait(&dns_refresh_cond, &dns_lock);
+	}
+	ast_mutex_unlock(&dns_lock);
+	if (cache) {
+		ast_cond_destroy(&dns_refresh_cond);
+		ao2_ref(cache, -1);
+	}
+}
+
+void rpt_dns_cache_flush(void)
+{
+	struct ao2_container *cache = dns_cache_get();
+
+	if (cache) {
+		ao2_callback(cache, OBJ_UNLINK | OBJ_MULTIPLE | OBJ_NODATA, NULL, NULL);
+		ao2_ref(cache, -1);
+	}
+}
+
+void rpt_dns_cache_get_stats(struct rpt_dns_cache_stats *stats)
+{
+	struct ao2_container *cache = dns_cache_get();
+
+	*stats = dns_stats;
+	stats->entries = cache ? ao2_container_count(cache) : 0;
+	ao2_cleanup(cache);
+}
+
+void rpt_dns_cache_foreach(void (*cb)(const char *node, const char *nodedata, int ttl, void *arg), void *arg)
+{
+	struct ao2_iterator it;
+	struct rpt_dns_entry *entry;
+	struct ao2_container *cache;
+	time_t now = time(NULL);
+
+	cache = dns_cache_get();
+	if (!cache) {
+		return;
+	}
+	it = ao2_iterator_init(cache, 0);
+	while ((entry = ao2_iterator_next(&it))) {
+		cb(entry->node, entry->nodedata, MAX((int) (entry->expires - now), 0), arg);
+		ao2_ref(entry, -1);
+	}
+	ao2_iterator_destroy(&it);
+	ao2_ref(cache, -1);
+}
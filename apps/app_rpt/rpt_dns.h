@@ -0,0 +1,83 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT DNS node lookup and cache
+ *
+ * Answers are cached per node number for the TTL of the DNS records,
+ * clamped to RPT_DNS_MIN_TTL..RPT_DNS_MAX_TTL.  Nodes that don't exist
+ * (NXDOMAIN) are cached for RPT_DNS_NEGATIVE_TTL, other failures are not
+ * cached.  A cached answer that is close to expiring is refreshed in the
+ * background while it is still being served.  Expired answers are removed
+ * as new ones are added, and at most RPT_DNS_CACHE_MAX are kept.
+ */
+
+/*! \brief Shortest time an answer is cached, in seconds */
+#define RPT_DNS_MIN_TTL 30
+/*! \brief Longest time an answer is cached, in seconds */
+#define RPT_DNS_MAX_TTL 3600
+/*! \brief How long a node that doesn't exist is cached, in seconds */
+#define RPT_DNS_NEGATIVE_TTL 30
+/*! \brief Most answers kept in the cache */
+#define RPT_DNS_CACHE_MAX 4096
+
+/*! \brief DNS cache counters */
+struct rpt_dns_cache_stats {
+	unsigned int hits;
+	unsigned int negative_hits;
+	unsigned int misses;
+	unsigned int refreshes;
+	unsigned int failures;
+	unsigned int entries;
+};
+
+/*!
+ * \brief AllStar Network node lookup by dns.
+ * Calling routine should pass a buffer for nodedata and nodedatalength
+ * of sufficient length. A typical response is
+ * "radio@123.123.123.123:4569/50000,123.123.123.123
+ * This routine uses the SRV records provided by AllStarLink and resolves
+ * the returned host's A record
+ *
+ * \note This routine can be called by app_rpt multiple times as
+ * it constructs the node number.  The routine will only perform a
+ * lookup after it receives 4 digits.  The actual node number may be
+ * longer than 4 digits.
+ *
+ * \param node				Node number to lookup
+ * \param nodedata			Buffer to hold the matching node information
+ * \param nodedatalength	Length of the nodedata buffer
+ * \retval -1 				if not successful
+ * \retval 0 				if successful
+ */
+int rpt_dns_node_lookup(const char *node, char *nodedata, size_t nodedatalength);
+
+/*!
+ * \brief Allocate the DNS cache
+ * \retval 0 on success
+ * \retval -1 on failure
+ */
+int rpt_dns_cache_init(void);
+
+/*!
+ * \brief Free the DNS cache
+ */
+void rpt_dns_cache_cleanup(void);
+
+/*!
+ * \brief Remove every entry from the DNS cache
+ */
+void rpt_dns_cache_flush(void);
+
+/*!
+ * \brief Get the DNS cache counters
+ * \param stats Filled in with the current counters
+ */
+void rpt_dns_cache_get_stats(struct rpt_dns_cache_stats *stats);
+
+/*!
+ * \brief Call a function for every entry in the DNS cache
+ * \param cb Callback, nodedata is empty for a negative entry and ttl is the number of seconds left
+ * \param arg Passed to the callback
+ */
+void rpt_dns_cache_foreach(void (*cb)(const char *node, const char *nodedata, int ttl, void *arg), void *arg);
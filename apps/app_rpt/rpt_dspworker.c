@@ -0,0 +1,176 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT receive audio DSP worker
+ */
+
+#include "asterisk.h"
+
+#include "asterisk/lock.h"
+#include "asterisk/sem.h"
+#include "asterisk/utils.h"
+
+#include "app_rpt.h"
+#include "rpt_dspworker.h"
+#include "rpt_perf.h"
+
+/*! \brief A frame waiting for the detectors */
+struct rpt_dsp_frame {
+	unsigned int flags;
+	int nsamples;
+	int16_t samples[RPT_DSP_MAX_SAMPLES];
+};
+
+/*
+ * Both rings have a single producer and a single consumer.  The producer
+ * fills in the slot at tail and then publishes it by advancing tail; the
+ * consumer reads the slot at head and then hands it back by advancing
+ * head.  Each index is only written by one side.
+ */
+struct rpt_dsp_worker {
+	pthread_t thread;
+	struct ast_sem sem; /*!< \brief Posted for each frame queued, and to stop */
+	int stop;
+	rpt_dsp_detect_cb detect;
+	void *data;
+	char name[32];
+	unsigned int frame_head;
+	unsigned int frame_tail;
+	unsigned int event_head;
+	unsigned int event_tail;
+	struct rpt_dsp_stats stats;
+	struct rpt_dsp_frame frames[RPT_DSP_FRAMES];
+	struct rpt_dsp_event events[RPT_DSP_EVENTS];
+};
+
+static void *dsp_worker(void *data)
+{
+	struct rpt_dsp_worker *worker = data;
+	struct rpt_dsp_frame *frame;
+	unsigned long long start;
+	unsigned int head, us;
+
+	for (;;) {
+		ast_sem_wait(&worker->sem);
+		if (__atomic_load_n(&worker->stop, __ATOMIC_ACQUIRE)) {
+			break;
+		}
+		head = worker->frame_head;
+		if (head == __atomic_load_n(&worker->frame_tail, __ATOMIC_ACQUIRE)) {
+			continue;
+		}
+		frame = &worker->frames[head & (RPT_DSP_FRAMES - 1)];
+		start = rpt_perf_now();
+		worker->detect(worker, worker->data, frame->samples, frame->nsamples, frame->flags);
+		us = rpt_perf_now() - start;
+		__atomic_store_n(&worker->frame_head, head + 1, __ATOMIC_RELEASE);
+
+		__atomic_fetch_add(&worker->stats.busy_us, us, __ATOMIC_RELAXED);
+		if (us > worker->stats.max_us) {
+			__atomic_store_n(&worker->stats.max_us, us, __ATOMIC_RELAXED);
+		}
+	}
+	return NULL;
+}
+
+struct rpt_dsp_worker *rpt_dsp_worker_start(const char *name, rpt_dsp_detect_cb detect, void *data)
+{
+	struct rpt_dsp_worker *worker;
+
+	worker = ast_calloc(1, sizeof(*worker));
+	if (!worker) {
+		return NULL;
+	}
+	worker->detect = detect;
+	worker->data = data;
+	ast_copy_string(worker->name, name, sizeof(worker->name));
+	if (ast_sem_init(&worker->sem, 0, 0)) {
+		ast_free(worker);
+		return NULL;
+	}
+	if (ast_pthread_create(&worker->thread, NULL, dsp_worker, worker)) {
+		ast_log(LOG_ERROR, "Could not start DSP worker for node %s\n", name);
+		ast_sem_destroy(&worker->sem);
+		ast_free(worker);
+		return NULL;
+	}
+	ast_debug(1, "Started DSP worker for node %s\n", name);
+	return worker;
+}
+
+void rpt_dsp_worker_stop(struct rpt_dsp_worker *worker)
+{
+	if (!worker) {
+		return;
+	}
+	__atomic_store_n(&worker->stop, 1, __ATOMIC_RELEASE);
+	ast_sem_post(&worker->sem);
+	pthread_join(worker->thread, NULL);
+	ast_sem_destroy(&worker->sem);
+	ast_debug(1, "Stopped DSP worker for node %s\n", worker->name);
+	ast_free(worker);
+}
+
+int rpt_dsp_worker_queue(struct rpt_dsp_worker *worker, const int16_t *samples, int nsamples, unsigned int flags)
+{
+	struct rpt_dsp_frame *frame;
+	unsigned int tail = worker->frame_tail;
+
+	if (nsamples > RPT_DSP_MAX_SAMPLES) {
+		nsamples = RPT_DSP_MAX_SAMPLES;
+	}
+	if (tail - __atomic_load_n(&worker->frame_head, __ATOMIC_ACQUIRE) == RPT_DSP_FRAMES) {
+		/* The worker isn't keeping up, the detectors miss this frame */
+		if (!__atomic_fetch_add(&worker->stats.dropped, 1, __ATOMIC_RELAXED)) {
+			ast_log(LOG_WARNING, "DSP worker for node %s is falling behind, dropping frames\n", worker->name);
+		}
+		return -1;
+	}
+	frame = &worker->frames[tail & (RPT_DSP_FRAMES - 1)];
+	frame->flags = flags;
+	frame->nsamples = nsamples;
+	memcpy(frame->samples, samples, nsamples * sizeof(*samples));
+	__atomic_store_n(&worker->frame_tail, tail + 1, __ATOMIC_RELEASE);
+	__atomic_fetch_add(&worker->stats.frames, 1, __ATOMIC_RELAXED);
+	ast_sem_post(&worker->sem);
+	return 0;
+}
+
+void rpt_dsp_worker_post(struct rpt_dsp_worker *worker, const struct rpt_dsp_event *event)
+{
+	unsigned int tail = worker->event_tail;
+
+	if (tail - __atomic_load_n(&worker->event_head, __ATOMIC_ACQUIRE) == RPT_DSP_EVENTS) {
+		if (!__atomic_fetch_add(&worker->stats.lost, 1, __ATOMIC_RELAXED)) {
+			ast_log(LOG_WARNING, "DSP events for node %s are not being read, dropping them\n", worker->name);
+		}
+		return;
+	}
+	worker->events[tail & (RPT_DSP_EVENTS - 1)] = *event;
+	__atomic_store_n(&worker->event_tail, tail + 1, __ATOMIC_RELEASE);
+	__atomic_fetch_add(&worker->stats.events, 1, __ATOMIC_RELAXED);
+}
+
+int rpt_dsp_worker_event(struct rpt_dsp_worker *worker, struct rpt_dsp_event *event)
+{
+	unsigned int head = worker->event_head;
+
+	if (head == __atomic_load_n(&worker->event_tail, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+	*event = worker->events[head & (RPT_DSP_EVENTS - 1)];
+	__atomic_store_n(&worker->event_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+void rpt_dsp_worker_get_stats(struct rpt_dsp_worker *worker, struct rpt_dsp_stats *stats)
+{
+	stats->frames = __atomic_load_n(&worker->stats.frames, __ATOMIC_RELAXED);
+	stats->dropped = __atomic_load_n(&worker->stats.dropped, __ATOMIC_RELAXED);
+	stats->events = __atomic_load_n(&worker->stats.events, __ATOMIC_RELAXED);
+	stats->lost = __atomic_load_n(&worker->stats.lost, __ATOMIC_RELAXED);
+	stats->busy_us = __atomic_load_n(&worker->stats.busy_us, __ATOMIC_RELAXED);
+	stats->max_us = __atomic_load_n(&worker->stats.max_us, __ATOMIC_RELAXED);
+	stats->depth = __atomic_load_n(&worker->frame_tail, __ATOMIC_RELAXED) - __atomic_load_n(&worker->frame_head, __ATOMIC_RELAXED);
+}
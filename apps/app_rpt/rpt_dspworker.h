@@ -0,0 +1,106 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT receive audio DSP worker
+ *
+ * With dspworker=yes, a node's receive audio signal detectors (rx burst
+ * tone and MDC-1200) run on a thread of their own.  The node thread copies
+ * each received voice frame into a single producer, single consumer ring
+ * and carries on forwarding it; the worker runs the detectors and posts
+ * what they found to a second ring, which the node thread drains on each
+ * pass through its loop.  Neither side ever waits on the other: if a ring
+ * is full, the frame or event is dropped and counted.
+ */
+
+/*! \brief Frames that can be waiting for the worker, a power of two */
+#define RPT_DSP_FRAMES 16
+
+/*! \brief Events that can be waiting for the node thread, a power of two */
+#define RPT_DSP_EVENTS 16
+
+/*! \brief Largest frame the worker takes, in samples */
+#define RPT_DSP_MAX_SAMPLES 640
+
+/*! \brief Something a detector found */
+enum rpt_dsp_event_type {
+	RPT_DSP_RXBURST, /*!< \brief Rx burst tone detector result for a frame */
+	RPT_DSP_MDC,	 /*!< \brief MDC-1200 packet */
+};
+
+struct rpt_dsp_event {
+	enum rpt_dsp_event_type type;
+	int hit;	/*!< \brief RPT_DSP_RXBURST: tone present */
+	int packet; /*!< \brief RPT_DSP_MDC: 1 for a single packet, 2 for a double packet */
+	unsigned char op;
+	unsigned char arg;
+	unsigned short unitID;
+	unsigned char extra[4];
+};
+
+/*! \brief Worker counters */
+struct rpt_dsp_stats {
+	unsigned long long frames;
+	unsigned long long dropped; /*!< \brief Frames not queued because the ring was full */
+	unsigned long long events;
+	unsigned long long lost;	/*!< \brief Events not posted because the ring was full */
+	unsigned long long busy_us; /*!< \brief Time spent running detectors */
+	unsigned int max_us;		/*!< \brief Longest time for one frame */
+	unsigned int depth;			/*!< \brief Frames waiting now */
+};
+
+struct rpt_dsp_worker;
+
+/*!
+ * \brief Detector callback, called on the worker thread for each frame
+ * \param worker Post events with rpt_dsp_worker_post()
+ * \param data As passed to rpt_dsp_worker_start()
+ * \param samples Signed linear audio
+ * \param nsamples Number of samples
+ * \param flags As passed to rpt_dsp_worker_queue()
+ */
+typedef void (*rpt_dsp_detect_cb)(struct rpt_dsp_worker *worker, void *data, int16_t *samples, int nsamples, unsigned int flags);
+
+/*!
+ * \brief Start a DSP worker
+ * \param name Node name, for the log
+ * \param detect Detector callback
+ * \param data Passed to the callback
+ * \return Worker, or NULL on failure
+ */
+struct rpt_dsp_worker *rpt_dsp_worker_start(const char *name, rpt_dsp_detect_cb detect, void *data);
+
+/*!
+ * \brief Stop a DSP worker and free it, discarding anything queued
+ */
+void rpt_dsp_worker_stop(struct rpt_dsp_worker *worker);
+
+/*!
+ * \brief Queue a copy of a frame for the detectors, from the node thread
+ * \param worker
+ * \param samples Signed linear audio
+ * \param nsamples Number of samples, at most RPT_DSP_MAX_SAMPLES
+ * \param flags Passed to the detector callback with the frame
+ * \retval 0 on success
+ * \retval -1 if the frame was dropped
+ */
+int rpt_dsp_worker_queue(struct rpt_dsp_worker *worker, const int16_t *samples, int nsamples, unsigned int flags);
+
+/*!
+ * \brief Post an event for the node thread, from the detector callback
+ */
+void rpt_dsp_worker_post(struct rpt_dsp_worker *worker, const struct rpt_dsp_event *event);
+
+/*!
+ * \brief Take the oldest event, from the node thread
+ * \param worker
+ * \param[out] event
+ * \retval 1 if an event was taken
+ * \retval 0 if there are none
+ */
+int rpt_dsp_worker_event(struct rpt_dsp_worker *worker, struct rpt_dsp_event *event);
+
+/*!
+ * \brief Get a worker's counters
+ */
+void rpt_dsp_worker_get_stats(struct rpt_dsp_worker *worker, struct rpt_dsp_stats *stats);
@@ -0,0 +1,904 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT event engine
+ */
+
+#include "asterisk.h"
+
+#include <ctype.h>
+
+#include "asterisk/astobj2.h"
+#include "asterisk/app.h"
+#include "asterisk/ast_expr.h"
+#include "asterisk/channel.h"
+#include "asterisk/config.h"
+#include "asterisk/options.h"
+#include "asterisk/pbx.h"
+#include "asterisk/strings.h"
+#include "asterisk/utils.h"
+#include "asterisk/vector.h"
+
+#include "app_rpt.h"
+#include "rpt_lock.h"
+#include "rpt_utils.h" /* use macro_append */
+#include "rpt_events.h"
+
+/*! \brief Number of hash buckets for the variables of a node's events */
+#define RPT_EVENT_VAR_BUCKETS 31
+
+/*! \brief Longest variable name substituted by the engine itself */
+#define RPT_EVENT_MAXVARNAME 80
+
+struct rpt_event_rule;
+
+/*! \brief A variable read or written by event rules */
+struct rpt_event_var {
+	char *value;  /*!< \brief Last value set through rpt_events_setvar() or by a rule, NULL to read it from the channel */
+	char *shadow; /*!< \brief Value at the end of the last pass, NULL before the first.  Formerly XX_<name>. */
+	AST_VECTOR(, struct rpt_event_rule *) dependents; /*!< \brief Rules reading this variable */
+	char name[0];
+};
+
+/*! \brief Part of a compiled expression, either literal text or a variable */
+struct rpt_event_part {
+	const char *text; /*!< \brief Points into the rule's expression */
+	size_t len;
+	struct rpt_event_var *var; /*!< \brief NULL for literal text */
+};
+
+struct rpt_event_rule {
+	char action;   /*!< \brief V, G, F, C or S */
+	char *name;	   /*!< \brief Entry name: variable, macro, command... */
+	char *spec;	   /*!< \brief Entry value, for logging */
+	char *expr;	   /*!< \brief Expression of an E rule */
+	int function;  /*!< \brief rpt_function_lookup() index of a C rule */
+	char *cmdparam;	 /*!< \brief Parameters of a C rule */
+	char *cmddigits; /*!< \brief Digits of a C rule */
+	rpt_bool evaluate:1;   /*!< \brief E rule, true when its expression is */
+	rpt_bool on_true:1;	   /*!< \brief T: input transitioned to true */
+	rpt_bool on_false:1;   /*!< \brief F: input transitioned to false */
+	rpt_bool on_same:1;	   /*!< \brief N: input didn't change */
+	rpt_bool on_initial:1; /*!< \brief I: input had no previous value */
+	rpt_bool always:1;	   /*!< \brief Can't be tracked, evaluated on every pass */
+	rpt_bool dirty:1;	   /*!< \brief An input changed since the rule was last evaluated */
+	struct rpt_event_var *input;			   /*!< \brief Variable of a transition rule */
+	struct rpt_event_var *output;			   /*!< \brief Variable set by a V or G rule */
+	AST_VECTOR(, struct rpt_event_part) parts; /*!< \brief Compiled expression, empty if substituted by the PBX */
+};
+
+/*! \brief A variable update waiting to be applied by rpt_event_process() */
+struct rpt_event_update {
+	AST_LIST_ENTRY(rpt_event_update) list;
+	char *value;
+	rpt_bool process:1; /*!< \brief Evaluate the rules after applying it */
+	char name[0];
+};
+
+/*! \brief A C, F or S rule that fired, run once the engine is unlocked */
+struct rpt_event_action {
+	const struct rpt_event_rule *rule;
+	const char *cmd;
+};
+
+AST_VECTOR(rpt_event_actions, struct rpt_event_action);
+
+/*! \brief Compiled events stanza of a node */
+struct rpt_events {
+	struct ao2_container *vars;					   /*!< \brief All variables, by name */
+	AST_VECTOR(, struct rpt_event_var *) shadowed; /*!< \brief Inputs of transition rules */
+	struct rpt_events *previous;				   /*!< \brief Rules replaced on reload, state not yet carried over */
+	struct ast_str *exprbuf;					   /*!< \brief Reused to substitute expressions */
+	ast_mutex_t pending_lock;					   /*!< \brief Protects pending, never held while taking another lock */
+	AST_LIST_HEAD_NOLOCK(, rpt_event_update) pending; /*!< \brief Updates queued by rpt_events_setvar() */
+	int ndirty;
+	int nrules;
+	struct rpt_event_rule rules[0];
+};
+
+AO2_STRING_FIELD_HASH_FN(rpt_event_var, name);
+AO2_STRING_FIELD_CMP_FN(rpt_event_var, name);
+
+static void event_var_destroy(void *obj)
+{
+	struct rpt_event_var *var = obj;
+
+	ast_free(var->value);
+	ast_free(var->shadow);
+	AST_VECTOR_FREE(&var->dependents);
+}
+
+static void event_update_free(struct rpt_event_update *update)
+{
+	ast_free(update->value);
+	ast_free(update);
+}
+
+static void events_destroy(void *obj)
+{
+	struct rpt_events *ev = obj;
+	struct rpt_event_update *update;
+	int i;
+
+	while ((update = AST_LIST_REMOVE_HEAD(&ev->pending, list))) {
+		event_update_free(update);
+	}
+	ast_mutex_destroy(&ev->pending_lock);
+
+	for (i = 0; i < ev->nrules; i++) {
+		struct rpt_event_rule *rule = &ev->rules[i];
+
+		ast_free(rule->name);
+		ast_free(rule->spec);
+		ast_free(rule->expr);
+		ast_free(rule->cmdparam);
+		ast_free(rule->cmddigits);
+		AST_VECTOR_FREE(&rule->parts);
+	}
+	AST_VECTOR_FREE(&ev->shadowed);
+	ao2_cleanup(ev->vars);
+	ao2_cleanup(ev->previous);
+	ast_free(ev->exprbuf);
+}
+
+/*!
+ * \internal
+ * \brief Find or create a variable
+ * \note The engine keeps the reference, the pointer is valid for its lifetime.
+ */
+static struct rpt_event_var *event_var_get(struct rpt_events *ev, const char *name)
+{
+	struct rpt_event_var *var;
+
+	var = ao2_find(ev->vars, name, OBJ_SEARCH_KEY);
+	if (var) {
+		ao2_ref(var, -1);
+		return var;
+	}
+	var = ao2_alloc_options(sizeof(*var) + strlen(name) + 1, event_var_destroy, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!var) {
+		return NULL;
+	}
+	strcpy(var->name, name); /* Safe */
+	if (AST_VECTOR_INIT(&var->dependents, 2) || !ao2_link(ev->vars, var)) {
+		ao2_ref(var, -1);
+		return NULL;
+	}
+	ao2_ref(var, -1);
+	return var;
+}
+
+static int event_var_depend(struct rpt_event_var *var, struct rpt_event_rule *rule)
+{
+	int i;
+
+	for (i = 0; i < AST_VECTOR_SIZE(&var->dependents); i++) {
+		if (AST_VECTOR_GET(&var->dependents, i) == rule) {
+			return 0;
+		}
+	}
+	return AST_VECTOR_APPEND(&var->dependents, rule);
+}
+
+static void event_rule_mark(struct rpt_events *ev, struct rpt_event_rule *rule)
+{
+	if (!rule->dirty) {
+		rule->dirty = 1;
+		ev->ndirty++;
+	}
+}
+
+/*!
+ * \internal
+ * \brief Store a variable's new value and mark the rules reading it
+ * \retval 1 if the value changed
+ * \retval 0 if it didn't, or on allocation failure
+ */
+static int event_var_set(struct rpt_events *ev, struct rpt_event_var *var, const char *value)
+{
+	char *newval;
+	int i;
+
+	if (var->value && !strcmp(var->value, value)) {
+		return 0;
+	}
+	newval = ast_strdup(value);
+	if (!newval) {
+		return 0;
+	}
+	ast_free(var->value);
+	var->value = newval;
+	for (i = 0; i < AST_VECTOR_SIZE(&var->dependents); i++) {
+		event_rule_mark(ev, AST_VECTOR_GET(&var->dependents, i));
+	}
+	return 1;
+}
+
+/*!
+ * \internal
+ * \brief Get a variable's current value
+ * \param buf Used for a value read from the channel
+ * \return Value, or NULL if the variable doesn't exist
+ */
+static const char *event_var_value(struct rpt_event_var *var, struct ast_channel *chan, char *buf, size_t buflen)
+{
+	const char *val;
+
+	if (var->value) {
+		return var->value;
+	}
+	ast_channel_lock(chan);
+	val = pbx_builtin_getvar_helper(chan, var->name);
+	if (val) {
+		ast_copy_string(buf, val, buflen);
+		val = buf;
+	}
+	ast_channel_unlock(chan);
+	return val;
+}
+
+/*!
+ * \internal
+ * \brief Compile the expression of an E rule into text and variable parts
+ * \retval 0 on success
+ * \retval 1 if the expression must be substituted by the PBX
+ * \retval -1 on allocation failure
+ */
+static int event_expr_compile(struct rpt_events *ev, struct rpt_event_rule *rule)
+{
+	const char *p = rule->expr, *s, *e;
+
+	if (strstr(p, "$[")) {
+		return 1;
+	}
+	while ((s = strstr(p, "${"))) {
+		struct rpt_event_part text = { .text = p, .len = s - p };
+		struct rpt_event_part ref = { 0 };
+		char name[RPT_EVENT_MAXVARNAME];
+		const char *c;
+
+		s += 2;
+		e = strchr(s, '}');
+		if (!e || e == s || e - s >= sizeof(name)) {
+			return 1;
+		}
+		/* Anything other than a plain variable name, like a function, is left to the PBX */
+		for (c = s; c < e; c++) {
+			if (!isalnum(*c) && *c != '_') {
+				return 1;
+			}
+		}
+		ast_copy_string(name, s, e - s + 1);
+		ref.var = event_var_get(ev, name);
+		if (!ref.var || event_var_depend(ref.var, rule)) {
+			return -1;
+		}
+		if ((text.len && AST_VECTOR_APPEND(&rule->parts, text)) || AST_VECTOR_APPEND(&rule->parts, ref)) {
+			return -1;
+		}
+		p = e + 1;
+	}
+	if (*p) {
+		struct rpt_event_part text = { .text = p, .len = strlen(p) };
+
+		if (AST_VECTOR_APPEND(&rule->parts, text)) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Compile one entry of the events stanza
+ * \retval 0 on success
+ * \retval 1 if the entry is invalid and was skipped
+ * \retval -1 on allocation failure
+ */
+static int event_rule_compile(struct rpt_events *ev, struct rpt_event_rule *rule, struct ast_variable *v)
+{
+	char *myval, *argv[5], *cmd, *cargv[5];
+	const char *c;
+	int argc, res;
+
+	/* separate out specification into pipe-delimited fields */
+	myval = ast_strdupa(v->value);
+	argc = ast_app_separate_args(myval, '|', argv, ARRAY_LEN(argv));
+	if (argc < 1) {
+		return 1;
+	}
+	if (argc != 3) {
+		ast_log(LOG_ERROR, "event exec item malformed: %s\n", v->value);
+		return 1;
+	}
+	rule->action = toupper(*argv[0]);
+	if (!strchr("VGFCS", rule->action)) {
+		ast_log(LOG_ERROR, "Unrecognized event action (%c) in exec item malformed: %s\n", rule->action, v->value);
+		return 1;
+	}
+	rule->name = ast_strdup(v->name);
+	rule->spec = ast_strdup(v->value);
+	if (!rule->name || !rule->spec || AST_VECTOR_INIT(&rule->parts, 0)) {
+		return -1;
+	}
+
+	if (toupper(*argv[1]) == 'E') { /* if to merely evaluate the statement */
+		if (!strncasecmp(v->name, "RPT", 3) || !strncasecmp(v->name, "XX_", 3)) {
+			ast_log(LOG_ERROR, "%s is not a valid name for an event variable!!!!\n", v->name);
+			return 1;
+		}
+		rule->evaluate = 1;
+		rule->expr = ast_strdup(argv[2]);
+		if (!rule->expr) {
+			return -1;
+		}
+		res = event_expr_compile(ev, rule);
+		if (res < 0) {
+			return -1;
+		}
+		if (res) {
+			AST_VECTOR_RESET(&rule->parts, AST_VECTOR_ELEM_CLEANUP_NOOP);
+			rule->always = 1;
+		}
+	} else {
+		for (c = argv[1]; *c; c++) {
+			switch (toupper(*c)) {
+			case 'T':
+				rule->on_true = 1;
+				break;
+			case 'F':
+				rule->on_false = 1;
+				break;
+			case 'N':
+				/* Fires on every pass the variable is unchanged, not just when it is set */
+				rule->on_same = 1;
+				rule->always = 1;
+				break;
+			case 'I':
+				rule->on_initial = 1;
+				break;
+			default:
+				ast_log(LOG_ERROR, "Unrecognized event type (%c) in exec item malformed: %s\n", *c, v->value);
+				break;
+			}
+		}
+		rule->input = event_var_get(ev, argv[2]);
+		if (!rule->input || event_var_depend(rule->input, rule)) {
+			return -1;
+		}
+		if (!AST_VECTOR_GET_CMP(&ev->shadowed, rule->input, AST_VECTOR_ELEM_DEFAULT_CMP)
+			&& AST_VECTOR_APPEND(&ev->shadowed, rule->input)) {
+			return -1;
+		}
+	}
+
+	if (rule->action == 'V' || rule->action == 'G') {
+		rule->output = event_var_get(ev, v->name);
+		if (!rule->output) {
+			return -1;
+		}
+	} else if (rule->action == 'C') {
+		/* Resolve the rpt command now, an E rule runs "TRUE" as before */
+		cmd = ast_strdupa(rule->evaluate ? "TRUE" : rule->name);
+		argc = ast_app_separate_args(cmd, ',', cargv, ARRAY_LEN(cargv));
+		rule->function = argc < 1 ? -1 : rpt_function_lookup(cargv[0]);
+		if (argc > 1) {
+			rule->cmdparam = ast_strdup(cargv[1]);
+		}
+		if (argc > 2) {
+			rule->cmddigits = ast_strdup(cargv[2]);
+		}
+	}
+	rule->dirty = 1;
+	ev->ndirty++;
+	return 0;
+}
+
+void rpt_events_load(struct rpt *myrpt, struct ast_config *cfg)
+{
+	struct rpt_events *ev;
+	struct ast_variable *v;
+	int n = 0, res;
+
+	for (v = ast_variable_browse(cfg, myrpt->p.events); v; v = v->next) {
+		n++;
+	}
+	if (!n) {
+		rpt_events_free(myrpt);
+		return;
+	}
+
+	ev = ao2_alloc(sizeof(*ev) + sizeof(struct rpt_event_rule) * n, events_destroy);
+	if (!ev) {
+		return;
+	}
+	ast_mutex_init(&ev->pending_lock);
+	ev->vars = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, AO2_CONTAINER_ALLOC_OPT_DUPS_REJECT, RPT_EVENT_VAR_BUCKETS,
+		rpt_event_var_hash_fn, NULL, rpt_event_var_cmp_fn);
+	ev->exprbuf = ast_str_create(256);
+	if (!ev->vars || !ev->exprbuf || AST_VECTOR_INIT(&ev->shadowed, 8)) {
+		ao2_ref(ev, -1);
+		return;
+	}
+
+	for (v = ast_variable_browse(cfg, myrpt->p.events); v; v = v->next) {
+		struct rpt_event_rule *rule = &ev->rules[ev->nrules++];
+
+		res = event_rule_compile(ev, rule, v);
+		if (res < 0) {
+			ast_log(LOG_ERROR, "Failed to compile events for node %s\n", myrpt->name);
+			ao2_ref(ev, -1);
+			return;
+		}
+		if (res) {
+			/* Skipped, never evaluated */
+			rule->action = 0;
+			if (rule->dirty) {
+				rule->dirty = 0;
+				ev->ndirty--;
+			}
+		}
+	}
+
+	/* Carry the variable state over the first time the new rules are used */
+	ev->previous = myrpt->eventengine;
+	if (ev->previous) {
+		/* Updates are queued with the node locked, so none can be added to the old rules after this */
+		ast_mutex_lock(&ev->previous->pending_lock);
+		AST_LIST_APPEND_LIST(&ev->pending, &ev->previous->pending, list);
+		ast_mutex_unlock(&ev->previous->pending_lock);
+	}
+	myrpt->eventengine = ev;
+	ast_debug(2, "Compiled %d event rules using %d variables for node %s\n", ev->nrules, ao2_container_count(ev->vars),
+		myrpt->name);
+}
+
+void rpt_events_free(struct rpt *myrpt)
+{
+	ao2_cleanup(myrpt->eventengine);
+	myrpt->eventengine = NULL;
+}
+
+static int event_var_carry(void *obj, void *arg, int flags)
+{
+	struct rpt_event_var *var = obj, *old;
+	struct rpt_events *previous = arg;
+
+	old = ao2_find(previous->vars, var->name, OBJ_SEARCH_KEY);
+	if (!old) {
+		return 0;
+	}
+	if (old->value) {
+		var->value = ast_strdup(old->value);
+	}
+	if (old->shadow) {
+		var->shadow = ast_strdup(old->shadow);
+	}
+	ao2_ref(old, -1);
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Get and lock a node's events
+ * \return Locked events with a reference, or NULL if the node has none
+ */
+static struct rpt_events *events_lock(struct rpt *myrpt)
+{
+	struct rpt_events *ev;
+
+	rpt_mutex_lock(&myrpt->lock);
+	ev = ao2_bump(myrpt->eventengine);
+	rpt_mutex_unlock(&myrpt->lock);
+	if (!ev) {
+		return NULL;
+	}
+
+	ao2_lock(ev);
+	if (ev->previous) {
+		ao2_lock(ev->previous);
+		ao2_callback(ev->vars, OBJ_NODATA, event_var_carry, ev->previous);
+		ao2_unlock(ev->previous);
+		ao2_ref(ev->previous, -1);
+		ev->previous = NULL;
+	}
+	return ev;
+}
+
+static void events_unlock(struct rpt_events *ev)
+{
+	ao2_unlock(ev);
+	ao2_ref(ev, -1);
+}
+
+/*!
+ * \internal
+ * \brief Queue a variable update for the next rpt_event_process()
+ */
+static void events_queue(struct rpt *myrpt, const char *name, const char *value, int process)
+{
+	struct rpt_event_update *update;
+
+	update = ast_calloc(1, sizeof(*update) + strlen(name) + 1);
+	if (!update) {
+		return;
+	}
+	strcpy(update->name, name); /* Safe */
+	update->value = ast_strdup(value);
+	if (!update->value) {
+		ast_free(update);
+		return;
+	}
+	update->process = process;
+
+	rpt_mutex_lock(&myrpt->lock);
+	if (!myrpt->eventengine) {
+		rpt_mutex_unlock(&myrpt->lock);
+		event_update_free(update);
+		return;
+	}
+	ast_mutex_lock(&myrpt->eventengine->pending_lock);
+	AST_LIST_INSERT_TAIL(&myrpt->eventengine->pending, update, list);
+	ast_mutex_unlock(&myrpt->eventengine->pending_lock);
+	rpt_mutex_unlock(&myrpt->lock);
+}
+
+void rpt_events_setvar(struct rpt *myrpt, const char *name, const char *value)
+{
+	events_queue(myrpt, name, value, 0);
+}
+
+void rpt_events_update(struct rpt *myrpt, const char *name, const char *value)
+{
+	events_queue(myrpt, name, value, 1);
+}
+
+/*!
+ * \internal
+ * \brief Check if a rule reads a variable that must be fetched from the channel
+ */
+static int event_rule_untracked(const struct rpt_event_rule *rule)
+{
+	int i;
+
+	if (rule->input) {
+		return !rule->input->value;
+	}
+	for (i = 0; i < AST_VECTOR_SIZE(&rule->parts); i++) {
+		const struct rpt_event_part *part = AST_VECTOR_GET_ADDR(&rule->parts, i);
+
+		if (part->var && !part->var->value) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Evaluate the expression of an E rule
+ * \return non-zero if true
+ */
+static int event_rule_expr(struct rpt_events *ev, struct rpt_event_rule *rule, struct ast_channel *chan)
+{
+	char buf[1000], valbuf[500];
+	int i;
+
+	/* An output the engine hasn't set may still be set on the channel */
+	if (rule->output && !event_var_value(rule->output, chan, valbuf, sizeof(valbuf))) {
+		/* if the variable doesn't exist yet, set it to zero, in case of the value being self-referenced */
+		event_var_set(ev, rule->output, "0");
+		pbx_builtin_setvar_helper(chan, rule->name, "0");
+	}
+
+	buf[0] = '\0';
+	if (!AST_VECTOR_SIZE(&rule->parts)) {
+		snprintf(valbuf, sizeof(valbuf), "$[ %s ]", rule->expr);
+		pbx_substitute_variables_helper(chan, valbuf, buf, sizeof(buf) - 1);
+		return pbx_checkcondition(buf);
+	}
+
+	ast_str_set(&ev->exprbuf, 0, " ");
+	for (i = 0; i < AST_VECTOR_SIZE(&rule->parts); i++) {
+		const struct rpt_event_part *part = AST_VECTOR_GET_ADDR(&rule->parts, i);
+
+		if (part->var) {
+			const char *val = event_var_value(part->var, chan, valbuf, sizeof(valbuf));
+
+			ast_str_append(&ev->exprbuf, 0, "%s", S_OR(val, ""));
+		} else {
+			ast_str_append_substr(&ev->exprbuf, 0, part->text, part->len);
+		}
+	}
+	ast_str_append(&ev->exprbuf, 0, " ");
+	ast_expr(ast_str_buffer(ev->exprbuf), buf, sizeof(buf), chan);
+	return pbx_checkcondition(buf);
+}
+
+/*!
+ * \internal
+ * \brief Evaluate a transition rule against its input's previous value
+ * \retval 1 if the rule fires
+ * \retval 0 if it doesn't
+ * \retval -1 if the input variable doesn't exist
+ */
+static int event_rule_transition(struct rpt_event_rule *rule, struct ast_channel *chan)
+{
+	char valbuf[500];
+	const char *var, *var1 = rule->input->shadow;
+	int varp, var1p;
+
+	var = event_var_value(rule->input, chan, valbuf, sizeof(valbuf));
+	if (!var) {
+		return -1;
+	}
+	/* set to 1 if var is true */
+	varp = pbx_checkcondition(var) > 0;
+	/* start with it being opposite */
+	var1p = var1 ? pbx_checkcondition(var1) > 0 : !varp;
+
+	if (rule->on_same && var1 && varp == var1p) {
+		return 1;
+	}
+	if (rule->on_initial && !var1) {
+		return 1;
+	}
+	if (rule->on_false && var1 && var1p && !varp) {
+		return 1;
+	}
+	if (rule->on_true && !var1p && varp) {
+		return 1;
+	}
+	return 0;
+}
+
+static void event_rule_command(struct rpt *myrpt, const struct rpt_event_rule *rule, const char *cmd)
+{
+	if (rule->function < 0) {
+		ast_log(LOG_ERROR, "Unknown action name %s.\n", cmd);
+		return;
+	}
+	ast_verb(3, "Event on node %s doing rpt command %s for condition %s\n", myrpt->name, cmd, rule->spec);
+	rpt_mutex_lock(&myrpt->lock);
+	if (myrpt->cmdAction.state == CMD_STATE_IDLE) {
+		myrpt->cmdAction.state = CMD_STATE_BUSY;
+		myrpt->cmdAction.functionNumber = rule->function;
+		myrpt->cmdAction.param[0] = 0;
+		if (rule->cmdparam) {
+			ast_copy_string(myrpt->cmdAction.param, rule->cmdparam, sizeof(myrpt->cmdAction.param));
+		}
+		myrpt->cmdAction.digits[0] = 0;
+		if (rule->cmddigits) {
+			ast_copy_string(myrpt->cmdAction.digits, rule->cmddigits, sizeof(myrpt->cmdAction.digits));
+			snprintf(myrpt->cmdAction.param, sizeof(myrpt->cmdAction.param), "%s,%s", S_OR(rule->cmdparam, ""),
+				rule->cmddigits);
+		}
+		myrpt->cmdAction.command_source = SOURCE_RPT;
+		myrpt->cmdAction.state = CMD_STATE_READY;
+	} else {
+		ast_log(LOG_WARNING, "Could not execute event %s for %s: Command buffer in use\n", cmd, S_OR(rule->cmdparam, ""));
+	}
+	rpt_mutex_unlock(&myrpt->lock);
+}
+
+static void event_rule_shell(struct rpt *myrpt, const struct rpt_event_rule *rule, const char *cmd)
+{
+	char *cmdbuf;
+	int argc;
+	char *argv[32];
+
+	ast_verb(3, "Event on node %s doing shell command %s for condition %s\n", myrpt->name, cmd, rule->spec);
+	cmdbuf = ast_strdupa(cmd);
+	argc = ast_app_separate_args(cmdbuf, ' ', argv, ARRAY_LEN(argv) - 1);
+	argv[argc] = NULL;
+	if (argc > 0) {
+		ast_safe_execvp(1, argv[0], argv);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Evaluate the rules whose variables changed
+ * \param actions Rules with commands to run are added here, to be run after the engine is unlocked
+ * \return Number of rules evaluated
+ */
+static int event_pass(struct rpt *myrpt, struct rpt_events *ev, struct ast_channel *chan, struct rpt_event_actions *actions)
+{
+	char valbuf[500];
+	int i, evaluated = 0;
+
+	for (i = 0; i < ev->nrules; i++) {
+		struct rpt_event_rule *rule = &ev->rules[i];
+		struct rpt_event_action action;
+		const char *cmd = NULL;
+		int res;
+
+		if (!rule->action) {
+			continue;
+		}
+		/* Only rules whose variables changed, unless they can't be tracked */
+		if (!rule->dirty && !rule->always && !event_rule_untracked(rule)) {
+			continue;
+		}
+		if (rule->dirty) {
+			rule->dirty = 0;
+			ev->ndirty--;
+		}
+		evaluated++;
+
+		if (rule->evaluate) {
+			if (event_rule_expr(ev, rule, chan)) {
+				cmd = "TRUE";
+			}
+		} else {
+			res = event_rule_transition(rule, chan);
+			if (res < 0) {
+				ast_log(LOG_ERROR, "Event variable %s not found\n", rule->input->name);
+				continue;
+			}
+			if (res) {
+				cmd = rule->name;
+			}
+		}
+
+		if (rule->output) { /* set a (global) variable */
+			if (event_var_set(ev, rule->output, cmd ? "1" : "0")) {
+				pbx_builtin_setvar_helper(rule->action == 'G' ? NULL : chan, rule->name, cmd ? "1" : "0");
+			}
+			continue;
+		}
+		/* if not command to execute, go to next one */
+		if (!cmd) {
+			continue;
+		}
+		action.rule = rule;
+		action.cmd = cmd;
+		if (AST_VECTOR_APPEND(actions, action)) {
+			ast_log(LOG_ERROR, "Could not run event %s on node %s\n", rule->spec, myrpt->name);
+		}
+	}
+
+	/* Remember the values transitions are compared against next time */
+	for (i = 0; i < AST_VECTOR_SIZE(&ev->shadowed); i++) {
+		struct rpt_event_var *var = AST_VECTOR_GET(&ev->shadowed, i);
+		const char *val = event_var_value(var, chan, valbuf, sizeof(valbuf));
+		char *shadow;
+
+		if (!val || (var->shadow && !strcmp(var->shadow, val))) {
+			continue;
+		}
+		shadow = ast_strdup(val);
+		if (shadow) {
+			ast_free(var->shadow);
+			var->shadow = shadow;
+		}
+	}
+	return evaluated;
+}
+
+/*!
+ * \internal
+ * \brief Apply queued updates, evaluating the rules after those that ask for it
+ * \param process Also evaluate the rules once at the end
+ * \return Number of rules evaluated
+ */
+static int events_run(struct rpt *myrpt, struct ast_channel *chan, int process)
+{
+	struct rpt_events *ev;
+	struct rpt_event_update *update;
+	struct rpt_event_var *var;
+	struct rpt_event_actions actions;
+	int i, evaluated = 0;
+
+	ev = events_lock(myrpt);
+	if (!ev) {
+		return 0;
+	}
+	if (AST_VECTOR_INIT(&actions, 4)) {
+		events_unlock(ev);
+		return 0;
+	}
+	for (;;) {
+		ast_mutex_lock(&ev->pending_lock);
+		update = AST_LIST_REMOVE_HEAD(&ev->pending, list);
+		ast_mutex_unlock(&ev->pending_lock);
+		if (!update) {
+			break;
+		}
+		var = ao2_find(ev->vars, update->name, OBJ_SEARCH_KEY);
+		if (var) {
+			event_var_set(ev, var, update->value);
+			ao2_ref(var, -1);
+		}
+		if (update->process && myrpt->ready) {
+			evaluated += event_pass(myrpt, ev, chan, &actions);
+		}
+		event_update_free(update);
+	}
+	if (process && myrpt->ready) {
+		evaluated += event_pass(myrpt, ev, chan, &actions);
+	}
+	/* Commands take the node lock, which must never be taken with the engine locked */
+	ao2_unlock(ev);
+
+	for (i = 0; i < AST_VECTOR_SIZE(&actions); i++) {
+		const struct rpt_event_action *action = AST_VECTOR_GET_ADDR(&actions, i);
+
+		if (action->rule->action == 'F') { /* execute a function */
+			ast_verb(3, "Event on node %s doing macro %s for condition %s\n", myrpt->name, action->cmd, action->rule->spec);
+			macro_append(myrpt, action->cmd);
+		} else if (action->rule->action == 'C') { /* execute a command */
+			event_rule_command(myrpt, action->rule, action->cmd);
+		} else if (action->rule->action == 'S') { /* execute a shell command */
+			event_rule_shell(myrpt, action->rule, action->cmd);
+		}
+	}
+	AST_VECTOR_FREE(&actions);
+	/* The rules the actions point to live as long as the engine */
+	ao2_ref(ev, -1);
+	return evaluated;
+}
+
+/*!
+ * \internal
+ * \brief Log the node variables after a pass
+ */
+static void events_dump(struct rpt *myrpt, struct ast_channel *chan, int evaluated)
+{
+	struct ast_var_t *newvariable;
+	int i;
+
+	ast_debug(4, "Evaluated %d event rules for node %s\n", evaluated, myrpt->name);
+	if (option_verbose < 5) {
+		return;
+	}
+	i = 0;
+	ast_debug(2, "Node Variable dump for node %s:\n", myrpt->name);
+	ast_channel_lock(chan);
+	AST_LIST_TRAVERSE(ast_channel_varshead(chan), newvariable, entries) {
+		i++;
+		ast_debug(2, "   %s=%s\n", ast_var_name(newvariable), ast_var_value(newvariable));
+	}
+	ast_channel_unlock(chan);
+	ast_debug(2, "    -- %d variables\n", i);
+}
+
+void rpt_events_run(struct rpt *myrpt)
+{
+	struct ast_channel *chan;
+	int pending, evaluated;
+
+	rpt_mutex_lock(&myrpt->lock);
+	if (!myrpt->eventengine || !myrpt->rxchannel) {
+		rpt_mutex_unlock(&myrpt->lock);
+		return;
+	}
+	ast_mutex_lock(&myrpt->eventengine->pending_lock);
+	pending = !AST_LIST_EMPTY(&myrpt->eventengine->pending);
+	ast_mutex_unlock(&myrpt->eventengine->pending_lock);
+	if (!pending) {
+		rpt_mutex_unlock(&myrpt->lock);
+		return;
+	}
+	chan = ast_channel_ref(myrpt->rxchannel);
+	rpt_mutex_unlock(&myrpt->lock);
+	if (!chan) {
+		return;
+	}
+	evaluated = events_run(myrpt, chan, 0);
+	if (evaluated) {
+		events_dump(myrpt, chan, evaluated);
+	}
+	ast_channel_unref(chan);
+}
+
+void rpt_event_process(struct rpt *myrpt, struct ast_channel *chan)
+{
+	int evaluated;
+
+	evaluated = events_run(myrpt, chan, 1);
+	if (myrpt->ready) {
+		events_dump(myrpt, chan, evaluated);
+	}
+}
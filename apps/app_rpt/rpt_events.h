@@ -0,0 +1,71 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT event engine
+ *
+ * The events stanza is compiled when the node's configuration is loaded.
+ * Every rule is parsed once, and each variable it reads is linked back to
+ * it, so that setting a variable only marks the rules that depend on it.
+ * rpt_event_process() then evaluates just those rules.  The previous value
+ * of each variable used for transitions (formerly the XX_ channel
+ * variables) is kept in the engine.
+ *
+ * Rules that can't be tracked this way are evaluated on every pass, as
+ * before: "no change" (N) rules, expressions using dialplan functions or
+ * nested substitutions, and rules reading variables that app_rpt doesn't set.
+ */
+
+/*!
+ * \brief Compile the events stanza of a node
+ * \note Called from load_rpt_vars() with the node's lock held.
+ * Variable state is carried over from the previously loaded rules.
+ * \param myrpt
+ * \param cfg The node's configuration
+ */
+void rpt_events_load(struct rpt *myrpt, struct ast_config *cfg);
+
+/*!
+ * \brief Free a node's compiled events
+ * \param myrpt
+ */
+void rpt_events_free(struct rpt *myrpt);
+
+/*!
+ * \brief Record a new value for a node variable
+ * \note The caller also sets the variable on the node's channel.
+ * The value is queued and applied by the next rpt_event_process() or
+ * rpt_events_run(), so this may be called with myrpt->lock held.
+ * \param myrpt
+ * \param name Variable name
+ * \param value New value
+ */
+void rpt_events_setvar(struct rpt *myrpt, const char *name, const char *value);
+
+/*!
+ * \brief Record a new value for a node variable, and evaluate the rules once it is applied
+ * \note As rpt_events_setvar(), may be called with myrpt->lock held.
+ * \param myrpt
+ * \param name Variable name
+ * \param value New value
+ */
+void rpt_events_update(struct rpt *myrpt, const char *name, const char *value);
+
+/*!
+ * \brief Apply queued variable updates, running the rules they trigger
+ * \note Must not be called with myrpt->lock held.
+ * \param myrpt
+ */
+void rpt_events_run(struct rpt *myrpt);
+
+/*!
+ * \brief Process RPT events for a repeater using a caller-owned channel reference.
+ *
+ * Applies queued variable updates, then evaluates the rules whose variables
+ * changed since the last pass.  Macros and commands of rules that fire are
+ * run after the engine is unlocked.
+ * \note Must not be called with myrpt->lock held.
+ * \param myrpt Non-NULL reference to the repeater structure.
+ * \param chan  Non-NULL channel reference that remains valid for the duration of this call.
+ */
+void rpt_event_process(struct rpt *myrpt, struct ast_channel *chan);
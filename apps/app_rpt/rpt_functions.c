@@ -169,7 +169,7 @@ enum rpt_function_response function_ilink(struct rpt *myrpt, char *param, char *
 		}
 
 		/* try to find this one in queue */
-		l = ao2_find(myrpt->links, digitbuf, 0);
+		l = rpt_link_find(myrpt, digitbuf);
 		if (!l) { /* if not found */
 			rpt_mutex_unlock(&myrpt->lock);
 			break;
@@ -0,0 +1,242 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT DTMF function tries
+ */
+
+#include "asterisk.h"
+
+#include <ctype.h>
+
+#include "asterisk/astobj2.h"
+#include "asterisk/config.h"
+#include "asterisk/utils.h"
+
+#include "app_rpt.h"
+#include "rpt_functrie.h"
+
+/*! \brief Number of hash buckets for a node's compiled stanzas */
+#define RPT_FUNCTRIE_BUCKETS 7
+
+struct rpt_functrie_node {
+	char digit;
+	struct rpt_functrie_node *child;   /*!< \brief First node for the next digit */
+	struct rpt_functrie_node *sibling; /*!< \brief Next node for this digit position */
+	struct rpt_functrie_entry *entry;  /*!< \brief Function whose name ends here */
+};
+
+/*! \brief A compiled function stanza, immutable once built */
+struct rpt_functrie {
+	struct rpt_functrie_node root;
+	char stanza[0];
+};
+
+AO2_STRING_FIELD_HASH_FN(rpt_functrie, stanza);
+AO2_STRING_FIELD_CMP_FN(rpt_functrie, stanza);
+
+static void functrie_node_free(struct rpt_functrie_node *node)
+{
+	while (node) {
+		struct rpt_functrie_node *next = node->sibling;
+
+		functrie_node_free(node->child);
+		if (node->entry) {
+			ast_free((char *) node->entry->param);
+			ast_free(node->entry);
+		}
+		ast_free(node);
+		node = next;
+	}
+}
+
+static void functrie_destroy(void *obj)
+{
+	struct rpt_functrie *trie = obj;
+
+	functrie_node_free(trie->root.child);
+}
+
+static struct rpt_functrie_node *functrie_child(const struct rpt_functrie_node *node, char digit)
+{
+	struct rpt_functrie_node *child;
+
+	for (child = node->child; child; child = child->sibling) {
+		if (child->digit == digit) {
+			return child;
+		}
+	}
+	return NULL;
+}
+
+/*!
+ * \internal
+ * \brief Add one function to a trie
+ * \retval 0 on success
+ * \retval -1 on allocation failure
+ */
+static int functrie_add(struct rpt_functrie *trie, const char *name, const char *value, int order)
+{
+	struct rpt_functrie_node *node = &trie->root;
+	struct rpt_functrie_entry *entry;
+	char *workstring, *stringp, *action;
+	const char *s;
+
+	for (s = name; *s; s++) {
+		char digit = toupper(*s);
+		struct rpt_functrie_node *child = functrie_child(node, digit);
+
+		if (!child) {
+			child = ast_calloc(1, sizeof(*child));
+			if (!child) {
+				return -1;
+			}
+			child->digit = digit;
+			child->sibling = node->child;
+			node->child = child;
+		}
+		node = child;
+	}
+	if (node->entry) {
+		/* Duplicate name, the first one in the stanza is always the one matched */
+		return 0;
+	}
+
+	entry = ast_calloc(1, sizeof(*entry));
+	if (!entry) {
+		return -1;
+	}
+	entry->order = order;
+	entry->namelen = strlen(name);
+
+	/* Pre-split "action,param" */
+	workstring = ast_strdupa(value);
+	stringp = workstring;
+	action = strsep(&stringp, ",");
+	entry->action = rpt_function_lookup(action);
+	if (entry->action < 0) {
+		ast_log(LOG_WARNING, "Unknown action '%s' for function %s in stanza %s\n", action, name, trie->stanza);
+	}
+	if (stringp) {
+		entry->param = ast_strdup(stringp);
+		if (!entry->param) {
+			ast_free(entry);
+			return -1;
+		}
+	}
+	node->entry = entry;
+	return 0;
+}
+
+static struct rpt_functrie *functrie_build(struct ast_config *cfg, const char *stanza)
+{
+	struct rpt_functrie *trie;
+	struct ast_variable *vp;
+	int order = 0;
+
+	trie = ao2_alloc_options(sizeof(*trie) + strlen(stanza) + 1, functrie_destroy, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!trie) {
+		return NULL;
+	}
+	strcpy(trie->stanza, stanza); /* Safe */
+
+	for (vp = ast_variable_browse(cfg, stanza); vp; vp = vp->next) {
+		if (functrie_add(trie, vp->name, vp->value, order++)) {
+			ao2_ref(trie, -1);
+			return NULL;
+		}
+	}
+	return trie;
+}
+
+/*!
+ * \internal
+ * \brief Compile a stanza and add it to the node's tries, replacing any older version
+ */
+static struct rpt_functrie *functrie_compile(struct rpt *myrpt, struct ast_config *cfg, const char *stanza)
+{
+	struct rpt_functrie *trie;
+
+	if (!stanza || !cfg || !myrpt->functries) {
+		return NULL;
+	}
+	trie = functrie_build(cfg, stanza);
+	if (!trie) {
+		return NULL;
+	}
+	ao2_wrlock(myrpt->functries);
+	ao2_find(myrpt->functries, stanza, OBJ_SEARCH_KEY | OBJ_UNLINK | OBJ_NODATA | OBJ_NOLOCK);
+	ao2_link_flags(myrpt->functries, trie, OBJ_NOLOCK);
+	ao2_unlock(myrpt->functries);
+	return trie;
+}
+
+void rpt_functries_load(struct rpt *myrpt, struct ast_config *cfg)
+{
+	if (!myrpt->functries) {
+		myrpt->functries = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_RWLOCK, AO2_CONTAINER_ALLOC_OPT_DUPS_REJECT,
+			RPT_FUNCTRIE_BUCKETS, rpt_functrie_hash_fn, NULL, rpt_functrie_cmp_fn);
+		if (!myrpt->functries) {
+			return;
+		}
+	} else {
+		/* Anything compiled from the old configuration is stale */
+		ao2_callback(myrpt->functries, OBJ_UNLINK | OBJ_MULTIPLE | OBJ_NODATA, NULL, NULL);
+	}
+
+	ao2_cleanup(functrie_compile(myrpt, cfg, myrpt->p.functions));
+	ao2_cleanup(functrie_compile(myrpt, cfg, myrpt->p.link_functions));
+	ao2_cleanup(functrie_compile(myrpt, cfg, myrpt->p.phone_functions));
+	ao2_cleanup(functrie_compile(myrpt, cfg, myrpt->p.dphone_functions));
+	ao2_cleanup(functrie_compile(myrpt, cfg, myrpt->p.alt_functions));
+}
+
+void rpt_functries_free(struct rpt *myrpt)
+{
+	ao2_cleanup(myrpt->functries);
+	myrpt->functries = NULL;
+}
+
+enum rpt_functrie_result rpt_functrie_match(struct rpt *myrpt, const char *stanza, const char *digits,
+	const struct rpt_functrie_entry **entry, void **trieobj)
+{
+	struct rpt_functrie *trie;
+	const struct rpt_functrie_node *node;
+	const struct rpt_functrie_entry *best = NULL;
+	const char *d;
+
+	if (!myrpt->functries) {
+		return RPT_FUNCTRIE_NOMATCH;
+	}
+	trie = ao2_find(myrpt->functries, stanza, OBJ_SEARCH_KEY);
+	if (!trie) {
+		/* e.g. an authenticated command set that isn't one of the node's own stanzas */
+		trie = functrie_compile(myrpt, myrpt->cfg, stanza);
+		if (!trie) {
+			return RPT_FUNCTRIE_NOMATCH;
+		}
+	}
+
+	node = &trie->root;
+	for (d = digits;; d++) {
+		if (node->entry && (!best || node->entry->order < best->order)) {
+			best = node->entry;
+		}
+		if (!*d) {
+			break;
+		}
+		node = functrie_child(node, toupper(*d));
+		if (!node) {
+			break;
+		}
+	}
+
+	if (best) {
+		*entry = best;
+		*trieobj = trie;
+		return RPT_FUNCTRIE_MATCH;
+	}
+	ao2_ref(trie, -1);
+	/* Ran out of digits while still inside the trie, more digits may match */
+	return node && node->child ? RPT_FUNCTRIE_PARTIAL : RPT_FUNCTRIE_NOMATCH;
+}
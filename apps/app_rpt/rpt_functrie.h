@@ -0,0 +1,57 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT DTMF function tries
+ *
+ * Each function stanza is compiled into a trie of its DTMF function names
+ * when the node's configuration is loaded, with the action and parameters
+ * of every function already resolved.  Matching collected digits against
+ * a stanza is then O(digits), and a digit string that can never match is
+ * recognized as soon as it leaves the trie.
+ */
+
+/*! \brief A compiled DTMF function */
+struct rpt_functrie_entry {
+	int order;		   /*!< \brief Position in the stanza, the first matching function wins */
+	int namelen;	   /*!< \brief Number of digits in the function name */
+	int action;		   /*!< \brief Index returned by rpt_function_lookup(), -1 if the action is unknown */
+	const char *param; /*!< \brief Parameters after the action, NULL if none */
+};
+
+/*! \brief Result of matching digits against a function trie */
+enum rpt_functrie_result {
+	/*! \brief A function name is a prefix of the digits */
+	RPT_FUNCTRIE_MATCH,
+	/*! \brief The digits are a prefix of at least one function name */
+	RPT_FUNCTRIE_PARTIAL,
+	/*! \brief No function can match, whatever digits follow */
+	RPT_FUNCTRIE_NOMATCH,
+};
+
+/*!
+ * \brief Compile the function tries for a node's function stanzas
+ * \note Called from load_rpt_vars() with the node's lock held.
+ * \param myrpt
+ * \param cfg The node's configuration
+ */
+void rpt_functries_load(struct rpt *myrpt, struct ast_config *cfg);
+
+/*!
+ * \brief Free a node's function tries
+ * \param myrpt
+ */
+void rpt_functries_free(struct rpt *myrpt);
+
+/*!
+ * \brief Match digits against the functions in a stanza
+ * \param myrpt
+ * \param stanza Function stanza, compiled on first use if it wasn't at load time
+ * \param digits Collected digits
+ * \param[out] entry Set to the matching function on RPT_FUNCTRIE_MATCH.  It remains
+ * valid while *trie is held.
+ * \param[out] trie Set to a reference to the stanza's trie on RPT_FUNCTRIE_MATCH, release with ao2_ref()
+ * \return enum rpt_functrie_result
+ */
+enum rpt_functrie_result rpt_functrie_match(struct rpt *myrpt, const char *stanza, const char *digits,
+	const struct rpt_functrie_entry **entry, void **trie);
@@ -0,0 +1,78 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT Goertzel tone detector bank
+ *
+ * A bank runs up to RPT_GOERTZEL_MAX Goertzel filters over the same audio
+ * in one pass, each filter in its own SIMD lane (AVX2 or SSE2 on x86, NEON
+ * on ARM, plain C elsewhere), and accumulates the total energy of the
+ * audio alongside so a caller can compare tone energy against it.
+ * Powers are on the same scale as the fixed point Goertzel filter this
+ * replaces.
+ */
+
+#ifndef _RPT_GOERTZEL_H_
+#define _RPT_GOERTZEL_H_
+
+/*! \brief Most filters in a bank */
+#define RPT_GOERTZEL_MAX 16
+
+/*! \brief Filter coefficients, fixed once initialized and shareable between states */
+struct rpt_goertzel_bank {
+	float coef[RPT_GOERTZEL_MAX] __attribute__((aligned(32))); /*!< \brief 2 cos(w), 0 in unused lanes */
+	int freqs[RPT_GOERTZEL_MAX];
+	int nfilters;
+};
+
+/*! \brief Filter state for a block in progress */
+struct rpt_goertzel_state {
+	float s1[RPT_GOERTZEL_MAX] __attribute__((aligned(32)));
+	float s2[RPT_GOERTZEL_MAX] __attribute__((aligned(32)));
+	float energy; /*!< \brief Sum of squared samples */
+	int samples;  /*!< \brief Samples in the block so far */
+};
+
+/*!
+ * \brief Set up a filter bank
+ * \param bank Bank
+ * \param freqs Frequencies to detect, in Hz
+ * \param nfilters Number of frequencies, at most RPT_GOERTZEL_MAX
+ * \param rate Sample rate
+ * \retval 0 on success
+ * \retval -1 if nfilters is out of range
+ */
+int rpt_goertzel_init(struct rpt_goertzel_bank *bank, const int *freqs, int nfilters, int rate);
+
+/*!
+ * \brief Start a new block
+ * \param state State
+ */
+void rpt_goertzel_reset(struct rpt_goertzel_state *state);
+
+/*!
+ * \brief Run every filter in a bank over some samples
+ * \param bank Bank
+ * \param state State, samples are added to the block in progress
+ * \param samples Signed linear audio
+ * \param count Number of samples
+ */
+void rpt_goertzel_update(const struct rpt_goertzel_bank *bank, struct rpt_goertzel_state *state, const int16_t *samples, int count);
+
+/*!
+ * \brief Get the power at each frequency for the block so far
+ * \param bank Bank
+ * \param state State
+ * \param[out] power Power at each of the bank's frequencies
+ */
+void rpt_goertzel_result(const struct rpt_goertzel_bank *bank, const struct rpt_goertzel_state *state, float *power);
+
+/*! \brief Name of the filter implementation in use */
+const char *rpt_goertzel_impl(void);
+
+#ifdef TEST_FRAMEWORK
+void rpt_goertzel_tests_register(void);
+void rpt_goertzel_tests_unregister(void);
+#endif
+
+#endif /* _RPT_GOERTZEL_H_ */
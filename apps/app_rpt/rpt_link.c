@@ -23,11 +23,16 @@
 #include "rpt_call.h"
 #include "rpt_vox.h"
 #include "rpt_link.h"
+#include "rpt_link_pool.h"
 #include "rpt_telemetry.h"
 #include "rpt_functions.h"
+#include "rpt_events.h"
+#include "rpt_trace.h"
 
 #define ENABLE_CHECK_TLINK_LIST 0
 
+#define RPT_LINK_BUCKETS 61 /* hash buckets for the per-node link name index */
+
 #define OBUFSIZE(size) (size + sizeof("123456,")) /* size of buffer + room for node count + comma */
 #define BUFSIZE(size) (size)
 
@@ -129,6 +134,9 @@ void rpt_link_destroy(void *obj)
 		ast_free(doomed_link->linklist);
 		doomed_link->linklist = NULL;
 	}
+	rpt_textq_flush(doomed_link);
+	ao2_cleanup(doomed_link->trace);
+	ao2_cleanup(doomed_link->linklist_sent);
 }
 
 void tele_link_add(struct rpt *myrpt, struct rpt_tele *t)
@@ -195,19 +203,116 @@ int altlink1(struct rpt *myrpt, struct rpt_link *mylink)
 	return 0;
 }
 
+struct rpt_text_payload *rpt_text_payload_alloc(const struct ast_frame *f)
+{
+	struct rpt_text_payload *payload;
+
+	payload = ao2_alloc_options(sizeof(*payload) + f->datalen, NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!payload) {
+		return NULL;
+	}
+	payload->datalen = f->datalen;
+	memcpy(payload->data, f->data.ptr, f->datalen);
+	return payload;
+}
+
+void rpt_textq_init(struct rpt_link *l)
+{
+	unsigned int i;
+
+	l->textq.head = l->textq.tail = l->textq.drops = 0;
+	for (i = 0; i < RPT_TEXTQ_SIZE; i++) {
+		l->textq.slots[i].seq = i;
+		l->textq.slots[i].payload = NULL;
+	}
+}
+
+/*
+ * The text queue is a bounded ring where every slot carries a sequence number.
+ * A slot whose seq equals the tail position is free, producers claim it by
+ * advancing tail with a CAS, fill it in and then publish it by setting seq to
+ * pos + 1.  The consumer takes a slot once its seq reaches head + 1 and hands
+ * it back to producers by setting seq to head + RPT_TEXTQ_SIZE.
+ */
+int rpt_qwrite_payload(struct rpt_link *l, struct rpt_text_payload *payload)
+{
+	struct rpt_textq *q = &l->textq;
+	struct rpt_textq_slot *slot;
+	unsigned int pos, seq;
+
+	if (!l->chan || !payload) {
+		return 0;
+	}
+	pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+	for (;;) {
+		int diff;
+
+		slot = &q->slots[pos & (RPT_TEXTQ_SIZE - 1)];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (int) (seq - pos);
+		if (!diff) {
+			if (__atomic_compare_exchange_n(&q->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				break;
+			}
+			/* pos was reloaded by the failed CAS */
+		} else if (diff < 0) {
+			/* Queue is full, the link isn't keeping up */
+			if (!__atomic_fetch_add(&q->drops, 1, __ATOMIC_RELAXED)) {
+				ast_log(LOG_WARNING, "Text queue for link %s is full, dropping frames\n", l->name);
+			}
+			return -1;
+		} else {
+			pos = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+		}
+	}
+	slot->payload = ao2_bump(payload);
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+struct rpt_text_payload *rpt_textq_pop(struct rpt_link *l)
+{
+	struct rpt_textq *q = &l->textq;
+	struct rpt_textq_slot *slot = &q->slots[q->head & (RPT_TEXTQ_SIZE - 1)];
+	struct rpt_text_payload *payload;
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != q->head + 1) {
+		return NULL;
+	}
+	payload = slot->payload;
+	slot->payload = NULL;
+	__atomic_store_n(&slot->seq, q->head + RPT_TEXTQ_SIZE, __ATOMIC_RELEASE);
+	__atomic_store_n(&q->head, q->head + 1, __ATOMIC_RELAXED);
+	return payload;
+}
+
+unsigned int rpt_textq_depth(struct rpt_link *l)
+{
+	unsigned int head = __atomic_load_n(&l->textq.head, __ATOMIC_RELAXED);
+	unsigned int tail = __atomic_load_n(&l->textq.tail, __ATOMIC_RELAXED);
+
+	return (int) (tail - head) > 0 ? tail - head : 0;
+}
+
 void rpt_qwrite(struct rpt_link *l, struct ast_frame *f)
 {
-	struct ast_frame *f1;
+	struct rpt_text_payload *payload;
 
 	if (!l->chan) {
 		return;
 	}
-	f1 = ast_frdup(f);
-	if (!f1) {
-		return;
+	payload = rpt_text_payload_alloc(f);
+	rpt_qwrite_payload(l, payload);
+	ao2_cleanup(payload);
+}
+
+void rpt_textq_flush(struct rpt_link *l)
+{
+	struct rpt_text_payload *payload;
+
+	while ((payload = rpt_textq_pop(l))) {
+		ao2_ref(payload, -1);
 	}
-	memset(&f1->frame_list, 0, sizeof(f1->frame_list));
-	AST_LIST_INSERT_TAIL(&l->textq, f1, frame_list);
 }
 
 int linkcount(struct rpt *myrpt)
@@ -288,11 +393,16 @@ void rssi_send(struct rpt *myrpt)
 		.frametype = AST_FRAME_TEXT,
 		.src = __PRETTY_FUNCTION__,
 	};
+	struct rpt_text_payload *payload;
 	char str[200];
 
 	snprintf(str, sizeof(str), "R %i", myrpt->rxrssi);
 	wf.datalen = strlen(str) + 1;
 	wf.data.ptr = str;
+	payload = rpt_text_payload_alloc(&wf);
+	if (!payload) {
+		return;
+	}
 	/* otherwise, send it to all of em */
 	rpt_mutex_lock(&myrpt->lock);
 	RPT_LIST_TRAVERSE(myrpt->links, l, l_it) {
@@ -301,20 +411,21 @@ void rssi_send(struct rpt *myrpt)
 		}
 		ast_debug(6, "[%s] rssi=%i to %s\n", myrpt->name, myrpt->rxrssi, l->name);
 		if (l->chan) {
-			rpt_qwrite(l, &wf);
+			rpt_qwrite_payload(l, payload);
 		}
 	}
 	rpt_mutex_unlock(&myrpt->lock);
 	ao2_iterator_destroy(&l_it);
+	ao2_ref(payload, -1);
 }
 
 static int link_qwrite_cb(void *obj, void *arg, int flags)
 {
 	struct rpt_link *link = obj;
-	struct ast_frame *wf = arg;
+	struct rpt_text_payload *payload = arg;
 
 	if (link->chan) {
-		rpt_qwrite(link, wf);
+		rpt_qwrite_payload(link, payload);
 	}
 
 	return 0;
@@ -329,7 +440,7 @@ void send_link_dtmf(struct rpt *myrpt, char c)
 	};
 
 	struct rpt_link *l;
-	struct ao2_iterator l_it;
+	struct rpt_text_payload *payload;
 
 	snprintf(str, sizeof(str), "D %s %s %d %c", myrpt->cmdnode, myrpt->name, ++(myrpt->dtmfidx), c);
 	wf.datalen = strlen(str) + 1;
@@ -342,25 +453,24 @@ void send_link_dtmf(struct rpt *myrpt, char c)
 	}
 
 	/* first, see if our dude is there */
-	RPT_LIST_TRAVERSE(myrpt->links, l, l_it) {
-		if (l->name[0] == '0') {
-			continue;
-		}
+	l = rpt_link_find(myrpt, myrpt->cmdnode);
+	if (l && l->name[0] != '0') {
 		/* if we found it, write it and were done */
-		if (!strcmp(l->name, myrpt->cmdnode)) {
-			if (l->chan) {
-				rpt_qwrite(l, &wf);
-			}
-			ao2_ref(l, -1);
-			ao2_iterator_destroy(&l_it);
-			rpt_mutex_unlock(&myrpt->lock);
-			return;
+		if (l->chan) {
+			rpt_qwrite(l, &wf);
 		}
+		ao2_ref(l, -1);
+		rpt_mutex_unlock(&myrpt->lock);
+		return;
 	}
-	ao2_iterator_destroy(&l_it);
+	ao2_cleanup(l);
 
 	/* if not, give it to everyone */
-	ao2_callback(myrpt->links, OBJ_MULTIPLE | OBJ_NODATA, link_qwrite_cb, &wf);
+	payload = rpt_text_payload_alloc(&wf);
+	if (payload) {
+		ao2_callback(myrpt->links, OBJ_MULTIPLE | OBJ_NODATA, link_qwrite_cb, payload);
+		ao2_ref(payload, -1);
+	}
 	rpt_mutex_unlock(&myrpt->lock);
 }
 
@@ -371,6 +481,7 @@ void send_link_keyquery(struct rpt *myrpt)
 		.frametype = AST_FRAME_TEXT,
 		.src = __PRETTY_FUNCTION__,
 	};
+	struct rpt_text_payload *payload;
 
 	rpt_mutex_lock(&myrpt->lock);
 	memset(myrpt->topkey, 0, sizeof(myrpt->topkey));
@@ -388,19 +499,45 @@ void send_link_keyquery(struct rpt *myrpt)
 	}
 
 	rpt_mutex_unlock(&myrpt->lock);
-	ao2_callback(myrpt->links, OBJ_MULTIPLE | OBJ_NODATA, link_qwrite_cb, &wf);
+	payload = rpt_text_payload_alloc(&wf);
+	if (!payload) {
+		return;
+	}
+	ao2_callback(myrpt->links, OBJ_MULTIPLE | OBJ_NODATA, link_qwrite_cb, payload);
+	ao2_ref(payload, -1);
 }
 
-void rpt_link_add(struct ao2_container *links, struct rpt_link *l)
+void rpt_link_add(struct rpt *myrpt, struct rpt_link *l)
 {
 	ast_assert(l != NULL);
-	ao2_link(links, l);
+	ao2_link(myrpt->links, l);
+	ao2_link(myrpt->links_byname, l);
+	rpt_linklist_changed(myrpt);
 }
 
-void rpt_link_remove(struct ao2_container *links, struct rpt_link *l)
+void rpt_link_remove(struct rpt *myrpt, struct rpt_link *l)
 {
 	ast_assert(l != NULL);
-	ao2_unlink(links, l);
+	ao2_unlink(myrpt->links_byname, l);
+	ao2_unlink(myrpt->links, l);
+	rpt_linklist_changed(myrpt);
+}
+
+AO2_STRING_FIELD_HASH_FN(rpt_link, name);
+AO2_STRING_FIELD_CMP_FN(rpt_link, name);
+
+struct ao2_container *rpt_link_index_alloc(void)
+{
+	return ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, AO2_CONTAINER_ALLOC_OPT_DUPS_ALLOW, RPT_LINK_BUCKETS, rpt_link_hash_fn,
+		NULL, rpt_link_cmp_fn);
+}
+
+struct rpt_link *rpt_link_find(struct rpt *myrpt, const char *name)
+{
+	if (!myrpt->links_byname) {
+		return NULL;
+	}
+	return ao2_find(myrpt->links_byname, name, OBJ_SEARCH_KEY);
 }
 
 static int __mklinklist_limit(struct rpt *myrpt, struct ast_str *buf, int bytes, enum __mklinklist_flags flags)
@@ -612,6 +749,81 @@ int __mklinklist(struct rpt *myrpt, struct rpt_link *mylink, struct ast_str **bu
 	return links_count;
 }
 
+/*! \brief Cache slot for a link list format */
+static int linklist_slot(enum __mklinklist_flags flags)
+{
+	return (flags & (USE_FORMAT_RPT_ALINK | USE_FORMAT_RPT_LINKPOST)) | ((flags & LIMIT_STRING_LENGTH) ? 4 : 0);
+}
+
+struct rpt_linklist *rpt_linklist_get(struct rpt *myrpt, struct rpt_link *mylink, enum __mklinklist_flags flags)
+{
+	struct rpt_linklist **cache, *list;
+	struct ast_str *buf;
+	unsigned int version;
+	int count;
+
+	cache = mylink ? &mylink->linklist_sent : &myrpt->linklists[linklist_slot(flags)];
+	/* Links change state without the node lock, so take the version before looking at them */
+	version = __atomic_load_n(&myrpt->linklist_version, __ATOMIC_ACQUIRE);
+	if (*cache && (*cache)->version == version && (*cache)->flags == flags) {
+		ao2_ref(*cache, +1);
+		return *cache;
+	}
+
+	buf = ast_str_create(RPT_AST_STR_INIT_SIZE);
+	if (!buf) {
+		return NULL;
+	}
+	count = __mklinklist(myrpt, mylink, &buf, flags);
+	list = ao2_alloc_options(sizeof(*list) + ast_str_strlen(buf) + 1, NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!list) {
+		ast_free(buf);
+		return NULL;
+	}
+	list->version = version;
+	list->flags = flags;
+	list->count = count;
+	list->len = ast_str_strlen(buf);
+	memcpy(list->str, ast_str_buffer(buf), list->len + 1);
+	ast_free(buf);
+
+	ao2_cleanup(*cache);
+	*cache = list;
+	ao2_ref(list, +1);
+	return list;
+}
+
+int rpt_linklist_append(struct rpt *myrpt, struct rpt_link *mylink, struct ast_str **buf, enum __mklinklist_flags flags)
+{
+	struct rpt_linklist *list;
+	int count;
+
+	list = rpt_linklist_get(myrpt, mylink, flags);
+	if (!list) {
+		/* Out of memory, build it in place */
+		return __mklinklist(myrpt, mylink, buf, flags);
+	}
+	ast_str_append(buf, 0, "%s", list->str);
+	count = list->count;
+	ao2_ref(list, -1);
+	return count;
+}
+
+void rpt_linklist_changed(struct rpt *myrpt)
+{
+	__atomic_add_fetch(&myrpt->linklist_version, 1, __ATOMIC_RELEASE);
+}
+
+void rpt_linklist_flush(struct rpt *myrpt)
+{
+	int i;
+
+	for (i = 0; i < RPT_LINKLIST_SLOTS; i++) {
+		ao2_cleanup(myrpt->linklists[i]);
+		myrpt->linklists[i] = NULL;
+	}
+}
+
 static int link_set_list_timer_cb(void *obj, void *arg, int flags)
 {
 	struct rpt_link *link = obj;
@@ -637,63 +849,61 @@ void __kickshort(struct rpt *myrpt)
 
 void rpt_update_links(struct rpt *myrpt)
 {
-	struct ast_str *buf, *obuf;
+	struct rpt_linklist *alinks, *links;
+	struct ast_str *obuf;
 	struct ast_channel *chan;
-	int n;
 
-	buf = ast_str_create(RPT_AST_STR_INIT_SIZE);
-	if (!buf) {
-		return;
-	}
 	obuf = ast_str_create(RPT_AST_STR_INIT_SIZE);
 	if (!obuf) {
-		ast_free(buf);
 		return;
 	}
 
 	rpt_mutex_lock(&myrpt->lock);
-	n = __mklinklist(myrpt, NULL, &buf, USE_FORMAT_RPT_ALINK);
-	/* parse em */
-	if (n) {
-		ast_str_set(&obuf, 0, "%d,%s", n, ast_str_buffer(buf));
-	}
-
 	if (!myrpt->rxchannel) {
-		ast_free(buf);
 		ast_free(obuf);
 		rpt_mutex_unlock(&myrpt->lock);
 		return;
 	}
-
+	alinks = rpt_linklist_get(myrpt, NULL, USE_FORMAT_RPT_ALINK);
+	links = rpt_linklist_get(myrpt, NULL, USE_FORMAT_RPT_LINK);
 	chan = ast_channel_ref(myrpt->rxchannel);
 	rpt_mutex_unlock(&myrpt->lock);
-	if (!chan) {
-		ast_free(buf);
+	if (!alinks || !links || !chan) {
+		ao2_cleanup(alinks);
+		ao2_cleanup(links);
+		if (chan) {
+			ast_channel_unref(chan);
+		}
 		ast_free(obuf);
 		return;
 	}
 
+	/* parse em */
+	if (alinks->count) {
+		ast_str_set(&obuf, 0, "%d,%s", alinks->count, alinks->str);
+	}
 	pbx_builtin_setvar_helper(chan, "RPT_ALINKS", ast_str_buffer(obuf));
 	rpt_manager_trigger(myrpt, chan, "RPT_ALINKS", ast_str_buffer(obuf));
-	ast_str_set(&obuf, 0, "%d", n);
+	rpt_events_setvar(myrpt, "RPT_ALINKS", ast_str_buffer(obuf));
+	ast_str_set(&obuf, 0, "%d", alinks->count);
 	pbx_builtin_setvar_helper(chan, "RPT_NUMALINKS", ast_str_buffer(obuf));
 	rpt_manager_trigger(myrpt, chan, "RPT_NUMALINKS", ast_str_buffer(obuf));
-	ast_str_reset(buf);
-	rpt_mutex_lock(&myrpt->lock);
-	n = __mklinklist(myrpt, NULL, &buf, USE_FORMAT_RPT_LINK);
-	rpt_mutex_unlock(&myrpt->lock);
-	if (n) {
-		ast_str_set(&obuf, 0, "%d,%s", n, ast_str_buffer(buf));
+	rpt_events_setvar(myrpt, "RPT_NUMALINKS", ast_str_buffer(obuf));
+	if (links->count) {
+		ast_str_set(&obuf, 0, "%d,%s", links->count, links->str);
 	}
 	pbx_builtin_setvar_helper(chan, "RPT_LINKS", ast_str_buffer(obuf));
 	rpt_manager_trigger(myrpt, chan, "RPT_LINKS", ast_str_buffer(obuf));
-	ast_str_set(&obuf, 0, "%d", n);
+	rpt_events_setvar(myrpt, "RPT_LINKS", ast_str_buffer(obuf));
+	ast_str_set(&obuf, 0, "%d", links->count);
 	pbx_builtin_setvar_helper(chan, "RPT_NUMLINKS", ast_str_buffer(obuf));
 	rpt_manager_trigger(myrpt, chan, "RPT_NUMLINKS", ast_str_buffer(obuf));
-	rpt_event_process(myrpt, chan);
+	/* May be called with the node locked, the node thread runs the rules */
+	rpt_events_update(myrpt, "RPT_NUMLINKS", ast_str_buffer(obuf));
 	ast_channel_unref(chan);
 
-	ast_free(buf);
+	ao2_ref(alinks, -1);
+	ao2_ref(links, -1);
 	ast_free(obuf);
 }
 
@@ -745,7 +955,7 @@ void *rpt_link_connect(void *data)
 	}
 	rpt_mutex_lock(&myrpt->lock);
 	/* try to find this one in queue */
-	l = ao2_find(myrpt->links, node, 0);
+	l = rpt_link_find(myrpt, node);
 	if (l) {
 		/* if found */
 		if ((l->mode == connect_data->mode) || (!l->chan)) {
@@ -760,6 +970,7 @@ void *rpt_link_connect(void *data)
 			ast_copy_string(myrpt->lastlinknode, node, sizeof(myrpt->lastlinknode));
 			rpt_mutex_unlock(&myrpt->lock);
 			l->mode = connect_data->mode;
+			rpt_linklist_changed(myrpt);
 			ao2_ref(l, -1);
 			goto cleanup;
 		}
@@ -778,7 +989,7 @@ void *rpt_link_connect(void *data)
 			rpt_mutex_unlock(&myrpt->lock);
 			goto cleanup;
 		}
-		n = __mklinklist(myrpt, NULL, &lstr, USE_FORMAT_RPT_LINK) + 1;
+		n = rpt_linklist_append(myrpt, NULL, &lstr, USE_FORMAT_RPT_LINK) + 1;
 		rpt_mutex_unlock(&myrpt->lock);
 		strs = ast_malloc(n * sizeof(char *));
 		if (!strs) {
@@ -812,6 +1023,8 @@ void *rpt_link_connect(void *data)
 		ao2_ref(l, -1);
 		goto cleanup;
 	}
+	rpt_textq_init(l);
+	l->trace = rpt_trace_stats_alloc(); /* Before the link can be handed to a link worker */
 	l->mode = connect_data->mode;
 	l->outbound = 1;
 	l->thisconnected = 0;
@@ -930,16 +1143,18 @@ void *rpt_link_connect(void *data)
 		l->retries = l->max_retries + 1;
 	}
 	l->rxlingertimer = RX_LINGER_TIME;
-	rpt_link_add(myrpt->links, l);
+	rpt_link_add(myrpt, l);
 	__kickshort(myrpt);
 	rpt_mutex_unlock(&myrpt->lock);
 	myrpt->linkactivityflag = 1;
 	rpt_telem_select(myrpt, connect_data->command_source, connect_data->mylink);
 	rpt_telemetry(myrpt, COMPLETE, NULL);
 
-	/* Service the link channel */
-	process_link_channel(myrpt, l);
-	/* call has ended, clean up */
+	/* Service the link channel, either from the shared link workers or from this thread */
+	if (rpt_link_pool_add(myrpt, l)) {
+		process_link_channel(myrpt, l);
+	}
+	/* call has ended (or is now owned by a link worker), clean up */
 	ao2_ref(l, -1);
 
 cleanup:
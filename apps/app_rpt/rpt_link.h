@@ -27,8 +27,59 @@ void tele_link_remove(struct rpt *myrpt, struct rpt_tele *t);
 
 int altlink1(struct rpt *myrpt, struct rpt_link *mylink);
 
+/*!
+ * \brief Queue a text frame to be sent on a link
+ * \param l Link to send on
+ * \param f Text frame, copied into a new payload
+ */
 void rpt_qwrite(struct rpt_link *l, struct ast_frame *f);
 
+/*!
+ * \brief Create a shared payload for a text frame
+ * \param f Text frame to copy
+ * \return ao2 payload, or NULL on failure
+ * \note Use when the same frame is queued to many links, the payload is
+ * copied once and each link queue holds a reference to it.
+ */
+struct rpt_text_payload *rpt_text_payload_alloc(const struct ast_frame *f);
+
+/*!
+ * \brief Queue a shared text payload to be sent on a link
+ * \param l Link to send on
+ * \param payload Payload, the queue takes its own reference
+ * \retval 0 on success
+ * \retval -1 if the link's text queue is full and the payload was dropped
+ * \note Does not require myrpt->lock.
+ */
+int rpt_qwrite_payload(struct rpt_link *l, struct rpt_text_payload *payload);
+
+/*!
+ * \brief Initialize a link's text queue
+ * \param l Link
+ */
+void rpt_textq_init(struct rpt_link *l);
+
+/*!
+ * \brief Take the next payload off a link's text queue
+ * \note Only the thread servicing the link may call this.
+ * \param l Link
+ * \return Payload with a reference the caller must release, or NULL if the queue is empty
+ */
+struct rpt_text_payload *rpt_textq_pop(struct rpt_link *l);
+
+/*!
+ * \brief Get the number of text frames waiting on a link
+ * \param l Link
+ */
+unsigned int rpt_textq_depth(struct rpt_link *l);
+
+/*!
+ * \brief Discard everything queued in a link's text queue
+ * \note Only the thread servicing the link, or the link destructor, may call this.
+ * \param l Link
+ */
+void rpt_textq_flush(struct rpt_link *l);
+
 int linkcount(struct rpt *myrpt);
 
 /*! \brief Considers repeater received RSSI and all voter link RSSI information and set values in myrpt structure. */
@@ -48,15 +99,29 @@ void send_link_keyquery(struct rpt *myrpt);
  * \param myrpt
  * \param l Link to insert into the repeater's linked list of links
  */
-void rpt_link_add(struct ao2_container *links, struct rpt_link *l);
+void rpt_link_add(struct rpt *myrpt, struct rpt_link *l);
+
+/*!
+ * \brief Remove an rpt_link from a rpt
+ * \param myrpt
+ * \param l Link to remove from the repeater's links
+ */
+
+void rpt_link_remove(struct rpt *myrpt, struct rpt_link *l);
 
 /*!
- * \brief Remove an rpt_link from a links container
- * \param links ao2_container to remove the link from
- * \param l Link to remove from the container
+ * \brief Allocate the hash index used to find a node's links by name
+ * \return ao2 container, or NULL on failure
  */
+struct ao2_container *rpt_link_index_alloc(void);
 
-void rpt_link_remove(struct ao2_container *links, struct rpt_link *l);
+/*!
+ * \brief Find a link by node name
+ * \param myrpt
+ * \param name Node name of the link
+ * \return Link with a reference the caller must release, or NULL if not connected
+ */
+struct rpt_link *rpt_link_find(struct rpt *myrpt, const char *name);
 
 /*!
  * \brief destroy ao2 object
@@ -90,6 +155,47 @@ enum __mklinklist_flags {
 
 int __mklinklist(struct rpt *myrpt, struct rpt_link *mylink, struct ast_str **buf, enum __mklinklist_flags flags);
 
+/*!
+ * \brief A link list, as built by __mklinklist()
+ *
+ * Snapshots are ao2 objects and never change once built, so they can be
+ * used after the node is unlocked.  They stay cached, and are handed out
+ * again, until rpt_linklist_changed() is called.
+ */
+struct rpt_linklist {
+	unsigned int version; /*!< \brief linklist_version of the node it was built at */
+	enum __mklinklist_flags flags;
+	int count; /*!< \brief Link count, as returned by __mklinklist() */
+	size_t len;
+	char str[0];
+};
+
+/*!
+ * \brief Get a node's link list, building it only if the links have changed.
+ * Must be called locked.
+ * \param myrpt		Pointer to rpt structure.
+ * \param mylink	Link to leave out, as for __mklinklist(), or NULL.
+ * \param flags		Format, as for __mklinklist().
+ * \return Snapshot the caller must release with ao2_ref(), or NULL on failure.
+ */
+struct rpt_linklist *rpt_linklist_get(struct rpt *myrpt, struct rpt_link *mylink, enum __mklinklist_flags flags);
+
+/*!
+ * \brief Append a node's link list to a string, like __mklinklist(), from the cache.
+ * Must be called locked.
+ * \retval		link count.
+ */
+int rpt_linklist_append(struct rpt *myrpt, struct rpt_link *mylink, struct ast_str **buf, enum __mklinklist_flags flags);
+
+/*!
+ * \brief Note that something a link list shows has changed: a link was added or
+ * removed, or its mode, connected or keyed state, or received node list changed.
+ */
+void rpt_linklist_changed(struct rpt *myrpt);
+
+/*! \brief Release a node's cached link lists */
+void rpt_linklist_flush(struct rpt *myrpt);
+
 /*! \brief must be called locked */
 void __kickshort(struct rpt *myrpt);
 
@@ -0,0 +1,423 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT shared link worker pool
+ */
+
+#include "asterisk.h"
+
+#include "asterisk/channel.h"
+#include "asterisk/lock.h"
+#include "asterisk/utils.h"
+#include "asterisk/vector.h"
+
+#include "app_rpt.h"
+#include "rpt_lock.h"
+#include "rpt_utils.h"
+#include "rpt_link_pool.h"
+
+struct rpt_link_worker {
+	struct rpt *myrpt;
+	pthread_t thread;
+	ast_mutex_t lock; /*!< Protects links, version and stop */
+	ast_cond_t cond;  /*!< Signaled when a link is added or the worker is stopped */
+	AST_VECTOR(, struct rpt_link *) links;
+	unsigned int version; /*!< Incremented when a link is added or removed */
+	rpt_bool stop:1;
+};
+
+struct rpt_link_pool {
+	int nworkers;
+	struct rpt_link_worker workers[];
+};
+
+/*!
+ * \brief Arrays a worker waits on, only rebuilt when its links or their channels change
+ * \note Only used by the worker thread
+ */
+struct link_worker_set {
+	struct rpt_link **links;		 /*!< NULL once removed */
+	struct ast_channel **linkchans;	 /*!< l->chan of each link when built, NULL if not waited on */
+	struct ast_channel **chans;		 /*!< Every channel to wait on */
+	int *chanlinks;					 /*!< Index in links of each channel */
+	struct ast_channel **waiting;	 /*!< Channels not yet serviced in this pass */
+	int *waitlinks;					 /*!< Index in links of each waiting channel */
+	int nlinks, nchans, alloced;
+	unsigned int version;
+	rpt_bool dirty:1;
+};
+
+/*!
+ * \internal
+ * \brief Remove a finished link from a worker, clean it up and drop the pool's reference
+ */
+static void link_worker_remove(struct rpt_link_worker *w, struct rpt_link *l)
+{
+	ast_mutex_lock(&w->lock);
+	AST_VECTOR_REMOVE_ELEM_UNORDERED(&w->links, l, AST_VECTOR_ELEM_CLEANUP_NOOP);
+	w->version++;
+	ast_mutex_unlock(&w->lock);
+
+	process_link_cleanup(w->myrpt, l);
+	ao2_ref(l, -1);
+}
+
+/*!
+ * \internal
+ * \brief Remove the link at index i of the set, see link_worker_remove()
+ */
+static void link_worker_drop(struct rpt_link_worker *w, struct link_worker_set *s, int i)
+{
+	struct rpt_link *l = s->links[i];
+
+	s->links[i] = NULL;
+	link_worker_remove(w, l);
+}
+
+/*!
+ * \internal
+ * \brief The channel of a link the worker should wait on, besides l->pchan
+ */
+static inline struct ast_channel *link_worker_linkchan(struct rpt_link *l)
+{
+	/* A deferred hangup is waiting for the channel to send its text, don't read it */
+	return l->hangupdelay ? NULL : l->chan;
+}
+
+static void link_worker_add_chan(struct link_worker_set *s, int link, struct ast_channel *chan)
+{
+	s->chans[s->nchans] = chan;
+	s->chanlinks[s->nchans] = link;
+	s->nchans++;
+}
+
+/*!
+ * \internal
+ * \brief Stop waiting on a serviced channel for the rest of the pass
+ * \param all Also stop waiting on the other channels of its link
+ * \return Number of channels still waiting
+ */
+static int link_worker_unwait(struct link_worker_set *s, int n, struct ast_channel *who, int link, int all)
+{
+	int i, j;
+
+	for (i = j = 0; i < n; i++) {
+		if (s->waiting[i] == who || (all && s->waitlinks[i] == link)) {
+			continue;
+		}
+		s->waiting[j] = s->waiting[i];
+		s->waitlinks[j] = s->waitlinks[i];
+		j++;
+	}
+	return j;
+}
+
+/*!
+ * \internal
+ * \brief Rebuild the arrays of a set from the worker's links
+ * \note Called with w->lock held
+ * \retval 0 on success, -1 on allocation failure
+ */
+static int link_worker_build(struct rpt_link_worker *w, struct link_worker_set *s)
+{
+	int i, nlinks = AST_VECTOR_SIZE(&w->links);
+
+	if (nlinks > s->alloced) {
+		int alloced = nlinks * 2;
+		void *tmp;
+
+		if (!(tmp = ast_realloc(s->links, sizeof(*s->links) * alloced))) {
+			return -1;
+		}
+		s->links = tmp;
+		if (!(tmp = ast_realloc(s->linkchans, sizeof(*s->linkchans) * alloced))) {
+			return -1;
+		}
+		s->linkchans = tmp;
+		if (!(tmp = ast_realloc(s->chans, sizeof(*s->chans) * alloced * 2))) {
+			return -1;
+		}
+		s->chans = tmp;
+		if (!(tmp = ast_realloc(s->chanlinks, sizeof(*s->chanlinks) * alloced * 2))) {
+			return -1;
+		}
+		s->chanlinks = tmp;
+		if (!(tmp = ast_realloc(s->waiting, sizeof(*s->waiting) * alloced * 2))) {
+			return -1;
+		}
+		s->waiting = tmp;
+		if (!(tmp = ast_realloc(s->waitlinks, sizeof(*s->waitlinks) * alloced * 2))) {
+			return -1;
+		}
+		s->waitlinks = tmp;
+		s->alloced = alloced;
+	}
+	s->nlinks = nlinks;
+	s->nchans = 0;
+	for (i = 0; i < nlinks; i++) {
+		struct rpt_link *l = AST_VECTOR_GET(&w->links, i);
+
+		s->links[i] = l;
+		s->linkchans[i] = link_worker_linkchan(l);
+		link_worker_add_chan(s, i, l->pchan);
+		if (s->linkchans[i]) {
+			link_worker_add_chan(s, i, s->linkchans[i]);
+		}
+	}
+	s->version = w->version;
+	s->dirty = 0;
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Service a channel of a link during a deferred hangup, dropping its audio
+ * \retval 0 if the link is still up
+ * \retval -1 if the link is done
+ */
+static int link_worker_hangup_activity(struct rpt *myrpt, struct rpt_link *l, struct ast_channel *who)
+{
+	struct ast_frame *f;
+
+	f = ast_read(who);
+	if (f) {
+		ast_frfree(f);
+		return 0;
+	}
+	/* Nothing more can be sent on this link, finish the hangup now */
+	return process_link_hangup(myrpt, l);
+}
+
+static void *link_worker_thread(void *data)
+{
+	struct rpt_link_worker *w = data;
+	struct rpt *myrpt = w->myrpt;
+	struct link_worker_set s = { .dirty = 1 };
+	struct timeval ticktime;
+	int tickelap = 0;
+
+	ticktime = rpt_tvnow();
+
+	for (;;) {
+		struct rpt_link *l;
+		struct ast_channel *who;
+		int i, j, n, ms, res, changed;
+
+		ast_mutex_lock(&w->lock);
+		while (!w->stop && !AST_VECTOR_SIZE(&w->links)) {
+			ast_cond_wait(&w->cond, &w->lock);
+			/* Don't count time spent without links toward the next tick */
+			ticktime = rpt_tvnow();
+			tickelap = 0;
+		}
+		if (w->stop) {
+			ast_mutex_unlock(&w->lock);
+			break;
+		}
+		if ((s.dirty || s.version != w->version) && link_worker_build(w, &s)) {
+			ast_mutex_unlock(&w->lock);
+			break;
+		}
+		ast_mutex_unlock(&w->lock);
+
+		/* Wait on all the channels at once, then service every one that is ready once */
+		ms = MAX(MSWAIT - tickelap, 0);
+		n = s.nchans;
+		memcpy(s.waiting, s.chans, sizeof(*s.chans) * n);
+		memcpy(s.waitlinks, s.chanlinks, sizeof(*s.chanlinks) * n);
+		while (n) {
+			who = ast_waitfor_n(s.waiting, n, &ms);
+			if (!who) {
+				if (ms < 0) {
+					/* Waiting failed, don't spin */
+					usleep(MSWAIT * 1000);
+				}
+				break;
+			}
+			/* Only pick up the channels that are already ready */
+			ms = 0;
+			for (j = 0; j < n - 1; j++) {
+				if (s.waiting[j] == who) {
+					break;
+				}
+			}
+			i = s.waitlinks[j];
+			l = s.links[i];
+			if (l->hangupdelay) {
+				res = link_worker_hangup_activity(myrpt, l, who);
+			} else {
+				res = process_link_activity(myrpt, l, who);
+			}
+			changed = res || link_worker_linkchan(l) != s.linkchans[i];
+			if (res) {
+				link_worker_drop(w, &s, i);
+			} else if (changed) {
+				s.dirty = 1;
+			}
+			/* A dropped link's channels are gone, and a changed one may have been hung up */
+			n = link_worker_unwait(&s, n, who, i, changed);
+		}
+		tickelap += rpt_time_elapsed(&ticktime);
+
+		if (tickelap < MSWAIT) {
+			continue;
+		}
+		/* Shared tick for all of this worker's links */
+		for (i = 0; i < s.nlinks; i++) {
+			l = s.links[i];
+			if (!l) {
+				continue;
+			}
+			if (l->hangupdelay) {
+				l->hangupdelay -= tickelap;
+				if (l->hangupdelay > 0) {
+					continue;
+				}
+				if (process_link_hangup(myrpt, l)) {
+					link_worker_drop(w, &s, i);
+					continue;
+				}
+			} else if (l->disced == RPT_LINK_DISCONNECT_NONE) {
+				periodic_process_link(myrpt, l, tickelap);
+			}
+			if (l->disced != RPT_LINK_DISCONNECT_NONE) {
+				link_worker_drop(w, &s, i);
+			} else if (link_worker_linkchan(l) != s.linkchans[i]) {
+				/* Reconnected, or hung up */
+				s.dirty = 1;
+			}
+		}
+		tickelap = 0;
+	}
+
+	/* Only reached on shutdown or allocation failure, release anything left */
+	ast_mutex_lock(&w->lock);
+	while (AST_VECTOR_SIZE(&w->links)) {
+		struct rpt_link *l = AST_VECTOR_GET(&w->links, 0);
+
+		ast_mutex_unlock(&w->lock);
+		l->disced = RPT_LINK_DISCONNECT_SILENT;
+		link_worker_remove(w, l);
+		ast_mutex_lock(&w->lock);
+	}
+	ast_mutex_unlock(&w->lock);
+
+	ast_free(s.links);
+	ast_free(s.linkchans);
+	ast_free(s.chans);
+	ast_free(s.chanlinks);
+	ast_free(s.waiting);
+	ast_free(s.waitlinks);
+	ast_debug(3, "Link worker for node %s exiting\n", myrpt->name);
+	return NULL;
+}
+
+/*!
+ * \internal
+ * \brief Create the link worker pool for a node
+ * \note Must be called with myrpt->lock held
+ */
+static struct rpt_link_pool *link_pool_create(struct rpt *myrpt, int nworkers)
+{
+	struct rpt_link_pool *pool;
+	int i;
+
+	pool = ast_calloc(1, sizeof(*pool) + sizeof(struct rpt_link_worker) * nworkers);
+	if (!pool) {
+		return NULL;
+	}
+	for (i = 0; i < nworkers; i++) {
+		struct rpt_link_worker *w = &pool->workers[i];
+
+		w->myrpt = myrpt;
+		ast_mutex_init(&w->lock);
+		ast_cond_init(&w->cond, NULL);
+		if (AST_VECTOR_INIT(&w->links, 8) || ast_pthread_create(&w->thread, NULL, link_worker_thread, w)) {
+			ast_log(LOG_WARNING, "Could not start link worker %d for node %s\n", i, myrpt->name);
+			AST_VECTOR_FREE(&w->links);
+			ast_cond_destroy(&w->cond);
+			ast_mutex_destroy(&w->lock);
+			break;
+		}
+		pool->nworkers++;
+	}
+	if (!pool->nworkers) {
+		ast_free(pool);
+		return NULL;
+	}
+	ast_debug(1, "Started %d link workers for node %s\n", pool->nworkers, myrpt->name);
+	return pool;
+}
+
+int rpt_link_pool_add(struct rpt *myrpt, struct rpt_link *l)
+{
+	struct rpt_link_worker *w;
+	int i, res;
+
+	if (myrpt->p.linkworkers <= 0) {
+		return -1;
+	}
+
+	rpt_mutex_lock(&myrpt->lock);
+	if (!myrpt->linkpool) {
+		myrpt->linkpool = link_pool_create(myrpt, myrpt->p.linkworkers);
+		if (!myrpt->linkpool) {
+			rpt_mutex_unlock(&myrpt->lock);
+			return -1;
+		}
+	}
+	/* Give the link to the least loaded worker */
+	w = &myrpt->linkpool->workers[0];
+	for (i = 1; i < myrpt->linkpool->nworkers; i++) {
+		if (AST_VECTOR_SIZE(&myrpt->linkpool->workers[i].links) < AST_VECTOR_SIZE(&w->links)) {
+			w = &myrpt->linkpool->workers[i];
+		}
+	}
+	ast_mutex_lock(&w->lock);
+	l->pooled = 1;
+	res = AST_VECTOR_APPEND(&w->links, l);
+	if (!res) {
+		ao2_ref(l, +1);
+		w->version++;
+		ast_cond_signal(&w->cond);
+	} else {
+		l->pooled = 0;
+	}
+	ast_mutex_unlock(&w->lock);
+	rpt_mutex_unlock(&myrpt->lock);
+
+	return res ? -1 : 0;
+}
+
+void rpt_link_pool_destroy(struct rpt *myrpt)
+{
+	struct rpt_link_pool *pool;
+	int i;
+
+	rpt_mutex_lock(&myrpt->lock);
+	pool = myrpt->linkpool;
+	myrpt->linkpool = NULL;
+	rpt_mutex_unlock(&myrpt->lock);
+
+	if (!pool) {
+		return;
+	}
+	for (i = 0; i < pool->nworkers; i++) {
+		struct rpt_link_worker *w = &pool->workers[i];
+
+		ast_mutex_lock(&w->lock);
+		w->stop = 1;
+		ast_cond_signal(&w->cond);
+		ast_mutex_unlock(&w->lock);
+	}
+	for (i = 0; i < pool->nworkers; i++) {
+		struct rpt_link_worker *w = &pool->workers[i];
+
+		pthread_join(w->thread, NULL);
+		AST_VECTOR_FREE(&w->links);
+		ast_cond_destroy(&w->cond);
+		ast_mutex_destroy(&w->lock);
+	}
+	ast_free(pool);
+}
@@ -0,0 +1,29 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT shared link worker pool
+ *
+ * When linkworkers is set for a node, its links are serviced by a fixed
+ * number of worker threads instead of one thread per link.  Each worker
+ * waits on the channels of all of its links at once and runs
+ * periodic_process_link() for them from a single MSWAIT tick.
+ */
+
+/*!
+ * \brief Hand a link over to the node's link worker pool
+ * \note myrpt->lock must not be held when calling.
+ * \param myrpt The node the link belongs to
+ * \param l The link, already added to myrpt->links.  The pool takes its own reference.
+ * \retval 0 if a worker now owns the link
+ * \retval -1 if pooling is disabled or failed, the caller must service the link itself
+ */
+int rpt_link_pool_add(struct rpt *myrpt, struct rpt_link *l);
+
+/*!
+ * \brief Stop the node's link workers and free the pool
+ * \note Must be called after all of the node's links have been disconnected,
+ * and without myrpt->lock held.
+ * \param myrpt The node
+ */
+void rpt_link_pool_destroy(struct rpt *myrpt);
@@ -1,3 +1,10 @@
+#include "asterisk.h"
+
+#include "asterisk/linkedlists.h"
+#include "asterisk/lock.h"
+#include "asterisk/utils.h"
+
+#include "app_rpt.h"
 #include "rpt_lock.h"
 
 #ifdef APP_RPT_LOCK_DEBUG
@@ -184,4 +191,347 @@ static void _rpt_mutex_unlock(ast_mutex_t *lockp, struct rpt *myrpt, int line)
 	ast_mutex_unlock(lockp);
 }
 
+#else /* APP_RPT_LOCK_DEBUG */
+
+/*! \brief Call sites tracked per thread, must be a power of 2 */
+#define LOCKSTAT_SITES 128
+
+/*! \brief Most locks a thread can hold and still be profiled */
+#define LOCKSTAT_HELD 8
+
+/*! \brief A thread's lock statistics, only written by the thread itself */
+struct lockstat_thread {
+	AST_LIST_ENTRY(lockstat_thread) list;
+	unsigned int gen; /*!< \brief Statistics are cleared when this doesn't match lockstat_gen */
+	unsigned int overflow;
+	struct rpt_lockstat sites[LOCKSTAT_SITES];
+};
+
+/*! \brief A lock the thread holds */
+struct lockstat_held {
+	ast_mutex_t *lock;
+	struct rpt_lockstat *site;
+	struct timespec acquired;
+};
+
+extern struct rpt rpt_vars[MAXRPTS];
+
+int rpt_lockstats_enabled;
+__thread int rpt_lockstats_held;
+
+static __thread struct lockstat_thread *lockstat_self;
+static __thread struct lockstat_held lockstat_held[LOCKSTAT_HELD];
+
+AST_MUTEX_DEFINE_STATIC(lockstat_lock);
+static AST_LIST_HEAD_NOLOCK_STATIC(lockstat_threads, lockstat_thread); /*!< \brief Protected by lockstat_lock */
+static struct lockstat_thread *lockstat_retired; /*!< \brief Statistics of threads that have exited.  Protected by lockstat_lock. */
+static unsigned int lockstat_gen;
+static pthread_key_t lockstat_key;
+static int lockstat_key_created;
+
+#define LOCKSTAT_ADD(field, val) __atomic_store_n(&(field), (field) + (val), __ATOMIC_RELAXED)
+#define LOCKSTAT_MAX(field, val) \
+	do { \
+		if ((val) > (field)) { \
+			__atomic_store_n(&(field), (val), __ATOMIC_RELAXED); \
+		} \
+	} while (0)
+
+static unsigned long long lockstat_ns(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1000000000ULL + end->tv_nsec - start->tv_nsec;
+}
+
+static int lockstat_bucket(unsigned long long ns)
+{
+	unsigned long long us = ns / 1000;
+	int b;
+
+	if (!us) {
+		return 0;
+	}
+	b = 64 - __builtin_clzll(us);
+	return b < RPT_LOCKSTAT_BUCKETS ? b : RPT_LOCKSTAT_BUCKETS - 1;
+}
+
+/*! \brief Index of the node owning a lock, or -1 */
+static int lockstat_node(ast_mutex_t *lock)
+{
+	uintptr_t p = (uintptr_t) lock, base = (uintptr_t) rpt_vars;
+
+	if (p < base || p >= base + sizeof(rpt_vars)) {
+		return -1;
+	}
+	return (p - base) / sizeof(struct rpt);
+}
+
+/*!
+ * \internal
+ * \brief Find or add the statistics for a call site
+ * \return Statistics, or NULL if the table is full
+ */
+static struct rpt_lockstat *lockstat_site(struct lockstat_thread *t, const char *file, int line, int node)
+{
+	unsigned int h = ((uintptr_t) file >> 3) ^ (line * 2654435761U) ^ (node * 40503U);
+	struct rpt_lockstat *site;
+	int i;
+
+	for (i = 0; i < LOCKSTAT_SITES; i++) {
+		site = &t->sites[(h + i) & (LOCKSTAT_SITES - 1)];
+		if (site->line == line && site->node == node && (site->file == file || !strcmp(site->file, file))) {
+			return site;
+		}
+		if (!site->line) {
+			site->file = file;
+			site->node = node;
+			/* Readers skip entries until the line is set */
+			__atomic_store_n(&site->line, line, __ATOMIC_RELEASE);
+			return site;
+		}
+	}
+	t->overflow++;
+	return NULL;
+}
+
+static void lockstat_merge(struct lockstat_thread *to, const struct lockstat_thread *from)
+{
+	const struct rpt_lockstat *src;
+	struct rpt_lockstat *dst;
+	int i, j;
+
+	to->overflow += from->overflow;
+	for (i = 0; i < LOCKSTAT_SITES; i++) {
+		src = &from->sites[i];
+		if (!__atomic_load_n(&src->line, __ATOMIC_ACQUIRE) || !src->count) {
+			continue;
+		}
+		dst = lockstat_site(to, src->file, src->line, src->node);
+		if (!dst) {
+			continue;
+		}
+		dst->count += src->count;
+		dst->contended += src->contended;
+		dst->wait_ns += src->wait_ns;
+		dst->hold_ns += src->hold_ns;
+		LOCKSTAT_MAX(dst->wait_max_ns, src->wait_max_ns);
+		LOCKSTAT_MAX(dst->hold_max_ns, src->hold_max_ns);
+		for (j = 0; j < RPT_LOCKSTAT_BUCKETS; j++) {
+			dst->wait_hist[j] += src->wait_hist[j];
+			dst->hold_hist[j] += src->hold_hist[j];
+		}
+	}
+}
+
+/*! \brief Thread exit, keep what the thread recorded */
+static void lockstat_thread_exit(void *data)
+{
+	struct lockstat_thread *t = data;
+
+	ast_mutex_lock(&lockstat_lock);
+	AST_LIST_REMOVE(&lockstat_threads, t, list);
+	if (lockstat_retired && t->gen == lockstat_gen) {
+		lockstat_merge(lockstat_retired, t);
+	}
+	ast_mutex_unlock(&lockstat_lock);
+	ast_free(t);
+}
+
+/*! \brief Get the calling thread's statistics, allocating them or clearing them after a reset */
+static struct lockstat_thread *lockstat_thread_get(void)
+{
+	struct lockstat_thread *t = lockstat_self;
+
+	if (t) {
+		if (t->gen != __atomic_load_n(&lockstat_gen, __ATOMIC_RELAXED)) {
+			ast_mutex_lock(&lockstat_lock);
+			memset(t->sites, 0, sizeof(t->sites));
+			t->overflow = 0;
+			t->gen = lockstat_gen;
+			ast_mutex_unlock(&lockstat_lock);
+		}
+		return t;
+	}
+	if (!lockstat_key_created) {
+		return NULL;
+	}
+
+	t = ast_calloc(1, sizeof(*t));
+	if (!t) {
+		return NULL;
+	}
+	ast_mutex_lock(&lockstat_lock);
+	t->gen = lockstat_gen;
+	AST_LIST_INSERT_HEAD(&lockstat_threads, t, list);
+	ast_mutex_unlock(&lockstat_lock);
+	pthread_setspecific(lockstat_key, t);
+	lockstat_self = t;
+	return t;
+}
+
+void rpt_lockstats_lock(ast_mutex_t *lock, const char *file, int line)
+{
+	struct lockstat_thread *t;
+	struct lockstat_held *held;
+	struct rpt_lockstat *site;
+	struct timespec start;
+	unsigned long long wait = 0;
+	int contended = 0;
+
+	if (rpt_lockstats_held == LOCKSTAT_HELD || !(t = lockstat_thread_get())) {
+		ast_mutex_lock(lock);
+		return;
+	}
+
+	held = &lockstat_held[rpt_lockstats_held];
+	if (ast_mutex_trylock(lock)) {
+		contended = 1;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		ast_mutex_lock(lock);
+		clock_gettime(CLOCK_MONOTONIC, &held->acquired);
+		wait = lockstat_ns(&start, &held->acquired);
+	} else {
+		clock_gettime(CLOCK_MONOTONIC, &held->acquired);
+	}
+
+	site = lockstat_site(t, file, line, lockstat_node(lock));
+	if (site) {
+		LOCKSTAT_ADD(site->count, 1);
+		if (contended) {
+			LOCKSTAT_ADD(site->contended, 1);
+			LOCKSTAT_ADD(site->wait_ns, wait);
+			LOCKSTAT_MAX(site->wait_max_ns, wait);
+			LOCKSTAT_ADD(site->wait_hist[lockstat_bucket(wait)], 1);
+		}
+	}
+	held->lock = lock;
+	held->site = site;
+	rpt_lockstats_held++;
+}
+
+void rpt_lockstats_unlock(ast_mutex_t *lock)
+{
+	struct rpt_lockstat *site;
+	struct timespec now;
+	unsigned long long hold;
+	int i;
+
+	/* The most recent lock of this mutex, it's recursive */
+	for (i = rpt_lockstats_held - 1; i >= 0; i--) {
+		if (lockstat_held[i].lock == lock) {
+			break;
+		}
+	}
+	if (i >= 0) {
+		site = lockstat_held[i].site;
+		if (site) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			hold = lockstat_ns(&lockstat_held[i].acquired, &now);
+			LOCKSTAT_ADD(site->hold_ns, hold);
+			LOCKSTAT_MAX(site->hold_max_ns, hold);
+			LOCKSTAT_ADD(site->hold_hist[lockstat_bucket(hold)], 1);
+		}
+		memmove(&lockstat_held[i], &lockstat_held[i + 1], (rpt_lockstats_held - i - 1) * sizeof(lockstat_held[0]));
+		rpt_lockstats_held--;
+	}
+	ast_mutex_unlock(lock);
+}
+
+void rpt_lockstats_enable(int enabled)
+{
+	__atomic_store_n(&rpt_lockstats_enabled, enabled ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+void rpt_lockstats_reset(void)
+{
+	ast_mutex_lock(&lockstat_lock);
+	/* Each thread clears its own statistics the next time it records something */
+	__atomic_store_n(&lockstat_gen, lockstat_gen + 1, __ATOMIC_RELAXED);
+	if (lockstat_retired) {
+		memset(lockstat_retired, 0, sizeof(*lockstat_retired));
+	}
+	ast_mutex_unlock(&lockstat_lock);
+}
+
+static int lockstat_cmp(const void *a, const void *b)
+{
+	const struct rpt_lockstat *sa = a, *sb = b;
+
+	if (sa->wait_ns != sb->wait_ns) {
+		return sa->wait_ns < sb->wait_ns ? 1 : -1;
+	}
+	return sa->hold_ns < sb->hold_ns ? 1 : (sa->hold_ns > sb->hold_ns ? -1 : 0);
+}
+
+int rpt_lockstats_get(struct rpt_lockstat **stats)
+{
+	struct lockstat_thread *all, *t;
+	int i, n = 0;
+
+	/* Combine everything in a table of the same shape */
+	all = ast_calloc(1, sizeof(*all));
+	if (!all) {
+		return -1;
+	}
+	ast_mutex_lock(&lockstat_lock);
+	if (lockstat_retired) {
+		lockstat_merge(all, lockstat_retired);
+	}
+	AST_LIST_TRAVERSE(&lockstat_threads, t, list) {
+		if (t->gen == lockstat_gen) {
+			lockstat_merge(all, t);
+		}
+	}
+	ast_mutex_unlock(&lockstat_lock);
+
+	*stats = ast_calloc(LOCKSTAT_SITES, sizeof(**stats));
+	if (!*stats) {
+		ast_free(all);
+		return -1;
+	}
+	for (i = 0; i < LOCKSTAT_SITES; i++) {
+		if (all->sites[i].line) {
+			(*stats)[n++] = all->sites[i];
+		}
+	}
+	ast_free(all);
+	qsort(*stats, n, sizeof(**stats), lockstat_cmp);
+	return n;
+}
+
+int rpt_lockstats_init(void)
+{
+	lockstat_retired = ast_calloc(1, sizeof(*lockstat_retired));
+	if (!lockstat_retired) {
+		return -1;
+	}
+	if (pthread_key_create(&lockstat_key, lockstat_thread_exit)) {
+		ast_free(lockstat_retired);
+		lockstat_retired = NULL;
+		return -1;
+	}
+	lockstat_key_created = 1;
+	return 0;
+}
+
+void rpt_lockstats_cleanup(void)
+{
+	struct lockstat_thread *t;
+
+	rpt_lockstats_enable(0);
+	if (!lockstat_key_created) {
+		return;
+	}
+	/* No more thread exit callbacks into this module */
+	pthread_key_delete(lockstat_key);
+	lockstat_key_created = 0;
+
+	ast_mutex_lock(&lockstat_lock);
+	while ((t = AST_LIST_REMOVE_HEAD(&lockstat_threads, list))) {
+		ast_free(t);
+	}
+	ast_free(lockstat_retired);
+	lockstat_retired = NULL;
+	ast_mutex_unlock(&lockstat_lock);
+}
+
 #endif /* APP_RPT_LOCK_DEBUG */
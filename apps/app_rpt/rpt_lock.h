@@ -3,9 +3,92 @@
 #define rpt_mutex_lock(x) _rpt_mutex_lock(x, myrpt, __LINE__)
 #define rpt_mutex_unlock(x) _rpt_mutex_unlock(x, myrpt, __LINE__)
 
+/* The lock profiler isn't available with lock debugging */
+#define rpt_lockstats_init() 0
+#define rpt_lockstats_cleanup()
+
 #else /* APP_RPT_LOCK_DEBUG */
 
-#define rpt_mutex_lock(x) ast_mutex_lock(x)
-#define rpt_mutex_unlock(x) ast_mutex_unlock(x)
+/*
+ * Lock contention profiler
+ *
+ * When enabled at runtime ("rpt lockstats on"), every rpt_mutex_lock records
+ * how long it waited for the lock and how long the lock was then held,
+ * by call site and node.  Counters are kept per thread, so recording
+ * doesn't add contention of its own.  When disabled, the only cost is
+ * checking a flag on lock and a thread local counter on unlock.
+ */
+
+/*! \brief Number of histogram buckets, powers of two microseconds */
+#define RPT_LOCKSTAT_BUCKETS 16
+
+/*! \brief Lock statistics for a call site and node */
+struct rpt_lockstat {
+	const char *file;
+	int line;
+	int node; /*!< \brief Index in rpt_vars, or -1 if not a node lock */
+	unsigned long long count;
+	unsigned long long contended; /*!< \brief Times the lock was not immediately available */
+	unsigned long long wait_ns;
+	unsigned long long wait_max_ns;
+	unsigned long long hold_ns;
+	unsigned long long hold_max_ns;
+	unsigned long long wait_hist[RPT_LOCKSTAT_BUCKETS]; /*!< \brief Contended waits, bucket n is < 2^n us */
+	unsigned long long hold_hist[RPT_LOCKSTAT_BUCKETS]; /*!< \brief Bucket n is < 2^n us */
+};
+
+extern int rpt_lockstats_enabled;
+extern __thread int rpt_lockstats_held;
+
+void rpt_lockstats_lock(ast_mutex_t *lock, const char *file, int line);
+void rpt_lockstats_unlock(ast_mutex_t *lock);
+
+#define rpt_mutex_lock(x) \
+	do { \
+		if (__builtin_expect(__atomic_load_n(&rpt_lockstats_enabled, __ATOMIC_RELAXED), 0)) { \
+			rpt_lockstats_lock(x, __FILE__, __LINE__); \
+		} else { \
+			ast_mutex_lock(x); \
+		} \
+	} while (0)
+
+#define rpt_mutex_unlock(x) \
+	do { \
+		if (__builtin_expect(rpt_lockstats_held, 0)) { \
+			rpt_lockstats_unlock(x); \
+		} else { \
+			ast_mutex_unlock(x); \
+		} \
+	} while (0)
+
+/*!
+ * \brief Turn the lock profiler on or off
+ * \param enabled
+ */
+void rpt_lockstats_enable(int enabled);
+
+/*!
+ * \brief Clear the lock statistics
+ */
+void rpt_lockstats_reset(void);
+
+/*!
+ * \brief Get the lock statistics, combined across threads
+ * \param[out] stats Array the caller must free with ast_free(), sorted by total wait time
+ * \return Number of entries, or -1 on failure
+ */
+int rpt_lockstats_get(struct rpt_lockstat **stats);
+
+/*!
+ * \brief Set up the lock profiler
+ * \retval 0 on success
+ * \retval -1 on failure
+ */
+int rpt_lockstats_init(void);
+
+/*!
+ * \brief Free the lock profiler
+ */
+void rpt_lockstats_cleanup(void);
 
 #endif /* APP_RPT_LOCK_DEBUG */
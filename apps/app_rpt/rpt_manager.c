@@ -14,7 +14,8 @@
 #include "rpt_config.h"
 #include "rpt_manager.h"
 #include "rpt_utils.h"
-#include "rpt_link.h" /* use __mklinklist */
+#include "rpt_link.h" /* use rpt_linklist_append */
+#include "rpt_perf.h"
 
 extern struct rpt rpt_vars[MAXRPTS];
 
@@ -227,7 +228,7 @@ static int rpt_manager_do_xstat(struct mansession *ses, const struct message *m)
 
 			/* Get connected node info */
 			/* Traverse the list of connected nodes */
-			n = __mklinklist(myrpt, NULL, &lbuf, USE_FORMAT_RPT_LINK) + 1;
+			n = rpt_linklist_append(myrpt, NULL, &lbuf, USE_FORMAT_RPT_LINK) + 1;
 
 			links_copy = ao2_container_clone(myrpt->links, OBJ_NOLOCK);
 			rpt_mutex_unlock(&myrpt->lock);
@@ -873,12 +874,128 @@ static int manager_rpt_status(struct mansession *s, const struct message *m)
 	return 0;
 }
 
+static void perf_hist_append(struct mansession *s, const char *prefix, const struct rpt_perf_hist *hist)
+{
+	int i;
+
+	astman_append(s, "%sCount: %llu\r\n", prefix, hist->count);
+	astman_append(s, "%sAvgUs: %llu\r\n", prefix, hist->count ? hist->sum_us / hist->count : 0);
+	astman_append(s, "%sMaxUs: %u\r\n", prefix, hist->max_us);
+	astman_append(s, "%sJitterUs: %u\r\n", prefix, hist->jitter_us);
+	astman_append(s, "%sHist: ", prefix);
+	for (i = 0; i < RPT_PERF_BUCKETS; i++) {
+		astman_append(s, "%s%u", i ? "," : "", hist->buckets[i]);
+	}
+	astman_append(s, "\r\n");
+}
+
+/*!\brief Node main loop timing, optionally clearing it
+   \addtogroup Group_AMI
+ */
+static int manager_rpt_perf_stats(struct mansession *s, const struct message *m)
+{
+	const char *node = astman_get_header(m, "Node");
+	struct rpt_perf perf;
+	struct rpt *myrpt = NULL;
+	int i, nrpts = rpt_num_rpts();
+
+	for (i = 0; i < nrpts; i++) {
+		if (!ast_strlen_zero(node) && !strcmp(node, rpt_vars[i].name)) {
+			myrpt = &rpt_vars[i];
+			break;
+		}
+	}
+	if (!myrpt || !myrpt->perf) {
+		astman_send_error(s, m, "RptPerfStats unknown or missing node");
+		return 0;
+	}
+	if (ast_true(astman_get_header(m, "Reset"))) {
+		rpt_perf_reset(myrpt->perf);
+		rpt_manager_success(s, m);
+		astman_append(s, "\r\n");
+		return 0;
+	}
+
+	memcpy(&perf, myrpt->perf, sizeof(perf));
+	rpt_manager_success(s, m);
+	astman_append(s, "Node: %s\r\n", node);
+	astman_append(s, "HistBoundsUs: ");
+	for (i = 0; i < RPT_PERF_BUCKETS - 1; i++) {
+		astman_append(s, "%s%u", i ? "," : "", rpt_perf_bucket_us(i));
+	}
+	astman_append(s, "\r\n\r\n");
+	for (i = 0; i < RPT_PERF_METRICS; i++) {
+		astman_append(s, "Metric: %s\r\n", rpt_perf_name(i));
+		perf_hist_append(s, "", &perf.total[i]);
+		perf_hist_append(s, "Minute", &perf.last[i]);
+		astman_append(s, "\r\n");
+	}
+	return 0;
+}
+
+#ifndef APP_RPT_LOCK_DEBUG
+static void lockstat_hist_append(struct mansession *s, const char *name, const unsigned long long *hist)
+{
+	int i;
+
+	astman_append(s, "%s: ", name);
+	for (i = 0; i < RPT_LOCKSTAT_BUCKETS; i++) {
+		astman_append(s, "%s%llu", i ? "," : "", hist[i]);
+	}
+	astman_append(s, "\r\n");
+}
+
+/*!\brief Lock contention statistics, by call site and node
+   \addtogroup Group_AMI
+ */
+static int manager_rpt_lock_stats(struct mansession *s, const struct message *m)
+{
+	const char *node = astman_get_header(m, "Node");
+	struct rpt_lockstat *stats;
+	int i, n;
+
+	n = rpt_lockstats_get(&stats);
+	if (n < 0) {
+		astman_send_error(s, m, "Could not get lock statistics");
+		return 0;
+	}
+
+	rpt_manager_success(s, m);
+	astman_append(s, "Enabled: %s\r\n", rpt_lockstats_enabled ? "Yes" : "No");
+	astman_append(s, "\r\n");
+	for (i = 0; i < n; i++) {
+		const char *name = stats[i].node < 0 ? "" : rpt_vars[stats[i].node].name;
+
+		if (!ast_strlen_zero(node) && strcmp(node, name)) {
+			continue;
+		}
+		astman_append(s, "Site: %s:%d\r\n", stats[i].file, stats[i].line);
+		astman_append(s, "Node: %s\r\n", name);
+		astman_append(s, "Count: %llu\r\n", stats[i].count);
+		astman_append(s, "Contended: %llu\r\n", stats[i].contended);
+		astman_append(s, "WaitNs: %llu\r\n", stats[i].wait_ns);
+		astman_append(s, "WaitMaxNs: %llu\r\n", stats[i].wait_max_ns);
+		astman_append(s, "HoldNs: %llu\r\n", stats[i].hold_ns);
+		astman_append(s, "HoldMaxNs: %llu\r\n", stats[i].hold_max_ns);
+		lockstat_hist_append(s, "WaitHist", stats[i].wait_hist);
+		lockstat_hist_append(s, "HoldHist", stats[i].hold_hist);
+		astman_append(s, "\r\n");
+	}
+	ast_free(stats);
+	return 0;
+}
+#endif
+
 int rpt_manager_load(void)
 {
 	int res = 0;
 
 	res |= ast_manager_register("RptLocalNodes", 0, manager_rpt_local_nodes, "List local node numbers");
 	res |= ast_manager_register("RptStatus", 0, manager_rpt_status, "Return Rpt Status for CGI");
+	res |= ast_manager_register("RptPerfStats", 0, manager_rpt_perf_stats, "Return or reset node main loop timing");
+#ifndef APP_RPT_LOCK_DEBUG
+	res |= ast_manager_register("RptLockStats", 0, manager_rpt_lock_stats, "Return node lock contention statistics");
+#endif
 
 	return res;
 }
@@ -889,6 +1006,10 @@ int rpt_manager_unload(void)
 
 	res |= ast_manager_unregister("RptLocalNodes");
 	res |= ast_manager_unregister("RptStatus");
+	res |= ast_manager_unregister("RptPerfStats");
+#ifndef APP_RPT_LOCK_DEBUG
+	res |= ast_manager_unregister("RptLockStats");
+#endif
 
 	return res;
 }
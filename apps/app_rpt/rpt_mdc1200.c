@@ -8,11 +8,16 @@
 
 #include <fcntl.h>
 #include <fnmatch.h>
+#include <limits.h>
+#include <math.h>
 
 #include "asterisk/channel.h"
 #include "asterisk/app.h"
 #include "asterisk/module.h"
 #include "asterisk/format_cache.h" /* use ast_format_slin */
+#ifdef TEST_FRAMEWORK
+#include "asterisk/test.h"
+#endif
 
 #include "app_rpt.h"
 
@@ -133,6 +138,7 @@ void mdc1200_send(struct rpt *myrpt, char *data)
 	char str[200];
 	struct rpt_link *l;
 	struct ao2_iterator l_it;
+	struct rpt_text_payload *payload;
 
 	if (!myrpt->keyed) {
 		return;
@@ -141,11 +147,16 @@ void mdc1200_send(struct rpt *myrpt, char *data)
 	snprintf(str, sizeof(str), "I %s %s", myrpt->name, data);
 	wf.data.ptr = str;
 	wf.datalen = strlen(str) + 1; /* Isuani, 20141001 */
+	payload = rpt_text_payload_alloc(&wf);
+	if (!payload) {
+		return;
+	}
 
 	/* otherwise, send it to all of em */
 	rpt_mutex_lock(&myrpt->lock);
 	if (!myrpt->links) {
 		rpt_mutex_unlock(&myrpt->lock);
+		ao2_ref(payload, -1);
 		return;
 	}
 
@@ -155,12 +166,13 @@ void mdc1200_send(struct rpt *myrpt, char *data)
 			continue;
 		}
 		if (l->chan) {
-			rpt_qwrite(l, &wf);
+			rpt_qwrite_payload(l, payload);
 		}
 	}
 
 	rpt_mutex_unlock(&myrpt->lock);
 	ao2_iterator_destroy(&l_it);
+	ao2_ref(payload, -1);
 }
 
 static const char *my_variable_match(const struct ast_config *config, const char *category, const char *variable)
@@ -445,6 +457,442 @@ static int mdcgen_exec(struct ast_channel *chan, const char *data)
 static char *mdc_app = "MDC1200Gen";
 #endif
 
+#if defined(TEST_FRAMEWORK) && defined(_MDC_DECODE_H_) && defined(_MDC_ENCODE_H_)
+/*! \brief The per sample decoder front end the pre-gated one replaced, for comparison */
+struct legacy_mdc {
+	double incr;
+	double th[MDC_ND];
+	int level;
+	int lastv;
+	int zc[MDC_ND];
+	int xorb[MDC_ND];
+	unsigned int synclow[MDC_ND];
+	unsigned int synchigh[MDC_ND];
+	int shstate[MDC_ND];
+	int shcount[MDC_ND];
+	int bits[MDC_ND][112];
+};
+
+static int legacy_onebits(unsigned int n)
+{
+	int i = 0;
+
+	while (n) {
+		++i;
+		n &= (n - 1);
+	}
+	return i;
+}
+
+/* Packets aren't checked, just started and received, which doesn't change the timing */
+static void legacy_shiftin(struct legacy_mdc *d, int x)
+{
+	int bit = d->xorb[x];
+	int gcount;
+
+	if (!d->shstate[x]) {
+		d->synchigh[x] = (d->synchigh[x] << 1) | (d->synclow[x] >> 31);
+		d->synclow[x] = (d->synclow[x] << 1) | (bit ? 1 : 0);
+		gcount = legacy_onebits(0x000000ff & (0x00000007 ^ d->synchigh[x]));
+		gcount += legacy_onebits(0x092a446f ^ d->synclow[x]);
+		if (gcount <= MDC_GDTHRESH || gcount >= (40 - MDC_GDTHRESH)) {
+			d->shstate[x] = 1;
+			d->shcount[x] = 0;
+			memset(d->bits[x], 0, sizeof(d->bits[x]));
+		}
+		return;
+	}
+	d->bits[x][d->shcount[x]++] = bit;
+	if (d->shcount[x] > 111) {
+		d->shstate[x] = 0;
+	}
+}
+
+static void __attribute__((noinline)) legacy_mdc_process(struct legacy_mdc *d, const int16_t *samples, int n)
+{
+	unsigned char ubuf[MDC_BLOCK * 16];
+	int i, j, k, d8;
+
+	for (i = 0; i < n; i++) {
+		ubuf[i] = (samples[i] >> 8) + 128;
+	}
+	for (i = 0; i < n; i++) {
+		d8 = ubuf[i] - d->lastv;
+		d->lastv = ubuf[i];
+		if (d->level == 0) {
+			if (d8 > 3) {
+				for (k = 0; k < MDC_ND; k++) {
+					d->zc[k]++;
+				}
+				d->level = 1;
+			}
+		} else if (d8 < -3) {
+			for (k = 0; k < MDC_ND; k++) {
+				d->zc[k]++;
+			}
+			d->level = 0;
+		}
+		for (j = 0; j < MDC_ND; j++) {
+			d->th[j] += d->incr;
+			if (d->th[j] >= 2.0 * M_PI) {
+				switch (d->zc[j]) {
+				case 3:
+					d->xorb[j] = !d->xorb[j];
+					/* Fall through */
+				case 2:
+				case 4:
+					legacy_shiftin(d, j);
+					break;
+				default:
+					break;
+				}
+				d->th[j] -= 2.0 * M_PI;
+				d->zc[j] = 0;
+			}
+		}
+	}
+}
+
+static void legacy_mdc_init(struct legacy_mdc *d)
+{
+	int i;
+
+	memset(d, 0, sizeof(*d));
+	d->incr = (1200.0 * 2.0 * M_PI) / 8000.0;
+	for (i = 0; i < MDC_ND; i++) {
+		d->th[i] = i * (2.0 * M_PI / MDC_ND);
+	}
+}
+
+enum mdc_background {
+	MDC_BG_SILENCE,
+	MDC_BG_SPEECH,
+	MDC_BG_TONE,
+};
+
+/*! \brief A recording in the decode corpus */
+struct mdc_corpus_case {
+	const char *name;
+	int packet;					/*!< \brief 0 for none, 1 for single, 2 for double */
+	unsigned char op;
+	unsigned char arg;
+	unsigned short unit;
+	unsigned char extra[4];
+	int level;					/*!< \brief Burst peak, percent of full scale */
+	int noise;					/*!< \brief Noise peak, percent of full scale */
+	enum mdc_background background;
+	int lead;					/*!< \brief ms of background before the burst */
+};
+
+/*! \note The decoder does no error correction, so a packet can fail to decode
+ * with some bit timings even without noise.  These are recordings the per
+ * sample decoder also decoded. */
+static const struct mdc_corpus_case mdc_corpus[] = {
+	{ "PTT ID", 1, 0x01, 0x80, 0x1234, { 0 }, 100, 0, MDC_BG_SILENCE, 100 },
+	{ "Emergency", 1, 0x00, 0x80, 0x0001, { 0 }, 50, 0, MDC_BG_SILENCE, 37 },
+	{ "Status", 1, 0x46, 0x03, 0xbeef, { 0 }, 25, 2, MDC_BG_SILENCE, 215 },
+	{ "Quiet", 1, 0x01, 0x00, 0x5a5a, { 0 }, 10, 0, MDC_BG_SILENCE, 6 },
+	{ "Noisy", 1, 0x01, 0x80, 0x0f0f, { 0 }, 70, 10, MDC_BG_SILENCE, 161 },
+	{ "After speech", 1, 0x01, 0x80, 0x2468, { 0 }, 60, 1, MDC_BG_SPEECH, 734 },
+	{ "Selcall", 2, 0x35, 0x89, 0x2468, { 0x82, 0x05, 0x12, 0x34 }, 70, 3, MDC_BG_SILENCE, 90 },
+	{ "Alert", 2, 0x35, 0x89, 0x0100, { 0x81, 0x0d, 0x00, 0x42 }, 40, 0, MDC_BG_SPEECH, 401 },
+	{ "Silence", 0, 0, 0, 0, { 0 }, 0, 0, MDC_BG_SILENCE, 1000 },
+	{ "Hiss", 0, 0, 0, 0, { 0 }, 0, 1, MDC_BG_SILENCE, 1000 },
+	{ "Noise", 0, 0, 0, 0, { 0 }, 0, 20, MDC_BG_SILENCE, 1000 },
+	{ "Speech", 0, 0, 0, 0, { 0 }, 0, 1, MDC_BG_SPEECH, 3000 },
+	{ "1500 Hz tone", 0, 0, 0, 0, { 0 }, 0, 0, MDC_BG_TONE, 1000 },
+};
+
+/*! \brief Background audio, a crude vowel or a steady tone */
+static int16_t mdc_background(enum mdc_background background, int i)
+{
+	float t = (float) i / 8000, v = 0;
+	int k;
+
+	switch (background) {
+	case MDC_BG_SILENCE:
+		break;
+	case MDC_BG_SPEECH:
+		/* Harmonics of a wandering pitch, loudest around 500 Hz, in syllables */
+		for (k = 1; k <= 20; k++) {
+			float f = k * (130.0f + 20.0f * sinf(2.0f * M_PI * 0.7f * t));
+
+			v += sinf(2.0f * M_PI * f * t) / (1.0f + fabsf(f - 500.0f) / 150.0f);
+		}
+		v *= 3000.0f * (0.6f + 0.4f * sinf(2.0f * M_PI * 4.0f * t));
+		break;
+	case MDC_BG_TONE:
+		v = 8000.0f * sinf(2.0f * M_PI * 1500.0f * t);
+		break;
+	}
+	return (int16_t) MAX(-32768.0f, MIN(32767.0f, v));
+}
+
+/*!
+ * \brief Render a corpus recording, the background, any burst, then 300 ms of background
+ * \return Samples, which the caller must free
+ */
+static int16_t *mdc_render(const struct mdc_corpus_case *c, int *len)
+{
+	mdc_encoder_t *enc = NULL;
+	unsigned char burst[8000];
+	int16_t *buf;
+	int n = 0, lead = c->lead * 8, i;
+	unsigned int seed = 12345;
+
+	if (c->packet) {
+		enc = mdc_encoder_new(8000);
+		if (!enc) {
+			return NULL;
+		}
+		if (c->packet == 1) {
+			mdc_encoder_set_packet(enc, c->op, c->arg, c->unit);
+		} else {
+			mdc_encoder_set_double_packet(enc, c->op, c->arg, c->unit, c->extra[0], c->extra[1], c->extra[2], c->extra[3]);
+		}
+		n = mdc_encoder_get_samples(enc, burst, sizeof(burst));
+		ast_free(enc);
+	}
+
+	*len = lead + n + 2400;
+	buf = ast_malloc(*len * sizeof(*buf));
+	if (!buf) {
+		return NULL;
+	}
+	for (i = 0; i < *len; i++) {
+		int v = mdc_background(c->background, i);
+
+		if (i >= lead && i < lead + n) {
+			v = (burst[i - lead] - 127) * 256 * c->level / 100;
+		}
+		seed = seed * 1103515245 + 12345;
+		v += ((int) (seed >> 16) % 32768 - 16384) * 2 * c->noise / 100;
+		buf[i] = MAX(-32768, MIN(32767, v));
+	}
+	return buf;
+}
+
+AST_TEST_DEFINE(mdc_decode_corpus)
+{
+	int i, res = AST_TEST_PASS;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "mdc_decode_corpus";
+		info->category = "/apps/app_rpt/mdc1200/";
+		info->summary = "MDC-1200 decoder corpus";
+		info->description = "Decode single and double packets at different levels, with noise and speech, "
+							"and check that audio without MDC-1200 decodes nothing.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	for (i = 0; i < ARRAY_LEN(mdc_corpus); i++) {
+		const struct mdc_corpus_case *c = &mdc_corpus[i];
+		unsigned char op = 0, arg = 0, ex[4] = { 0 };
+		unsigned short unit = 0;
+		mdc_decoder_t *dec;
+		int16_t *buf;
+		int len, pos, n, singles = 0, doubles = 0;
+
+		buf = mdc_render(c, &len);
+		dec = mdc_decoder_new(8000);
+		if (!buf || !dec) {
+			ast_free(buf);
+			ast_free(dec);
+			return AST_TEST_FAIL;
+		}
+		/* In frames, the way rpt() feeds it */
+		for (pos = 0; pos < len; pos += n) {
+			n = MIN(len - pos, 160);
+			switch (mdc_decoder_process_samples(dec, buf + pos, n)) {
+			case 1:
+				mdc_decoder_get_packet(dec, &op, &arg, &unit);
+				singles++;
+				break;
+			case 2:
+				mdc_decoder_get_double_packet(dec, &op, &arg, &unit, &ex[0], &ex[1], &ex[2], &ex[3]);
+				doubles++;
+				break;
+			}
+		}
+		ast_test_status_update(test, "%-14s %d single, %d double, %3d%% of the audio skipped by the pre-gate\n", c->name, singles, doubles,
+			(int) (100LL * dec->gated / len));
+
+		if (singles != (c->packet == 1) || doubles != (c->packet == 2)) {
+			ast_test_status_update(test, "%s: expected a %s packet\n", c->name, c->packet == 2 ? "double" : c->packet ? "single" : "no");
+			res = AST_TEST_FAIL;
+		} else if (c->packet && (op != c->op || arg != c->arg || unit != c->unit)) {
+			ast_test_status_update(test, "%s: got op %02x arg %02x unit %04x\n", c->name, op, arg, unit);
+			res = AST_TEST_FAIL;
+		} else if (c->packet == 2 && memcmp(ex, c->extra, sizeof(ex))) {
+			ast_test_status_update(test, "%s: got extra %02x %02x %02x %02x\n", c->name, ex[0], ex[1], ex[2], ex[3]);
+			res = AST_TEST_FAIL;
+		}
+		/* Audio that's nowhere near FSK must not wake the decoders */
+		if (!c->packet && c->background == MDC_BG_SILENCE && c->noise < 2 && dec->gated != len) {
+			ast_test_status_update(test, "%s: pre-gate opened\n", c->name);
+			res = AST_TEST_FAIL;
+		}
+		ast_free(buf);
+		ast_free(dec);
+	}
+	return res;
+}
+
+/*! \brief Samples cut from the start of the burst in the offset test, all but the last two bits of the preamble */
+#define MDC_TEST_CUT 360
+
+AST_TEST_DEFINE(mdc_decode_offset)
+{
+	unsigned char burst[8000], op = 0, arg = 0;
+	unsigned short unit = 0;
+	mdc_encoder_t *enc;
+	mdc_decoder_t *dec;
+	int16_t *buf;
+	int offset, len, lead = 10 * MDC_BLOCK, n, pos, i, missed = 0;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "mdc_decode_offset";
+		info->category = "/apps/app_rpt/mdc1200/";
+		info->summary = "MDC-1200 bursts starting part way through a block";
+		info->description = "Decode a burst with a short preamble starting at every sample of a block, "
+							"so the pre-gate has to open on a partial block.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	enc = mdc_encoder_new(8000);
+	if (!enc) {
+		return AST_TEST_FAIL;
+	}
+	mdc_encoder_set_packet(enc, 0x01, 0x80, 0x1234);
+	n = mdc_encoder_get_samples(enc, burst, sizeof(burst)) - MDC_TEST_CUT;
+	ast_free(enc);
+	ast_test_validate(test, n > 0);
+
+	len = lead + MDC_BLOCK + n + 2400;
+	buf = ast_malloc(len * sizeof(*buf));
+	if (!buf) {
+		return AST_TEST_FAIL;
+	}
+	for (offset = 0; offset < MDC_BLOCK; offset++) {
+		int got = 0;
+
+		dec = mdc_decoder_new(8000);
+		if (!dec) {
+			ast_free(buf);
+			return AST_TEST_FAIL;
+		}
+		memset(buf, 0, len * sizeof(*buf));
+		for (i = 0; i < n; i++) {
+			buf[lead + offset + i] = (burst[MDC_TEST_CUT + i] - 127) * 256;
+		}
+		for (pos = 0; pos < len; pos += MDC_BLOCK) {
+			if (mdc_decoder_process_samples(dec, buf + pos, MIN(len - pos, MDC_BLOCK)) == 1) {
+				mdc_decoder_get_packet(dec, &op, &arg, &unit);
+				got += op == 0x01 && arg == 0x80 && unit == 0x1234;
+			}
+		}
+		if (got != 1) {
+			ast_test_status_update(test, "Burst starting %d samples into a block: %d packets\n", offset, got);
+			missed++;
+		}
+		ast_free(dec);
+	}
+	ast_free(buf);
+	return missed ? AST_TEST_FAIL : AST_TEST_PASS;
+}
+
+AST_TEST_DEFINE(mdc_decode_benchmark)
+{
+	static const int cases[] = { 8, 11, 5 }; /* Silence, speech, a packet */
+	const int frames = 20000;
+	struct legacy_mdc legacy;
+	mdc_decoder_t *dec;
+	int16_t *buf;
+	struct timeval start;
+	int64_t legacy_us, open_us, gated_us;
+	int c, i, len;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "mdc_decode_benchmark";
+		info->category = "/apps/app_rpt/mdc1200/";
+		info->summary = "MDC-1200 decoder speed";
+		info->description = "Time 160 sample frames of silence, speech and MDC-1200 through the decoder, "
+							"with and without the pre-gate, and through the per sample decoder it replaced.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	ast_test_status_update(test, "%d frames of 160 samples\n", frames);
+	for (c = 0; c < ARRAY_LEN(cases); c++) {
+		buf = mdc_render(&mdc_corpus[cases[c]], &len);
+		dec = mdc_decoder_new(8000);
+		if (!buf || !dec) {
+			ast_free(buf);
+			ast_free(dec);
+			return AST_TEST_FAIL;
+		}
+		len -= len % 160;
+
+		legacy_mdc_init(&legacy);
+		start = ast_tvnow();
+		for (i = 0; i < frames; i++) {
+			legacy_mdc_process(&legacy, buf + (i * 160) % len, 160);
+		}
+		legacy_us = ast_tvdiff_us(ast_tvnow(), start);
+
+		start = ast_tvnow();
+		for (i = 0; i < frames; i++) {
+			dec->hang = INT_MAX; /* Hold the pre-gate open */
+			mdc_decoder_process_samples(dec, buf + (i * 160) % len, 160);
+			dec->good = 0;
+		}
+		open_us = ast_tvdiff_us(ast_tvnow(), start);
+
+		dec->hang = 0;
+		start = ast_tvnow();
+		for (i = 0; i < frames; i++) {
+			mdc_decoder_process_samples(dec, buf + (i * 160) % len, 160);
+			dec->good = 0;
+		}
+		gated_us = ast_tvdiff_us(ast_tvnow(), start);
+
+		ast_test_status_update(test, "%-12s per sample %.3f us/frame, table driven %.3f us/frame, pre-gated %.3f us/frame\n",
+			mdc_corpus[cases[c]].name, (double) legacy_us / frames, (double) open_us / frames, (double) gated_us / frames);
+		ast_free(buf);
+		ast_free(dec);
+	}
+	return AST_TEST_PASS;
+}
+#endif
+
+#ifdef TEST_FRAMEWORK
+void rpt_mdc1200_tests_register(void)
+{
+#if defined(_MDC_DECODE_H_) && defined(_MDC_ENCODE_H_)
+	AST_TEST_REGISTER(mdc_decode_corpus);
+	AST_TEST_REGISTER(mdc_decode_offset);
+	AST_TEST_REGISTER(mdc_decode_benchmark);
+#endif
+}
+
+void rpt_mdc1200_tests_unregister(void)
+{
+#if defined(_MDC_DECODE_H_) && defined(_MDC_ENCODE_H_)
+	AST_TEST_UNREGISTER(mdc_decode_corpus);
+	AST_TEST_UNREGISTER(mdc_decode_offset);
+	AST_TEST_UNREGISTER(mdc_decode_benchmark);
+#endif
+}
+#endif
+
 int mdc1200_load(void)
 {
 #ifdef _MDC_ENCODE_H_
@@ -35,3 +35,8 @@ int mdc1200gen(struct ast_channel *chan, char *type, short UnitID, short destID,
 
 int mdc1200_load(void);
 int mdc1200_unload(void);
+
+#ifdef TEST_FRAMEWORK
+void rpt_mdc1200_tests_register(void);
+void rpt_mdc1200_tests_unregister(void);
+#endif
@@ -0,0 +1,337 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT node activity log writer
+ */
+
+#include "asterisk.h"
+
+#include <fcntl.h>
+#include <sys/uio.h>
+
+#include "asterisk/lock.h"
+#include "asterisk/utils.h"
+#include "asterisk/vector.h"
+
+#include "app_rpt.h"
+#include "rpt_nodelog.h"
+
+/*! \brief Number of records that can be waiting to be written, must be a power of 2 */
+#define RPT_NODELOG_RING 512
+
+/*! \brief Most records written with one writev() */
+#define RPT_NODELOG_IOV 64
+
+/*! \brief Close log files that haven't been written for this many seconds */
+#define RPT_NODELOG_IDLE 300
+
+/*! \brief A formatted log line waiting to be written */
+struct rpt_nodelog_rec {
+	time_t timestamp;
+	rpt_bool json:1;
+	int len;
+	char dir[MAXNODESTR]; /*!< \brief archivedir/node */
+	char line[MAXNODESTR * 2];
+};
+
+/*! \brief A node's open log file, only used by the writer thread */
+struct rpt_nodelog_file {
+	int fd;
+	rpt_bool json:1;
+	time_t dayend;	 /*!< \brief Start of the next day, when the file must be rotated */
+	time_t lastwrite;
+	char fname[MAXNODESTR + 16];
+	char dir[MAXNODESTR];
+};
+
+AST_MUTEX_DEFINE_STATIC(nodelog_lock);
+static ast_cond_t nodelog_cond;
+static pthread_t nodelog_thread = AST_PTHREADT_NULL;
+static struct rpt_nodelog_rec *nodelog_ring;
+static unsigned int nodelog_head; /*!< \brief Next record to write */
+static unsigned int nodelog_tail; /*!< \brief Next free record */
+static unsigned int nodelog_drops;
+static rpt_bool nodelog_stop;
+
+static AST_VECTOR(, struct rpt_nodelog_file *) nodelog_files;
+
+/*!
+ * \internal
+ * \brief Copy a string into a JSON string value, escaping as needed
+ * \return Length of the escaped string
+ */
+static size_t nodelog_json_escape(char *buf, size_t buflen, const char *s)
+{
+	size_t n = 0;
+
+	for (; *s && n + 7 < buflen; s++) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\') {
+			buf[n++] = '\\';
+			buf[n++] = c;
+		} else if (c < 0x20) {
+			n += snprintf(buf + n, buflen - n, "\\u%04x", c);
+		} else {
+			buf[n++] = c;
+		}
+	}
+	buf[n] = '\0';
+	return n;
+}
+
+static int nodelog_format_json(char *buf, size_t buflen, const char *node, time_t timestamp, const char *datestr,
+	const char *str)
+{
+	char enode[MAXNODESTR * 2], edate[200], event[200], data[MAXNODESTR * 2];
+	const char *comma = strchr(str, ',');
+
+	nodelog_json_escape(enode, sizeof(enode), node);
+	nodelog_json_escape(edate, sizeof(edate), datestr);
+	if (comma) {
+		char *tmp = ast_strdupa(str);
+
+		tmp[comma - str] = '\0';
+		nodelog_json_escape(event, sizeof(event), tmp);
+		nodelog_json_escape(data, sizeof(data), comma + 1);
+		return snprintf(buf, buflen, "{\"node\":\"%s\",\"timestamp\":%ld,\"time\":\"%s\",\"event\":\"%s\",\"data\":\"%s\"}\n", enode,
+			(long) timestamp, edate, event, data);
+	}
+	nodelog_json_escape(event, sizeof(event), str);
+	return snprintf(buf, buflen, "{\"node\":\"%s\",\"timestamp\":%ld,\"time\":\"%s\",\"event\":\"%s\"}\n", enode, (long) timestamp,
+		edate, event);
+}
+
+void rpt_nodelog_queue(struct rpt *myrpt, time_t timestamp, const char *datestr, const char *str)
+{
+	struct rpt_nodelog_rec *rec;
+	int len;
+
+	ast_mutex_lock(&nodelog_lock);
+	if (!nodelog_ring || nodelog_tail - nodelog_head >= RPT_NODELOG_RING) {
+		nodelog_drops++;
+		ast_mutex_unlock(&nodelog_lock);
+		return;
+	}
+	rec = &nodelog_ring[nodelog_tail % RPT_NODELOG_RING];
+	rec->timestamp = timestamp;
+	rec->json = myrpt->p.archivejson;
+	snprintf(rec->dir, sizeof(rec->dir), "%s/%s", myrpt->p.archivedir, myrpt->name);
+	if (rec->json) {
+		len = nodelog_format_json(rec->line, sizeof(rec->line), myrpt->name, timestamp, datestr, str);
+	} else {
+		len = snprintf(rec->line, sizeof(rec->line), "%s,%s\n", datestr, str);
+	}
+	if (len >= sizeof(rec->line)) {
+		/* Truncated, still end with a newline */
+		len = sizeof(rec->line) - 1;
+		rec->line[len - 1] = '\n';
+	}
+	rec->len = len;
+	nodelog_tail++;
+	ast_cond_signal(&nodelog_cond);
+	ast_mutex_unlock(&nodelog_lock);
+}
+
+static struct rpt_nodelog_file *nodelog_file_find(const struct rpt_nodelog_rec *rec)
+{
+	struct rpt_nodelog_file *file;
+	int i;
+
+	for (i = 0; i < AST_VECTOR_SIZE(&nodelog_files); i++) {
+		file = AST_VECTOR_GET(&nodelog_files, i);
+		if (file->json == rec->json && !strcmp(file->dir, rec->dir)) {
+			return file;
+		}
+	}
+	file = ast_calloc(1, sizeof(*file));
+	if (!file) {
+		return NULL;
+	}
+	file->fd = -1;
+	file->json = rec->json;
+	ast_copy_string(file->dir, rec->dir, sizeof(file->dir));
+	if (AST_VECTOR_APPEND(&nodelog_files, file)) {
+		ast_free(file);
+		return NULL;
+	}
+	return file;
+}
+
+/*!
+ * \internal
+ * \brief Open the file for the day of a timestamp, closing the previous day's
+ * \retval 0 on success
+ * \retval -1 on failure
+ */
+static int nodelog_file_open(struct rpt_nodelog_file *file, time_t timestamp)
+{
+	struct tm tm;
+	char datestr[10];
+
+	if (file->fd != -1) {
+		close(file->fd);
+		file->fd = -1;
+	}
+	localtime_r(&timestamp, &tm);
+	strftime(datestr, sizeof(datestr), "%Y%m%d", &tm);
+	snprintf(file->fname, sizeof(file->fname), "%s/%s.%s", file->dir, datestr, file->json ? "jsonl" : "txt");
+	/* Midnight, local time */
+	tm.tm_mday++;
+	tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+	tm.tm_isdst = -1;
+	file->dayend = mktime(&tm);
+
+	file->fd = open(file->fname, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (file->fd == -1) {
+		ast_log(LOG_ERROR, "Cannot open node log file %s for write: %s\n", file->fname, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static void nodelog_file_write(struct rpt_nodelog_file *file, const struct iovec *iov, int iovcnt, size_t len)
+{
+	if (!file || !iovcnt) {
+		return;
+	}
+	if (writev(file->fd, iov, iovcnt) != (ssize_t) len) {
+		ast_log(LOG_ERROR, "Cannot write node log file %s: %s\n", file->fname, strerror(errno));
+	}
+	file->lastwrite = time(NULL);
+}
+
+/*! \brief Write out the records from start up to end */
+static void nodelog_write(unsigned int start, unsigned int end)
+{
+	struct iovec iov[RPT_NODELOG_IOV];
+	struct rpt_nodelog_file *file = NULL;
+	size_t len = 0;
+	int n = 0;
+	unsigned int i;
+
+	for (i = start; i != end; i++) {
+		struct rpt_nodelog_rec *rec = &nodelog_ring[i % RPT_NODELOG_RING];
+		struct rpt_nodelog_file *f = nodelog_file_find(rec);
+
+		if (!f) {
+			continue;
+		}
+		/* Batch consecutive records for the same file */
+		if (f != file || n == RPT_NODELOG_IOV || f->fd == -1 || rec->timestamp >= f->dayend) {
+			nodelog_file_write(file, iov, n, len);
+			file = NULL;
+			n = 0;
+			len = 0;
+			if ((f->fd == -1 || rec->timestamp >= f->dayend) && nodelog_file_open(f, rec->timestamp)) {
+				continue;
+			}
+			file = f;
+		}
+		iov[n].iov_base = rec->line;
+		iov[n].iov_len = rec->len;
+		len += rec->len;
+		n++;
+	}
+	nodelog_file_write(file, iov, n, len);
+}
+
+static void nodelog_close_files(int idle)
+{
+	time_t now = time(NULL);
+	int i;
+
+	for (i = 0; i < AST_VECTOR_SIZE(&nodelog_files); i++) {
+		struct rpt_nodelog_file *file = AST_VECTOR_GET(&nodelog_files, i);
+
+		if (file->fd != -1 && (!idle || now - file->lastwrite >= RPT_NODELOG_IDLE)) {
+			close(file->fd);
+			file->fd = -1;
+		}
+	}
+}
+
+static void *nodelog_writer(void *data)
+{
+	unsigned int start, end, drops, reported = 0;
+	rpt_bool stop;
+
+	for (;;) {
+		ast_mutex_lock(&nodelog_lock);
+		if (nodelog_head == nodelog_tail && !nodelog_stop) {
+			struct timespec ts = { .tv_sec = time(NULL) + RPT_NODELOG_IDLE / 5 };
+
+			ast_cond_timedwait(&nodelog_cond, &nodelog_lock, &ts);
+		}
+		start = nodelog_head;
+		end = nodelog_tail;
+		drops = nodelog_drops;
+		stop = nodelog_stop;
+		ast_mutex_unlock(&nodelog_lock);
+
+		if (drops != reported) {
+			ast_log(LOG_WARNING, "Node log queue full, dropped %u records\n", drops - reported);
+			reported = drops;
+		}
+		if (start == end) {
+			if (stop) {
+				break;
+			}
+			nodelog_close_files(1);
+			continue;
+		}
+		nodelog_write(start, end);
+
+		ast_mutex_lock(&nodelog_lock);
+		nodelog_head = end;
+		ast_mutex_unlock(&nodelog_lock);
+	}
+
+	nodelog_close_files(0);
+	return NULL;
+}
+
+int rpt_nodelog_init(void)
+{
+	nodelog_ring = ast_calloc(RPT_NODELOG_RING, sizeof(*nodelog_ring));
+	if (!nodelog_ring) {
+		return -1;
+	}
+	if (AST_VECTOR_INIT(&nodelog_files, 8)) {
+		ast_free(nodelog_ring);
+		nodelog_ring = NULL;
+		return -1;
+	}
+	nodelog_head = nodelog_tail = nodelog_drops = 0;
+	nodelog_stop = 0;
+	ast_cond_init(&nodelog_cond, NULL);
+	if (ast_pthread_create(&nodelog_thread, NULL, nodelog_writer, NULL)) {
+		ast_log(LOG_ERROR, "Could not start node log writer\n");
+		rpt_nodelog_cleanup();
+		return -1;
+	}
+	return 0;
+}
+
+void rpt_nodelog_cleanup(void)
+{
+	ast_mutex_lock(&nodelog_lock);
+	nodelog_stop = 1;
+	ast_cond_signal(&nodelog_cond);
+	ast_mutex_unlock(&nodelog_lock);
+
+	if (nodelog_thread != AST_PTHREADT_NULL) {
+		pthread_join(nodelog_thread, NULL);
+		nodelog_thread = AST_PTHREADT_NULL;
+	}
+
+	ast_mutex_lock(&nodelog_lock);
+	ast_free(nodelog_ring);
+	nodelog_ring = NULL;
+	ast_mutex_unlock(&nodelog_lock);
+
+	AST_VECTOR_CALLBACK_VOID(&nodelog_files, ast_free);
+	AST_VECTOR_FREE(&nodelog_files);
+	ast_cond_destroy(&nodelog_cond);
+}
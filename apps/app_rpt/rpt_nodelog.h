@@ -0,0 +1,33 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT node activity log writer
+ *
+ * Node log records are formatted into a preallocated ring and written out
+ * by a dedicated thread.  The writer keeps each node's log file open,
+ * switching to a new file when the date changes, and writes consecutive
+ * records for the same file with a single writev().  Records are dropped,
+ * and counted, if the ring fills up.
+ */
+
+/*!
+ * \brief Queue a line for a node's activity log
+ * \param myrpt Node, with archivedir set
+ * \param timestamp Time of the event, selects the day's log file
+ * \param datestr Time of the event, formatted with archivedatefmt
+ * \param str Log entry, "EVENT[,data]"
+ */
+void rpt_nodelog_queue(struct rpt *myrpt, time_t timestamp, const char *datestr, const char *str);
+
+/*!
+ * \brief Start the node log writer
+ * \retval 0 on success
+ * \retval -1 on failure
+ */
+int rpt_nodelog_init(void);
+
+/*!
+ * \brief Write out anything queued, stop the node log writer and close its files
+ */
+void rpt_nodelog_cleanup(void);
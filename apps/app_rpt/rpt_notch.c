@@ -0,0 +1,352 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT receive audio notch filters
+ */
+
+#include "asterisk.h"
+
+#include <math.h>
+
+#include "asterisk/utils.h"
+#ifdef TEST_FRAMEWORK
+#include "asterisk/test.h"
+#endif
+
+#include "app_rpt.h"
+#include "rpt_notch.h"
+
+/*! \brief Samples filtered at a time */
+#define NOTCH_BLOCK 160
+
+void rpt_notch_design(struct rpt_notch_stage *stage, float freq, float bw, int rate)
+{
+	double w0 = 2.0 * M_PI * freq / rate;
+	double r = 1.0 - M_PI * bw / rate; /* Pole radius, closer to 1 for a narrower notch */
+	double c = cos(w0);
+	double gain;
+
+	/* Zeros on the unit circle at the notch frequency, poles just inside them */
+	gain = (1.0 - 2.0 * r * c + r * r) / (2.0 - 2.0 * c); /* Unity gain at DC */
+	stage->b0 = gain;
+	stage->b1 = -2.0 * c * gain;
+	stage->b2 = gain;
+	stage->a1 = -2.0 * r * c;
+	stage->a2 = r * r;
+}
+
+void rpt_notch_clear(struct rpt_notch *notch)
+{
+	memset(notch, 0, sizeof(*notch));
+}
+
+int rpt_notch_add(struct rpt_notch *notch, float freq, float bw)
+{
+	if (notch->nstages == RPT_NOTCH_MAX || freq <= 0 || freq >= TONE_SAMPLE_RATE / 2 || bw <= 0 || bw >= TONE_SAMPLE_RATE / M_PI) {
+		return -1;
+	}
+	rpt_notch_design(&notch->stages[notch->nstages], freq, bw, TONE_SAMPLE_RATE);
+	notch->z1[notch->nstages] = 0;
+	notch->z2[notch->nstages] = 0;
+	notch->nstages++;
+	return 0;
+}
+
+/*! \brief Run one stage over a block, keeping its state in registers */
+static void notch_stage(const struct rpt_notch_stage *stage, float *restrict z1p, float *restrict z2p, float *restrict x, int len)
+{
+	const float b0 = stage->b0, b1 = stage->b1, b2 = stage->b2, a1 = stage->a1, a2 = stage->a2;
+	float z1 = *z1p, z2 = *z2p;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		float in = x[i];
+		float out = b0 * in + z1;
+
+		z1 = b1 * in - a1 * out + z2;
+		z2 = b2 * in - a2 * out;
+		x[i] = out;
+	}
+	*z1p = z1;
+	*z2p = z2;
+}
+
+void rpt_notch_process(struct rpt_notch *notch, int16_t *buf, int len)
+{
+	float x[NOTCH_BLOCK];
+	int i, j, n;
+
+	if (!notch->nstages) {
+		return;
+	}
+	for (; len > 0; buf += n, len -= n) {
+		n = MIN(len, NOTCH_BLOCK);
+		for (i = 0; i < n; i++) {
+			x[i] = buf[i];
+		}
+		for (j = 0; j < notch->nstages; j++) {
+			notch_stage(&notch->stages[j], &notch->z1[j], &notch->z2[j], x, n);
+		}
+		for (i = 0; i < n; i++) {
+			float v = x[i];
+
+			buf[i] = v >= 32767.0f ? 32767 : (v <= -32768.0f ? -32768 : (int16_t) v);
+		}
+	}
+}
+
+#ifdef TEST_FRAMEWORK
+/*! \brief The per sample filter the cascade replaced, for comparison */
+struct legacy_filter {
+	char desc[100];
+	float x0, x1, x2, y0, y1, y2;
+	float gain, const0, const1, const2;
+};
+
+/*!
+ * \brief Per sample filter constants, fixed so the comparison does not depend on rpt_notch_design
+ * \note Computed offline in double precision from zeros at e^(+-jw0) and poles at
+ *       (1 - pi * bw / 8000) * e^(+-jw0), normalized to unity gain at DC.
+ */
+static const struct legacy_notch {
+	float freq, bw;
+	float gain, const0, const1, const2;
+} legacy_notches[] = {
+	{ 300, 100, 1.01149387, -1.94473984, -0.923002309, 1.86837009 },
+	{ 600, 100, 1.03326655, -1.78201305, -0.923002309, 1.71203356 },
+	{ 900, 100, 1.03740004, -1.52081193, -0.923002309, 1.46108979 },
+	{ 1200, 100, 1.03885243, -1.1755705, -0.923002309, 1.12940596 },
+	{ 1500, 100, 1.03952357, -0.765366865, -0.923002309, 0.735310978 },
+	{ 1800, 100, 1.03988571, -0.31286893, -0.923002309, 0.300582596 },
+	{ 2100, 100, 1.04010103, 0.156918191, -0.923002309, -0.150756028 },
+	{ 2400, 100, 1.04023728, 0.618033989, -0.923002309, -0.593763851 },
+	{ 2700, 100, 1.04032666, 1.04499713, -0.923002309, -1.00396019 },
+	{ 3000, 100, 1.04038594, 1.41421356, -0.923002309, -1.35867753 },
+};
+
+/*! \brief Response of a 1000 Hz, 50 Hz wide notch to a 10000 impulse, computed offline in double precision */
+static const int16_t notch_impulse_1000[] = {
+	9810, -272, 4, 267, 367, 252, -3, -247, -339, -232, 3, 228,
+	313, 215, -3, -211, -289, -198, 3, 194, 267, 183, -3, -180,
+};
+
+static void legacy_set(struct legacy_filter *f, const struct legacy_notch *n)
+{
+	memset(f, 0, sizeof(*f));
+	snprintf(f->desc, sizeof(f->desc), "%f Hz, BW = %f", n->freq, n->bw);
+	f->gain = n->gain;
+	f->const0 = n->const0;
+	f->const1 = n->const1;
+	f->const2 = n->const2;
+}
+
+static void legacy_filter(struct legacy_filter *filters, int nfilters, volatile short *buf, int len)
+{
+	struct legacy_filter *f;
+	int i, j;
+
+	for (i = 0; i < len; i++) {
+		for (j = 0; j < nfilters; j++) {
+			f = &filters[j];
+			if (!*f->desc) {
+				continue;
+			}
+			f->x0 = f->x1;
+			f->x1 = f->x2;
+			f->x2 = ((float) buf[i]) / f->gain;
+			f->y0 = f->y1;
+			f->y1 = f->y2;
+			f->y2 = (f->x0 + f->x2) + f->const0 * f->x1 + (f->const1 * f->y0) + (f->const2 * f->y1);
+			buf[i] = (short) f->y2;
+		}
+	}
+}
+
+static void notch_tone(int16_t *buf, int len, int start, float freq, float amp)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		buf[i] = (int16_t) lrintf(amp * sinf(2.0f * M_PI * freq * (start + i) / TONE_SAMPLE_RATE));
+	}
+}
+
+static double notch_rms(const int16_t *buf, int len)
+{
+	double sum = 0;
+	int i;
+
+	for (i = 0; i < len; i++) {
+		sum += (double) buf[i] * buf[i];
+	}
+	return sqrt(sum / len);
+}
+
+/*! \brief RMS of a tone after settling through a cascade */
+static double notch_response(struct rpt_notch *notch, float freq)
+{
+	int16_t buf[TONE_SAMPLES_IN_FRAME];
+	int i;
+
+	for (i = 0; i < 50; i++) {
+		notch_tone(buf, ARRAY_LEN(buf), i * ARRAY_LEN(buf), freq, 10000);
+		rpt_notch_process(notch, buf, ARRAY_LEN(buf));
+	}
+	return notch_rms(buf, ARRAY_LEN(buf));
+}
+
+AST_TEST_DEFINE(notch_response_test)
+{
+	struct rpt_notch notch;
+	int16_t impulse[ARRAY_LEN(notch_impulse_1000)];
+	double rms;
+	int i;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "notch_response";
+		info->category = "/apps/app_rpt/notch/";
+		info->summary = "Notch filter response";
+		info->description = "Check that a notch removes its tone, passes others and has the expected impulse response.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	rpt_notch_clear(&notch);
+	ast_test_validate(test, !rpt_notch_add(&notch, 1000, 50));
+	rms = notch_response(&notch, 1000);
+	ast_test_status_update(test, "1000 Hz through a 1000 Hz notch: %.1f RMS\n", rms);
+	ast_test_validate(test, rms < 70); /* 10000 peak in, better than -40 dB */
+
+	rpt_notch_clear(&notch);
+	ast_test_validate(test, !rpt_notch_add(&notch, 1000, 50));
+	rms = notch_response(&notch, 1500);
+	ast_test_status_update(test, "1500 Hz through a 1000 Hz notch: %.1f RMS\n", rms);
+	ast_test_validate(test, rms > 6000);
+
+	rpt_notch_clear(&notch);
+	ast_test_validate(test, !rpt_notch_add(&notch, 1000, 50));
+	memset(impulse, 0, sizeof(impulse));
+	impulse[0] = 10000;
+	rpt_notch_process(&notch, impulse, ARRAY_LEN(impulse));
+	for (i = 0; i < ARRAY_LEN(impulse); i++) {
+		if (abs(impulse[i] - notch_impulse_1000[i]) > 1) { /* The cascade truncates, the reference rounds */
+			ast_test_status_update(test, "Impulse response sample %d is %d, expected %d\n", i, impulse[i], notch_impulse_1000[i]);
+			return AST_TEST_FAIL;
+		}
+	}
+
+	rpt_notch_clear(&notch);
+	ast_test_validate(test, rpt_notch_add(&notch, 0, 50) == -1);
+	ast_test_validate(test, rpt_notch_add(&notch, 5000, 50) == -1);
+	return AST_TEST_PASS;
+}
+
+AST_TEST_DEFINE(notch_legacy_test)
+{
+	struct legacy_filter legacy[RPT_NOTCH_MAX];
+	struct rpt_notch notch;
+	int16_t in[TONE_SAMPLES_IN_FRAME], a[TONE_SAMPLES_IN_FRAME], b[TONE_SAMPLES_IN_FRAME];
+	int i, j, maxdiff = 0;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "notch_legacy";
+		info->category = "/apps/app_rpt/notch/";
+		info->summary = "Notch cascade matches the per sample filter";
+		info->description = "Filter the same audio through the cascade and through the per sample filter it replaced, "
+							"using fixed per sample filter constants.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	rpt_notch_clear(&notch);
+	for (j = 0; j < 4; j++) {
+		legacy_set(&legacy[j], &legacy_notches[j * 2]);
+		ast_test_validate(test, !rpt_notch_add(&notch, legacy_notches[j * 2].freq, legacy_notches[j * 2].bw));
+	}
+	for (i = 0; i < 20; i++) {
+		notch_tone(in, ARRAY_LEN(in), i * ARRAY_LEN(in), 440, 6000);
+		memcpy(a, in, sizeof(a));
+		memcpy(b, in, sizeof(b));
+		legacy_filter(legacy, 4, a, ARRAY_LEN(a));
+		rpt_notch_process(&notch, b, ARRAY_LEN(b));
+		for (j = 0; j < ARRAY_LEN(a); j++) {
+			maxdiff = MAX(maxdiff, abs(a[j] - b[j]));
+		}
+	}
+	/* The per sample filter truncates to 16 bits after every stage */
+	ast_test_status_update(test, "Largest difference %d\n", maxdiff);
+	ast_test_validate(test, maxdiff <= 8);
+	return AST_TEST_PASS;
+}
+
+AST_TEST_DEFINE(notch_benchmark)
+{
+	const int counts[] = { 1, 4, 10 };
+	struct legacy_filter legacy[RPT_NOTCH_MAX];
+	struct rpt_notch notch;
+	int16_t buf[TONE_SAMPLES_IN_FRAME];
+	const int frames = 20000;
+	struct timeval start;
+	int64_t legacy_us, cascade_us;
+	int c, i, j;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "notch_benchmark";
+		info->category = "/apps/app_rpt/notch/";
+		info->summary = "Notch cascade speed";
+		info->description = "Time 160 sample frames through 1, 4 and 10 notches, in the cascade and in the "
+							"per sample filter it replaced.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	notch_tone(buf, ARRAY_LEN(buf), 0, 440, 6000);
+	ast_test_status_update(test, "%d frames of %d samples\n", frames, (int) ARRAY_LEN(buf));
+	for (c = 0; c < ARRAY_LEN(counts); c++) {
+		memset(legacy, 0, sizeof(legacy));
+		rpt_notch_clear(&notch);
+		for (j = 0; j < counts[c]; j++) {
+			legacy_set(&legacy[j], &legacy_notches[j]);
+			rpt_notch_add(&notch, legacy_notches[j].freq, legacy_notches[j].bw);
+		}
+
+		/* The old filter looked at every slot, configured or not */
+		start = ast_tvnow();
+		for (i = 0; i < frames; i++) {
+			legacy_filter(legacy, RPT_NOTCH_MAX, buf, ARRAY_LEN(buf));
+		}
+		legacy_us = ast_tvdiff_us(ast_tvnow(), start);
+
+		start = ast_tvnow();
+		for (i = 0; i < frames; i++) {
+			rpt_notch_process(&notch, buf, ARRAY_LEN(buf));
+		}
+		cascade_us = ast_tvdiff_us(ast_tvnow(), start);
+
+		ast_test_status_update(test, "%2d notches: per sample %.3f us/frame, cascade %.3f us/frame\n", counts[c], (double) legacy_us / frames,
+			(double) cascade_us / frames);
+	}
+	return AST_TEST_PASS;
+}
+
+void rpt_notch_tests_register(void)
+{
+	AST_TEST_REGISTER(notch_response_test);
+	AST_TEST_REGISTER(notch_legacy_test);
+	AST_TEST_REGISTER(notch_benchmark);
+}
+
+void rpt_notch_tests_unregister(void)
+{
+	AST_TEST_UNREGISTER(notch_response_test);
+	AST_TEST_UNREGISTER(notch_legacy_test);
+	AST_TEST_UNREGISTER(notch_benchmark);
+}
+#endif
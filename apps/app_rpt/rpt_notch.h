@@ -0,0 +1,73 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT receive audio notch filters
+ *
+ * The notches configured with rxnotch are compiled into a cascade of
+ * biquad stages when the configuration is loaded.  A frame is converted
+ * to float once, run through each stage in turn (transposed direct form
+ * II) and converted back, saturating, once.
+ */
+
+#ifndef _RPT_NOTCH_H_
+#define _RPT_NOTCH_H_
+
+/*! \brief Most notches per node */
+#define RPT_NOTCH_MAX 10
+
+/*! \brief Biquad coefficients, normalized so a0 is 1 */
+struct rpt_notch_stage {
+	float b0;
+	float b1;
+	float b2;
+	float a1;
+	float a2;
+};
+
+/*! \brief A node's notch filter cascade */
+struct rpt_notch {
+	struct rpt_notch_stage stages[RPT_NOTCH_MAX]; /*!< \brief Active stages, packed */
+	float z1[RPT_NOTCH_MAX];
+	float z2[RPT_NOTCH_MAX];
+	int nstages;
+};
+
+/*!
+ * \brief Design a notch filter stage
+ * \param stage Filled in with the coefficients
+ * \param freq Center frequency in Hz
+ * \param bw Bandwidth in Hz
+ * \param rate Sample rate
+ */
+void rpt_notch_design(struct rpt_notch_stage *stage, float freq, float bw, int rate);
+
+/*!
+ * \brief Remove every stage from a cascade
+ */
+void rpt_notch_clear(struct rpt_notch *notch);
+
+/*!
+ * \brief Add a notch to a cascade
+ * \param notch Cascade
+ * \param freq Center frequency in Hz
+ * \param bw Bandwidth in Hz
+ * \retval 0 on success
+ * \retval -1 if the cascade is full or the notch is invalid
+ */
+int rpt_notch_add(struct rpt_notch *notch, float freq, float bw);
+
+/*!
+ * \brief Filter audio in place
+ * \param notch Cascade, does nothing if it has no stages
+ * \param buf Signed linear audio at 8 kHz
+ * \param len Number of samples
+ */
+void rpt_notch_process(struct rpt_notch *notch, int16_t *buf, int len);
+
+#ifdef TEST_FRAMEWORK
+void rpt_notch_tests_register(void);
+void rpt_notch_tests_unregister(void);
+#endif
+
+#endif /* _RPT_NOTCH_H_ */
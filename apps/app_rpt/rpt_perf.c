@@ -0,0 +1,143 @@
+/*!
+ * \file
+ *
+ * \brief RPT node main loop timing
+ */
+
+#include "asterisk.h"
+
+#include <limits.h>
+
+#include "asterisk/utils.h"
+
+#include "app_rpt.h"
+#include "rpt_perf.h"
+
+/*! \brief Bucket upper bounds in microseconds, finer around the 20 ms frame time */
+static const unsigned int perf_bounds[RPT_PERF_BUCKETS - 1] = {
+	50, 100, 250, 500, 1000, 2000, 5000, 10000, 15000, 19000, 21000, 25000, 30000, 40000, 60000, 100000, 250000,
+};
+
+static const char *const perf_names[RPT_PERF_METRICS] = {
+	[RPT_PERF_LOOP] = "Loop",
+	[RPT_PERF_LATE] = "Late wakeup",
+	[RPT_PERF_RXREAD] = "rxchannel read",
+	[RPT_PERF_PREAD] = "pchannel read",
+	[RPT_PERF_LOCALTXREAD] = "localtxchannel read",
+	[RPT_PERF_RXVOICE] = "RX voice interval",
+	[RPT_PERF_TXVOICE] = "TX voice interval",
+};
+
+/*! \brief Voice frames should arrive this often */
+#define PERF_FRAME_US 20000
+
+#define PERF_SET(field, val) __atomic_store_n(&(field), (val), __ATOMIC_RELAXED)
+
+unsigned long long rpt_perf_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+const char *rpt_perf_name(enum rpt_perf_metric metric)
+{
+	return perf_names[metric];
+}
+
+unsigned int rpt_perf_bucket_us(int bucket)
+{
+	return bucket < RPT_PERF_BUCKETS - 1 ? perf_bounds[bucket] : 0;
+}
+
+static int perf_bucket(unsigned int us)
+{
+	int lo = 0, hi = RPT_PERF_BUCKETS - 1;
+
+	/* First bound that us is below */
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (us < perf_bounds[mid]) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+static void perf_add(struct rpt_perf_hist *hist, enum rpt_perf_metric metric, unsigned int us, int bucket)
+{
+	PERF_SET(hist->count, hist->count + 1);
+	PERF_SET(hist->sum_us, hist->sum_us + us);
+	if (us > hist->max_us) {
+		PERF_SET(hist->max_us, us);
+	}
+	if (metric == RPT_PERF_RXVOICE || metric == RPT_PERF_TXVOICE) {
+		int d = abs((int) us - PERF_FRAME_US);
+
+		/* Interarrival jitter estimate, as in RFC 3550 */
+		PERF_SET(hist->jitter_us, hist->jitter_us + (d - (int) hist->jitter_us) / 16);
+	}
+	PERF_SET(hist->buckets[bucket], hist->buckets[bucket] + 1);
+}
+
+static void perf_record(struct rpt_perf *perf, enum rpt_perf_metric metric, unsigned long long now, unsigned int us)
+{
+	int bucket = perf_bucket(us);
+
+	if (perf->cleared != __atomic_load_n(&perf->resets, __ATOMIC_RELAXED)) {
+		perf->cleared = perf->resets;
+		memset(perf->total, 0, sizeof(perf->total));
+		memset(perf->last, 0, sizeof(perf->last));
+		memset(perf->window, 0, sizeof(perf->window));
+		perf->window_start = now;
+	}
+	if (now - perf->window_start >= RPT_PERF_WINDOW * 1000000ULL) {
+		memcpy(perf->last, perf->window, sizeof(perf->last));
+		memset(perf->window, 0, sizeof(perf->window));
+		perf->window_start = now;
+	}
+	perf_add(&perf->total[metric], metric, us, bucket);
+	perf_add(&perf->window[metric], metric, us, bucket);
+}
+
+void rpt_perf_add(struct rpt_perf *perf, enum rpt_perf_metric metric, unsigned int us)
+{
+	if (perf) {
+		perf_record(perf, metric, rpt_perf_now(), us);
+	}
+}
+
+void rpt_perf_end(struct rpt_perf *perf, enum rpt_perf_metric metric, unsigned long long start)
+{
+	unsigned long long now;
+
+	if (!perf) {
+		return;
+	}
+	now = rpt_perf_now();
+	perf_record(perf, metric, now, now - start > UINT_MAX ? UINT_MAX : now - start);
+}
+
+void rpt_perf_voice(struct rpt_perf *perf, enum rpt_perf_metric metric)
+{
+	unsigned long long now, last;
+
+	if (!perf) {
+		return;
+	}
+	now = rpt_perf_now();
+	last = perf->lastvoice[metric];
+	perf->lastvoice[metric] = now;
+	if (last && now - last < 1000000) {
+		perf_record(perf, metric, now, now - last);
+	}
+}
+
+void rpt_perf_reset(struct rpt_perf *perf)
+{
+	__atomic_fetch_add(&perf->resets, 1, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,94 @@
+/*!
+ * \file
+ *
+ * \brief RPT node main loop timing
+ *
+ * Each node's rpt() thread records how long its loop iterations and
+ * channel reads take, how late it wakes up, and the time between voice
+ * frames received and transmitted, in histograms that run since the last
+ * reset and over the last complete minute.  Only the node thread writes
+ * them; the CLI and AMI read them without locking, which may show a
+ * sample mid update but never stalls the node.
+ */
+
+/*! \brief What is timed */
+enum rpt_perf_metric {
+	RPT_PERF_LOOP,		  /*!< \brief Loop iteration, not counting the wait for channels */
+	RPT_PERF_LATE,		  /*!< \brief Wakeups after the deadline passed to ast_waitfor_n() */
+	RPT_PERF_RXREAD,	  /*!< \brief rxchannel_read() */
+	RPT_PERF_PREAD,		  /*!< \brief pchannel_read() */
+	RPT_PERF_LOCALTXREAD, /*!< \brief localtxchannel_read() */
+	RPT_PERF_RXVOICE,	  /*!< \brief Between voice frames received on rxchannel */
+	RPT_PERF_TXVOICE,	  /*!< \brief Between voice frames written to txchannel */
+	RPT_PERF_METRICS,
+};
+
+/*! \brief Number of histogram buckets */
+#define RPT_PERF_BUCKETS 18
+
+/*! \brief Seconds in the rolling window */
+#define RPT_PERF_WINDOW 60
+
+/*! \brief A histogram of times */
+struct rpt_perf_hist {
+	unsigned long long count;
+	unsigned long long sum_us;
+	unsigned int max_us;
+	unsigned int jitter_us; /*!< \brief Smoothed deviation from 20 ms, voice frames only */
+	unsigned int buckets[RPT_PERF_BUCKETS];
+};
+
+/*! \brief A node's timing histograms */
+struct rpt_perf {
+	struct rpt_perf_hist total[RPT_PERF_METRICS];  /*!< \brief Since the last reset */
+	struct rpt_perf_hist last[RPT_PERF_METRICS];   /*!< \brief Over the last complete window */
+	struct rpt_perf_hist window[RPT_PERF_METRICS]; /*!< \brief Current window, so far */
+	unsigned long long window_start;
+	unsigned long long lastvoice[RPT_PERF_METRICS]; /*!< \brief Time of the previous voice frame */
+	unsigned int resets; /*!< \brief Bumped to ask the node thread to clear everything */
+	unsigned int cleared;
+};
+
+/*! \brief Monotonic time in microseconds */
+unsigned long long rpt_perf_now(void);
+
+/*!
+ * \brief Record a time
+ * \param perf Node's histograms, may be NULL
+ * \param metric What was timed
+ * \param us Microseconds
+ * \note Must only be called from the node's thread
+ */
+void rpt_perf_add(struct rpt_perf *perf, enum rpt_perf_metric metric, unsigned int us);
+
+/*!
+ * \brief Record the time since something started
+ * \param perf Node's histograms, may be NULL
+ * \param metric What was timed
+ * \param start rpt_perf_now() when it started
+ * \note Must only be called from the node's thread
+ */
+void rpt_perf_end(struct rpt_perf *perf, enum rpt_perf_metric metric, unsigned long long start);
+
+/*!
+ * \brief Record the time since the previous voice frame
+ * \param perf Node's histograms, may be NULL
+ * \param metric RPT_PERF_RXVOICE or RPT_PERF_TXVOICE
+ * \note Gaps of a second or more are the start of a new transmission and aren't recorded
+ */
+void rpt_perf_voice(struct rpt_perf *perf, enum rpt_perf_metric metric);
+
+/*!
+ * \brief Clear a node's histograms
+ * \note The node thread does the clearing the next time it records something
+ */
+void rpt_perf_reset(struct rpt_perf *perf);
+
+/*! \brief Name of a metric, for display */
+const char *rpt_perf_name(enum rpt_perf_metric metric);
+
+/*!
+ * \brief Upper bound of a histogram bucket
+ * \return Microseconds, or 0 for the last bucket, which has no bound
+ */
+unsigned int rpt_perf_bucket_us(int bucket);
@@ -0,0 +1,569 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT decoded sound file cache
+ */
+
+#include "asterisk.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "asterisk/astobj2.h"
+#include "asterisk/channel.h"
+#include "asterisk/dlinkedlists.h"
+#include "asterisk/file.h"
+#include "asterisk/format_cache.h"
+#include "asterisk/lock.h"
+#include "asterisk/paths.h"
+#include "asterisk/translate.h"
+#include "asterisk/utils.h"
+
+#include "app_rpt.h"
+#include "rpt_channel.h"
+#include "rpt_soundcache.h"
+
+/*! \brief Number of hash buckets in the sound cache */
+#define RPT_SOUNDCACHE_BUCKETS 127
+
+/*! \brief Most files played by one rpt_soundcache_play() */
+#define RPT_SOUNDCACHE_MAX_FILES 64
+
+/*! \brief A decoded sound file */
+struct rpt_sound {
+	AST_DLLIST_ENTRY(rpt_sound) lru;
+	size_t samples;
+	int16_t *data;
+	char key[0]; /*!< \brief language/name */
+};
+
+/*! \brief Formats tried when looking for a sound file, as for ast_readfile() */
+static const char *const sound_formats[] = { "sln", "ulaw", "alaw", "gsm", "wav", "g722", "sln16" };
+
+AST_MUTEX_DEFINE_STATIC(sound_lock);
+static struct ao2_container *sound_cache; /*!< \brief Protected by sound_lock */
+static AST_DLLIST_HEAD_NOLOCK_STATIC(sound_lru, rpt_sound); /*!< \brief Most recently played first.  Protected by sound_lock. */
+static size_t sound_bytes;
+static size_t sound_maxbytes;
+
+static pthread_t sound_preload_thread = AST_PTHREADT_NULL;
+static rpt_bool sound_preload_stop;
+
+AO2_STRING_FIELD_HASH_FN(rpt_sound, key);
+AO2_STRING_FIELD_CMP_FN(rpt_sound, key);
+
+static void sound_destroy(void *obj)
+{
+	struct rpt_sound *sound = obj;
+
+	ast_free(sound->data);
+}
+
+/*!
+ * \internal
+ * \brief Find a sound file the way the file streaming code does, for the common layouts
+ * \param lang Language
+ * \param name Sound file name, without extension
+ * \param path Filled in with the file's path, without extension
+ * \param pathlen Size of path
+ * \return Format name to pass to ast_readfile(), or NULL if not found
+ */
+static const char *sound_find(const char *lang, const char *name, char *path, size_t pathlen)
+{
+	char file[PATH_MAX];
+	struct stat st;
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		if (name[0] == '/') {
+			if (i) {
+				break;
+			}
+			ast_copy_string(path, name, pathlen);
+		} else if (i == 0) {
+			snprintf(path, pathlen, "%s/sounds/%s/%s", ast_config_AST_DATA_DIR, lang, name);
+		} else if (i == 1) {
+			if (!strcmp(lang, "en")) {
+				continue;
+			}
+			snprintf(path, pathlen, "%s/sounds/en/%s", ast_config_AST_DATA_DIR, name);
+		} else {
+			snprintf(path, pathlen, "%s/sounds/%s", ast_config_AST_DATA_DIR, name);
+		}
+		for (j = 0; j < ARRAY_LEN(sound_formats); j++) {
+			snprintf(file, sizeof(file), "%s.%s", path, sound_formats[j]);
+			if (!stat(file, &st) && S_ISREG(st.st_mode)) {
+				return sound_formats[j];
+			}
+		}
+	}
+	return NULL;
+}
+
+/*!
+ * \internal
+ * \brief Read a sound file and decode it to signed linear
+ * \param maxbytes Give up on files that decode to more than this
+ */
+static struct rpt_sound *sound_load(const char *key, const char *lang, const char *name, size_t maxbytes)
+{
+	char path[PATH_MAX];
+	const char *fmt;
+	struct ast_filestream *fs;
+	struct ast_trans_pvt *trans = NULL;
+	struct ast_frame *f, *out, *cur;
+	struct rpt_sound *sound;
+	int16_t *data = NULL, *tmp;
+	size_t samples = 0, size = 0;
+	int failed = 0;
+
+	fmt = sound_find(lang, name, path, sizeof(path));
+	if (!fmt) {
+		return NULL;
+	}
+	fs = ast_readfile(path, fmt, NULL, O_RDONLY, 0, 0);
+	if (!fs) {
+		return NULL;
+	}
+
+	while (!failed && (f = ast_readframe(fs))) {
+		out = f;
+		if (f->frametype != AST_FRAME_VOICE) {
+			ast_frfree(f);
+			continue;
+		}
+		if (ast_format_cmp(f->subclass.format, ast_format_slin) != AST_FORMAT_CMP_EQUAL) {
+			if (!trans) {
+				trans = ast_translator_build_path(ast_format_slin, f->subclass.format);
+			}
+			out = trans ? ast_translate(trans, f, 0) : NULL;
+			if (!out) {
+				failed = 1;
+			}
+		}
+		for (cur = out; !failed && cur; cur = AST_LIST_NEXT(cur, frame_list)) {
+			if (samples + cur->samples > size) {
+				size = MAX(size * 2, samples + cur->samples + 8000);
+				if (size * sizeof(int16_t) > maxbytes) {
+					failed = 1;
+					break;
+				}
+				tmp = ast_realloc(data, size * sizeof(int16_t));
+				if (!tmp) {
+					failed = 1;
+					break;
+				}
+				data = tmp;
+			}
+			memcpy(&data[samples], cur->data.ptr, cur->samples * sizeof(int16_t));
+			samples += cur->samples;
+		}
+		if (out && out != f) {
+			ast_frfree(out);
+		}
+		ast_frfree(f);
+	}
+	ast_closestream(fs);
+	if (trans) {
+		ast_translator_free_path(trans);
+	}
+
+	if (failed || !samples) {
+		ast_free(data);
+		return NULL;
+	}
+
+	sound = ao2_alloc_options(sizeof(*sound) + strlen(key) + 1, sound_destroy, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!sound) {
+		ast_free(data);
+		return NULL;
+	}
+	strcpy(sound->key, key); /* Safe */
+	sound->samples = samples;
+	sound->data = data;
+	return sound;
+}
+
+/*!
+ * \internal
+ * \brief Drop the least recently played files until the cache fits
+ * \note Must be called with sound_lock held
+ */
+static void sound_evict(size_t maxbytes)
+{
+	struct rpt_sound *sound;
+
+	while (sound_bytes > maxbytes && (sound = AST_DLLIST_REMOVE_TAIL(&sound_lru, lru))) {
+		ast_debug(5, "Evicting %s from the sound cache\n", sound->key);
+		sound_bytes -= sound->samples * sizeof(int16_t);
+		ao2_unlink_flags(sound_cache, sound, OBJ_NOLOCK);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Get a decoded sound file, loading it if it isn't cached
+ * \return Sound reference, or NULL if the file couldn't be loaded
+ */
+static struct rpt_sound *sound_get(const char *lang, const char *name)
+{
+	char key[PATH_MAX];
+	struct rpt_sound *sound, *cached;
+	size_t maxbytes;
+
+	snprintf(key, sizeof(key), "%s/%s", lang, name);
+
+	ast_mutex_lock(&sound_lock);
+	maxbytes = sound_maxbytes;
+	sound = sound_cache ? ao2_find(sound_cache, key, OBJ_SEARCH_KEY | OBJ_NOLOCK) : NULL;
+	if (sound) {
+		AST_DLLIST_REMOVE(&sound_lru, sound, lru);
+		AST_DLLIST_INSERT_HEAD(&sound_lru, sound, lru);
+		ast_mutex_unlock(&sound_lock);
+		return sound;
+	}
+	ast_mutex_unlock(&sound_lock);
+	if (!maxbytes) {
+		return NULL;
+	}
+
+	/* Decode outside the lock, a file never takes more than a quarter of the cache */
+	sound = sound_load(key, lang, name, maxbytes / 4);
+	if (!sound) {
+		return NULL;
+	}
+
+	ast_mutex_lock(&sound_lock);
+	cached = sound_cache ? ao2_find(sound_cache, key, OBJ_SEARCH_KEY | OBJ_NOLOCK) : NULL;
+	if (cached) {
+		/* Loaded by someone else in the meantime */
+		ast_mutex_unlock(&sound_lock);
+		ao2_ref(sound, -1);
+		return cached;
+	}
+	if (sound_cache && sound_maxbytes) {
+		ao2_link_flags(sound_cache, sound, OBJ_NOLOCK);
+		AST_DLLIST_INSERT_HEAD(&sound_lru, sound, lru);
+		sound_bytes += sound->samples * sizeof(int16_t);
+		sound_evict(sound_maxbytes);
+		ast_debug(5, "Cached %s, %zu samples\n", key, sound->samples);
+	}
+	ast_mutex_unlock(&sound_lock);
+	return sound;
+}
+
+/*! \brief Language used to look up a channel's sound files */
+static const char *sound_lang(struct ast_channel *chan)
+{
+	const char *lang = ast_channel_language(chan);
+
+	return ast_strlen_zero(lang) ? "en" : lang;
+}
+
+int rpt_soundcache_play(struct ast_channel *chan, const char *const *files, int nfiles)
+{
+	struct rpt_sound *sounds[RPT_SOUNDCACHE_MAX_FILES];
+	const char *lang = sound_lang(chan);
+	int i, n, res = 0;
+
+	if (nfiles > RPT_SOUNDCACHE_MAX_FILES || !__atomic_load_n(&sound_maxbytes, __ATOMIC_RELAXED)) {
+		return RPT_SOUNDCACHE_MISS;
+	}
+
+	/* Get everything first, so nothing is played if a file has to be streamed */
+	for (n = 0; n < nfiles; n++) {
+		sounds[n] = sound_get(lang, files[n]);
+		if (!sounds[n]) {
+			res = RPT_SOUNDCACHE_MISS;
+			break;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!res) {
+			res = play_slin(chan, sounds[i], sounds[i]->data, sounds[i]->samples);
+		}
+		ao2_ref(sounds[i], -1);
+	}
+	return res;
+}
+
+int rpt_soundcache_chars(const char *str, int phonetic, const char **files, int maxfiles, char *buf)
+{
+	int n = 0;
+	char c;
+
+	for (; *str; str++) {
+		if (n == maxfiles) {
+			return -1;
+		}
+		/* Same files as ast_say_character_str() and ast_say_phonetic_str() */
+		switch (*str) {
+		case '*':
+			files[n++] = "digits/star";
+			continue;
+		case '#':
+			files[n++] = "digits/pound";
+			continue;
+		case '!':
+			files[n++] = "letters/exclaimation-point";
+			continue;
+		case '@':
+			files[n++] = "letters/at";
+			continue;
+		case '$':
+			files[n++] = "letters/dollar";
+			continue;
+		case '-':
+			files[n++] = "letters/dash";
+			continue;
+		case '.':
+			files[n++] = "letters/dot";
+			continue;
+		case '=':
+			files[n++] = "letters/equals";
+			continue;
+		case '+':
+			files[n++] = "letters/plus";
+			continue;
+		case '/':
+			files[n++] = "letters/slash";
+			continue;
+		case ' ':
+			files[n++] = "letters/space";
+			continue;
+		}
+		c = tolower(*str);
+		if (c >= '0' && c <= '9') {
+			sprintf(buf, "digits/%c", c); /* Safe */
+		} else if (c >= 'a' && c <= 'z') {
+			sprintf(buf, phonetic ? "phonetic/%c_p" : "letters/%c", c); /* Safe */
+		} else {
+			return -1;
+		}
+		files[n++] = buf;
+		buf += strlen(buf) + 1;
+	}
+	return n;
+}
+
+/*! \brief Add the files for 0 <= num < 1000 */
+static int sound_number_hundreds(int num, const char **files, int n, int maxfiles, char **buf)
+{
+	if (num >= 100) {
+		if (n + 2 > maxfiles) {
+			return -1;
+		}
+		sprintf(*buf, "digits/%d", num / 100); /* Safe */
+		files[n++] = *buf;
+		*buf += strlen(*buf) + 1;
+		files[n++] = "digits/hundred";
+		num %= 100;
+		if (!num) {
+			return n;
+		}
+	}
+	if (num >= 20) {
+		if (n + 1 > maxfiles) {
+			return -1;
+		}
+		sprintf(*buf, "digits/%d", num - num % 10); /* Safe */
+		files[n++] = *buf;
+		*buf += strlen(*buf) + 1;
+		num %= 10;
+		if (!num) {
+			return n;
+		}
+	}
+	if (n + 1 > maxfiles) {
+		return -1;
+	}
+	sprintf(*buf, "digits/%d", num); /* Safe */
+	files[n++] = *buf;
+	*buf += strlen(*buf) + 1;
+	return n;
+}
+
+int rpt_soundcache_number(int num, const char **files, int maxfiles, char *buf)
+{
+	int n = 0;
+
+	/* Same files as the English ast_say_number() */
+	if (num < 0) {
+		if (num == INT_MIN || !maxfiles) {
+			return -1;
+		}
+		files[n++] = "digits/minus";
+		num = -num;
+	}
+	if (num >= 1000000000) {
+		return -1;
+	}
+	if (num >= 1000000) {
+		n = sound_number_hundreds(num / 1000000, files, n, maxfiles, &buf);
+		if (n < 0 || n + 1 > maxfiles) {
+			return -1;
+		}
+		files[n++] = "digits/million";
+		num %= 1000000;
+		if (!num) {
+			return n;
+		}
+	}
+	if (num >= 1000) {
+		n = sound_number_hundreds(num / 1000, files, n, maxfiles, &buf);
+		if (n < 0 || n + 1 > maxfiles) {
+			return -1;
+		}
+		files[n++] = "digits/thousand";
+		num %= 1000;
+		if (!num) {
+			return n;
+		}
+	}
+	return sound_number_hundreds(num, files, n, maxfiles, &buf);
+}
+
+/*!
+ * \internal
+ * \brief Preload a sound file
+ * \retval 0 to continue
+ * \retval -1 to stop preloading
+ */
+static int sound_preload(const char *name)
+{
+	struct rpt_sound *sound;
+	int full;
+
+	if (__atomic_load_n(&sound_preload_stop, __ATOMIC_RELAXED)) {
+		return -1;
+	}
+	sound = sound_get("en", name);
+	ao2_cleanup(sound);
+
+	ast_mutex_lock(&sound_lock);
+	/* Don't evict what we just loaded */
+	full = sound_bytes >= sound_maxbytes * 3 / 4;
+	ast_mutex_unlock(&sound_lock);
+	return full ? -1 : 0;
+}
+
+/*! \brief Preload every sound file in a directory under the sounds directory */
+static int sound_preload_dir(const char *dir)
+{
+	char path[PATH_MAX], name[PATH_MAX];
+	struct dirent *ent;
+	DIR *d;
+	char *ext;
+	int res = 0;
+
+	snprintf(path, sizeof(path), "%s/sounds/en/%s", ast_config_AST_DATA_DIR, dir);
+	d = opendir(path);
+	if (!d) {
+		return 0;
+	}
+	while (!res && (ent = readdir(d))) {
+		if (ent->d_name[0] == '.') {
+			continue;
+		}
+		snprintf(name, sizeof(name), "%s/%s", dir, ent->d_name);
+		ext = strrchr(name, '.');
+		if (!ext) {
+			continue;
+		}
+		*ext = '\0';
+		res = sound_preload(name);
+	}
+	closedir(d);
+	return res;
+}
+
+static void *sound_preloader(void *data)
+{
+	static const char *const digits[] = { "hundred", "thousand", "million", "minus", "star", "pound" };
+	char name[32];
+	int i;
+
+	for (i = 0; i <= 90; i++) {
+		if (i > 20 && i % 10) {
+			continue;
+		}
+		snprintf(name, sizeof(name), "digits/%d", i);
+		if (sound_preload(name)) {
+			goto done;
+		}
+	}
+	for (i = 0; i < ARRAY_LEN(digits); i++) {
+		snprintf(name, sizeof(name), "digits/%s", digits[i]);
+		if (sound_preload(name)) {
+			goto done;
+		}
+	}
+	for (i = 'a'; i <= 'z'; i++) {
+		snprintf(name, sizeof(name), "letters/%c", i);
+		if (sound_preload(name)) {
+			goto done;
+		}
+	}
+	sound_preload_dir("rpt");
+
+done:
+	ast_mutex_lock(&sound_lock);
+	ast_debug(1, "Preloaded sound cache, %zu bytes\n", sound_bytes);
+	ast_mutex_unlock(&sound_lock);
+	return NULL;
+}
+
+static void sound_preload_join(void)
+{
+	if (sound_preload_thread != AST_PTHREADT_NULL) {
+		__atomic_store_n(&sound_preload_stop, 1, __ATOMIC_RELAXED);
+		pthread_join(sound_preload_thread, NULL);
+		sound_preload_thread = AST_PTHREADT_NULL;
+	}
+}
+
+void rpt_soundcache_configure(unsigned int kbytes, int preload)
+{
+	sound_preload_join();
+
+	ast_mutex_lock(&sound_lock);
+	/* Sound files may have changed */
+	sound_evict(0);
+	__atomic_store_n(&sound_maxbytes, (size_t) kbytes * 1024, __ATOMIC_RELAXED);
+	ast_mutex_unlock(&sound_lock);
+
+	if (kbytes && preload) {
+		sound_preload_stop = 0;
+		if (ast_pthread_create(&sound_preload_thread, NULL, sound_preloader, NULL)) {
+			ast_log(LOG_WARNING, "Could not start sound cache preloader\n");
+			sound_preload_thread = AST_PTHREADT_NULL;
+		}
+	}
+}
+
+int rpt_soundcache_init(void)
+{
+	sound_cache = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_NOLOCK, 0, RPT_SOUNDCACHE_BUCKETS, rpt_sound_hash_fn, NULL, rpt_sound_cmp_fn);
+	if (!sound_cache) {
+		return -1;
+	}
+	sound_maxbytes = (size_t) RPT_SOUNDCACHE_DEFAULT_KB * 1024;
+	return 0;
+}
+
+void rpt_soundcache_cleanup(void)
+{
+	sound_preload_join();
+
+	ast_mutex_lock(&sound_lock);
+	sound_maxbytes = 0;
+	sound_evict(0);
+	ao2_cleanup(sound_cache);
+	sound_cache = NULL;
+	ast_mutex_unlock(&sound_lock);
+}
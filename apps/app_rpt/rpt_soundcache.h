@@ -0,0 +1,73 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT decoded sound file cache
+ *
+ * Telemetry sound files are decoded to 8 kHz signed linear the first time
+ * they are played and kept in memory, up to sound_cache_size kilobytes in
+ * the general stanza of rpt.conf, discarding the least recently played
+ * files first.  Announcements made of several files are then played
+ * back to back from memory without opening or decoding anything.
+ *
+ * Anything the cache can't handle (a missing file, a file too large to
+ * cache, or a language whose numbers or letters it doesn't know how to
+ * say) is streamed from disk as before.
+ */
+
+/*! \brief Returned by the play functions when the caller should stream the files instead */
+#define RPT_SOUNDCACHE_MISS 1
+
+/*! \brief Default sound cache size, in kilobytes */
+#define RPT_SOUNDCACHE_DEFAULT_KB 4096
+
+/*!
+ * \brief Set the cache size and empty it, called when rpt.conf is (re)loaded
+ * \param kbytes Cache size in kilobytes, 0 to disable the cache
+ * \param preload Decode the digits, letters and rpt prompts in the background
+ */
+void rpt_soundcache_configure(unsigned int kbytes, int preload);
+
+/*!
+ * \brief Play sound files back to back from the cache
+ * \param chan Channel to play on, its language selects the files
+ * \param files Sound file names, as for ast_streamfile()
+ * \param nfiles Number of files
+ * \retval 0 on success
+ * \retval -1 on failure or hangup
+ * \retval RPT_SOUNDCACHE_MISS if nothing was played, and the files should be streamed
+ */
+int rpt_soundcache_play(struct ast_channel *chan, const char *const *files, int nfiles);
+
+/*!
+ * \brief Get the sound files used to say a string of characters
+ * \param str Characters
+ * \param phonetic Use phonetic letters (alpha, bravo, ...)
+ * \param files Filled in with file names, which point to static strings or into buf
+ * \param maxfiles Size of files
+ * \param buf Storage for generated names, at least 12 * strlen(str) bytes
+ * \return Number of files, or -1 if a character can't be said this way
+ */
+int rpt_soundcache_chars(const char *str, int phonetic, const char **files, int maxfiles, char *buf);
+
+/*!
+ * \brief Get the sound files used to say a number in English
+ * \param num Number
+ * \param files Filled in with file names, which point into buf
+ * \param maxfiles Size of files
+ * \param buf Storage for generated names, at least 16 * maxfiles bytes
+ * \return Number of files, or -1 if the number can't be said this way
+ */
+int rpt_soundcache_number(int num, const char **files, int maxfiles, char *buf);
+
+/*!
+ * \brief Allocate the sound cache
+ * \retval 0 on success
+ * \retval -1 on failure
+ */
+int rpt_soundcache_init(void);
+
+/*!
+ * \brief Free the sound cache
+ */
+void rpt_soundcache_cleanup(void);
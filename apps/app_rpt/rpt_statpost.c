@@ -0,0 +1,737 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT status posting
+ */
+
+#include "asterisk.h"
+
+#include <curl/curl.h>
+
+#include "asterisk/lock.h"
+#include "asterisk/strings.h"
+#include "asterisk/utils.h"
+#ifdef TEST_FRAMEWORK
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "asterisk/poll-compat.h"
+#include "asterisk/test.h"
+#endif
+
+#include "app_rpt.h"
+#include "rpt_statpost.h"
+
+/*! \brief Most transfers in progress at once */
+#define RPT_STATPOST_TRANSFERS 4
+
+/*! \brief Give up on a post after this many seconds */
+#define RPT_STATPOST_TIMEOUT 30
+
+/*! \brief A status post waiting to be sent */
+struct rpt_statpost_req {
+	struct rpt *myrpt;
+	char *url;
+};
+
+/*! \brief A reusable transfer */
+struct rpt_statpost_xfer {
+	CURL *curl;
+	struct rpt_statpost_req req; /*!< \brief The post being sent, url is NULL when idle */
+	struct ast_str *response;
+	char error_buffer[CURL_ERROR_SIZE];
+};
+
+AST_MUTEX_DEFINE_STATIC(statpost_lock);
+static ast_cond_t statpost_cond;
+static pthread_t statpost_thread = AST_PTHREADT_NULL;
+static rpt_bool statpost_stop;
+/*! \brief Waiting posts, oldest first.  Protected by statpost_lock. */
+static struct rpt_statpost_req statpost_queue[RPT_STATPOST_QUEUE];
+static unsigned int statpost_head;
+static unsigned int statpost_len;
+
+static struct rpt_statpost_stats statpost_stats;
+
+#ifdef TEST_FRAMEWORK
+/*! \brief Node used by the tests, kept until the worker has stopped since a transfer may still use it */
+static struct rpt *statpost_test_rpt;
+#endif
+
+/*! \brief Store the output of libcurl (the OK is sent to stdout) */
+static size_t writefunction(char *contents, size_t size, size_t nmemb, void *userdata)
+{
+	struct ast_str **buffer = userdata;
+
+	return ast_str_append(buffer, 0, "%.*s", (int) (size * nmemb), contents);
+}
+
+/* Function to check if HTTP status code is in 2xx range */
+static rpt_bool is_http_success(int code)
+{
+	return (code >= 200 && code <= 299);
+}
+
+static const char *http_status_text(long code)
+{
+	switch (code) {
+	case 100:
+		return "Continue";
+	case 101:
+		return "Switching Protocols";
+	case 200:
+		return "OK";
+	case 201:
+		return "Created";
+	case 204:
+		return "No Content";
+	case 206:
+		return "Partial Content";
+	case 301:
+		return "Moved Permanently";
+	case 302:
+		return "Found";
+	case 304:
+		return "Not Modified";
+	case 307:
+		return "Temporary Redirect";
+	case 308:
+		return "Permanent Redirect";
+	case 400:
+		return "Bad Request";
+	case 401:
+		return "Unauthorized";
+	case 403:
+		return "Forbidden";
+	case 404:
+		return "Not Found";
+	case 405:
+		return "Method Not Allowed";
+	case 408:
+		return "Request Timeout";
+	case 429:
+		return "Too Many Requests";
+	case 500:
+		return "Internal Server Error";
+	case 501:
+		return "Not Implemented";
+	case 502:
+		return "Bad Gateway";
+	case 503:
+		return "Service Unavailable";
+	case 504:
+		return "Gateway Timeout";
+	default:
+		return "Unknown Status";
+	}
+}
+
+/*!
+ * \internal
+ * \brief Queue a post, replacing a waiting post for the same node if the queue is backing up
+ * \note Must be called with statpost_lock held
+ * \retval 0 on success
+ * \retval -1 if the queue is full
+ */
+static int statpost_enqueue(struct rpt *myrpt, char *url)
+{
+	struct rpt_statpost_req *req;
+	unsigned int i;
+
+	if (statpost_len >= RPT_STATPOST_COALESCE) {
+		for (i = 0; i < statpost_len; i++) {
+			req = &statpost_queue[(statpost_head + i) % RPT_STATPOST_QUEUE];
+			if (req->myrpt == myrpt) {
+				/* Only the newest status matters */
+				ast_free(req->url);
+				req->url = url;
+				statpost_stats.coalesced++;
+				return 0;
+			}
+		}
+	}
+	if (statpost_len == RPT_STATPOST_QUEUE) {
+		return -1;
+	}
+	req = &statpost_queue[(statpost_head + statpost_len) % RPT_STATPOST_QUEUE];
+	req->myrpt = myrpt;
+	req->url = url;
+	statpost_len++;
+	statpost_stats.queued++;
+	return 0;
+}
+
+void rpt_statpost(struct rpt *myrpt, struct ast_str *pairs)
+{
+	time_t now;
+	unsigned int seq;
+	char *url;
+	int res;
+
+	if (!myrpt->p.statpost_url) {
+		return;
+	}
+
+	ast_mutex_lock(&myrpt->statpost_lock);
+	seq = ++myrpt->statpost_seqno;
+	ast_mutex_unlock(&myrpt->statpost_lock);
+
+	time(&now);
+	if (ast_asprintf(&url, "%s?node=%s&time=%u&seqno=%u%s", myrpt->p.statpost_url, myrpt->name, (unsigned int) now, seq,
+			ast_str_buffer(pairs)) < 0) {
+		return;
+	}
+
+	/* The worker makes the actual cURL call, so we can continue without blocking. */
+	ast_debug(4, "Making statpost to %s\n", url);
+	ast_mutex_lock(&statpost_lock);
+	res = statpost_thread == AST_PTHREADT_NULL || statpost_stop ? -1 : statpost_enqueue(myrpt, url);
+	if (res) {
+		statpost_stats.dropped++;
+	} else {
+		ast_cond_signal(&statpost_cond);
+	}
+	ast_mutex_unlock(&statpost_lock);
+
+	if (res) {
+		ast_log(LOG_WARNING, "statpost queue full, dropped post for node %s\n", myrpt->name);
+		ast_free(url);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Start sending a post on an idle transfer
+ * \retval 0 on success
+ * \retval -1 on failure
+ */
+static int statpost_start(CURLM *multi, struct rpt_statpost_xfer *xfer, struct rpt_statpost_req *req)
+{
+	if (!xfer->curl) {
+		xfer->curl = curl_easy_init();
+		if (!xfer->curl) {
+			return -1;
+		}
+		curl_easy_setopt(xfer->curl, CURLOPT_WRITEFUNCTION, writefunction);
+		curl_easy_setopt(xfer->curl, CURLOPT_WRITEDATA, &xfer->response);
+		/*
+		 *	The option setting below is the default, so there's no need to set it.
+		 *
+		 *	curl_easy_setopt(curl, CURLOPT_IPRESOLVE, (long)CURL_IPRESOLVE_WHATEVER);
+		 */
+		curl_easy_setopt(xfer->curl, CURLOPT_USERAGENT, AST_CURL_USER_AGENT);
+		curl_easy_setopt(xfer->curl, CURLOPT_ERRORBUFFER, xfer->error_buffer);
+		curl_easy_setopt(xfer->curl, CURLOPT_TCP_KEEPALIVE, 1L);
+		curl_easy_setopt(xfer->curl, CURLOPT_TIMEOUT, (long) RPT_STATPOST_TIMEOUT);
+		curl_easy_setopt(xfer->curl, CURLOPT_NOSIGNAL, 1L);
+	}
+	ast_str_reset(xfer->response);
+	xfer->error_buffer[0] = '\0';
+	curl_easy_setopt(xfer->curl, CURLOPT_URL, req->url);
+	if (curl_multi_add_handle(multi, xfer->curl) != CURLM_OK) {
+		return -1;
+	}
+	xfer->req = *req;
+	return 0;
+}
+
+/*! \brief Check the result of a finished post */
+static void statpost_done(CURLM *multi, struct rpt_statpost_xfer *xfer, CURLcode res)
+{
+	int failed = 0;
+	long rescode = 0;
+	struct rpt *myrpt = xfer->req.myrpt;
+	char *url = xfer->req.url;
+
+	if (res != CURLE_OK) {
+		if (*xfer->error_buffer) { /* Anything in the error buffer? */
+			failed = 1;
+			if (!myrpt->last_statpost_failed) {
+				ast_log(LOG_WARNING, "statpost to URL '%s' failed with error: %s\n", url, xfer->error_buffer);
+			}
+		} else {
+			failed = 1;
+			if (!myrpt->last_statpost_failed) {
+				ast_log(LOG_WARNING, "statpost to URL '%s' failed with error: %s\n", url, curl_easy_strerror(res));
+			}
+		}
+	} else {
+		curl_easy_getinfo(xfer->curl, CURLINFO_RESPONSE_CODE, &rescode);
+		if (!is_http_success(rescode)) {
+			failed = 1;
+			if (!myrpt->last_statpost_failed) {
+				ast_log(LOG_WARNING, "statpost to URL '%s' failed with code %ld: %s\n", url, rescode, http_status_text(rescode));
+			}
+		}
+	}
+	myrpt->last_statpost_failed = ((failed) ? 1 : 0);
+
+	ast_debug(5, "Response: %s\n", ast_str_buffer(xfer->response));
+	curl_multi_remove_handle(multi, xfer->curl);
+	ast_free(xfer->req.url);
+	xfer->req.url = NULL;
+
+	ast_mutex_lock(&statpost_lock);
+	if (failed) {
+		statpost_stats.failed++;
+	} else {
+		statpost_stats.sent++;
+	}
+	ast_mutex_unlock(&statpost_lock);
+}
+
+/*!
+ * \brief Status post worker
+ * All transfers share a curl multi handle, so connections to the status
+ * server are kept alive and reused between posts.
+ */
+static void *statpost_worker(void *data)
+{
+	struct rpt_statpost_xfer xfers[RPT_STATPOST_TRANSFERS];
+	struct rpt_statpost_req req;
+	CURLM *multi = data;
+	CURLMsg *msg;
+	int i, running = 0, active = 0, msgs;
+
+	memset(xfers, 0, sizeof(xfers));
+	for (i = 0; i < RPT_STATPOST_TRANSFERS; i++) {
+		xfers[i].response = ast_str_create(RPT_AST_STR_INIT_SIZE);
+		if (!xfers[i].response) {
+			ast_log(LOG_ERROR, "Statpost worker could not start, status posts will be dropped\n");
+			/* Nothing would ever take posts off the queue, so stop accepting them */
+			ast_mutex_lock(&statpost_lock);
+			statpost_stop = 1;
+			ast_mutex_unlock(&statpost_lock);
+			goto done;
+		}
+	}
+
+	for (;;) {
+		ast_mutex_lock(&statpost_lock);
+		if (!active) {
+			while (!statpost_len && !statpost_stop) {
+				ast_cond_wait(&statpost_cond, &statpost_lock);
+			}
+		}
+		if (statpost_stop) {
+			ast_mutex_unlock(&statpost_lock);
+			break;
+		}
+		/* Start as many waiting posts as we have idle transfers */
+		for (i = 0; i < RPT_STATPOST_TRANSFERS && statpost_len; i++) {
+			if (xfers[i].req.url) {
+				continue;
+			}
+			req = statpost_queue[statpost_head];
+			statpost_head = (statpost_head + 1) % RPT_STATPOST_QUEUE;
+			statpost_len--;
+			ast_mutex_unlock(&statpost_lock);
+			if (statpost_start(multi, &xfers[i], &req)) {
+				ast_log(LOG_WARNING, "Could not start statpost to URL '%s'\n", req.url);
+				ast_free(req.url);
+				ast_mutex_lock(&statpost_lock);
+				statpost_stats.failed++;
+				continue;
+			}
+			active++;
+			ast_mutex_lock(&statpost_lock);
+		}
+		ast_mutex_unlock(&statpost_lock);
+
+		curl_multi_perform(multi, &running);
+		while ((msg = curl_multi_info_read(multi, &msgs))) {
+			if (msg->msg != CURLMSG_DONE) {
+				continue;
+			}
+			for (i = 0; i < RPT_STATPOST_TRANSFERS; i++) {
+				if (xfers[i].req.url && xfers[i].curl == msg->easy_handle) {
+					statpost_done(multi, &xfers[i], msg->data.result);
+					active--;
+					break;
+				}
+			}
+		}
+		if (active) {
+			/* Short timeout, so newly queued posts don't wait long for a transfer */
+			curl_multi_wait(multi, NULL, 0, 100, NULL);
+		}
+	}
+
+done:
+	for (i = 0; i < RPT_STATPOST_TRANSFERS; i++) {
+		if (xfers[i].curl) {
+			if (xfers[i].req.url) {
+				curl_multi_remove_handle(multi, xfers[i].curl);
+				ast_free(xfers[i].req.url);
+			}
+			curl_easy_cleanup(xfers[i].curl);
+		}
+		ast_free(xfers[i].response);
+	}
+	curl_multi_cleanup(multi);
+	return NULL;
+}
+
+int rpt_statpost_init(void)
+{
+	CURLM *multi;
+
+	memset(&statpost_stats, 0, sizeof(statpost_stats));
+	statpost_head = statpost_len = 0;
+	statpost_stop = 0;
+	multi = curl_multi_init();
+	if (!multi) {
+		ast_log(LOG_ERROR, "Could not create statpost curl handle\n");
+		return -1;
+	}
+	ast_cond_init(&statpost_cond, NULL);
+	if (ast_pthread_create(&statpost_thread, NULL, statpost_worker, multi)) {
+		ast_log(LOG_ERROR, "Could not start statpost worker\n");
+		statpost_thread = AST_PTHREADT_NULL;
+		ast_cond_destroy(&statpost_cond);
+		curl_multi_cleanup(multi);
+		return -1;
+	}
+	return 0;
+}
+
+void rpt_statpost_cleanup(void)
+{
+	if (statpost_thread == AST_PTHREADT_NULL) {
+		return;
+	}
+	ast_mutex_lock(&statpost_lock);
+	statpost_stop = 1;
+	ast_cond_signal(&statpost_cond);
+	ast_mutex_unlock(&statpost_lock);
+
+	pthread_join(statpost_thread, NULL);
+
+	ast_mutex_lock(&statpost_lock);
+	statpost_thread = AST_PTHREADT_NULL;
+	/* Anything still waiting is dropped */
+	while (statpost_len) {
+		ast_free(statpost_queue[statpost_head].url);
+		statpost_head = (statpost_head + 1) % RPT_STATPOST_QUEUE;
+		statpost_len--;
+	}
+	ast_mutex_unlock(&statpost_lock);
+	ast_cond_destroy(&statpost_cond);
+
+#ifdef TEST_FRAMEWORK
+	if (statpost_test_rpt) {
+		ast_mutex_destroy(&statpost_test_rpt->statpost_lock);
+		ast_free(statpost_test_rpt);
+		statpost_test_rpt = NULL;
+	}
+#endif
+}
+
+void rpt_statpost_get_stats(struct rpt_statpost_stats *stats)
+{
+	ast_mutex_lock(&statpost_lock);
+	*stats = statpost_stats;
+	stats->waiting = statpost_len;
+	ast_mutex_unlock(&statpost_lock);
+}
+
+#ifdef TEST_FRAMEWORK
+/*! \brief Most connections the test server accepts */
+#define STATPOST_TEST_CLIENTS 8
+
+/*! \brief Posts the test makes while the server holds its answers */
+#define STATPOST_TEST_BURST 40
+
+/*! \brief A local HTTP server that records the posts it receives */
+struct statpost_test_server {
+	int listener;
+	int port;
+	pthread_t thread;
+	ast_mutex_t lock; /*!< \brief Protects everything below */
+	int stop;
+	int hold;	  /*!< \brief Don't answer requests while set */
+	int accepted; /*!< \brief Connections accepted */
+	int requests; /*!< \brief Requests received */
+	int answered; /*!< \brief Requests answered */
+	unsigned int maxseqno; /*!< \brief Newest post received, coalesced posts can arrive out of order */
+	int clients[STATPOST_TEST_CLIENTS];
+	int pending[STATPOST_TEST_CLIENTS]; /*!< \brief Requests waiting for an answer on each connection */
+	char buf[STATPOST_TEST_CLIENTS][2048];
+	int len[STATPOST_TEST_CLIENTS];
+};
+
+/*! \brief Record the complete requests received on a connection */
+static void statpost_test_parse(struct statpost_test_server *srv, int c)
+{
+	char *end, *seqno;
+
+	srv->buf[c][srv->len[c]] = '\0';
+	while ((end = strstr(srv->buf[c], "\r\n\r\n"))) {
+		*end = '\0';
+		seqno = strstr(srv->buf[c], "&seqno=");
+		ast_mutex_lock(&srv->lock);
+		if (seqno) {
+			srv->maxseqno = MAX(srv->maxseqno, strtoul(seqno + 7, NULL, 10));
+		}
+		srv->requests++;
+		srv->pending[c]++;
+		ast_mutex_unlock(&srv->lock);
+		end += 4;
+		srv->len[c] -= end - srv->buf[c];
+		memmove(srv->buf[c], end, srv->len[c] + 1);
+	}
+}
+
+static void *statpost_test_server_thread(void *data)
+{
+	static const char response[] = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 2\r\n\r\nOK";
+	struct statpost_test_server *srv = data;
+	struct pollfd pfds[STATPOST_TEST_CLIENTS + 1];
+	int c, res;
+
+	for (;;) {
+		ast_mutex_lock(&srv->lock);
+		if (srv->stop) {
+			ast_mutex_unlock(&srv->lock);
+			break;
+		}
+		/* Answer everything waiting once the test lets us */
+		for (c = 0; !srv->hold && c < STATPOST_TEST_CLIENTS; c++) {
+			for (; srv->pending[c]; srv->pending[c]--) {
+				if (send(srv->clients[c], response, strlen(response), MSG_NOSIGNAL) > 0) {
+					srv->answered++;
+				}
+			}
+		}
+		ast_mutex_unlock(&srv->lock);
+
+		pfds[0].fd = srv->listener;
+		pfds[0].events = POLLIN;
+		for (c = 0; c < STATPOST_TEST_CLIENTS; c++) {
+			pfds[c + 1].fd = srv->clients[c];
+			pfds[c + 1].events = POLLIN;
+		}
+		if (ast_poll(pfds, STATPOST_TEST_CLIENTS + 1, 10) <= 0) {
+			continue;
+		}
+		if (pfds[0].revents & POLLIN) {
+			int fd = accept(srv->listener, NULL, NULL);
+
+			for (c = 0; fd >= 0 && c < STATPOST_TEST_CLIENTS; c++) {
+				if (srv->clients[c] < 0) {
+					ast_mutex_lock(&srv->lock);
+					srv->clients[c] = fd;
+					srv->accepted++;
+					ast_mutex_unlock(&srv->lock);
+					fd = -1;
+				}
+			}
+			if (fd >= 0) {
+				close(fd);
+			}
+		}
+		for (c = 0; c < STATPOST_TEST_CLIENTS; c++) {
+			if (srv->clients[c] < 0 || !(pfds[c + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+				continue;
+			}
+			res = recv(srv->clients[c], srv->buf[c] + srv->len[c], sizeof(srv->buf[c]) - srv->len[c] - 1, 0);
+			if (res <= 0) {
+				ast_mutex_lock(&srv->lock);
+				close(srv->clients[c]);
+				srv->clients[c] = -1;
+				srv->pending[c] = 0;
+				srv->len[c] = 0;
+				ast_mutex_unlock(&srv->lock);
+				continue;
+			}
+			srv->len[c] += res;
+			statpost_test_parse(srv, c);
+		}
+	}
+
+	for (c = 0; c < STATPOST_TEST_CLIENTS; c++) {
+		if (srv->clients[c] >= 0) {
+			close(srv->clients[c]);
+		}
+	}
+	return NULL;
+}
+
+static int statpost_test_server_start(struct statpost_test_server *srv)
+{
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t sinlen = sizeof(sin);
+	int c;
+
+	memset(srv, 0, sizeof(*srv));
+	for (c = 0; c < STATPOST_TEST_CLIENTS; c++) {
+		srv->clients[c] = -1;
+	}
+	srv->listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (srv->listener < 0) {
+		return -1;
+	}
+	if (bind(srv->listener, (struct sockaddr *) &sin, sizeof(sin)) || listen(srv->listener, STATPOST_TEST_CLIENTS) ||
+		getsockname(srv->listener, (struct sockaddr *) &sin, &sinlen)) {
+		close(srv->listener);
+		return -1;
+	}
+	srv->port = ntohs(sin.sin_port);
+	ast_mutex_init(&srv->lock);
+	if (ast_pthread_create(&srv->thread, NULL, statpost_test_server_thread, srv)) {
+		ast_mutex_destroy(&srv->lock);
+		close(srv->listener);
+		return -1;
+	}
+	return 0;
+}
+
+static void statpost_test_server_stop(struct statpost_test_server *srv)
+{
+	ast_mutex_lock(&srv->lock);
+	srv->stop = 1;
+	ast_mutex_unlock(&srv->lock);
+	pthread_join(srv->thread, NULL);
+	close(srv->listener);
+	ast_mutex_destroy(&srv->lock);
+}
+
+/*!
+ * \brief Wait for the test server to have answered the posts up to a sequence number
+ * \retval 0 if it did within a few seconds, and nothing more was waiting to be sent
+ */
+static int statpost_test_wait(struct statpost_test_server *srv, unsigned int seqno)
+{
+	struct rpt_statpost_stats stats;
+	int i, requests = -1, res = -1;
+
+	for (i = 0; res && i < 500; i++) {
+		usleep(10000);
+		rpt_statpost_get_stats(&stats);
+		ast_mutex_lock(&srv->lock);
+		/* Settled once nothing new arrived for a poll */
+		if (srv->maxseqno == seqno && srv->answered == srv->requests && !stats.waiting && srv->requests == requests) {
+			res = 0;
+		}
+		requests = srv->requests;
+		ast_mutex_unlock(&srv->lock);
+	}
+	return res;
+}
+
+AST_TEST_DEFINE(statpost_loopback_test)
+{
+	struct statpost_test_server srv;
+	struct ast_str *pairs;
+	char url[64];
+	unsigned int seqno;
+	int i, burst, accepted, res = AST_TEST_PASS;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "statpost_loopback";
+		info->category = "/apps/app_rpt/statpost/";
+		info->summary = "Status posts are delivered, reuse their connection and coalesce";
+		info->description = "Post node status to a local HTTP server, checking that each post arrives and that "
+							"posts share one connection, then hold the server's answers while posting a burst and "
+							"check that the waiting posts for the node were coalesced down to the newest one.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	if (statpost_thread == AST_PTHREADT_NULL) {
+		ast_test_status_update(test, "The statpost worker isn't running\n");
+		return AST_TEST_FAIL;
+	}
+	if (!statpost_test_rpt) {
+		statpost_test_rpt = ast_calloc(1, sizeof(*statpost_test_rpt));
+		if (!statpost_test_rpt) {
+			return AST_TEST_FAIL;
+		}
+		ast_mutex_init(&statpost_test_rpt->statpost_lock);
+		statpost_test_rpt->name = "1999";
+	}
+	pairs = ast_str_create(32);
+	if (!pairs) {
+		return AST_TEST_FAIL;
+	}
+	if (statpost_test_server_start(&srv)) {
+		ast_test_status_update(test, "Could not start the loopback server\n");
+		ast_free(pairs);
+		return AST_TEST_FAIL;
+	}
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/statpost", srv.port);
+	statpost_test_rpt->p.statpost_url = url;
+	ast_str_set(&pairs, 0, "&keyed=0");
+
+	/* Two posts one after the other arrive on the same connection */
+	for (i = 1; i <= 2; i++) {
+		rpt_statpost(statpost_test_rpt, pairs);
+		ast_mutex_lock(&statpost_test_rpt->statpost_lock);
+		seqno = statpost_test_rpt->statpost_seqno;
+		ast_mutex_unlock(&statpost_test_rpt->statpost_lock);
+		if (statpost_test_wait(&srv, seqno)) {
+			ast_test_status_update(test, "Post %d was not delivered\n", i);
+			res = AST_TEST_FAIL;
+			goto done;
+		}
+	}
+	ast_mutex_lock(&srv.lock);
+	accepted = srv.accepted;
+	ast_mutex_unlock(&srv.lock);
+	ast_test_status_update(test, "2 posts delivered on %d connection(s)\n", accepted);
+	if (accepted != 1) {
+		res = AST_TEST_FAIL;
+		goto done;
+	}
+
+	/* While the server is slow, the queue backs up and the node's posts are coalesced */
+	ast_mutex_lock(&srv.lock);
+	srv.hold = 1;
+	ast_mutex_unlock(&srv.lock);
+	for (i = 0; i < STATPOST_TEST_BURST; i++) {
+		rpt_statpost(statpost_test_rpt, pairs);
+	}
+	ast_mutex_lock(&statpost_test_rpt->statpost_lock);
+	seqno = statpost_test_rpt->statpost_seqno;
+	ast_mutex_unlock(&statpost_test_rpt->statpost_lock);
+	ast_mutex_lock(&srv.lock);
+	srv.hold = 0;
+	ast_mutex_unlock(&srv.lock);
+	if (statpost_test_wait(&srv, seqno)) {
+		ast_test_status_update(test, "The newest post was not delivered\n");
+		res = AST_TEST_FAIL;
+		goto done;
+	}
+	ast_mutex_lock(&srv.lock);
+	burst = srv.requests - 2;
+	ast_mutex_unlock(&srv.lock);
+	ast_test_status_update(test, "%d posts in a burst delivered as %d\n", STATPOST_TEST_BURST, burst);
+	/* The worker holds at most one post per transfer, the rest queue up */
+	if (burst >= STATPOST_TEST_BURST || burst > RPT_STATPOST_COALESCE + RPT_STATPOST_TRANSFERS) {
+		res = AST_TEST_FAIL;
+	}
+
+done:
+	statpost_test_rpt->p.statpost_url = NULL;
+	statpost_test_server_stop(&srv);
+	ast_free(pairs);
+	return res;
+}
+
+void rpt_statpost_tests_register(void)
+{
+	AST_TEST_REGISTER(statpost_loopback_test);
+}
+
+void rpt_statpost_tests_unregister(void)
+{
+	AST_TEST_UNREGISTER(statpost_loopback_test);
+}
+#endif
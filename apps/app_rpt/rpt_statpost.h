@@ -0,0 +1,58 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT status posting
+ *
+ * Status posts (statpost_url) are queued for a single worker thread,
+ * which sends them over a shared curl multi handle so connections to the
+ * status server are kept alive and reused.  Once the queue starts backing
+ * up, a new post replaces any post for the same node that is still
+ * waiting, since only the newest status matters.
+ */
+
+/*! \brief Most posts waiting to be sent */
+#define RPT_STATPOST_QUEUE 128
+
+/*! \brief Once this many posts are waiting, posts for the same node are coalesced */
+#define RPT_STATPOST_COALESCE 16
+
+/*! \brief Status post counters */
+struct rpt_statpost_stats {
+	unsigned int queued;
+	unsigned int sent;
+	unsigned int failed;
+	unsigned int coalesced; /*!< \brief Replaced by a newer post for the same node before being sent */
+	unsigned int dropped;	/*!< \brief Not queued because the queue was full */
+	unsigned int waiting;
+};
+
+/*!
+ * \brief Post status data to the node's statpost_url
+ * \param myrpt
+ * \param pairs URL encoded data to append to the query string, starting with '&'
+ */
+void rpt_statpost(struct rpt *myrpt, struct ast_str *pairs);
+
+/*!
+ * \brief Start the status post worker
+ * \retval 0 on success
+ * \retval -1 on failure
+ */
+int rpt_statpost_init(void);
+
+/*!
+ * \brief Stop the status post worker, dropping anything not yet sent
+ */
+void rpt_statpost_cleanup(void);
+
+/*!
+ * \brief Get the status post counters
+ * \param stats Filled in with the current counters
+ */
+void rpt_statpost_get_stats(struct rpt_statpost_stats *stats);
+
+#ifdef TEST_FRAMEWORK
+void rpt_statpost_tests_register(void);
+void rpt_statpost_tests_unregister(void);
+#endif
@@ -13,6 +13,10 @@
 #include "asterisk/say.h"
 #include "asterisk/indications.h"
 #include "asterisk/format_cache.h" /* use ast_format_slin */
+#include "asterisk/vector.h"
+#ifdef TEST_FRAMEWORK
+#include "asterisk/test.h"
+#endif
 
 #include "app_rpt.h"
 
@@ -34,6 +38,7 @@
 #include "rpt_capabilities.h"
 #include "rpt_xcat.h"
 #include "rpt_rig.h"
+#include "rpt_tonecache.h"
 
 #define TELEM_TAIL_FILE_EXTN "TAIL"
 #define TELEM_TIME_EXTN "TIME"
@@ -80,6 +85,16 @@ static int rpt_telem_datastore(struct ast_channel *chan, time_t t)
 	struct ast_datastore *datastore;
 	time_t *time_data;
 
+	/* Telemetry channels are reused, update the time if one is already stored */
+	ast_channel_lock(chan);
+	datastore = ast_channel_datastore_find(chan, &telemetry_datastore, NULL);
+	if (datastore && datastore->data) {
+		*(time_t *) datastore->data = t;
+		ast_channel_unlock(chan);
+		return 0;
+	}
+	ast_channel_unlock(chan);
+
 	datastore = ast_datastore_alloc(&telemetry_datastore, NULL);
 	if (!datastore) {
 		return -1;
@@ -699,10 +714,10 @@ void cancel_pfxtone(struct rpt *myrpt)
 static int telm_qwrite_cb(void *obj, void *arg, int flags)
 {
 	struct rpt_link *link = obj;
-	struct ast_frame *wf = arg;
+	struct rpt_text_payload *payload = arg;
 
 	if (link->chan && (link->mode == MODE_TRANSCEIVE)) {
-		rpt_qwrite(link, wf);
+		rpt_qwrite_payload(link, payload);
 	}
 
 	return 0;
@@ -712,6 +727,7 @@ static void send_tele_link(struct rpt *myrpt, char *cmd)
 {
 	int len;
 	char *str;
+	struct rpt_text_payload *payload;
 	struct ast_frame wf = {
 		.frametype = AST_FRAME_TEXT,
 		.src = __PRETTY_FUNCTION__,
@@ -725,16 +741,21 @@ static void send_tele_link(struct rpt *myrpt, char *cmd)
 	/* give it to everyone */
 	wf.data.ptr = str;
 	wf.datalen = len + 1;
+	payload = rpt_text_payload_alloc(&wf);
+	ast_free(str);
 	rpt_mutex_lock(&myrpt->lock);
-	if (myrpt->links) {
-		ao2_callback(myrpt->links, OBJ_MULTIPLE | OBJ_NODATA, telm_qwrite_cb, &wf);
+	if (payload && myrpt->links) {
+		ao2_callback(myrpt->links, OBJ_MULTIPLE | OBJ_NODATA, telm_qwrite_cb, payload);
 	}
 	rpt_mutex_unlock(&myrpt->lock);
-	ast_free(str);
+	ao2_cleanup(payload);
 
 	rpt_telemetry(myrpt, VARCMD, cmd);
 }
 
+/*! \brief Most segments in a telemetry tone sequence */
+#define TONE_TELEMETRY_MAX_SEGS 64
+
 /*! \brief Send telemetry tones */
 static int send_tone_telemetry(struct ast_channel *chan, const char *tonestring)
 {
@@ -743,7 +764,11 @@ static int send_tone_telemetry(struct ast_channel *chan, const char *tonestring)
 	int f1, f2;
 	int duration;
 	int amplitude;
-	int res;
+	int res, i;
+	int nsegs = 0;
+	struct rpt_tone_seg segs[TONE_TELEMETRY_MAX_SEGS];
+	struct rpt_tone_audio *audio;
+	char *key;
 
 	res = 0;
 
@@ -753,7 +778,7 @@ static int send_tone_telemetry(struct ast_channel *chan, const char *tonestring)
 
 	p = stringp = ast_strdup(tonestring);
 
-	for (; tonestring;) {
+	while (stringp && nsegs < TONE_TELEMETRY_MAX_SEGS - 1) {
 		tonesubset = strsep(&stringp, ")");
 		if (!tonesubset) {
 			break;
@@ -763,18 +788,37 @@ static int send_tone_telemetry(struct ast_channel *chan, const char *tonestring)
 			break;
 		}
 
-		res = play_tone_pair(chan, f1, f2, duration, amplitude);
-		if (res) {
-			break;
-		}
+		segs[nsegs].f1 = f1;
+		segs[nsegs].f2 = f2;
+		segs[nsegs].duration = duration;
+		segs[nsegs].amplitude = amplitude < 1 ? 8192 : amplitude; /* Same default as ast_tonepair_start */
+		nsegs++;
 	}
 
 	if (p) {
 		ast_free(p);
 	}
 
-	if (!res) {
-		res = play_tone_pair(chan, 0, 0, 100, 0); /* This is needed to ensure the last tone segment is timed correctly */
+	/* This is needed to ensure the last tone segment is timed correctly */
+	segs[nsegs].f1 = 0;
+	segs[nsegs].f2 = 0;
+	segs[nsegs].duration = 100;
+	segs[nsegs].amplitude = 0;
+	nsegs++;
+
+	audio = NULL;
+	if (ast_asprintf(&key, "T/%s", tonestring) >= 0) {
+		audio = rpt_tonecache_get(key, segs, nsegs);
+		ast_free(key);
+	}
+
+	if (audio) {
+		res = rpt_tonecache_play(chan, audio);
+		ao2_ref(audio, -1);
+	} else {
+		for (i = 0; i < nsegs && !res; i++) {
+			res = play_tone_pair(chan, segs[i].f1, segs[i].f2, segs[i].duration, segs[i].amplitude);
+		}
 	}
 
 	if (!res) {
@@ -1457,16 +1501,205 @@ static int handle_varcmd_tele(struct rpt *myrpt, struct ast_channel *mychannel,
 	return 0;
 }
 
+/*! \brief Wait between idle telemetry channel checks, in ms */
+#define RPT_TELE_IDLE_POLL 20
+
+/*! \brief Hang up idle telemetry channels after this many ms without a job */
+#define RPT_TELE_CHAN_IDLE 30000
+
+/*! \brief Telemetry executor lanes */
+enum rpt_tele_lane_type {
+	/*! \brief Announcements, played one at a time in priority order */
+	RPT_TELE_LANE_QUEUED,
+	/*!
+	 * \brief Courtesy tones and remote acknowledgements, which never wait behind announcements.
+	 * Each job gets its own thread, since unkeys wait out their hang time before playing.
+	 */
+	RPT_TELE_LANE_IMMEDIATE,
+};
+
+struct rpt_tele_exec;
+
+/*! \brief A telemetry executor thread and the jobs waiting for it */
+struct rpt_tele_lane {
+	struct rpt_tele_exec *exec;
+	pthread_t thread;
+	enum rpt_tele_lane_type type;
+	AST_VECTOR(, struct rpt_tele *) queue; /*!< \brief Waiting jobs, highest priority first.  Protected by myrpt->lock. */
+	struct ast_channel *chans[2];		   /*!< \brief Idle telemetry channels by enum rpt_conf_type, only used by the lane's thread */
+	struct timeval lastjob;
+};
+
+/*! \brief A node's telemetry executor */
+struct rpt_tele_exec {
+	struct rpt *myrpt;
+	ast_cond_t cond; /*!< \brief Signaled when a job is queued or finishes.  Used with myrpt->lock. */
+	rpt_bool stop:1;
+	struct rpt_tele_lane lanes[2];
+	int jobs;				   /*!< \brief Immediate job threads running.  Protected by myrpt->lock. */
+	struct ast_channel *spare; /*!< \brief Channel an immediate job gave back to its lane.  Protected by myrpt->lock. */
+};
+
+/*! \brief An immediate telemetry job running on its own thread */
+struct rpt_tele_job {
+	struct rpt_tele_lane lane; /*!< \brief The job's own lane, holding the channel it was given */
+	struct rpt_tele *tele;
+};
+
+/*! \brief Modes that are played as soon as they are queued, not after the active telemetry */
+static int tele_immediate(enum rpt_tele_mode mode)
+{
+	switch (mode) {
+	case SETREMOTE:
+	case UNKEY:
+	case LINKUNKEY:
+	case LOCUNKEY:
+	case COMPLETE:
+	case REMGO:
+	case REMCOMPLETE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*! \brief Order of queued announcements, higher first */
+static int tele_priority(enum rpt_tele_mode mode)
+{
+	switch (mode) {
+	case TIMEOUT:
+		return 2;
+	case ID:
+	case ID1:
+	case IDTALKOVER:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*!
+ * \internal
+ * \brief Discard the conference audio queued on an idle telemetry channel
+ * \retval 0 if the channel is still usable
+ * \retval -1 if it was hung up
+ */
+static int tele_chan_drain(struct ast_channel *chan)
+{
+	struct ast_frame *f;
+
+	if (ast_check_hangup(chan)) {
+		return -1;
+	}
+	while (ast_waitfor(chan, 0) > 0) {
+		f = ast_read(chan);
+		if (!f) {
+			return -1;
+		}
+		ast_frfree(f);
+	}
+	return 0;
+}
+
+/*!
+ * \internal
+ * \brief Get a telemetry channel in a conference, reusing an idle one if possible
+ * \return Channel the caller owns until it is given back with tele_lane_release(), or NULL on failure
+ */
+static struct ast_channel *tele_lane_channel(struct rpt_tele_lane *lane, struct rpt *myrpt, enum rpt_conf_type type)
+{
+	struct ast_channel *chan = lane->chans[type];
+	struct ast_format_cap *cap;
+
+	lane->chans[type] = NULL;
+	if (chan && tele_chan_drain(chan)) {
+		ast_hangup(chan);
+		chan = NULL;
+	}
+
+	if (!chan) {
+		cap = ast_format_cap_alloc(AST_FORMAT_CAP_FLAG_DEFAULT);
+		if (!cap) {
+			return NULL;
+		}
+		if (ast_format_cap_append(cap, ast_format_slin, 0)) {
+			ast_log(LOG_ERROR, "Failed to append slin to cap\n");
+			ao2_ref(cap, -1);
+			return NULL;
+		}
+
+		/* allocate a local channel thru asterisk and call the correct conference */
+		chan = rpt_request_telem_chan(cap, "Telemetry");
+		ao2_ref(cap, -1);
+		if (!chan) {
+			return NULL;
+		}
+		ast_debug(1, "Requested channel %s\n", ast_channel_name(chan));
+
+		if (rpt_conf_add(chan, myrpt, type)) {
+			ast_log(LOG_WARNING, "Unable to join local channel to conference %s\n", type == RPT_CONF ? RPT_CONF_NAME : RPT_TXCONF_NAME);
+			ast_hangup(chan);
+			return NULL;
+		}
+	}
+
+	/* May have been ducked during the previous job */
+	if (ast_audiohook_volume_set_float(chan, AST_AUDIOHOOK_DIRECTION_WRITE, myrpt->p.telemnomgain)) {
+		ast_log(LOG_WARNING, "Setting the volume on channel %s to %2.2f failed", ast_channel_name(chan), myrpt->p.telemnomgain);
+	}
+	return chan;
+}
+
+/*!
+ * \internal
+ * \brief Give a telemetry channel back to the lane for the next job
+ */
+static void tele_lane_release(struct rpt_tele_lane *lane, enum rpt_conf_type type, struct ast_channel *chan)
+{
+	lane->lastjob = ast_tvnow();
+	if (lane->chans[type] || ast_check_hangup(chan)) {
+		/* Killed or hung up while playing, don't reuse it */
+		ast_hangup(chan);
+		return;
+	}
+	lane->chans[type] = chan;
+}
+
+/*!
+ * \internal
+ * \brief Keep a lane's idle channels drained, and hang them up once they've been idle for a while
+ * \retval 1 if the lane still has idle channels
+ * \retval 0 if not
+ */
+static int tele_lane_idle(struct rpt_tele_lane *lane)
+{
+	int i, idle = 0;
+	int expired = ast_tvdiff_ms(ast_tvnow(), lane->lastjob) >= RPT_TELE_CHAN_IDLE;
+
+	for (i = 0; i < ARRAY_LEN(lane->chans); i++) {
+		if (!lane->chans[i]) {
+			continue;
+		}
+		if (expired || tele_chan_drain(lane->chans[i])) {
+			ast_hangup(lane->chans[i]);
+			lane->chans[i] = NULL;
+			continue;
+		}
+		idle = 1;
+	}
+	return idle;
+}
+
 /*
- * Threaded telemetry handling routines - goes hand in hand with handle_varcmd_tele (see above)
+ * Telemetry handling routines - goes hand in hand with handle_varcmd_tele (see above)
  * This routine does a lot of processing of what you "hear" when app_rpt is running.
  * Note that this routine could probably benefit from an overhaul to make it easier to read/debug.
  * Many of the items here seem to have been bolted onto this routine as app_rpt has evolved.
+ * It is run by the node's telemetry executor once it is the job's turn.
  */
-void *rpt_tele_thread(void *this)
+static void rpt_tele_run(struct rpt_tele_lane *lane, struct rpt_tele *mytele)
 {
 	int res = 0, pbx = 0, haslink, hastx, hasremote, imdone = 0, unkeys_queued, x, n = 1;
-	struct rpt_tele *mytele = (struct rpt_tele *) this;
 	struct rpt_tele *tlist;
 	struct rpt *myrpt;
 	struct rpt_link *l;
@@ -1484,8 +1717,7 @@ void *rpt_tele_thread(void *this)
 	unsigned long long u_mono;
 	char gps_data[100], lat[LAT_SZ + 1], lon[LON_SZ + 1], elev[ELEV_SZ + 1], c;
 	struct ast_str *lbuf = NULL;
-	enum rpt_conf_type type;
-	struct ast_format_cap *cap;
+	enum rpt_conf_type type = RPT_TXCONF;
 
 	/* get a pointer to myrpt */
 	myrpt = mytele->rpt;
@@ -1510,62 +1742,18 @@ void *rpt_tele_thread(void *this)
 		ident = "";
 		id_malloc = 0;
 	}
-	/* Wait for previous telemetry to finish before we start so we're not speaking on top of each other. */
-	ast_debug(5, "Queued telemetry, active_telem = %p, mytele = %p\n", myrpt->active_telem, mytele);
-
-	while (myrpt->active_telem && ((myrpt->active_telem->mode == PAGE) || (myrpt->active_telem->mode == MDC1200))) {
-		rpt_mutex_unlock(&myrpt->lock);
-		usleep(100000);
-		rpt_mutex_lock(&myrpt->lock);
-	}
 
-	rpt_mutex_unlock(&myrpt->lock);
-
-	while (!mytele->killed && (mytele->mode != SETREMOTE) && (mytele->mode != UNKEY) && (mytele->mode != LINKUNKEY) &&
-		   (mytele->mode != LOCUNKEY) && (mytele->mode != COMPLETE) && (mytele->mode != REMGO) && (mytele->mode != REMCOMPLETE)) {
-		rpt_mutex_lock(&myrpt->lock);
-
-		if ((!myrpt->active_telem) && (myrpt->tele.prev == mytele)) {
-			myrpt->active_telem = mytele;
-			rpt_mutex_unlock(&myrpt->lock);
-			break;
-		}
-
-		rpt_mutex_unlock(&myrpt->lock);
-		usleep(100000);
+	/* The executor only runs a queued job once the previous one is done,
+	 * so we're not speaking on top of each other. */
+	if (!mytele->killed && !tele_immediate(mytele->mode)) {
+		myrpt->active_telem = mytele;
 	}
 
 	ast_debug(5, "Beginning telemetry, active_telem = %p, mytele = %p\n", myrpt->active_telem, mytele);
 	if (mytele->killed) {
-		rpt_mutex_lock(&myrpt->lock);
-		goto abort;
-	}
-
-	cap = ast_format_cap_alloc(AST_FORMAT_CAP_FLAG_DEFAULT);
-	if (!cap) {
-		rpt_mutex_lock(&myrpt->lock);
-		goto abort;
-	}
-
-	if (ast_format_cap_append(cap, ast_format_slin, 0)) {
-		ast_log(LOG_ERROR, "Failed to append slin to cap\n");
-		ao2_ref(cap, -1);
-		rpt_mutex_lock(&myrpt->lock);
-		goto abort;
-	}
-
-	/* allocate a local channel thru asterisk and call the correct conference */
-	mychannel = rpt_request_telem_chan(cap, "Telemetry");
-	ao2_ref(cap, -1);
-	if (!mychannel) {
-		ast_log(LOG_WARNING, "Unable to obtain local channel (mode: %d)\n", mytele->mode);
-		rpt_mutex_lock(&myrpt->lock);
 		goto abort;
 	}
-
-	ast_debug(1, "Requested channel %s\n", ast_channel_name(mychannel));
-	ast_channel_ref(mychannel); /* Create a reference to prevent channel from being freed too soon */
-	mytele->chan = mychannel;
+	rpt_mutex_unlock(&myrpt->lock);
 
 	switch (mytele->mode) {
 	case ID1:
@@ -1580,16 +1768,18 @@ void *rpt_tele_thread(void *this)
 		break;
 	}
 
-	if (ast_audiohook_volume_set_float(mychannel, AST_AUDIOHOOK_DIRECTION_WRITE, myrpt->p.telemnomgain)) {
-		ast_log(LOG_WARNING, "Setting the volume on channel %s to %2.2f failed", ast_channel_name(mychannel), myrpt->p.telemnomgain);
-	}
-
-	if (rpt_conf_add(mychannel, myrpt, type)) {
-		ast_log(LOG_WARNING, "Unable to join local channel to conference %s\n", type == RPT_CONF ? RPT_CONF_NAME : RPT_TXCONF_NAME);
+	mychannel = tele_lane_channel(lane, myrpt, type);
+	if (!mychannel) {
+		ast_log(LOG_WARNING, "Unable to obtain local channel (mode: %d)\n", mytele->mode);
 		rpt_mutex_lock(&myrpt->lock);
 		goto abort;
 	}
 
+	ast_channel_ref(mychannel); /* Create a reference to prevent channel from being freed too soon */
+	rpt_mutex_lock(&myrpt->lock);
+	mytele->chan = mychannel;
+	rpt_mutex_unlock(&myrpt->lock);
+
 	res = 0;
 	switch (mytele->mode) {
 	case USEROUT:
@@ -1641,7 +1831,7 @@ void *rpt_tele_thread(void *this)
 		break;
 
 	case IDTALKOVER:
-		ast_debug(7, "Tracepoint IDTALKOVER: in rpt_tele_thread()\n");
+		ast_debug(7, "Tracepoint IDTALKOVER: in rpt_tele_run()\n");
 
 		val = ast_variable_retrieve(myrpt->cfg, nodename, "idtalkover");
 		if (val) {
@@ -1791,31 +1981,8 @@ void *rpt_tele_thread(void *this)
 		myrpt->unkeytocttimer = x; /* Must be protected as it is changed below */
 		rpt_mutex_unlock(&myrpt->lock);
 
-		/* If there's one already queued, don't do another */
-		unkeys_queued = 0;
-
-		tlist = myrpt->tele.next;
-		if (tlist != &myrpt->tele) {
-			rpt_mutex_lock(&myrpt->lock);
-
-			while (tlist != &myrpt->tele) {
-				if ((tlist->mode == UNKEY) || (tlist->mode == LOCUNKEY)) {
-					unkeys_queued++;
-				}
-
-				tlist = tlist->next;
-			}
-
-			rpt_mutex_unlock(&myrpt->lock);
-		}
-
-		if (unkeys_queued > 1) {
-			imdone = 1;
-			break;
-		}
-
 		/* Wait for the telemetry timer to expire */
-		/* Periodically check the timer since it can be re-initialized above */
+		/* Periodically check the timer since it can be re-initialized by another unkey (see tele_unkey_merge) */
 		while (myrpt->unkeytocttimer) {
 			int ctint;
 
@@ -1830,6 +1997,9 @@ void *rpt_tele_thread(void *this)
 			update_timer(&myrpt->unkeytocttimer, ctint, 0);
 			rpt_mutex_unlock(&myrpt->lock);
 		}
+		rpt_mutex_lock(&myrpt->lock);
+		mytele->ctwait = 0; /* Unkeys from now on get their own courtesy tone */
+		rpt_mutex_unlock(&myrpt->lock);
 
 		/*
 		 * Now, the carrier on the rptr rx should be gone.
@@ -1854,7 +2024,7 @@ treataslocal:
 		}
 
 		/* get all the nodes */
-		n = __mklinklist(myrpt, NULL, &lbuf, USE_FORMAT_RPT_LINK) + 1;
+		n = rpt_linklist_append(myrpt, NULL, &lbuf, USE_FORMAT_RPT_LINK) + 1;
 		rpt_mutex_unlock(&myrpt->lock);
 		strs = ast_malloc(n * sizeof(char *));
 		if (!strs) {
@@ -2053,6 +2223,9 @@ treataslocal:
 					rpt_mutex_unlock(&myrpt->lock);
 				}
 			}
+			rpt_mutex_lock(&myrpt->lock);
+			mytele->ctwait = 0;
+			rpt_mutex_unlock(&myrpt->lock);
 			goto treataslocal;
 		}
 		if (myrpt->p.nolocallinkct) {
@@ -2082,33 +2255,12 @@ treataslocal:
 
 		/* Reset the Unkey to CT timer */
 		x = get_wait_interval(myrpt, DLY_LINKUNKEY);
+		rpt_mutex_lock(&myrpt->lock);
 		mytele->mylink.linkunkeytocttimer = x; /* Must be protected as it is changed below */
-
-		/* If there's one already queued, don't do another */
-		unkeys_queued = 0;
-
-		tlist = myrpt->tele.next;
-		if (tlist != &myrpt->tele) {
-			rpt_mutex_lock(&myrpt->lock);
-
-			while (tlist != &myrpt->tele) {
-				if (tlist->mode == LINKUNKEY) {
-					unkeys_queued++;
-				}
-
-				tlist = tlist->next;
-			}
-
-			rpt_mutex_unlock(&myrpt->lock);
-		}
-
-		if (unkeys_queued > 1) {
-			imdone = 1;
-			break;
-		}
+		rpt_mutex_unlock(&myrpt->lock);
 
 		/* Wait for the telemetry timer to expire */
-		/* Periodically check the timer since it can be re-initialized above */
+		/* Periodically check the timer since it can be re-initialized by another unkey (see tele_unkey_merge) */
 		while (mytele->mylink.linkunkeytocttimer) {
 			int ctint;
 
@@ -2123,6 +2275,9 @@ treataslocal:
 			update_timer(&mytele->mylink.linkunkeytocttimer, ctint, 0);
 			rpt_mutex_unlock(&myrpt->lock);
 		}
+		rpt_mutex_lock(&myrpt->lock);
+		mytele->ctwait = 0;
+		rpt_mutex_unlock(&myrpt->lock);
 
 		unkeys_queued = 0;
 
@@ -2867,7 +3022,7 @@ treataslocal:
 
 		/* get all the nodes */
 		rpt_mutex_lock(&myrpt->lock);
-		n = __mklinklist(myrpt, NULL, &lbuf, USE_FORMAT_RPT_LINK) + 1;
+		n = rpt_linklist_append(myrpt, NULL, &lbuf, USE_FORMAT_RPT_LINK) + 1;
 		rpt_mutex_unlock(&myrpt->lock);
 
 		/* parse em */
@@ -3408,7 +3563,6 @@ treataslocal:
 		}
 
 		ast_stopstream(mychannel);
-		ast_hangup(mychannel);
 	}
 
 	rpt_mutex_lock(&myrpt->lock);
@@ -3428,8 +3582,12 @@ treataslocal:
 
 	telem_done(myrpt, mytele);
 	tele_link_remove(myrpt, mytele);
-	ast_channel_unref(mychannel);
 	rpt_mutex_unlock(&myrpt->lock);
+	if (!pbx) {
+		/* The PBX hangs up the channel when it is done with it, anything else can be reused */
+		tele_lane_release(lane, type, mychannel);
+	}
+	ast_channel_unref(mychannel);
 	ast_free(nodename);
 
 	if (id_malloc) {
@@ -3437,23 +3595,8 @@ treataslocal:
 	}
 
 	ast_free(mytele);
-#ifdef APP_RPT_LOCK_DEBUG
-	{
-		struct lockthread *t;
-
-		sleep(5);
-		ast_mutex_lock(&locklock);
-		t = get_lockthread(pthread_self());
-
-		if (t) {
-			memset(t, 0, sizeof(struct lockthread));
-		}
-
-		ast_mutex_unlock(&locklock);
-	}
-#endif
 	myrpt->noduck = 0;
-	return NULL;
+	return;
 abort:
 	telem_done(myrpt, mytele);
 abort2:
@@ -3469,13 +3612,334 @@ abort3:
 	ast_free(mytele);
 
 	if (mychannel) {
-		ast_hangup(mychannel);
+		ast_stopstream(mychannel);
+		tele_lane_release(lane, type, mychannel);
 		ast_channel_unref(mychannel);
 	}
+}
+
+/*!
+ * \internal
+ * \brief Check if a lane has a job it can start
+ * \note Must be called with myrpt->lock held
+ */
+static int tele_lane_ready(struct rpt_tele_lane *lane)
+{
+	struct rpt *myrpt = lane->exec->myrpt;
+
+	if (!AST_VECTOR_SIZE(&lane->queue)) {
+		return 0;
+	}
+	/* Nothing plays over a page or MDC1200 burst */
+	if (lane->type == RPT_TELE_LANE_IMMEDIATE && myrpt->active_telem &&
+		(myrpt->active_telem->mode == PAGE || myrpt->active_telem->mode == MDC1200)) {
+		return 0;
+	}
+	return 1;
+}
+
+/*! \brief Forget a finished telemetry thread's lock debugging state */
+static void tele_thread_done(void)
+{
+#ifdef APP_RPT_LOCK_DEBUG
+	struct lockthread *t;
+
+	ast_mutex_lock(&locklock);
+	t = get_lockthread(pthread_self());
+
+	if (t) {
+		memset(t, 0, sizeof(struct lockthread));
+	}
+
+	ast_mutex_unlock(&locklock);
+#endif
+}
+
+static void *tele_job_thread(void *data)
+{
+	struct rpt_tele_job *job = data;
+	struct rpt_tele_exec *exec = job->lane.exec;
+	struct rpt *myrpt = exec->myrpt;
+
+	rpt_tele_run(&job->lane, job->tele);
+
+	/* Give the channel back for the next job, the lane thread picks it up */
+	rpt_mutex_lock(&myrpt->lock);
+	if (job->lane.chans[RPT_TXCONF] && !exec->spare) {
+		exec->spare = job->lane.chans[RPT_TXCONF];
+		job->lane.chans[RPT_TXCONF] = NULL;
+	}
+	exec->jobs--;
+	ast_cond_broadcast(&exec->cond);
+	rpt_mutex_unlock(&myrpt->lock);
+
+	job->lane.lastjob = ast_tv(0, 0);
+	tele_lane_idle(&job->lane);
+	ast_free(job);
+	tele_thread_done();
+	return NULL;
+}
+
+/*!
+ * \internal
+ * \brief Start an immediate job on its own thread, with the lane's idle channel
+ * \note Must be called with myrpt->lock held
+ * \retval 0 on success
+ * \retval -1 on failure, the job is left to the caller
+ */
+static int tele_job_start(struct rpt_tele_lane *lane, struct rpt_tele *mytele)
+{
+	struct rpt_tele_job *job;
+	pthread_t thread;
+
+	job = ast_calloc(1, sizeof(*job));
+	if (!job) {
+		return -1;
+	}
+	job->lane.exec = lane->exec;
+	job->lane.type = lane->type;
+	job->lane.thread = AST_PTHREADT_NULL;
+	job->tele = mytele;
+	/* Immediate jobs all play into the tx conference */
+	job->lane.chans[RPT_TXCONF] = lane->chans[RPT_TXCONF];
+	lane->chans[RPT_TXCONF] = NULL;
+	if (ast_pthread_create_detached(&thread, NULL, tele_job_thread, job)) {
+		lane->chans[RPT_TXCONF] = job->lane.chans[RPT_TXCONF];
+		ast_free(job);
+		return -1;
+	}
+	lane->exec->jobs++;
+	return 0;
+}
+
+static void *tele_lane_thread(void *data)
+{
+	struct rpt_tele_lane *lane = data;
+	struct rpt_tele_exec *exec = lane->exec;
+	struct rpt *myrpt = exec->myrpt;
+	struct rpt_tele *mytele;
+
+	rpt_mutex_lock(&myrpt->lock);
+	for (;;) {
+		if (exec->spare && lane->type == RPT_TELE_LANE_IMMEDIATE) {
+			if (lane->chans[RPT_TXCONF]) {
+				ast_hangup(exec->spare);
+			} else {
+				lane->chans[RPT_TXCONF] = exec->spare;
+				lane->lastjob = ast_tvnow();
+			}
+			exec->spare = NULL;
+		}
+		if (!tele_lane_ready(lane)) {
+			if (exec->stop) {
+				break;
+			}
+			if (lane->chans[RPT_CONF] || lane->chans[RPT_TXCONF]) {
+				struct timespec ts;
+				struct timeval tv = ast_tvadd(ast_tvnow(), ast_samp2tv(RPT_TELE_IDLE_POLL, 1000));
+
+				ts.tv_sec = tv.tv_sec;
+				ts.tv_nsec = tv.tv_usec * 1000;
+				ast_cond_timedwait(&exec->cond, &myrpt->lock, &ts);
+				rpt_mutex_unlock(&myrpt->lock);
+				tele_lane_idle(lane);
+				rpt_mutex_lock(&myrpt->lock);
+			} else {
+				ast_cond_wait(&exec->cond, &myrpt->lock);
+			}
+			continue;
+		}
+		mytele = AST_VECTOR_REMOVE_ORDERED(&lane->queue, 0);
+		if (lane->type == RPT_TELE_LANE_IMMEDIATE && !tele_job_start(lane, mytele)) {
+			continue;
+		}
+		rpt_mutex_unlock(&myrpt->lock);
+
+		rpt_tele_run(lane, mytele);
+
+		rpt_mutex_lock(&myrpt->lock);
+		/* Hand off to the next job right away */
+		ast_cond_broadcast(&exec->cond);
+	}
+
+	/* Stopping, drop anything that couldn't be played */
+	while (AST_VECTOR_SIZE(&lane->queue)) {
+		mytele = AST_VECTOR_REMOVE_ORDERED(&lane->queue, 0);
+		tele_link_remove(myrpt, mytele);
+		ast_free(mytele);
+	}
+	rpt_mutex_unlock(&myrpt->lock);
 
+	lane->lastjob = ast_tv(0, 0);
+	tele_lane_idle(lane);
+	tele_thread_done();
 	return NULL;
 }
 
+/*!
+ * \internal
+ * \brief Start a node's telemetry executor
+ * \note Must be called with myrpt->lock held
+ * \return The executor, already stopped if a lane could not be started, or NULL
+ */
+static struct rpt_tele_exec *tele_exec_start(struct rpt *myrpt)
+{
+	struct rpt_tele_exec *exec;
+	int i;
+
+	exec = ast_calloc(1, sizeof(*exec));
+	if (!exec) {
+		return NULL;
+	}
+	exec->myrpt = myrpt;
+	ast_cond_init(&exec->cond, NULL);
+	for (i = 0; i < ARRAY_LEN(exec->lanes); i++) {
+		struct rpt_tele_lane *lane = &exec->lanes[i];
+
+		lane->exec = exec;
+		lane->type = i;
+		lane->thread = AST_PTHREADT_NULL;
+		if (AST_VECTOR_INIT(&lane->queue, 8) || ast_pthread_create(&lane->thread, NULL, tele_lane_thread, lane)) {
+			ast_log(LOG_ERROR, "Could not start telemetry executor for node %s\n", myrpt->name);
+			lane->thread = AST_PTHREADT_NULL;
+			/* The lanes already started need myrpt->lock to exit, which the caller may hold
+			 * more than once, so they are joined later by rpt_telemetry_reap() */
+			exec->stop = 1;
+			ast_cond_broadcast(&exec->cond);
+			return exec;
+		}
+	}
+	ast_debug(1, "Started telemetry executor for node %s\n", myrpt->name);
+	return exec;
+}
+
+/*!
+ * \internal
+ * \brief Hand a telemetry job to the node's executor
+ * \note Must be called with myrpt->lock held, and the job already added to myrpt->tele
+ * \retval 0 on success
+ * \retval -1 on failure
+ */
+static int tele_exec_queue(struct rpt *myrpt, struct rpt_tele *tele)
+{
+	struct rpt_tele_lane *lane;
+	int i, prio;
+
+	if (!myrpt->telexec) {
+		myrpt->telexec = tele_exec_start(myrpt);
+		if (!myrpt->telexec) {
+			return -1;
+		}
+	}
+	if (myrpt->telexec->stop) {
+		/* Failed to start, not reaped yet */
+		return -1;
+	}
+
+	if (tele_immediate(tele->mode)) {
+		lane = &myrpt->telexec->lanes[RPT_TELE_LANE_IMMEDIATE];
+		i = AST_VECTOR_SIZE(&lane->queue);
+	} else {
+		lane = &myrpt->telexec->lanes[RPT_TELE_LANE_QUEUED];
+		/* After everything of the same or higher priority */
+		prio = tele_priority(tele->mode);
+		for (i = 0; i < AST_VECTOR_SIZE(&lane->queue); i++) {
+			if (tele_priority(AST_VECTOR_GET(&lane->queue, i)->mode) < prio) {
+				break;
+			}
+		}
+	}
+	if (AST_VECTOR_INSERT_AT(&lane->queue, i, tele)) {
+		return -1;
+	}
+	ast_cond_broadcast(&myrpt->telexec->cond);
+	return 0;
+}
+
+void rpt_telemetry_stop(struct rpt *myrpt)
+{
+	struct rpt_tele_exec *exec;
+	int i;
+
+	rpt_mutex_lock(&myrpt->lock);
+	exec = myrpt->telexec;
+	myrpt->telexec = NULL;
+	if (exec) {
+		exec->stop = 1;
+		ast_cond_broadcast(&exec->cond);
+	}
+	rpt_mutex_unlock(&myrpt->lock);
+
+	if (!exec) {
+		return;
+	}
+	for (i = 0; i < ARRAY_LEN(exec->lanes); i++) {
+		if (exec->lanes[i].thread != AST_PTHREADT_NULL) {
+			pthread_join(exec->lanes[i].thread, NULL);
+		}
+		AST_VECTOR_FREE(&exec->lanes[i].queue);
+	}
+
+	/* Immediate jobs already running play out */
+	rpt_mutex_lock(&myrpt->lock);
+	while (exec->jobs) {
+		ast_cond_wait(&exec->cond, &myrpt->lock);
+	}
+	rpt_mutex_unlock(&myrpt->lock);
+	if (exec->spare) {
+		ast_hangup(exec->spare);
+	}
+	ast_cond_destroy(&exec->cond);
+	ast_free(exec);
+}
+
+void rpt_telemetry_reap(struct rpt *myrpt)
+{
+	int stopped;
+
+	rpt_mutex_lock(&myrpt->lock);
+	stopped = myrpt->telexec && myrpt->telexec->stop;
+	rpt_mutex_unlock(&myrpt->lock);
+
+	if (stopped) {
+		rpt_telemetry_stop(myrpt);
+	}
+}
+
+/*!
+ * \internal
+ * \brief Fold an unkey into one still waiting out its hang time, restarting the wait
+ * \note Must be called with myrpt->lock held
+ * \param myrpt
+ * \param mode UNKEY, LOCUNKEY or LINKUNKEY
+ * \param linkname Link that unkeyed, for LINKUNKEY
+ * \param interval Hang time to wait again, in ms
+ * \retval 1 if merged, so no courtesy tone needs to be queued
+ * \retval 0 if not
+ */
+static int tele_unkey_merge(struct rpt *myrpt, enum rpt_tele_mode mode, const char *linkname, int interval)
+{
+	struct rpt_tele *t;
+
+	for (t = myrpt->tele.next; t != &myrpt->tele; t = t->next) {
+		if (!t->ctwait || t->killed) {
+			continue;
+		}
+		if (mode == LINKUNKEY) {
+			if (t->mode == LINKUNKEY && !strcmp(t->mylink.name, linkname)) {
+				t->mylink.linkunkeytocttimer = interval;
+				return 1;
+			}
+		} else if (t->mode == UNKEY || t->mode == LOCUNKEY) {
+			/* The latest unkey picks the courtesy tone */
+			t->mode = mode;
+			myrpt->unkeytocttimer = interval;
+			return 1;
+		}
+	}
+	return 0;
+}
+
 static const char *rpt_tele_mode_str(enum rpt_tele_mode mode)
 {
 	static const char *mode_str[] = {
@@ -3844,7 +4308,7 @@ void rpt_telemetry(struct rpt *myrpt, enum rpt_tele_mode mode, void *data)
 
 			/* get all the nodes */
 			rpt_mutex_lock(&myrpt->lock);
-			n = __mklinklist(myrpt, NULL, &lbuf, USE_FORMAT_RPT_LINK) + 1;
+			n = rpt_linklist_append(myrpt, NULL, &lbuf, USE_FORMAT_RPT_LINK) + 1;
 			rpt_mutex_unlock(&myrpt->lock);
 
 			/* parse em */
@@ -3898,6 +4362,16 @@ void rpt_telemetry(struct rpt *myrpt, enum rpt_tele_mode mode, void *data)
 		}
 	}
 
+	if ((mode == UNKEY) || (mode == LOCUNKEY) || (mode == LINKUNKEY)) {
+		i = get_wait_interval(myrpt, mode == LINKUNKEY ? DLY_LINKUNKEY : DLY_UNKEY);
+		rpt_mutex_lock(&myrpt->lock);
+		res = tele_unkey_merge(myrpt, mode, mode == LINKUNKEY && data ? ((struct rpt_link *) data)->name : "", i);
+		rpt_mutex_unlock(&myrpt->lock);
+		if (res) {
+			return;
+		}
+	}
+
 	tele = ast_calloc(1, sizeof(struct rpt_tele));
 	if (!tele) {
 		return;
@@ -3905,6 +4379,7 @@ void rpt_telemetry(struct rpt *myrpt, enum rpt_tele_mode mode, void *data)
 
 	tele->rpt = myrpt;
 	tele->mode = mode;
+	tele->ctwait = (mode == UNKEY) || (mode == LOCUNKEY) || (mode == LINKUNKEY);
 
 	if (mode == PARROT) {
 		tele->submode.p = data;
@@ -3917,10 +4392,10 @@ void rpt_telemetry(struct rpt *myrpt, enum rpt_tele_mode mode, void *data)
 	rpt_mutex_lock(&myrpt->lock);
 
 	if ((mode == CONNFAIL) || (mode == REMDISC) || (mode == CONNECTED) || (mode == LINKUNKEY)) {
-		memset(&tele->mylink, 0, sizeof(struct rpt_link));
-
+		/* Only what the announcement needs, not the whole link */
 		if (mylink) {
-			memcpy(&tele->mylink, mylink, sizeof(struct rpt_link));
+			ast_copy_string(tele->mylink.name, mylink->name, sizeof(tele->mylink.name));
+			tele->mylink.hasconnected = mylink->hasconnected;
 		}
 	} else if ((mode == ARB_ALPHA) || (mode == REV_PATCH) || (mode == PLAYBACK) || (mode == LOCALPLAY) || (mode == VARCMD) ||
 			   (mode == METER) || (mode == USEROUT)) {
@@ -3932,16 +4407,121 @@ void rpt_telemetry(struct rpt *myrpt, enum rpt_tele_mode mode, void *data)
 	}
 
 	tele_link_add(myrpt, tele);
-	rpt_mutex_unlock(&myrpt->lock);
-	res = ast_pthread_create_detached(&tele->threadid, NULL, rpt_tele_thread, (void *) tele);
-
+	res = tele_exec_queue(myrpt, tele);
 	if (res) {
-		rpt_mutex_lock(&myrpt->lock);
 		tele_link_remove(myrpt, tele); /* We don't like stuck transmitters, remove it from the queue */
 		rpt_mutex_unlock(&myrpt->lock);
 		ast_free(tele);
-		ast_log(LOG_WARNING, "Could not create telemetry thread: %s", strerror(res));
+		ast_log(LOG_WARNING, "Could not queue telemetry for node %s\n", myrpt->name);
+		return;
 	}
+	rpt_mutex_unlock(&myrpt->lock);
 
 	ast_debug(6, "Tracepoint rpt_telemetry() exit\n");
 }
+
+#ifdef TEST_FRAMEWORK
+AST_TEST_DEFINE(tele_unkey_merge_test)
+{
+	struct rpt *myrpt;
+	struct rpt_tele unkey = { .mode = UNKEY, .ctwait = 1 };
+	struct rpt_tele linkunkey = { .mode = LINKUNKEY, .ctwait = 1 };
+	struct rpt_tele *t;
+	enum ast_test_result_state res = AST_TEST_PASS;
+	int unkeys = 0;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "unkey_merge";
+		info->category = "/apps/app_rpt/telemetry/";
+		info->summary = "Unkeys during one hang time get one courtesy tone";
+		info->description = "Queue unkeys while another is waiting out its hang time and check they restart its wait "
+							"instead of queueing another courtesy tone.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	myrpt = ast_calloc(1, sizeof(*myrpt));
+	if (!myrpt) {
+		return AST_TEST_FAIL;
+	}
+	ast_mutex_init(&myrpt->lock);
+	myrpt->tele.next = &myrpt->tele;
+	myrpt->tele.prev = &myrpt->tele;
+	ast_copy_string(linkunkey.mylink.name, "1999", sizeof(linkunkey.mylink.name));
+
+	rpt_mutex_lock(&myrpt->lock);
+	if (tele_unkey_merge(myrpt, UNKEY, "", 1000)) {
+		ast_test_status_update(test, "Unkey merged with nothing pending\n");
+		res = AST_TEST_FAIL;
+		goto done;
+	}
+	tele_link_add(myrpt, &unkey);
+
+	/* Two more unkeys part way through the hang time */
+	myrpt->unkeytocttimer = 300;
+	if (!tele_unkey_merge(myrpt, UNKEY, "", 1000) || myrpt->unkeytocttimer != 1000) {
+		ast_test_status_update(test, "Second unkey did not restart the pending hang time\n");
+		res = AST_TEST_FAIL;
+		goto done;
+	}
+	myrpt->unkeytocttimer = 500;
+	if (!tele_unkey_merge(myrpt, LOCUNKEY, "", 1000) || myrpt->unkeytocttimer != 1000 || unkey.mode != LOCUNKEY) {
+		ast_test_status_update(test, "Local unkey did not restart the pending hang time\n");
+		res = AST_TEST_FAIL;
+		goto done;
+	}
+	for (t = myrpt->tele.next; t != &myrpt->tele; t = t->next) {
+		if (t->mode == UNKEY || t->mode == LOCUNKEY) {
+			unkeys++;
+		}
+	}
+	if (unkeys != 1) {
+		ast_test_status_update(test, "%d courtesy tones pending, expected 1\n", unkeys);
+		res = AST_TEST_FAIL;
+		goto done;
+	}
+
+	/* Once the courtesy tone is playing, the next unkey is a new transmission */
+	unkey.ctwait = 0;
+	if (tele_unkey_merge(myrpt, UNKEY, "", 1000)) {
+		ast_test_status_update(test, "Unkey merged with a courtesy tone already playing\n");
+		res = AST_TEST_FAIL;
+		goto done;
+	}
+
+	/* Link unkeys only merge with the same link */
+	tele_link_add(myrpt, &linkunkey);
+	linkunkey.mylink.linkunkeytocttimer = 100;
+	if (!tele_unkey_merge(myrpt, LINKUNKEY, "1999", 2000) || linkunkey.mylink.linkunkeytocttimer != 2000) {
+		ast_test_status_update(test, "Link unkey did not restart the pending hang time\n");
+		res = AST_TEST_FAIL;
+		goto done;
+	}
+	if (tele_unkey_merge(myrpt, LINKUNKEY, "2000", 2000)) {
+		ast_test_status_update(test, "Link unkey merged with another link's\n");
+		res = AST_TEST_FAIL;
+		goto done;
+	}
+
+done:
+	while (myrpt->tele.next != &myrpt->tele) {
+		tele_link_remove(myrpt, myrpt->tele.next);
+	}
+	rpt_mutex_unlock(&myrpt->lock);
+	ast_mutex_destroy(&myrpt->lock);
+	ast_free(myrpt);
+	return res;
+}
+
+void rpt_telemetry_tests_register(void)
+{
+	AST_TEST_REGISTER(tele_unkey_merge_test);
+}
+
+void rpt_telemetry_tests_unregister(void)
+{
+	AST_TEST_UNREGISTER(tele_unkey_merge_test);
+}
+#endif
@@ -13,11 +13,21 @@ void birdbath(struct rpt *myrpt);
 /*! \note must be called locked */
 void cancel_pfxtone(struct rpt *myrpt);
 
-void *rpt_tele_thread(void *this);
-
 /*! \brief More repeater telemetry routines. */
 void rpt_telemetry(struct rpt *myrpt, enum rpt_tele_mode mode, void *data);
 
+/*!
+ * \brief Stop a node's telemetry executor
+ * \note Jobs that haven't started yet are discarded.  Must not be called with myrpt->lock held.
+ */
+void rpt_telemetry_stop(struct rpt *myrpt);
+
+/*!
+ * \brief Free a node's telemetry executor if it failed to start, so the next telemetry starts a new one
+ * \note Must not be called with myrpt->lock held.
+ */
+void rpt_telemetry_reap(struct rpt *myrpt);
+
 /*!
  * \brief Register telemetry function
  */
@@ -32,4 +42,9 @@ int rpt_cleanup_telemetry(void);
  * \brief Kill a telemetry entry
  * \param telem The telemetry entry to kill
  */
-void rpt_kill_telem(struct rpt_tele *telem);
\ No newline at end of file
+void rpt_kill_telem(struct rpt_tele *telem);
+
+#ifdef TEST_FRAMEWORK
+void rpt_telemetry_tests_register(void);
+void rpt_telemetry_tests_unregister(void);
+#endif
\ No newline at end of file
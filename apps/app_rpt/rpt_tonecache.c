@@ -0,0 +1,218 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT telemetry tone cache
+ */
+
+#include "asterisk.h"
+
+#include <math.h>
+
+#include "asterisk/astobj2.h"
+#include "asterisk/channel.h"
+#include "asterisk/utils.h"
+
+#include "app_rpt.h"
+#include "rpt_channel.h"
+#include "rpt_tonecache.h"
+
+/*! \brief Number of hash buckets in the tone cache */
+#define RPT_TONECACHE_BUCKETS 31
+
+/*! \brief Telemetry channels are signed linear at 8 kHz */
+#define RPT_TONECACHE_RATE 8000
+
+struct rpt_tone_audio {
+	char *key;
+	size_t samples;
+	unsigned int plays;
+	int16_t data[0];
+};
+
+static struct ao2_container *tone_cache;
+
+static struct rpt_tonecache_stats tone_stats;
+
+static int tone_audio_hash(const void *obj, const int flags)
+{
+	const char *key = (flags & OBJ_SEARCH_KEY) ? obj : ((const struct rpt_tone_audio *) obj)->key;
+
+	return ast_str_hash(key);
+}
+
+static int tone_audio_cmp(void *obj, void *arg, int flags)
+{
+	const struct rpt_tone_audio *audio = obj;
+	const char *key = (flags & OBJ_SEARCH_KEY) ? arg : ((const struct rpt_tone_audio *) arg)->key;
+
+	return strcmp(audio->key, key) ? 0 : CMP_MATCH | CMP_STOP;
+}
+
+static void tone_audio_destroy(void *obj)
+{
+	struct rpt_tone_audio *audio = obj;
+
+	ast_free(audio->key);
+}
+
+/*!
+ * \internal
+ * \brief Render a tone sequence to signed linear
+ */
+static struct rpt_tone_audio *tone_render(const char *key, const struct rpt_tone_seg *segs, int nsegs)
+{
+	struct rpt_tone_audio *audio;
+	size_t samples = 0, pos = 0;
+	int i;
+
+	for (i = 0; i < nsegs; i++) {
+		samples += (size_t) segs[i].duration * RPT_TONECACHE_RATE / 1000;
+	}
+
+	audio = ao2_alloc_options(sizeof(*audio) + samples * sizeof(int16_t), tone_audio_destroy, AO2_ALLOC_OPT_LOCK_NOLOCK);
+	if (!audio) {
+		return NULL;
+	}
+	audio->key = ast_strdup(key);
+	if (!audio->key) {
+		ao2_ref(audio, -1);
+		return NULL;
+	}
+	audio->samples = samples;
+
+	for (i = 0; i < nsegs; i++) {
+		size_t n = (size_t) segs[i].duration * RPT_TONECACHE_RATE / 1000;
+		double w1 = 2.0 * M_PI * segs[i].f1 / RPT_TONECACHE_RATE;
+		double w2 = 2.0 * M_PI * segs[i].f2 / RPT_TONECACHE_RATE;
+		size_t j;
+
+		if (!segs[i].f1 && !segs[i].f2) {
+			memset(&audio->data[pos], 0, n * sizeof(int16_t));
+			pos += n;
+			continue;
+		}
+		/* Each segment starts at zero phase, like the tone generators */
+		for (j = 0; j < n; j++) {
+			double v = segs[i].amplitude * ((segs[i].f1 ? sin(w1 * j) : 0.0) + (segs[i].f2 ? sin(w2 * j) : 0.0));
+
+			audio->data[pos++] = (int16_t) (v > 32767.0 ? 32767.0 : (v < -32768.0 ? -32768.0 : v));
+		}
+	}
+	return audio;
+}
+
+struct rpt_tone_audio *rpt_tonecache_get(const char *key, const struct rpt_tone_seg *segs, int nsegs)
+{
+	struct rpt_tone_audio *audio, *cached;
+	int i, ms = 0;
+
+	if (tone_cache) {
+		audio = ao2_find(tone_cache, key, OBJ_SEARCH_KEY);
+		if (audio) {
+			__atomic_fetch_add(&tone_stats.hits, 1, __ATOMIC_RELAXED);
+			__atomic_fetch_add(&audio->plays, 1, __ATOMIC_RELAXED);
+			return audio;
+		}
+	}
+
+	for (i = 0; i < nsegs; i++) {
+		ms += segs[i].duration;
+	}
+
+	audio = tone_render(key, segs, nsegs);
+	if (!audio) {
+		return NULL;
+	}
+	audio->plays = 1;
+
+	if (!tone_cache || ms > RPT_TONECACHE_MAX_MS) {
+		__atomic_fetch_add(&tone_stats.uncached, 1, __ATOMIC_RELAXED);
+		return audio;
+	}
+
+	ao2_lock(tone_cache);
+	/* Someone else may have rendered it while we were */
+	cached = ao2_find(tone_cache, key, OBJ_SEARCH_KEY | OBJ_NOLOCK);
+	if (cached) {
+		ao2_unlock(tone_cache);
+		__atomic_fetch_add(&tone_stats.hits, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&cached->plays, 1, __ATOMIC_RELAXED);
+		ao2_ref(audio, -1);
+		return cached;
+	}
+	if (ao2_container_count(tone_cache) >= RPT_TONECACHE_MAX_ENTRIES) {
+		ao2_unlock(tone_cache);
+		__atomic_fetch_add(&tone_stats.uncached, 1, __ATOMIC_RELAXED);
+		return audio;
+	}
+	ao2_link_flags(tone_cache, audio, OBJ_NOLOCK);
+	ao2_unlock(tone_cache);
+	__atomic_fetch_add(&tone_stats.misses, 1, __ATOMIC_RELAXED);
+	ast_debug(3, "Rendered %d ms of telemetry audio for '%s'\n", ms, key);
+	return audio;
+}
+
+int rpt_tonecache_play(struct ast_channel *chan, struct rpt_tone_audio *audio)
+{
+	return play_slin(chan, audio, audio->data, audio->samples);
+}
+
+int rpt_tonecache_init(void)
+{
+	tone_cache = ao2_container_alloc_hash(AO2_ALLOC_OPT_LOCK_MUTEX, 0, RPT_TONECACHE_BUCKETS, tone_audio_hash, NULL, tone_audio_cmp);
+	if (!tone_cache) {
+		return -1;
+	}
+	memset(&tone_stats, 0, sizeof(tone_stats));
+	return 0;
+}
+
+void rpt_tonecache_cleanup(void)
+{
+	ao2_cleanup(tone_cache);
+	tone_cache = NULL;
+}
+
+void rpt_tonecache_flush(void)
+{
+	if (tone_cache) {
+		ao2_callback(tone_cache, OBJ_UNLINK | OBJ_NODATA | OBJ_MULTIPLE, NULL, NULL);
+	}
+}
+
+static int tone_audio_bytes(void *obj, void *arg, int flags)
+{
+	struct rpt_tone_audio *audio = obj;
+	size_t *bytes = arg;
+
+	*bytes += audio->samples * sizeof(int16_t);
+	return 0;
+}
+
+void rpt_tonecache_get_stats(struct rpt_tonecache_stats *stats)
+{
+	*stats = tone_stats;
+	stats->entries = 0;
+	stats->bytes = 0;
+	if (tone_cache) {
+		stats->entries = ao2_container_count(tone_cache);
+		ao2_callback(tone_cache, OBJ_NODATA | OBJ_MULTIPLE, tone_audio_bytes, &stats->bytes);
+	}
+}
+
+void rpt_tonecache_foreach(void (*cb)(const char *key, int ms, unsigned int plays, void *arg), void *arg)
+{
+	struct ao2_iterator it;
+	struct rpt_tone_audio *audio;
+
+	if (!tone_cache) {
+		return;
+	}
+	it = ao2_iterator_init(tone_cache, 0);
+	while ((audio = ao2_iterator_next(&it))) {
+		cb(audio->key, audio->samples * 1000 / RPT_TONECACHE_RATE, __atomic_load_n(&audio->plays, __ATOMIC_RELAXED), arg);
+		ao2_ref(audio, -1);
+	}
+	ao2_iterator_destroy(&it);
+}
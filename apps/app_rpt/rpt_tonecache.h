@@ -0,0 +1,86 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT telemetry tone cache
+ *
+ * Morse IDs, Morse messages and tone sequences are rendered to signed
+ * linear audio the first time they are played, and kept in a cache keyed
+ * by everything that affects the audio (the text or tone specification,
+ * speed, frequency and amplitude).  Later plays copy the rendered samples
+ * straight to the channel instead of running the tone generators again.
+ * The cache is emptied when the configuration is reloaded.
+ */
+
+/*! \brief Most entries kept in the tone cache */
+#define RPT_TONECACHE_MAX_ENTRIES 64
+/*! \brief Longest audio that is cached, in ms.  Anything longer is rendered for each play. */
+#define RPT_TONECACHE_MAX_MS 20000
+
+/*! \brief One segment of a tone sequence */
+struct rpt_tone_seg {
+	int f1;		   /*!< \brief First frequency in Hz, 0 for none */
+	int f2;		   /*!< \brief Second frequency in Hz, 0 for none */
+	int duration;  /*!< \brief Length in ms */
+	int amplitude; /*!< \brief Peak amplitude of each frequency */
+};
+
+/*! \brief Rendered audio, an ao2 object */
+struct rpt_tone_audio;
+
+/*! \brief Tone cache counters */
+struct rpt_tonecache_stats {
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int uncached; /*!< \brief Rendered but too long, or the cache was full */
+	unsigned int entries;
+	size_t bytes;
+};
+
+/*!
+ * \brief Get rendered audio for a tone sequence, rendering and caching it if needed
+ * \param key Uniquely identifies the audio described by segs
+ * \param segs Tone segments
+ * \param nsegs Number of segments
+ * \return Audio reference the caller must release with ao2_ref(), or NULL on failure
+ */
+struct rpt_tone_audio *rpt_tonecache_get(const char *key, const struct rpt_tone_seg *segs, int nsegs);
+
+/*!
+ * \brief Play rendered audio on a channel, waiting until it has been sent
+ * \param chan Channel, its write format is slin while playing
+ * \param audio Audio from rpt_tonecache_get()
+ * \retval 0 on success
+ * \retval -1 on failure or hangup
+ */
+int rpt_tonecache_play(struct ast_channel *chan, struct rpt_tone_audio *audio);
+
+/*!
+ * \brief Allocate the tone cache
+ * \retval 0 on success
+ * \retval -1 on failure
+ */
+int rpt_tonecache_init(void);
+
+/*!
+ * \brief Free the tone cache
+ */
+void rpt_tonecache_cleanup(void);
+
+/*!
+ * \brief Remove every entry from the tone cache
+ */
+void rpt_tonecache_flush(void);
+
+/*!
+ * \brief Get the tone cache counters
+ * \param stats Filled in with the current counters
+ */
+void rpt_tonecache_get_stats(struct rpt_tonecache_stats *stats);
+
+/*!
+ * \brief Call a function for every entry in the tone cache
+ * \param cb Callback, with the entry's key, length in ms and number of plays
+ * \param arg Passed to the callback
+ */
+void rpt_tonecache_foreach(void (*cb)(const char *key, int ms, unsigned int plays, void *arg), void *arg);
@@ -0,0 +1,186 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT sampled audio path latency tracing
+ */
+
+#include "asterisk.h"
+
+#include <limits.h>
+#include <math.h>
+
+#include "asterisk/astobj2.h"
+#include "asterisk/lock.h"
+#include "asterisk/utils.h"
+
+#include "app_rpt.h"
+#include "rpt_perf.h"
+#include "rpt_trace.h"
+
+/*! \brief Trace points older than this are stale, the conference had nothing to send */
+#define TRACE_MAX_AGE_US 1000000
+
+static const char *const hop_names[RPT_TRACE_HOPS] = {
+	[RPT_TRACE_RX_QUEUE] = "RX queue",
+	[RPT_TRACE_RX_CONF] = "RX conference",
+	[RPT_TRACE_RX_TOTAL] = "RX to link",
+	[RPT_TRACE_TX_QUEUE] = "Link queue",
+	[RPT_TRACE_TX_CONF] = "TX conference",
+	[RPT_TRACE_TX_TOTAL] = "Link to TX",
+};
+
+/*! \brief Trace one in this many voice frames, 0 to disable */
+static unsigned int trace_every;
+
+/*! \brief Protects every trace point */
+AST_MUTEX_DEFINE_STATIC(trace_lock);
+
+const char *rpt_trace_hop_name(enum rpt_trace_hop hop)
+{
+	return hop_names[hop];
+}
+
+static int trace_bucket(unsigned long long us)
+{
+	if (us < 50000) {
+		return us / 250;
+	}
+	if (us < 1000000) {
+		return 200 + (us - 50000) / 10000;
+	}
+	return RPT_TRACE_BUCKETS - 1;
+}
+
+/*! \brief Upper bound of a bucket, in us */
+static unsigned int trace_bucket_us(int bucket)
+{
+	if (bucket < 200) {
+		return (bucket + 1) * 250;
+	}
+	if (bucket < RPT_TRACE_BUCKETS - 1) {
+		return 50000 + (bucket - 199) * 10000;
+	}
+	return UINT_MAX;
+}
+
+unsigned long long rpt_trace_sample(struct rpt_trace_stats *stats)
+{
+	unsigned int every = __atomic_load_n(&trace_every, __ATOMIC_RELAXED);
+
+	if (!every || !stats || ++stats->sample < every) {
+		return 0;
+	}
+	stats->sample = 0;
+	return rpt_perf_now();
+}
+
+void rpt_trace_add(struct rpt_trace_stats *stats, enum rpt_trace_hop hop, unsigned long long us)
+{
+	struct rpt_trace_hist *hist;
+	unsigned int max;
+
+	if (!stats) {
+		return;
+	}
+	/* A hop may be recorded by the node thread and several link threads */
+	hist = &stats->hops[hop];
+	__atomic_fetch_add(&hist->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&hist->buckets[trace_bucket(us)], 1, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&hist->max_us, __ATOMIC_RELAXED);
+	while (us > max && !__atomic_compare_exchange_n(&hist->max_us, &max, us > UINT_MAX ? UINT_MAX : us, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+void rpt_trace_mark(struct rpt_trace_point *pt, unsigned long long t0, unsigned long long tconf, struct rpt_trace_stats *stats)
+{
+	struct rpt_trace_stats *old;
+
+	ast_mutex_lock(&trace_lock);
+	old = pt->stats;
+	pt->t0 = t0;
+	pt->tconf = tconf;
+	pt->stats = stats ? ao2_bump(stats) : NULL;
+	__atomic_store_n(&pt->id, pt->id + 1 ? pt->id + 1 : 1, __ATOMIC_RELEASE);
+	ast_mutex_unlock(&trace_lock);
+	ao2_cleanup(old);
+}
+
+int rpt_trace_take(struct rpt_trace_point *pt, unsigned int *seen, unsigned long long *t0, unsigned long long *tconf,
+	struct rpt_trace_stats **stats)
+{
+	int res = 0;
+
+	/* Checked for every frame, so only lock when there is something new */
+	if (__atomic_load_n(&pt->id, __ATOMIC_ACQUIRE) == *seen) {
+		return 0;
+	}
+	ast_mutex_lock(&trace_lock);
+	*seen = pt->id;
+	if (pt->id && rpt_perf_now() - pt->tconf < TRACE_MAX_AGE_US) {
+		*t0 = pt->t0;
+		*tconf = pt->tconf;
+		if (stats) {
+			*stats = pt->stats ? ao2_bump(pt->stats) : NULL;
+		}
+		res = 1;
+	}
+	ast_mutex_unlock(&trace_lock);
+	return res;
+}
+
+struct rpt_trace_stats *rpt_trace_stats_alloc(void)
+{
+	return ao2_alloc_options(sizeof(struct rpt_trace_stats), NULL, AO2_ALLOC_OPT_LOCK_NOLOCK);
+}
+
+void rpt_trace_free(struct rpt_trace *trace)
+{
+	if (!trace) {
+		return;
+	}
+	ao2_cleanup(trace->rx.stats);
+	ao2_cleanup(trace->tx.stats);
+	ast_free(trace);
+}
+
+void rpt_trace_set_rate(double percent)
+{
+	unsigned int every = 0;
+
+	if (percent > 0) {
+		every = percent >= 100 ? 1 : (unsigned int) lround(100 / percent);
+	}
+	__atomic_store_n(&trace_every, every, __ATOMIC_RELAXED);
+}
+
+double rpt_trace_get_rate(void)
+{
+	unsigned int every = __atomic_load_n(&trace_every, __ATOMIC_RELAXED);
+
+	return every ? 100.0 / every : 0;
+}
+
+void rpt_trace_reset(struct rpt_trace_stats *stats)
+{
+	memset(stats->hops, 0, sizeof(stats->hops));
+}
+
+unsigned int rpt_trace_percentile(const struct rpt_trace_hist *hist, int pct)
+{
+	unsigned long long want, total = 0;
+	int i;
+
+	if (!hist->count) {
+		return 0;
+	}
+	want = ((unsigned long long) hist->count * pct + 99) / 100;
+	for (i = 0; i < RPT_TRACE_BUCKETS; i++) {
+		total += hist->buckets[i];
+		if (total >= want) {
+			/* Never report more than was actually seen */
+			return MIN(trace_bucket_us(i), hist->max_us);
+		}
+	}
+	return hist->max_us;
+}
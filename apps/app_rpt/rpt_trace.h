@@ -0,0 +1,132 @@
+
+/*!
+ * \file
+ *
+ * \brief RPT sampled audio path latency tracing
+ *
+ * When enabled (frame_trace_rate in the general stanza of rpt.conf, or
+ * "rpt trace rate"), one in every so many voice frames is stamped when it
+ * is received from the local radio or from a link.  Its time through
+ * the node's frame queue is measured directly.  Audio is mixed in the
+ * conference, so a frame can't be followed through it; the conference
+ * hop is instead the time until the next frame read from the conference
+ * on the other side, the link or localtxchannel.  Hop latencies are kept
+ * in histograms per node and per link, from which percentiles are shown.
+ *
+ * Only sampled frames do any work beyond a counter, so tracing 1% of
+ * frames costs nothing measurable.
+ */
+
+/*! \brief Hops a traced frame is timed over */
+enum rpt_trace_hop {
+	RPT_TRACE_RX_QUEUE, /*!< \brief Read from rxchannel to written to the conference */
+	RPT_TRACE_RX_CONF,	/*!< \brief Written to the conference to read from it by a link */
+	RPT_TRACE_RX_TOTAL, /*!< \brief Read from rxchannel to written to a link */
+	RPT_TRACE_TX_QUEUE, /*!< \brief Read from a link to written to the conference */
+	RPT_TRACE_TX_CONF,	/*!< \brief Written to the conference to read from localtxchannel */
+	RPT_TRACE_TX_TOTAL, /*!< \brief Read from a link to written to txchannel */
+	RPT_TRACE_HOPS,
+};
+
+/*! \brief Histogram buckets, 250 us wide to 50 ms, then 10 ms wide to 1 s, then everything longer */
+#define RPT_TRACE_BUCKETS 296
+
+/*! \brief Latency histogram for a hop */
+struct rpt_trace_hist {
+	unsigned int count;
+	unsigned int max_us;
+	unsigned int buckets[RPT_TRACE_BUCKETS];
+};
+
+/*! \brief Latency histograms for a node or link */
+struct rpt_trace_stats {
+	struct rpt_trace_hist hops[RPT_TRACE_HOPS];
+	unsigned int sample; /*!< \brief Frames since the last one traced, only used by the thread reading them */
+	unsigned int seen;	 /*!< \brief Last trace point taken, only used by the thread taking them */
+};
+
+/*! \brief A traced frame that has been written to the conference */
+struct rpt_trace_point {
+	unsigned int id;			   /*!< \brief Changes with every new trace point */
+	unsigned long long t0;		   /*!< \brief When the frame was read, us */
+	unsigned long long tconf;	   /*!< \brief When it was written to the conference, us */
+	struct rpt_trace_stats *stats; /*!< \brief Link it came from, if any */
+};
+
+/*! \brief A node's tracing state */
+struct rpt_trace {
+	struct rpt_trace_stats stats;
+	struct rpt_trace_point rx; /*!< \brief Last traced frame from the local radio */
+	struct rpt_trace_point tx; /*!< \brief Last traced frame from a link */
+};
+
+/*!
+ * \brief Decide whether to trace a frame
+ * \param stats Node or link reading the frame, may be NULL
+ * \return Time stamp for the frame (rpt_perf_now()), or 0 not to trace it
+ */
+unsigned long long rpt_trace_sample(struct rpt_trace_stats *stats);
+
+/*!
+ * \brief Record a hop's latency
+ * \param stats Node or link, may be NULL
+ * \param hop Hop
+ * \param us Latency
+ */
+void rpt_trace_add(struct rpt_trace_stats *stats, enum rpt_trace_hop hop, unsigned long long us);
+
+/*!
+ * \brief Publish a traced frame that has been written to the conference
+ * \param pt Trace point
+ * \param t0 When the frame was read
+ * \param tconf When it was written to the conference
+ * \param stats Link it came from, or NULL
+ */
+void rpt_trace_mark(struct rpt_trace_point *pt, unsigned long long t0, unsigned long long tconf, struct rpt_trace_stats *stats);
+
+/*!
+ * \brief Take a trace point, if there is a new one
+ * \param pt Trace point
+ * \param seen Last trace point taken by the caller, updated
+ * \param[out] t0 When the frame was read
+ * \param[out] tconf When it was written to the conference
+ * \param[out] stats If not NULL, the link the frame came from, a reference the caller must release
+ * \retval 1 if there was a recent trace point the caller hadn't seen
+ * \retval 0 otherwise
+ */
+int rpt_trace_take(struct rpt_trace_point *pt, unsigned int *seen, unsigned long long *t0, unsigned long long *tconf,
+	struct rpt_trace_stats **stats);
+
+/*! \brief Allocate a link's histograms, an ao2 object */
+struct rpt_trace_stats *rpt_trace_stats_alloc(void);
+
+/*!
+ * \brief Free a node's tracing state
+ */
+void rpt_trace_free(struct rpt_trace *trace);
+
+/*!
+ * \brief Set the sample rate
+ * \param percent Percentage of voice frames traced, 0 to disable tracing
+ */
+void rpt_trace_set_rate(double percent);
+
+/*! \brief Get the sample rate, in percent */
+double rpt_trace_get_rate(void);
+
+/*!
+ * \brief Clear a node's or link's histograms
+ * \note Samples recorded while clearing may be partly lost
+ */
+void rpt_trace_reset(struct rpt_trace_stats *stats);
+
+/*!
+ * \brief Get a latency percentile
+ * \param hist Histogram
+ * \param pct Percentile, 1 to 100
+ * \return Upper bound of the bucket holding the percentile, in us, or 0 if there are no samples
+ */
+unsigned int rpt_trace_percentile(const struct rpt_trace_hist *hist, int pct);
+
+/*! \brief Name of a hop, for display */
+const char *rpt_trace_hop_name(enum rpt_trace_hop hop);
@@ -3,17 +3,134 @@
 
 #include <math.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VOX_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VOX_NEON
+#endif
+
 #include "asterisk/utils.h"
 #include "asterisk/lock.h"
 #include "asterisk/file.h"
 #include "asterisk/logger.h"
 #include "asterisk/channel.h"
+#ifdef TEST_FRAMEWORK
+#include "asterisk/test.h"
+#endif
 
 #include "app_rpt.h"
 #include "rpt_vox.h"
 
+/*
+ * The frame energy is the exact 64 bit sum of squares of the samples.
+ * A 16 bit sample squared fits in 31 bits, and so does the sum of two of
+ * them, read as unsigned, which is what the multiply-add instructions
+ * produce; those pair sums are widened to 64 bits before they are added up.
+ */
+typedef uint64_t (*vox_kernel)(const int16_t *buf, int bs);
+
+static uint64_t vox_sumsq_scalar(const int16_t *buf, int bs)
+{
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < bs; i++) {
+		sum += (uint32_t) (buf[i] * buf[i]);
+	}
+	return sum;
+}
+
+#ifdef VOX_X86
+static __attribute__((target("sse2"))) uint64_t vox_sumsq_sse2(const int16_t *buf, int bs)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc = zero;
+	uint64_t sum[2];
+	int i;
+
+	for (i = 0; i + 8 <= bs; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i *) &buf[i]);
+		__m128i sq = _mm_madd_epi16(x, x);
+
+		acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+	}
+	_mm_storeu_si128((__m128i *) sum, acc);
+	return sum[0] + sum[1] + vox_sumsq_scalar(&buf[i], bs - i);
+}
+
+static __attribute__((target("avx2"))) uint64_t vox_sumsq_avx2(const int16_t *buf, int bs)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc = zero;
+	uint64_t sum[4];
+	int i;
+
+	for (i = 0; i + 16 <= bs; i += 16) {
+		__m256i x = _mm256_loadu_si256((const __m256i *) &buf[i]);
+		__m256i sq = _mm256_madd_epi16(x, x);
+
+		acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(sq, zero));
+		acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(sq, zero));
+	}
+	_mm256_storeu_si256((__m256i *) sum, acc);
+	return sum[0] + sum[1] + sum[2] + sum[3] + vox_sumsq_scalar(&buf[i], bs - i);
+}
+#endif
+
+#ifdef VOX_NEON
+static uint64_t vox_sumsq_neon(const int16_t *buf, int bs)
+{
+	uint64x2_t acc = vdupq_n_u64(0);
+	int i;
+
+	for (i = 0; i + 8 <= bs; i += 8) {
+		int16x8_t x = vld1q_s16(&buf[i]);
+		uint32x4_t lo = vreinterpretq_u32_s32(vmull_s16(vget_low_s16(x), vget_low_s16(x)));
+		uint32x4_t hi = vreinterpretq_u32_s32(vmull_s16(vget_high_s16(x), vget_high_s16(x)));
+
+		acc = vpadalq_u32(acc, lo);
+		acc = vpadalq_u32(acc, hi);
+	}
+	return vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1) + vox_sumsq_scalar(&buf[i], bs - i);
+}
+#endif
+
+static vox_kernel vox_sumsq;
+static const char *vox_kernel_name;
+
+/*! \brief Pick the best sum of squares implementation for this CPU */
+static void vox_select(void)
+{
+	if (vox_sumsq) {
+		return;
+	}
+#if defined(VOX_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		vox_kernel_name = "avx2";
+		__atomic_store_n(&vox_sumsq, vox_sumsq_avx2, __ATOMIC_RELEASE);
+		return;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		vox_kernel_name = "sse2";
+		__atomic_store_n(&vox_sumsq, vox_sumsq_sse2, __ATOMIC_RELEASE);
+		return;
+	}
+#elif defined(VOX_NEON)
+	vox_kernel_name = "neon";
+	__atomic_store_n(&vox_sumsq, vox_sumsq_neon, __ATOMIC_RELEASE);
+	return;
+#endif
+	vox_kernel_name = "scalar";
+	__atomic_store_n(&vox_sumsq, vox_sumsq_scalar, __ATOMIC_RELEASE);
+}
+
 void voxinit_rpt(struct rpt *myrpt, char enable)
 {
+	vox_select();
 	myrpt->vox.speech_energy = 0.0;
 	myrpt->vox.noise_energy = 0.0;
 	myrpt->vox.enacount = 0;
@@ -33,6 +150,7 @@ void voxinit_rpt(struct rpt *myrpt, char enable)
 
 void voxinit_link(struct rpt_link *mylink, char enable)
 {
+	vox_select();
 	mylink->vox.speech_energy = 0.0;
 	mylink->vox.noise_energy = 0.0;
 	mylink->vox.enacount = 0;
@@ -51,6 +169,60 @@ void voxinit_link(struct rpt_link *mylink, char enable)
 }
 
 int dovox(struct vox *v, short *buf, int bs)
+{
+	float energy = 0.0;
+	float threshold = 0.0;
+
+	if (v->voxena < 0) {
+		return v->lastvox;
+	}
+
+	energy = sqrtf((float) vox_sumsq(buf, bs));
+	if (energy >= v->speech_energy) {
+		v->speech_energy += (energy - v->speech_energy) / 4;
+	} else {
+		v->speech_energy += (energy - v->speech_energy) / 64;
+	}
+
+	if (energy >= v->noise_energy) {
+		v->noise_energy += (energy - v->noise_energy) / 64;
+	} else {
+		v->noise_energy += (energy - v->noise_energy) / 4;
+	}
+
+	if (v->voxena) {
+		threshold = v->speech_energy / 8;
+	} else {
+		threshold = MAX(v->speech_energy / 16, v->noise_energy * 2);
+		threshold = MIN(threshold, VOX_MAX_THRESHOLD);
+	}
+
+	threshold = MAX(threshold, VOX_MIN_THRESHOLD);
+	if (energy > threshold) {
+		if (v->voxena) {
+			v->noise_energy *= 0.75;
+		}
+
+		v->voxena = 1;
+	} else {
+		v->voxena = 0;
+	}
+
+	if (v->lastvox != v->voxena) {
+		if (v->enacount++ >= ((v->lastvox) ? v->offdebcnt : v->ondebcnt)) {
+			v->lastvox = v->voxena;
+			v->enacount = 0;
+		}
+	} else {
+		v->enacount = 0;
+	}
+
+	return v->lastvox;
+}
+
+#ifdef TEST_FRAMEWORK
+/*! \brief The per sample float detector dovox() replaced, for comparison */
+static int legacy_dovox(struct vox *v, volatile short *buf, int bs)
 {
 	int i;
 	float esquare = 0.0;
@@ -107,3 +279,168 @@ int dovox(struct vox *v, short *buf, int bs)
 
 	return v->lastvox;
 }
+
+static void vox_test_init(struct vox *v)
+{
+	memset(v, 0, sizeof(*v));
+	v->ondebcnt = VOX_ON_DEBOUNCE_COUNT;
+	v->offdebcnt = VOX_OFF_DEBOUNCE_COUNT;
+}
+
+/*!
+ * \brief Make a stretch of phone audio
+ *
+ * Alternating talk spurts and pauses over a noise floor.  Talk is a
+ * harmonic series on a wandering pitch, shaped by a syllable envelope,
+ * so the frame energy swings through the thresholds the way speech does.
+ * The loudest level clips, to exercise full scale samples.
+ */
+static void vox_test_audio(int16_t *buf, int len, unsigned int seed, double level, double noise)
+{
+	double pitch = 120, phase = 0, env;
+	int i, h, talking = 0, left = 0;
+
+	for (i = 0; i < len; i++) {
+		double v;
+
+		if (!left--) {
+			seed = seed * 1103515245 + 12345;
+			talking = !talking;
+			left = TONE_SAMPLE_RATE / 4 + (seed >> 8) % (TONE_SAMPLE_RATE * 2);
+			pitch = 100 + (seed >> 20) % 150;
+		}
+		seed = seed * 1103515245 + 12345;
+		v = noise * ((double) ((seed >> 8) & 0xffff) / 32768.0 - 1.0);
+		if (talking) {
+			phase += 2.0 * M_PI * pitch * (1.0 + 0.05 * sin(2.0 * M_PI * 3 * i / TONE_SAMPLE_RATE)) / TONE_SAMPLE_RATE;
+			env = 0.5 + 0.5 * sin(2.0 * M_PI * 4 * i / TONE_SAMPLE_RATE);
+			for (h = 1; h <= 8; h++) {
+				v += level * env * sin(h * phase) / h;
+			}
+		}
+		buf[i] = (int16_t) (v > 32767 ? 32767 : (v < -32768 ? -32768 : v));
+	}
+}
+
+AST_TEST_DEFINE(vox_legacy_test)
+{
+	const double levels[] = { 300, 1500, 6000, 30000 };
+	const double noises[] = { 0, 100, 1000 };
+	const int sizes[] = { 160, 80, 157 };
+	const int len = TONE_SAMPLE_RATE * 60;
+	struct vox v, lv;
+	int16_t *buf, full[TONE_SAMPLES_IN_FRAME];
+	int l, n, z, i, frames = 0, keyed = 0, mismatches = 0;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "vox_legacy";
+		info->category = "/apps/app_rpt/vox/";
+		info->summary = "VOX decisions match the float detector";
+		info->description = "Replay a minute of phone audio at several talk and noise levels and frame sizes "
+							"through dovox() and the per sample float detector it replaced, and compare every decision.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	vox_select();
+	buf = ast_malloc(len * sizeof(*buf));
+	if (!buf) {
+		return AST_TEST_FAIL;
+	}
+	for (l = 0; l < ARRAY_LEN(levels); l++) {
+		for (n = 0; n < ARRAY_LEN(noises); n++) {
+			vox_test_audio(buf, len, l * 16 + n, levels[l], noises[n]);
+			for (z = 0; z < ARRAY_LEN(sizes); z++) {
+				vox_test_init(&v);
+				vox_test_init(&lv);
+				for (i = 0; i + sizes[z] <= len; i += sizes[z]) {
+					int d = dovox(&v, &buf[i], sizes[z]);
+
+					if (d != legacy_dovox(&lv, &buf[i], sizes[z])) {
+						mismatches++;
+					}
+					keyed += d;
+					frames++;
+				}
+			}
+		}
+	}
+	ast_free(buf);
+	ast_test_status_update(test, "%d frames, %d keyed, %d decisions differ, %s implementation\n", frames, keyed, mismatches,
+		vox_kernel_name);
+	ast_test_validate(test, !mismatches);
+	/* The audio has to actually key and unkey the detector */
+	ast_test_validate(test, keyed > frames / 10 && keyed < frames * 9 / 10);
+
+	/* Full scale negative samples are the multiply-add overflow case */
+	for (i = 0; i < ARRAY_LEN(full); i++) {
+		full[i] = -32768;
+	}
+	ast_test_validate(test, vox_sumsq(full, ARRAY_LEN(full)) == (uint64_t) ARRAY_LEN(full) << 30);
+	ast_test_validate(test, vox_sumsq(full, 13) == vox_sumsq_scalar(full, 13));
+	return AST_TEST_PASS;
+}
+
+AST_TEST_DEFINE(vox_benchmark)
+{
+	struct vox v;
+	int16_t buf[TONE_SAMPLES_IN_FRAME * 50];
+	const int rounds = 2000;
+	struct timeval start;
+	int64_t legacy_us, kernel_us;
+	int i, r, sink = 0;
+
+	switch (cmd) {
+	case TEST_INIT:
+		info->name = "vox_benchmark";
+		info->category = "/apps/app_rpt/vox/";
+		info->summary = "VOX detector speed";
+		info->description = "Time 160 sample frames through dovox() and the per sample float detector it replaced.";
+		return AST_TEST_NOT_RUN;
+	case TEST_EXECUTE:
+		break;
+	}
+
+	vox_select();
+	vox_test_audio(buf, ARRAY_LEN(buf), 1, 6000, 100);
+
+	vox_test_init(&v);
+	start = ast_tvnow();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < ARRAY_LEN(buf); i += TONE_SAMPLES_IN_FRAME) {
+			sink += legacy_dovox(&v, &buf[i], TONE_SAMPLES_IN_FRAME);
+		}
+	}
+	legacy_us = ast_tvdiff_us(ast_tvnow(), start);
+
+	vox_test_init(&v);
+	start = ast_tvnow();
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < ARRAY_LEN(buf); i += TONE_SAMPLES_IN_FRAME) {
+			sink += dovox(&v, &buf[i], TONE_SAMPLES_IN_FRAME);
+		}
+	}
+	kernel_us = ast_tvdiff_us(ast_tvnow(), start);
+
+	r = rounds * ARRAY_LEN(buf) / TONE_SAMPLES_IN_FRAME;
+	ast_test_status_update(test, "%d frames: float %.3f us/frame, %s %.3f us/frame\n", r, (double) legacy_us / r, vox_kernel_name,
+		(double) kernel_us / r);
+	/* Keep the results live */
+	ast_test_validate(test, sink >= 0);
+	return AST_TEST_PASS;
+}
+
+void rpt_vox_tests_register(void)
+{
+	AST_TEST_REGISTER(vox_legacy_test);
+	AST_TEST_REGISTER(vox_benchmark);
+}
+
+void rpt_vox_tests_unregister(void)
+{
+	AST_TEST_UNREGISTER(vox_legacy_test);
+	AST_TEST_UNREGISTER(vox_benchmark);
+}
+#endif
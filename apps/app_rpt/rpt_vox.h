@@ -4,3 +4,8 @@ void voxinit_rpt(struct rpt *myrpt, char enable);
 void voxinit_link(struct rpt_link *mylink, char enable);
 
 int dovox(struct vox *v, short *buf, int bs);
+
+#ifdef TEST_FRAMEWORK
+void rpt_vox_tests_register(void);
+void rpt_vox_tests_unregister(void);
+#endif